@@ -12,6 +12,7 @@ declare -a tests=(
     # 'test_queue_manager'
     # 'test_prefetch_rb'
     'test_timestamp'
+    'test_flow_table_wrapper'
     # 'test_rate_limiter'
     # 'sketch'
 )
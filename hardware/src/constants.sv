@@ -223,7 +223,8 @@ typedef struct packed {
 } config_flit_t;
 
 typedef struct packed {
-    logic [223:0] pad;
+    logic [222:0] pad;
+    logic         remove;  // Set to 1 to remove the entry for the tuple.
     logic [31:0]  pkt_queue_id;
     logic [31:0]  prot;
     tuple_t       tuple;  // 96 bits.
@@ -142,6 +142,7 @@ flow_table_config_t p_c5;
 flow_table_config_t p_c6;
 flow_table_config_t p_c7;
 fce_t p_insert_fce_r;
+logic p_remove_r;
 tuple_t p_lookup_tuple;
 
 logic rd_valid_a;
@@ -322,7 +323,10 @@ always@(posedge clk) begin
                     p_busy <= 1'b1;
                     p_state <= P_LOOKUP;
                     p_lookup_tuple <= p_c7.tuple;
-                    p_insert_fce_r.valid <= 1'b1;
+                    p_remove_r <= p_c7.remove;
+
+                    // Removing an entry is an update that invalidates it.
+                    p_insert_fce_r.valid <= !p_c7.remove;
                     p_insert_fce_r.tuple <= p_c7.tuple;
                     p_insert_fce_r.pkt_queue_id <= p_c7.pkt_queue_id;
                 end
@@ -342,6 +346,12 @@ always@(posedge clk) begin
                     if (p_ft_hit != 0) begin
                         p_state <= P_UPDATE;
                     end
+                    else if (p_remove_r) begin
+                        // Nothing to remove.
+                        p_busy <= 1'b0;
+                        p_state <= P_IDLE;
+                        out_control_done <= 1'b1;
+                    end
                     else if (p_ft_empty != 0) begin
                         p_state <= P_INSERT_NO_EVIC;
                     end
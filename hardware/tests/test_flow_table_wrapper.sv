@@ -0,0 +1,156 @@
+`timescale 1 ns/10 ps  // time-unit = 1 ns, precision = 10 ps
+`include "../src/constants.sv"
+
+module test_flow_table_wrapper;
+
+localparam PERIOD = 4;
+
+localparam NB_CONFIGS = 5;
+localparam TIMEOUT = 2000;
+
+logic clk;
+logic rst;
+logic [63:0] cnt;
+
+metadata_t in_meta_data;
+logic      in_meta_valid;
+logic      in_meta_ready;
+metadata_t out_meta_data;
+logic      out_meta_valid;
+logic      out_meta_ready;
+
+flow_table_config_t in_control_data;
+logic               in_control_valid;
+logic               in_control_ready;
+logic               out_control_done;
+
+logic [31:0] eviction_cnt;
+
+// Configurations applied in order. The two removals in the middle target
+// tuples that are not in the table and must complete like any other
+// configuration, without stalling the ones that follow.
+tuple_t      cfg_tuple [NB_CONFIGS];
+logic        cfg_remove [NB_CONFIGS];
+logic [31:0] cfg_queue_id [NB_CONFIGS];
+
+logic [31:0] nb_sent;
+logic [31:0] nb_done;
+logic        waiting_done;
+logic [31:0] nb_lookups;
+
+// The flow table uses `hdisplay`, which refers to `tb`.
+if (1) begin : tb
+  logic error_termination_r = 0;
+end
+
+initial clk = 0;
+initial rst = 1;
+initial cnt = 0;
+
+always #(PERIOD) clk = ~clk;
+
+initial begin
+  cfg_tuple[0] = {32'hc0a80001, 32'hc0a80101, 16'd1000, 16'd80};
+  cfg_remove[0] = 0;
+  cfg_queue_id[0] = 5;
+
+  cfg_tuple[1] = {32'hc0a80002, 32'hc0a80102, 16'd1001, 16'd80};
+  cfg_remove[1] = 1;
+  cfg_queue_id[1] = 0;
+
+  cfg_tuple[2] = {32'hc0a80003, 32'hc0a80103, 16'd1002, 16'd80};
+  cfg_remove[2] = 1;
+  cfg_queue_id[2] = 0;
+
+  cfg_tuple[3] = cfg_tuple[0];
+  cfg_remove[3] = 1;
+  cfg_queue_id[3] = 0;
+
+  cfg_tuple[4] = {32'hc0a80004, 32'hc0a80104, 16'd1003, 16'd80};
+  cfg_remove[4] = 0;
+  cfg_queue_id[4] = 7;
+end
+
+always @(posedge clk) begin
+  cnt <= cnt + 1;
+
+  in_control_valid <= 0;
+  in_meta_valid <= 0;
+
+  if (cnt < 10) begin
+    nb_sent <= 0;
+    nb_done <= 0;
+    waiting_done <= 0;
+    nb_lookups <= 0;
+    out_meta_ready <= 1;
+  end else if (cnt == 10) begin
+    rst <= 0;
+  end else if (cnt > 20) begin
+    // Send the next configuration once the previous one is done.
+    if (nb_sent < NB_CONFIGS && !waiting_done && in_control_ready &&
+        !in_control_valid) begin
+      automatic flow_table_config_t configuration = 0;
+      configuration.config_id = FLOW_TABLE_CONFIG_ID;
+      configuration.tuple = cfg_tuple[nb_sent];
+      configuration.remove = cfg_remove[nb_sent];
+      configuration.pkt_queue_id = cfg_queue_id[nb_sent];
+      in_control_data <= configuration;
+      in_control_valid <= 1;
+      nb_sent <= nb_sent + 1;
+      waiting_done <= 1;
+    end
+
+    // Once all configurations are done, look up the removed and the last
+    // inserted tuples.
+    if (nb_done == NB_CONFIGS && nb_lookups < 2 && in_meta_ready) begin
+      automatic metadata_t meta = 0;
+      meta.tuple = (nb_lookups == 0) ? cfg_tuple[3] : cfg_tuple[4];
+      in_meta_data <= meta;
+      in_meta_valid <= 1;
+      nb_lookups <= nb_lookups + 1;
+    end
+  end
+
+  if (out_control_done) begin
+    nb_done <= nb_done + 1;
+    waiting_done <= 0;
+    assert(nb_done < NB_CONFIGS) else $error("Unexpected config done");
+  end
+
+  if (out_meta_valid) begin
+    if (out_meta_data.tuple == cfg_tuple[3]) begin
+      assert(out_meta_data.pkt_queue_id == '1)
+        else $error("Removed entry still matches");
+    end else begin
+      assert(out_meta_data.tuple == cfg_tuple[4]);
+      assert(out_meta_data.pkt_queue_id == cfg_queue_id[4])
+        else $error("Wrong queue id: %d", out_meta_data.pkt_queue_id);
+      $display("All %0d configurations done", nb_done);
+      $finish;
+    end
+  end
+
+  if (cnt == TIMEOUT) begin
+    $error("Timeout, only %0d of %0d configurations done", nb_done,
+           NB_CONFIGS);
+    $finish;
+  end
+end
+
+flow_table_wrapper flow_table_inst (
+  .clk              (clk),
+  .rst              (rst),
+  .in_meta_data     (in_meta_data),
+  .in_meta_valid    (in_meta_valid),
+  .in_meta_ready    (in_meta_ready),
+  .out_meta_data    (out_meta_data),
+  .out_meta_valid   (out_meta_valid),
+  .out_meta_ready   (out_meta_ready),
+  .in_control_data  (in_control_data),
+  .in_control_valid (in_control_valid),
+  .in_control_ready (in_control_ready),
+  .out_control_done (out_control_done),
+  .eviction_cnt     (eviction_cnt)
+);
+
+endmodule
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Compares busy polling with the adaptive wait (spin then sleep) when
+ *        traffic is low.
+ *
+ * First, a producer thread pushes one message to a Queue every `PERIOD_US`
+ * and the consumer measures the time between the push and the pop. Then, the
+ * NIC emulator delivers one packet every `PERIOD_US` to a pipe. In both cases
+ * the consumer either busy polls or uses `Wait`/`WaitForRx` when there is
+ * nothing to receive. Reports the latency and the CPU time used by the
+ * consumer.
+ */
+
+#include <enso/helpers.h>
+#include <enso/pipe.h>
+#include <enso/queue.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+// Must match the address and port used by the emulator's synthetic trace.
+#define BASE_DST_IP 0xc0a80000  // 192.168.0.0
+#define DST_PORT 80
+#define PROTOCOL 0x11
+
+#define PKT_SIZE 64
+
+// Spin budget used in adaptive mode.
+#define SPIN_US 50
+
+static uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static void print_result(const std::string& name, uint64_t cpu_ns,
+                         uint64_t wall_ns, std::vector<uint64_t>* latencies) {
+  std::cout << name << "  CPU: " << 100.0 * cpu_ns / wall_ns << "%";
+  if (latencies != nullptr && !latencies->empty()) {
+    std::sort(latencies->begin(), latencies->end());
+    std::cout << "  latency (us) p50: "
+              << (*latencies)[latencies->size() / 2] / 1e3
+              << "  p99: " << (*latencies)[latencies->size() * 99 / 100] / 1e3;
+  }
+  std::cout << std::endl;
+}
+
+static void run_queue(bool adaptive, uint32_t duration, uint32_t period_us) {
+  auto queue_producer = enso::QueueProducer<uint64_t>::Create("adaptive_wait");
+  auto queue_consumer = enso::QueueConsumer<uint64_t>::Create("adaptive_wait");
+  if (queue_producer == nullptr || queue_consumer == nullptr) {
+    std::cerr << "Could not create queue" << std::endl;
+    return;
+  }
+
+  std::atomic<bool> producer_done = false;
+  uint64_t nb_msgs = (uint64_t)duration * 1000000 / period_us;
+
+  std::thread producer([&] {
+    for (uint64_t i = 0; i < nb_msgs; ++i) {
+      std::this_thread::sleep_for(std::chrono::microseconds(period_us));
+      while (queue_producer->Push(now_ns()) != 0) {
+      }
+    }
+    producer_done = true;
+  });
+
+  std::vector<uint64_t> latencies;
+  uint64_t start_cpu = enso::bench::thread_time_ns();
+  uint64_t start = now_ns();
+
+  while (latencies.size() < nb_msgs) {
+    std::optional<uint64_t> sent = queue_consumer->Pop();
+    if (sent) {
+      latencies.push_back(now_ns() - *sent);
+      continue;
+    }
+    if (adaptive) {
+      queue_consumer->Wait(SPIN_US);
+    }
+  }
+
+  uint64_t cpu_ns = enso::bench::thread_time_ns() - start_cpu;
+  uint64_t wall_ns = now_ns() - start;
+
+  producer.join();
+
+  print_result(adaptive ? "Queue adaptive" : "Queue busy    ", cpu_ns,
+               wall_ns, &latencies);
+}
+
+static void run_pipe(bool adaptive, uint32_t duration, uint32_t period_us) {
+  enso::emulator::EmulatorConfig config = enso::bench::emulator_config();
+  config.rx_burst_size = 1;
+  config.rx_rate_mpps = 1.0 / period_us;
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(config, 1, PKT_SIZE, BASE_DST_IP, DST_PORT);
+  if (!emulator) {
+    return;
+  }
+
+  std::unique_ptr<enso::Device> dev = enso::Device::Create();
+  if (!dev) {
+    std::cerr << "Problem creating device" << std::endl;
+    return;
+  }
+
+  enso::RxPipe* pipe = dev->AllocateRxPipe();
+  if (!pipe || pipe->Bind(DST_PORT, 0, BASE_DST_IP, 0, PROTOCOL)) {
+    std::cerr << "Problem creating pipe" << std::endl;
+    return;
+  }
+
+  uint64_t nb_bytes = 0;
+  uint64_t start_cpu = enso::bench::thread_time_ns();
+  uint64_t start = now_ns();
+  uint64_t end = start + (uint64_t)duration * 1000000000;
+
+  while (now_ns() < end) {
+    enso::RxPipe* next_pipe = dev->NextRxPipeToRecv();
+    if (next_pipe == nullptr) {
+      if (adaptive) {
+        dev->WaitForRx(SPIN_US, 100000);
+      }
+      continue;
+    }
+    uint8_t* buf;
+    nb_bytes += next_pipe->Recv(&buf, ~0);
+    next_pipe->Clear();
+  }
+
+  uint64_t cpu_ns = enso::bench::thread_time_ns() - start_cpu;
+  uint64_t wall_ns = now_ns() - start;
+
+  print_result(adaptive ? "Pipe adaptive " : "Pipe busy     ", cpu_ns, wall_ns,
+               nullptr);
+  std::cout << "  packets received: " << nb_bytes / PKT_SIZE << std::endl;
+
+  dev.reset();
+  emulator->Stop();
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2 || argc > 3) {
+    std::cerr << "Usage: " << argv[0] << " DURATION [PERIOD_US]" << std::endl
+              << std::endl;
+    std::cerr << "DURATION: Duration of each measurement in seconds."
+              << std::endl;
+    std::cerr << "PERIOD_US: Time between messages (default: 1000)."
+              << std::endl;
+    return 1;
+  }
+
+  uint32_t duration = atoi(argv[1]);
+  uint32_t period_us = argc == 3 ? atoi(argv[2]) : 1000;
+
+  run_queue(false, duration, period_us);
+  run_queue(true, duration, period_us);
+
+  run_pipe(false, duration, period_us);
+  run_pipe(true, duration, period_us);
+
+  return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Helpers shared by the benchmarks that run the NIC emulator in the same
+ *        process.
+ */
+
+#ifndef SOFTWARE_BENCHMARKS_BENCH_COMMON_H_
+#define SOFTWARE_BENCHMARKS_BENCH_COMMON_H_
+
+#include <time.h>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include "../emulator/nic_emulator.h"
+#include "../emulator/packet_trace.h"
+
+namespace enso {
+namespace bench {
+
+/**
+ * @brief Returns the CPU time used by the calling thread in nanoseconds.
+ */
+inline uint64_t thread_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Returns the emulator configuration used by the benchmarks.
+ *
+ * Serves all cores, as the application threads may run on any of them.
+ */
+inline emulator::EmulatorConfig emulator_config() {
+  emulator::EmulatorConfig config;
+  config.nb_app_cores = std::thread::hardware_concurrency();
+  return config;
+}
+
+/**
+ * @brief Creates and starts an emulator.
+ *
+ * @param config Emulator configuration. @see emulator_config()
+ * @param trace Packets that the emulator receives. May be null if the
+ *              configuration has no RX threads.
+ *
+ * @return The running emulator or nullptr on failure.
+ */
+inline std::unique_ptr<emulator::NicEmulator> start_emulator(
+    const emulator::EmulatorConfig& config,
+    std::unique_ptr<emulator::PacketTrace> trace = nullptr) {
+  std::unique_ptr<emulator::NicEmulator> nic_emulator =
+      emulator::NicEmulator::Create(config, std::move(trace));
+  if (!nic_emulator || nic_emulator->Start()) {
+    std::cerr << "Problem starting emulator" << std::endl;
+    return nullptr;
+  }
+  return nic_emulator;
+}
+
+/**
+ * @brief Creates and starts an emulator that receives a synthetic trace.
+ *
+ * @see emulator::PacketTrace::CreateSynthetic()
+ *
+ * @return The running emulator or nullptr on failure.
+ */
+inline std::unique_ptr<emulator::NicEmulator> start_emulator(
+    const emulator::EmulatorConfig& config, uint32_t nb_flows,
+    uint16_t pkt_size, uint32_t base_dst_ip, uint16_t dst_port) {
+  std::unique_ptr<emulator::PacketTrace> trace =
+      emulator::PacketTrace::CreateSynthetic(nb_flows, pkt_size, base_dst_ip,
+                                             dst_port);
+  if (!trace) {
+    std::cerr << "Problem creating trace" << std::endl;
+    return nullptr;
+  }
+  return start_emulator(config, std::move(trace));
+}
+
+}  // namespace bench
+}  // namespace enso
+
+#endif  // SOFTWARE_BENCHMARKS_BENCH_COMMON_H_
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Measures how fast flow entries can be installed.
+ *
+ * Allocates a single RX pipe and binds it to `NB_RULES` UDP flows, either one
+ * at a time with `RxPipe::Bind()` or all at once with `RxPipe::BindMany()`.
+ * Repeats this `NB_ROUNDS` times, updating the same entries, and reports the
+ * number of rules installed per second.
+ *
+ * The emulator's flow table holds at most 8192 entries and drops entries that
+ * collide once their bucket is full, so expect drops as `NB_RULES` gets close
+ * to the limit.
+ */
+
+#include <enso/config.h>
+#include <enso/consts.h>
+#include <enso/pipe.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+static constexpr uint32_t kMaxNbRules = 8192;
+static constexpr uint32_t kBaseDstIp = 0xc0a80000;  // 192.168.0.0
+static constexpr uint16_t kDstPort = 80;
+static constexpr uint32_t kUdpProtocol = 17;
+
+static int run(uint32_t nb_rules, uint32_t nb_rounds, bool bulk) {
+  std::unique_ptr<enso::Device> dev = enso::Device::Create();
+  if (!dev) {
+    std::cerr << "Problem creating device" << std::endl;
+    return 4;
+  }
+
+  enso::RxPipe* pipe = dev->AllocateRxPipe();
+  if (pipe == nullptr) {
+    std::cerr << "Problem creating pipe" << std::endl;
+    return 5;
+  }
+
+  std::vector<enso::FlowEntry> flows(nb_rules);
+  for (uint32_t i = 0; i < nb_rules; ++i) {
+    flows[i] = {kDstPort, 0, kBaseDstIp + i, 0, kUdpProtocol};
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (uint32_t round = 0; round < nb_rounds; ++round) {
+    if (bulk) {
+      if (pipe->BindMany(flows.data(), nb_rules)) {
+        std::cerr << "Problem binding flows" << std::endl;
+        return 6;
+      }
+    } else {
+      for (const enso::FlowEntry& flow : flows) {
+        if (pipe->Bind(flow.dst_port, flow.src_port, flow.dst_ip,
+                       flow.src_ip, flow.protocol)) {
+          std::cerr << "Problem binding flow" << std::endl;
+          return 6;
+        }
+      }
+    }
+  }
+
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cout << nb_rules << " rules, " << (bulk ? "bulk" : "one at a time")
+            << ": " << nb_rules * nb_rounds / seconds << " rules/s"
+            << std::endl;
+
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 3 || argc > 4) {
+    std::cerr << "Usage: " << argv[0] << " NB_RULES NB_ROUNDS [bulk]"
+              << std::endl
+              << std::endl;
+    std::cerr << "NB_RULES: Number of flow entries to install (1 to "
+              << kMaxNbRules << ")." << std::endl;
+    std::cerr << "NB_ROUNDS: Number of times to install the entries."
+              << std::endl;
+    std::cerr << "bulk: Install all entries at once instead of one at a time."
+              << std::endl;
+    return 1;
+  }
+
+  uint32_t nb_rules = atoi(argv[1]);
+  uint32_t nb_rounds = atoi(argv[2]);
+  bool bulk = argc > 3 && strcmp(argv[3], "bulk") == 0;
+
+  if (nb_rules == 0 || nb_rules > kMaxNbRules || nb_rounds == 0) {
+    std::cerr << "NB_RULES must be between 1 and " << kMaxNbRules
+              << " and NB_ROUNDS must be positive" << std::endl;
+    return 1;
+  }
+
+  enso::emulator::EmulatorConfig config = enso::bench::emulator_config();
+  config.nb_rx_threads = 0;
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(config);
+  if (!emulator) {
+    return 3;
+  }
+
+  int ret = run(nb_rules, nb_rounds, bulk);
+
+  emulator->Stop();
+
+  return ret;
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief Measures the overhead of the burst API over iterating over batches.
+ *
+ * Runs the NIC emulator in the same process and polls `NB_PIPES` RX pipes in
+ * turn for `DURATION` seconds, reading the destination IP of every packet, at
+ * most `BURST_SIZE` packets at a time. It first iterates over the batches
+ * returned by `RxPipe::RecvPkts()` and then uses `RxPipe::RecvBurst()`. With
+ * `FORWARD` set to 1, the packets are also copied to a TX pipe, with
+ * `memcpy_64_align()` while iterating and with `TxPipe::SendBurst()` when
+ * using bursts. Reports the throughput and the CPU time of the receiving
+ * thread per packet of both runs.
+ */
+
+#include <enso/consts.h>
+#include <enso/helpers.h>
+#include <enso/pipe.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+// Must match the address and port used by the emulator's synthetic trace.
+#define BASE_DST_IP 0xc0a80000  // 192.168.0.0
+#define DST_PORT 80
+#define PROTOCOL 0x11
+
+#define PKT_SIZE 64
+#define DEFAULT_BURST_SIZE 32
+
+static constexpr uint32_t kDstIpOffset =
+    sizeof(struct ether_header) + offsetof(struct iphdr, daddr);
+
+struct RunResult {
+  double mpps;
+  double cpu_ns_per_pkt;
+};
+
+static uint32_t recv_iterating(enso::RxPipe* rx_pipe, enso::TxPipe* tx_pipe,
+                               uint16_t burst_size, uint64_t* sum) {
+  uint32_t nb_pkts = 0;
+  auto batch = rx_pipe->RecvPkts(burst_size);
+
+  if (tx_pipe == nullptr) {
+    for (uint8_t* pkt : batch) {
+      *sum += *(uint32_t*)(pkt + kDstIpOffset);
+      ++nb_pkts;
+    }
+    return nb_pkts;
+  }
+
+  uint8_t* tx_buf = tx_pipe->AllocateBuf(burst_size * PKT_SIZE);
+  for (uint8_t* pkt : batch) {
+    *sum += *(uint32_t*)(pkt + kDstIpOffset);
+    uint16_t pkt_len_64 = ((enso::get_pkt_len(pkt) - 1) / 64 + 1) * 64;
+    enso::memcpy_64_align(tx_buf, pkt, pkt_len_64);
+    tx_buf += pkt_len_64;
+    ++nb_pkts;
+  }
+  if (batch.processed_bytes() > 0) {
+    tx_pipe->SendAndFree(batch.processed_bytes());
+  }
+  return nb_pkts;
+}
+
+static uint32_t recv_burst(enso::RxPipe* rx_pipe, enso::TxPipe* tx_pipe,
+                           uint16_t burst_size, uint64_t* sum) {
+  static uint8_t* pkts[UINT16_MAX];
+  static uint16_t lens[UINT16_MAX];
+
+  uint16_t nb_pkts = rx_pipe->RecvBurst(pkts, lens, burst_size);
+  for (uint16_t i = 0; i < nb_pkts; ++i) {
+    *sum += *(uint32_t*)(pkts[i] + kDstIpOffset);
+  }
+
+  if (tx_pipe != nullptr) {
+    uint16_t nb_sent = 0;
+    while (nb_sent < nb_pkts) {
+      nb_sent += tx_pipe->SendBurst(pkts + nb_sent, lens + nb_sent,
+                                    nb_pkts - nb_sent);
+    }
+  }
+  return nb_pkts;
+}
+
+static int run(uint32_t nb_pipes, uint32_t duration, uint16_t burst_size,
+               bool forward, bool burst, RunResult* result) {
+  std::unique_ptr<enso::Device> dev = enso::Device::Create();
+  if (!dev) {
+    std::cerr << "Problem creating device" << std::endl;
+    return 4;
+  }
+
+  std::vector<enso::RxPipe*> pipes;
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    enso::RxPipe* pipe = dev->AllocateRxPipe();
+    if (pipe == nullptr ||
+        pipe->Bind(DST_PORT, 0, BASE_DST_IP + i, 0, PROTOCOL)) {
+      std::cerr << "Problem creating pipe" << std::endl;
+      return 5;
+    }
+    pipes.push_back(pipe);
+  }
+
+  enso::TxPipe* tx_pipe = nullptr;
+  if (forward) {
+    tx_pipe = dev->AllocateTxPipe();
+    if (tx_pipe == nullptr) {
+      std::cerr << "Problem creating TX pipe" << std::endl;
+      return 5;
+    }
+  }
+
+  uint64_t nb_pkts = 0;
+  uint64_t sum = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  auto end = start + std::chrono::seconds(duration);
+  uint64_t start_ns = enso::bench::thread_time_ns();
+
+  while (std::chrono::steady_clock::now() < end) {
+    // Polls every pipe in turn, as DPDK applications poll their queues, since
+    // a pipe that still has packets after a burst may not be returned by
+    // `NextRxPipeToRecv()` again.
+    for (enso::RxPipe* pipe : pipes) {
+      if (burst) {
+        nb_pkts += recv_burst(pipe, tx_pipe, burst_size, &sum);
+      } else {
+        nb_pkts += recv_iterating(pipe, tx_pipe, burst_size, &sum);
+      }
+      pipe->Clear();
+    }
+  }
+
+  uint64_t cpu_ns = enso::bench::thread_time_ns() - start_ns;
+
+  // Keeps the compiler from dropping the reads.
+  if (sum == 0) {
+    std::cout << "checksum " << sum << std::endl;
+  }
+
+  result->mpps = (double)nb_pkts / duration / 1e6;
+  result->cpu_ns_per_pkt = nb_pkts ? (double)cpu_ns / nb_pkts : 0;
+
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 3 || argc > 5) {
+    std::cerr << "Usage: " << argv[0]
+              << " NB_PIPES DURATION [BURST_SIZE] [FORWARD]" << std::endl
+              << std::endl;
+    std::cerr << "NB_PIPES: Number of RX pipes (1 to " << enso::kMaxNbFlows
+              << ")." << std::endl;
+    std::cerr << "DURATION: Duration of each run in seconds." << std::endl;
+    std::cerr << "BURST_SIZE: Maximum number of packets received at a time "
+                 "(default: "
+              << DEFAULT_BURST_SIZE << ")." << std::endl;
+    std::cerr << "FORWARD: 1 to also send the packets (default: 0)."
+              << std::endl;
+    return 1;
+  }
+
+  uint32_t nb_pipes = atoi(argv[1]);
+  uint32_t duration = atoi(argv[2]);
+  uint32_t burst_size = DEFAULT_BURST_SIZE;
+  bool forward = false;
+  if (argc > 3) {
+    burst_size = atoi(argv[3]);
+  }
+  if (argc > 4) {
+    forward = atoi(argv[4]);
+  }
+
+  if (nb_pipes == 0 || nb_pipes > enso::kMaxNbFlows) {
+    std::cerr << "NB_PIPES must be between 1 and " << enso::kMaxNbFlows
+              << std::endl;
+    return 1;
+  }
+
+  if (burst_size == 0 || burst_size > UINT16_MAX) {
+    std::cerr << "BURST_SIZE must be between 1 and " << UINT16_MAX
+              << std::endl;
+    return 1;
+  }
+
+  // While iterating, the TX buffer is allocated for the whole burst upfront.
+  if (forward && burst_size * PKT_SIZE > enso::TxPipe::kMaxCapacity) {
+    std::cerr << "BURST_SIZE must be at most "
+              << enso::TxPipe::kMaxCapacity / PKT_SIZE << " to forward"
+              << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(enso::bench::emulator_config(), nb_pipes,
+                                  PKT_SIZE, BASE_DST_IP, DST_PORT);
+  if (!emulator) {
+    return 3;
+  }
+
+  RunResult iterating;
+  RunResult burst;
+  int ret = run(nb_pipes, duration, burst_size, forward, false, &iterating);
+  if (!ret) {
+    ret = run(nb_pipes, duration, burst_size, forward, true, &burst);
+  }
+
+  emulator->Stop();
+
+  if (ret) {
+    return ret;
+  }
+
+  std::cout << "Iterating: " << iterating.mpps << " Mpps, "
+            << iterating.cpu_ns_per_pkt << " ns of CPU time per packet"
+            << std::endl;
+  std::cout << "Bursts:    " << burst.mpps << " Mpps, "
+            << burst.cpu_ns_per_pkt << " ns of CPU time per packet"
+            << std::endl;
+
+  return 0;
+}
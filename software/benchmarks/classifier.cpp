@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Measures the throughput of the wildcard packet classifier.
+ *
+ * Generates random rule sets with 1k, 10k, ... up to `MAX_NB_RULES` rules,
+ * mixing prefixes of different lengths, port ranges and protocol wildcards,
+ * and packets that mostly hit them. Reports the time to compile the rules,
+ * the shape of the resulting tries and the classification rate in Mpps. Also
+ * checks the results against a linear scan of the rules.
+ */
+
+#include <arpa/inet.h>
+#include <enso/classifier.h>
+#include <netinet/ether.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+static constexpr uint32_t kNbClasses = 16;
+static constexpr uint32_t kDefaultClass = kNbClasses;
+static constexpr uint32_t kPktSize = 64;
+static constexpr uint32_t kNbCheckedPkts = 10000;
+static constexpr uint64_t kNbClassifications = 20000000;
+
+static uint8_t random_prefix_len(std::mt19937* rng, uint32_t short_pct) {
+  uint32_t pct = (*rng)() % 100;
+  if (pct < short_pct) {
+    return 0;
+  } else if (pct < short_pct + 10) {
+    return 8 + (*rng)() % 8;
+  } else if (pct < short_pct + 40) {
+    return 16 + (*rng)() % 8;
+  }
+  return 24 + (*rng)() % 9;
+}
+
+static void random_port_range(std::mt19937* rng, uint32_t any_pct,
+                              uint16_t* min, uint16_t* max) {
+  uint32_t pct = (*rng)() % 100;
+  if (pct < any_pct) {
+    *min = 0;
+    *max = 65535;
+  } else if (pct < any_pct + (100 - any_pct) / 2) {
+    *min = 1024;
+    *max = 65535;
+  } else {
+    *min = (*rng)() % 1024;
+    *max = *min;
+  }
+}
+
+static std::vector<enso::ClassifierRule> generate_rules(uint32_t nb_rules,
+                                                        std::mt19937* rng) {
+  std::vector<enso::ClassifierRule> rules(nb_rules);
+
+  for (enso::ClassifierRule& rule : rules) {
+    rule.dst_ip = (*rng)();
+    rule.src_ip = (*rng)();
+    rule.dst_prefix_len = random_prefix_len(rng, 1);
+    rule.src_prefix_len = random_prefix_len(rng, 50);
+    random_port_range(rng, 30, &rule.dst_port_min, &rule.dst_port_max);
+    random_port_range(rng, 80, &rule.src_port_min, &rule.src_port_max);
+
+    uint32_t pct = (*rng)() % 100;
+    rule.protocol = pct < 45 ? IPPROTO_TCP : IPPROTO_UDP;
+    rule.protocol_mask = pct < 90 ? 0xff : 0;
+
+    rule.class_id = (*rng)() % kNbClasses;
+  }
+
+  return rules;
+}
+
+static uint32_t random_in_prefix(uint32_t value, uint8_t prefix_len,
+                                 std::mt19937* rng) {
+  uint32_t mask = prefix_len == 0 ? 0 : ~0U << (32 - prefix_len);
+  return (value & mask) | ((*rng)() & ~mask);
+}
+
+static uint16_t random_in_range(uint16_t min, uint16_t max,
+                                std::mt19937* rng) {
+  return min + (*rng)() % ((uint32_t)max - min + 1);
+}
+
+/**
+ * @brief Writes a packet that matches a random rule (or a random packet, once
+ *        in a while).
+ */
+static void generate_pkt(uint8_t* pkt,
+                         const std::vector<enso::ClassifierRule>& rules,
+                         std::mt19937* rng) {
+  struct ether_header* l2_hdr = (struct ether_header*)pkt;
+  struct iphdr* l3_hdr = (struct iphdr*)(l2_hdr + 1);
+  uint16_t* ports = (uint16_t*)(l3_hdr + 1);
+
+  memset(pkt, 0, kPktSize);
+  l2_hdr->ether_type = htons(ETHERTYPE_IP);
+  l3_hdr->version = 4;
+  l3_hdr->ihl = 5;
+  l3_hdr->tot_len = htons(kPktSize - sizeof(*l2_hdr));
+
+  if ((*rng)() % 10 == 0) {
+    l3_hdr->daddr = (*rng)();
+    l3_hdr->saddr = (*rng)();
+    l3_hdr->protocol = (*rng)() % 2 ? IPPROTO_TCP : IPPROTO_UDP;
+    ports[0] = (*rng)();
+    ports[1] = (*rng)();
+    return;
+  }
+
+  const enso::ClassifierRule& rule = rules[(*rng)() % rules.size()];
+  l3_hdr->daddr = htonl(random_in_prefix(rule.dst_ip, rule.dst_prefix_len,
+                                         rng));
+  l3_hdr->saddr = htonl(random_in_prefix(rule.src_ip, rule.src_prefix_len,
+                                         rng));
+  l3_hdr->protocol = rule.protocol_mask ? rule.protocol : (uint8_t)IPPROTO_UDP;
+  ports[0] = htons(random_in_range(rule.src_port_min, rule.src_port_max, rng));
+  ports[1] = htons(random_in_range(rule.dst_port_min, rule.dst_port_max, rng));
+}
+
+/**
+ * @brief Reference classification, checking every rule in order.
+ */
+static uint32_t linear_classify(
+    const uint8_t* pkt, const std::vector<enso::ClassifierRule>& rules) {
+  const struct iphdr* l3_hdr =
+      (const struct iphdr*)(pkt + sizeof(struct ether_header));
+  const uint16_t* ports = (const uint16_t*)(l3_hdr + 1);
+  uint32_t dst_ip = ntohl(l3_hdr->daddr);
+  uint32_t src_ip = ntohl(l3_hdr->saddr);
+  uint16_t src_port = ntohs(ports[0]);
+  uint16_t dst_port = ntohs(ports[1]);
+
+  for (const enso::ClassifierRule& rule : rules) {
+    uint32_t dst_mask =
+        rule.dst_prefix_len == 0 ? 0 : ~0U << (32 - rule.dst_prefix_len);
+    uint32_t src_mask =
+        rule.src_prefix_len == 0 ? 0 : ~0U << (32 - rule.src_prefix_len);
+    if ((dst_ip & dst_mask) == (rule.dst_ip & dst_mask) &&
+        (src_ip & src_mask) == (rule.src_ip & src_mask) &&
+        dst_port >= rule.dst_port_min && dst_port <= rule.dst_port_max &&
+        src_port >= rule.src_port_min && src_port <= rule.src_port_max &&
+        (l3_hdr->protocol & rule.protocol_mask) ==
+            (rule.protocol & rule.protocol_mask)) {
+      return rule.class_id;
+    }
+  }
+
+  return kDefaultClass;
+}
+
+static int run(uint32_t nb_rules, uint32_t nb_pkts) {
+  std::mt19937 rng(nb_rules);
+  std::vector<enso::ClassifierRule> rules = generate_rules(nb_rules, &rng);
+
+  auto start = std::chrono::steady_clock::now();
+  std::unique_ptr<enso::Classifier> classifier =
+      enso::Classifier::Create(rules.data(), nb_rules, kDefaultClass);
+  double compile_ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+  if (!classifier) {
+    std::cerr << "Problem creating classifier" << std::endl;
+    return 2;
+  }
+
+  std::vector<uint8_t> pkt_buf((uint64_t)nb_pkts * kPktSize);
+  std::vector<const uint8_t*> pkts(nb_pkts);
+  for (uint32_t i = 0; i < nb_pkts; ++i) {
+    pkts[i] = &pkt_buf[(uint64_t)i * kPktSize];
+    generate_pkt(&pkt_buf[(uint64_t)i * kPktSize], rules, &rng);
+  }
+
+  std::vector<uint32_t> classes(nb_pkts);
+
+  uint32_t nb_checked = std::min(nb_pkts, kNbCheckedPkts);
+  classifier->ClassifyBurst(pkts.data(), nb_checked, classes.data());
+  for (uint32_t i = 0; i < nb_checked; ++i) {
+    if (classes[i] != linear_classify(pkts[i], rules)) {
+      std::cerr << "Wrong class for packet " << i << std::endl;
+      return 3;
+    }
+  }
+
+  uint64_t nb_rounds = std::max(kNbClassifications / nb_pkts, 1UL);
+  start = std::chrono::steady_clock::now();
+  for (uint64_t round = 0; round < nb_rounds; ++round) {
+    classifier->ClassifyBurst(pkts.data(), nb_pkts, classes.data());
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  enso::Classifier::Stats stats = classifier->GetStats();
+  std::cout << nb_rules << " rules: " << nb_pkts * nb_rounds / seconds / 1e6
+            << " Mpps, compiled in " << compile_ms << " ms (" << stats.nb_nodes
+            << " nodes, " << stats.nb_leaves << " leaves, depth "
+            << stats.depth << ", up to " << stats.max_leaf_rules
+            << " rules per leaf, " << stats.nb_leaf_rules
+            << " rules in leaves)" << std::endl;
+
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2 || argc > 3) {
+    std::cerr << "Usage: " << argv[0] << " MAX_NB_RULES [NB_PKTS]"
+              << std::endl
+              << std::endl;
+    std::cerr << "MAX_NB_RULES: Run with 1000, 10000, ... up to MAX_NB_RULES "
+                 "rules."
+              << std::endl;
+    std::cerr << "NB_PKTS: Number of distinct packets (default: 65536)."
+              << std::endl;
+    return 1;
+  }
+
+  uint32_t max_nb_rules = atoi(argv[1]);
+  uint32_t nb_pkts = argc == 3 ? atoi(argv[2]) : 65536;
+
+  if (max_nb_rules < 1000 || nb_pkts == 0) {
+    std::cerr << "MAX_NB_RULES must be at least 1000 and NB_PKTS positive"
+              << std::endl;
+    return 1;
+  }
+
+  for (uint32_t nb_rules = 1000; nb_rules <= max_nb_rules; nb_rules *= 10) {
+    int ret = run(nb_rules, nb_pkts);
+    if (ret) {
+      return ret;
+    }
+  }
+
+  return 0;
+}
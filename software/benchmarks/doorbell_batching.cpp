@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Measures how many IPC messages the software backend sends per
+ *        received batch.
+ *
+ * Runs the NIC emulator in the same process and receives packets on multiple
+ * pipes. At the end, it reports the number of register writes issued by the
+ * library per batch, which is the number of messages needed without batching,
+ * and the number of messages that were actually sent.
+ */
+
+#include <enso/helpers.h>
+#include <enso/pipe.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+// Must match the address and port used by the emulator's synthetic trace.
+#define BASE_DST_IP 0xc0a80000  // 192.168.0.0
+#define DST_PORT 80
+#define PROTOCOL 0x11
+
+#define PKT_SIZE 64
+
+int main(int argc, const char* argv[]) {
+  if (argc < 3 || argc > 4) {
+    std::cerr << "Usage: " << argv[0] << " NB_PIPES DURATION [echo]"
+              << std::endl
+              << std::endl;
+    std::cerr << "NB_PIPES: Number of pipes to receive on." << std::endl;
+    std::cerr << "DURATION: Duration of the measurement in seconds."
+              << std::endl;
+    std::cerr << "echo: Send received packets back (default: receive only)."
+              << std::endl;
+    return 1;
+  }
+
+  uint32_t nb_pipes = atoi(argv[1]);
+  uint32_t duration = atoi(argv[2]);
+  bool echo = argc == 4 && strcmp(argv[3], "echo") == 0;
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(enso::bench::emulator_config(), nb_pipes,
+                                  PKT_SIZE, BASE_DST_IP, DST_PORT);
+  if (!emulator) {
+    return 3;
+  }
+
+  std::unique_ptr<enso::Device> dev = enso::Device::Create();
+  if (!dev) {
+    std::cerr << "Problem creating device" << std::endl;
+    return 4;
+  }
+
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    int ret;
+    if (echo) {
+      enso::RxTxPipe* pipe = dev->AllocateRxTxPipe();
+      ret = pipe ? pipe->Bind(DST_PORT, 0, BASE_DST_IP + i, 0, PROTOCOL) : -1;
+    } else {
+      enso::RxPipe* pipe = dev->AllocateRxPipe();
+      ret = pipe ? pipe->Bind(DST_PORT, 0, BASE_DST_IP + i, 0, PROTOCOL) : -1;
+    }
+    if (ret) {
+      std::cerr << "Problem creating pipe" << std::endl;
+      return 5;
+    }
+  }
+
+  enso::emulator::EmulatorStats start_stats = emulator->GetStats();
+  uint64_t nb_batches = 0;
+  uint64_t nb_bytes = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  auto end = start + std::chrono::seconds(duration);
+
+  while (std::chrono::steady_clock::now() < end) {
+    for (uint32_t i = 0; i < enso::kBatchSize; ++i) {
+      uint8_t* buf;
+      uint32_t recv = 0;
+
+      if (echo) {
+        enso::RxTxPipe* pipe = dev->NextRxTxPipeToRecv();
+        if (pipe == nullptr) {
+          continue;
+        }
+        recv = pipe->Recv(&buf, ~0);
+        pipe->SendAndFree(recv);
+      } else {
+        enso::RxPipe* pipe = dev->NextRxPipeToRecv();
+        if (pipe == nullptr) {
+          continue;
+        }
+        recv = pipe->Recv(&buf, ~0);
+        pipe->Clear();
+      }
+
+      if (recv > 0) {
+        ++nb_batches;
+        nb_bytes += recv;
+      }
+    }
+  }
+
+  enso::emulator::EmulatorStats stats = emulator->GetStats();
+
+  uint64_t nb_writes = stats.mmio_writes - start_stats.mmio_writes +
+                       stats.mmio_coalesced_writes -
+                       start_stats.mmio_coalesced_writes;
+  uint64_t nb_msgs = stats.mmio_write_msgs - start_stats.mmio_write_msgs;
+
+  std::cout << "Batches: " << nb_batches << " (" << nb_bytes / PKT_SIZE
+            << " packets)" << std::endl;
+
+  if (nb_batches > 0) {
+    std::cout << "Register writes per batch: " << (double)nb_writes / nb_batches
+              << std::endl;
+    std::cout << "Messages per batch: " << (double)nb_msgs / nb_batches
+              << std::endl;
+  }
+
+  dev.reset();
+  emulator->Stop();
+
+  return 0;
+}
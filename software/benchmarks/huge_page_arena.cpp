@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Measures dTLB misses when receiving on many pipes, either with one
+ *        huge page per pipe or with pipes carved from the huge page arena.
+ *
+ * Runs the NIC emulator in the same process and receives packets on
+ * `NB_PIPES` pipes for `DURATION` seconds, reading the header of every packet.
+ * Reports the number of dTLB load misses per packet, measured with perf
+ * counters on the receiving thread only. Run it once with `ARENA_SIZE_MB` set
+ * to 0 and once with an arena to compare both. Use a `HUGE_PAGE_PREFIX` in a
+ * hugetlbfs mount with 1GB pages to back the arena with a single page.
+ *
+ * Pipes carved from the arena may also be smaller than a huge page. Set
+ * `PIPE_SIZE_KB` to compare the huge page memory used by every pipe.
+ */
+
+#include <arpa/inet.h>
+#include <enso/helpers.h>
+#include <enso/pipe.h>
+#include <linux/perf_event.h>
+#include <netinet/ip.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+// Must match the address and port used by the emulator's synthetic trace.
+#define BASE_DST_IP 0xc0a80000  // 192.168.0.0
+#define DST_PORT 80
+#define PROTOCOL 0x11
+
+#define PKT_SIZE 64
+
+// Opens a counter for dTLB load misses in the calling thread.
+static int open_dtlb_counter() {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static int run(const std::string& huge_page_prefix, uint64_t arena_size,
+               uint32_t nb_pipes, uint32_t pipe_size, uint32_t duration) {
+  std::unique_ptr<enso::Device> dev =
+      enso::Device::Create("", huge_page_prefix, arena_size);
+  if (!dev) {
+    std::cerr << "Problem creating device" << std::endl;
+    return 4;
+  }
+
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    enso::RxPipe* pipe = dev->AllocateRxPipe(false, pipe_size);
+    if (pipe == nullptr ||
+        pipe->Bind(DST_PORT, 0, BASE_DST_IP + i, 0, PROTOCOL)) {
+      std::cerr << "Problem creating pipe" << std::endl;
+      return 5;
+    }
+  }
+
+  int counter_fd = open_dtlb_counter();
+  if (counter_fd < 0) {
+    std::cerr << "(" << errno << ") dTLB counter is not available"
+              << std::endl;
+  } else {
+    ioctl(counter_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  uint64_t nb_pkts = 0;
+  uint64_t checksum = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  auto end = start + std::chrono::seconds(duration);
+
+  while (std::chrono::steady_clock::now() < end) {
+    for (uint32_t i = 0; i < enso::kBatchSize; ++i) {
+      enso::RxPipe* pipe = dev->NextRxPipeToRecv();
+      if (pipe == nullptr) {
+        continue;
+      }
+
+      uint8_t* buf;
+      uint32_t recv = pipe->Recv(&buf, ~0);
+      uint8_t* pkt = buf;
+      while (pkt < buf + recv) {
+        struct iphdr* l3_hdr = (struct iphdr*)(pkt + 14);
+        checksum += l3_hdr->daddr;
+        pkt = enso::get_next_pkt(pkt);
+        ++nb_pkts;
+      }
+      pipe->Clear();
+    }
+  }
+
+  uint64_t nb_misses = 0;
+  if (counter_fd >= 0) {
+    ioctl(counter_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counter_fd, &nb_misses, sizeof(nb_misses)) < 0) {
+      nb_misses = 0;
+    }
+    close(counter_fd);
+  }
+
+  std::cout << (arena_size ? "Arena:     " : "Per pipe:  ") << nb_pkts
+            << " packets (" << (double)nb_pkts / duration / 1e6 << " Mpps)";
+  if (counter_fd >= 0 && nb_pkts > 0) {
+    std::cout << ", " << (double)nb_misses / nb_pkts
+              << " dTLB load misses per packet";
+  }
+  // Arena pipes are followed by a guard region, other pipes are mirrored with
+  // virtual memory only.
+  uint32_t pipe_mem = pipe_size + (arena_size ? enso::kPipeGuardSize : 0);
+  std::cout << ", " << pipe_mem / 1024 << " KB of huge pages per pipe";
+  std::cout << " [" << (checksum & 0xff) << "]" << std::endl;
+
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 4 || argc > 6) {
+    std::cerr << "Usage: " << argv[0]
+              << " NB_PIPES DURATION ARENA_SIZE_MB [PIPE_SIZE_KB] "
+                 "[HUGE_PAGE_PREFIX]"
+              << std::endl
+              << std::endl;
+    std::cerr << "NB_PIPES: Number of pipes to receive on." << std::endl;
+    std::cerr << "DURATION: Duration of the measurement in seconds."
+              << std::endl;
+    std::cerr << "ARENA_SIZE_MB: Size of the huge page arena (0 to use one "
+                 "huge page per pipe)."
+              << std::endl;
+    std::cerr << "PIPE_SIZE_KB: Size of every pipe buffer (default: "
+              << enso::kDefaultPipeBufSize / 1024
+              << "). Sizes below a huge page need an arena." << std::endl;
+    std::cerr << "HUGE_PAGE_PREFIX: Prefix for huge page files (default: "
+              << enso::kHugePageDefaultPrefix << ")." << std::endl;
+    return 1;
+  }
+
+  uint32_t nb_pipes = atoi(argv[1]);
+  uint32_t duration = atoi(argv[2]);
+  uint64_t arena_size = strtoull(argv[3], nullptr, 10) << 20;
+  uint32_t pipe_size = enso::kDefaultPipeBufSize;
+  if (argc > 4) {
+    pipe_size = atoi(argv[4]) * 1024;
+  }
+  std::string huge_page_prefix(enso::kHugePageDefaultPrefix);
+  if (argc > 5) {
+    huge_page_prefix = argv[5];
+  }
+
+  enso::emulator::EmulatorConfig config = enso::bench::emulator_config();
+  config.huge_page_prefix = huge_page_prefix;
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(config, nb_pipes, PKT_SIZE, BASE_DST_IP,
+                                  DST_PORT);
+  if (!emulator) {
+    return 3;
+  }
+
+  int ret = run(huge_page_prefix, arena_size, nb_pipes, pipe_size, duration);
+
+  emulator->Stop();
+
+  return ret;
+}
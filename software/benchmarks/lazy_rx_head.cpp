@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Measures the effect of lazy RX heads on the receive path.
+ *
+ * Allocates `NB_PIPES` RX pipes that receive packets from the NIC emulator and
+ * frees every batch right after receiving it, for `DURATION` seconds. With
+ * `FLUSH_PERCENT` set, heads are only written to the device after that share
+ * of a ring has been freed (see `Device::EnableLazyRxHead()`). Reports the
+ * throughput, the CPU time of the receiving thread per packet and the number
+ * of head updates written to the device per received batch.
+ */
+
+#include <enso/consts.h>
+#include <enso/helpers.h>
+#include <enso/pipe.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+// Must match the address and port used by the emulator's synthetic trace.
+#define BASE_DST_IP 0xc0a80000  // 192.168.0.0
+#define DST_PORT 80
+#define PROTOCOL 0x11
+
+#define PKT_SIZE 64
+
+static int run(uint32_t nb_pipes, uint32_t duration, uint32_t flush_percent) {
+  std::unique_ptr<enso::Device> dev = enso::Device::Create();
+  if (!dev) {
+    std::cerr << "Problem creating device" << std::endl;
+    return 4;
+  }
+
+  if (flush_percent > 0 && dev->EnableLazyRxHead(flush_percent)) {
+    return 4;
+  }
+
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    enso::RxPipe* pipe = dev->AllocateRxPipe();
+    if (pipe == nullptr ||
+        pipe->Bind(DST_PORT, 0, BASE_DST_IP + i, 0, PROTOCOL)) {
+      std::cerr << "Problem creating pipe" << std::endl;
+      return 5;
+    }
+  }
+
+  uint64_t nb_batches = 0;
+  uint64_t nb_bytes = 0;
+
+  enso::Device::RxHeadStats start_stats = dev->GetRxHeadStats();
+
+  auto start = std::chrono::steady_clock::now();
+  auto end = start + std::chrono::seconds(duration);
+  uint64_t start_ns = enso::bench::thread_time_ns();
+
+  while (std::chrono::steady_clock::now() < end) {
+    for (uint32_t i = 0; i < enso::kBatchSize; ++i) {
+      enso::RxPipe* pipe = dev->NextRxPipeToRecv();
+      if (pipe == nullptr) {
+        continue;
+      }
+      uint8_t* buf;
+      uint32_t recv = pipe->Recv(&buf, ~0);
+      pipe->Clear();
+      nb_bytes += recv;
+      ++nb_batches;
+    }
+  }
+
+  uint64_t cpu_ns = enso::bench::thread_time_ns() - start_ns;
+
+  enso::Device::RxHeadStats stats = dev->GetRxHeadStats();
+  uint64_t doorbells = stats.doorbells - start_stats.doorbells;
+  uint64_t elided = stats.elided_doorbells - start_stats.elided_doorbells;
+  uint64_t nb_pkts = nb_bytes / PKT_SIZE;
+
+  std::cout << nb_pipes << " pipes, "
+            << (flush_percent ? "lazy" : "eager") << " heads: "
+            << (double)nb_pkts / duration / 1e6 << " Mpps, "
+            << (double)cpu_ns / nb_pkts << " ns of CPU time per packet, "
+            << (double)doorbells / nb_batches << " head doorbells per batch ("
+            << doorbells << " issued, " << elided << " elided)" << std::endl;
+
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 3 || argc > 4) {
+    std::cerr << "Usage: " << argv[0] << " NB_PIPES DURATION [FLUSH_PERCENT]"
+              << std::endl
+              << std::endl;
+    std::cerr << "NB_PIPES: Number of RX pipes (1 to " << enso::kMaxNbFlows
+              << ")." << std::endl;
+    std::cerr << "DURATION: Duration of the run in seconds." << std::endl;
+    std::cerr << "FLUSH_PERCENT: Share of a ring to free before writing its "
+                 "head (default: 0, write heads eagerly)."
+              << std::endl;
+    return 1;
+  }
+
+  uint32_t nb_pipes = atoi(argv[1]);
+  uint32_t duration = atoi(argv[2]);
+  uint32_t flush_percent = 0;
+  if (argc > 3) {
+    flush_percent = atoi(argv[3]);
+  }
+
+  if (nb_pipes == 0 || nb_pipes > enso::kMaxNbFlows) {
+    std::cerr << "NB_PIPES must be between 1 and " << enso::kMaxNbFlows
+              << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(enso::bench::emulator_config(), nb_pipes,
+                                  PKT_SIZE, BASE_DST_IP, DST_PORT);
+  if (!emulator) {
+    return 3;
+  }
+
+  int ret = run(nb_pipes, duration, flush_percent);
+
+  emulator->Stop();
+
+  return ret;
+}
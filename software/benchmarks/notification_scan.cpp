@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Measures the cost of scanning the notification buffer for pipes with
+ *        new data.
+ *
+ * Instead of receiving packets, fills the notification buffer with synthetic
+ * notifications, where notification `i` targets pipe `i % NB_PIPES`, and
+ * consumes them with `get_next_enso_pipe_id()`. Reports the time spent per
+ * notification and the number of pipe ids returned per notification, which is
+ * below 1 when a pipe has several notifications before it is returned. The NIC
+ * emulator runs in the same process only to handle the register writes. Time
+ * is measured as CPU time of the scanning thread, so that emulator threads
+ * sharing the same core do not affect the result.
+ *
+ * Build with and without `-Davx512_notification_scan=true` to compare the
+ * vectorized and the scalar scan.
+ */
+
+#include <enso/consts.h>
+#include <enso/internals.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "../emulator/nic_emulator.h"
+#include "../src/pcie.h"
+#include "bench_common.h"
+
+// Number of notifications written to the buffer before consuming them.
+#define ROUND_SIZE 1024
+
+static int run(uint32_t nb_pipes, uint32_t duration) {
+  struct enso::NotificationBufPair notification_buf_pair = {};
+  if (enso::notification_buf_init(0, -1, &notification_buf_pair,
+                                  std::string(enso::kHugePageDefaultPrefix))) {
+    std::cerr << "Problem creating notification buffer" << std::endl;
+    return 4;
+  }
+
+  struct enso::RxNotification* notification_buf = notification_buf_pair.rx_buf;
+  uint64_t nb_notifications = 0;
+  uint64_t nb_ids = 0;
+  uint64_t checksum = 0;
+  uint64_t scan_time_ns = 0;
+
+  auto end = std::chrono::steady_clock::now() + std::chrono::seconds(duration);
+
+  while (std::chrono::steady_clock::now() < end) {
+    // Emulate the NIC: fill the notification buffer from the current head.
+    uint32_t head = notification_buf_pair.rx_head;
+    for (uint32_t i = 0; i < ROUND_SIZE; ++i) {
+      struct enso::RxNotification* notification =
+          notification_buf + (head + i) % enso::kNotificationBufSize;
+      notification->queue_id = (nb_notifications + i) % nb_pipes;
+      notification->tail = (nb_notifications + i) & 0xffff;
+      notification->signal = 1;
+    }
+
+    uint64_t start_ns = enso::bench::thread_time_ns();
+    int32_t enso_pipe_id;
+    while ((enso_pipe_id = enso::get_next_enso_pipe_id(
+                &notification_buf_pair)) >= 0) {
+      checksum += notification_buf_pair.pending_rx_pipe_tails[enso_pipe_id];
+      ++nb_ids;
+    }
+    scan_time_ns += enso::bench::thread_time_ns() - start_ns;
+
+    nb_notifications += ROUND_SIZE;
+  }
+
+  std::cout << nb_notifications << " notifications: "
+            << (double)scan_time_ns / nb_notifications
+            << " ns per notification, " << (double)nb_ids / nb_notifications
+            << " pipe ids per notification [" << (checksum & 0xff) << "]"
+            << std::endl;
+
+  enso::notification_buf_free(&notification_buf_pair);
+
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " NB_PIPES DURATION" << std::endl
+              << std::endl;
+    std::cerr << "NB_PIPES: Number of distinct pipes in the notifications."
+              << std::endl;
+    std::cerr << "DURATION: Duration of the measurement in seconds."
+              << std::endl;
+    return 1;
+  }
+
+  uint32_t nb_pipes = atoi(argv[1]);
+  uint32_t duration = atoi(argv[2]);
+
+  if (nb_pipes == 0 || nb_pipes > enso::kMaxNbFlows) {
+    std::cerr << "NB_PIPES must be between 1 and " << enso::kMaxNbFlows
+              << std::endl;
+    return 1;
+  }
+
+#ifdef AVX512_NOTIFICATION_SCAN
+  std::cout << "Scan: AVX-512" << std::endl;
+#else
+  std::cout << "Scan: scalar" << std::endl;
+#endif
+
+  // No RX or TX threads, the emulator only handles the register writes.
+  enso::emulator::EmulatorConfig config = enso::bench::emulator_config();
+  config.nb_rx_threads = 0;
+  config.nb_tx_threads = 0;
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(config);
+  if (!emulator) {
+    return 3;
+  }
+
+  int ret = run(nb_pipes, duration);
+
+  emulator->Stop();
+
+  return ret;
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Measures how fast pipes can be allocated.
+ *
+ * Creates a device and allocates `NB_PIPES` RX/TX pipes, either one at a time
+ * with `Device::AllocateRxTxPipe()` or all at once with
+ * `Device::AllocateRxTxPipes()`, and then destroys the device. Repeats this
+ * `NB_ROUNDS` times and reports the number of pipes allocated per second,
+ * excluding the time to create and destroy the device.
+ *
+ * Every pipe uses a buffer of `kDefaultPipeBufSize` bytes, so the number of
+ * pipes is limited by the number of available huge pages.
+ */
+
+#include <enso/consts.h>
+#include <enso/pipe.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+static constexpr std::chrono::milliseconds kRoundInterval(500);
+
+static int run(uint32_t nb_pipes, uint32_t nb_rounds, bool bulk) {
+  std::chrono::nanoseconds alloc_time(0);
+
+  for (uint32_t round = 0; round < nb_rounds; ++round) {
+    std::unique_ptr<enso::Device> dev = enso::Device::Create();
+    if (!dev) {
+      std::cerr << "Problem creating device" << std::endl;
+      return 4;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (bulk) {
+      std::vector<enso::RxTxPipe*> pipes = dev->AllocateRxTxPipes(nb_pipes);
+      if (pipes.size() != nb_pipes) {
+        std::cerr << "Problem creating pipes" << std::endl;
+        return 5;
+      }
+    } else {
+      for (uint32_t i = 0; i < nb_pipes; ++i) {
+        if (dev->AllocateRxTxPipe() == nullptr) {
+          std::cerr << "Problem creating pipe" << std::endl;
+          return 5;
+        }
+      }
+    }
+
+    alloc_time += std::chrono::steady_clock::now() - start;
+
+    // Give the emulator time to unmap the buffers of the previous round, so
+    // that the next round finds free huge pages.
+    dev.reset();
+    std::this_thread::sleep_for(kRoundInterval);
+  }
+
+  double seconds = std::chrono::duration<double>(alloc_time).count();
+  std::cout << nb_pipes << " pipes, " << (bulk ? "bulk" : "one at a time")
+            << ": " << nb_pipes * nb_rounds / seconds << " pipes/s"
+            << std::endl;
+
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 3 || argc > 4) {
+    std::cerr << "Usage: " << argv[0] << " NB_PIPES NB_ROUNDS [bulk]"
+              << std::endl
+              << std::endl;
+    std::cerr << "NB_PIPES: Number of RX/TX pipes to allocate (1 to "
+              << enso::kMaxNbFlows << ")." << std::endl;
+    std::cerr << "NB_ROUNDS: Number of times to allocate the pipes."
+              << std::endl;
+    std::cerr << "bulk: Allocate all pipes at once instead of one at a time."
+              << std::endl;
+    return 1;
+  }
+
+  uint32_t nb_pipes = atoi(argv[1]);
+  uint32_t nb_rounds = atoi(argv[2]);
+  bool bulk = argc > 3 && strcmp(argv[3], "bulk") == 0;
+
+  if (nb_pipes == 0 || nb_pipes > enso::kMaxNbFlows || nb_rounds == 0) {
+    std::cerr << "NB_PIPES must be between 1 and " << enso::kMaxNbFlows
+              << " and NB_ROUNDS must be positive" << std::endl;
+    return 1;
+  }
+
+  enso::emulator::EmulatorConfig config = enso::bench::emulator_config();
+  config.nb_rx_threads = 0;
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(config);
+  if (!emulator) {
+    return 3;
+  }
+
+  int ret = run(nb_pipes, nb_rounds, bulk);
+
+  emulator->Stop();
+
+  return ret;
+}
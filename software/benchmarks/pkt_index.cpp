@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief Compares iterating over a batch of packets with indexing it first.
+ *
+ * Fills an RX pipe with `PKT_SIZE`-byte packets from the NIC emulator and then
+ * processes the same batch `NB_REPS` times, reading the destination IP of
+ * every packet. The batch is processed by iterating over it, by indexing
+ * it with `IndexPkts()` and then by indexing it and prefetching `PREFETCH`
+ * packets ahead. Reports the CPU time per packet of each, with the batch
+ * either in cache (hot) or flushed from it before every repetition (cold).
+ */
+
+#include <enso/consts.h>
+#include <enso/helpers.h>
+#include <enso/pipe.h>
+#include <immintrin.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+// Must match the address and port used by the emulator's synthetic trace.
+#define DST_IP 0xc0a80000  // 192.168.0.0
+#define DST_PORT 80
+#define PROTOCOL 0x11
+
+#define DEFAULT_PREFETCH 8
+
+// Time to let the emulator fill the pipe.
+#define FILL_TIMEOUT_MS 1000
+
+static constexpr uint32_t kMaxNbPkts = enso::kDefaultPipeBufSize / 64;
+
+static constexpr uint32_t kDstIpOffset =
+    sizeof(struct ether_header) + offsetof(struct iphdr, daddr);
+
+static void flush_batch(const uint8_t* buf, uint32_t nb_bytes) {
+  for (uint32_t i = 0; i < nb_bytes; i += enso::kCacheLineSize) {
+    _mm_clflush(buf + i);
+  }
+  _mm_mfence();
+}
+
+static uint32_t process_iterating(enso::RxPipe* pipe, uint64_t* sum) {
+  uint32_t nb_pkts = 0;
+  auto batch = pipe->PeekPkts();
+  for (uint8_t* pkt : batch) {
+    *sum += *(uint32_t*)(pkt + kDstIpOffset);
+    ++nb_pkts;
+  }
+  return nb_pkts;
+}
+
+static uint32_t process_indexed(enso::RxPipe* pipe, uint32_t prefetch,
+                                uint64_t* sum) {
+  static uint32_t offsets[kMaxNbPkts];
+  static uint16_t lens[kMaxNbPkts];
+
+  auto batch = pipe->PeekPkts();
+  uint32_t nb_pkts = batch.IndexPkts(offsets, lens, kMaxNbPkts);
+  uint8_t* buf = batch.buf();
+
+  for (uint32_t i = 0; i < nb_pkts; ++i) {
+    if (prefetch > 0 && i + prefetch < nb_pkts) {
+      _mm_prefetch(buf + offsets[i + prefetch] + kDstIpOffset, _MM_HINT_T0);
+    }
+    *sum += *(uint32_t*)(buf + offsets[i] + kDstIpOffset) + lens[i];
+  }
+  return nb_pkts;
+}
+
+// Returns the CPU time per packet in nanoseconds.
+static double measure(enso::RxPipe* pipe, int mode, uint32_t prefetch,
+                      bool cold, uint32_t nb_reps, uint64_t* sum) {
+  uint64_t cpu_ns = 0;
+  uint64_t nb_pkts = 0;
+
+  for (uint32_t i = 0; i < nb_reps; ++i) {
+    if (cold) {
+      auto batch = pipe->PeekPkts();
+      flush_batch(batch.buf(), batch.available_bytes());
+    }
+
+    uint64_t start_ns = enso::bench::thread_time_ns();
+    if (mode == 0) {
+      nb_pkts += process_iterating(pipe, sum);
+    } else {
+      nb_pkts += process_indexed(pipe, mode == 2 ? prefetch : 0, sum);
+    }
+    cpu_ns += enso::bench::thread_time_ns() - start_ns;
+  }
+
+  return (double)cpu_ns / nb_pkts;
+}
+
+static int run(uint16_t pkt_size, uint32_t nb_reps, uint32_t prefetch) {
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(enso::bench::emulator_config(), 1, pkt_size,
+                                  DST_IP, DST_PORT);
+  if (!emulator) {
+    return 3;
+  }
+
+  int ret = 0;
+  {
+    std::unique_ptr<enso::Device> dev = enso::Device::Create();
+    enso::RxPipe* pipe = dev ? dev->AllocateRxPipe() : nullptr;
+    if (pipe == nullptr || pipe->Bind(DST_PORT, 0, DST_IP, 0, PROTOCOL)) {
+      std::cerr << "Problem creating pipe" << std::endl;
+      emulator->Stop();
+      return 4;
+    }
+
+    // Wait for the pipe to fill up, packets are only peeked so the batch
+    // stays the same from then on.
+    auto timeout = std::chrono::steady_clock::now() +
+                   std::chrono::milliseconds(FILL_TIMEOUT_MS);
+    uint32_t nb_bytes = 0;
+    while (std::chrono::steady_clock::now() < timeout) {
+      uint8_t* buf;
+      nb_bytes = pipe->Peek(&buf, ~0);
+    }
+
+    uint64_t sum = 0;
+    uint32_t nb_iterated = process_iterating(pipe, &sum);
+    uint32_t nb_indexed = process_indexed(pipe, 0, &sum);
+    if (nb_iterated == 0 || nb_iterated != nb_indexed) {
+      std::cerr << "Iterating found " << nb_iterated << " packets but "
+                << "indexing found " << nb_indexed << std::endl;
+      ret = 5;
+    } else {
+      std::cout << pkt_size << "B packets (" << nb_iterated << " in "
+                << nb_bytes << " bytes):" << std::endl;
+      for (int cold = 0; cold < 2; ++cold) {
+        double iterate_ns = measure(pipe, 0, prefetch, cold, nb_reps, &sum);
+        double index_ns = measure(pipe, 1, prefetch, cold, nb_reps, &sum);
+        double prefetch_ns = measure(pipe, 2, prefetch, cold, nb_reps, &sum);
+        std::cout << "  " << (cold ? "cold" : "hot ")
+                  << ": iterate " << iterate_ns << " ns/pkt, index "
+                  << index_ns << " ns/pkt, index + prefetch " << prefetch_ns
+                  << " ns/pkt" << std::endl;
+      }
+    }
+
+    // Keeps the compiler from dropping the reads.
+    if (sum == 0) {
+      std::cout << "checksum " << sum << std::endl;
+    }
+  }
+
+  emulator->Stop();
+
+  return ret;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 3 || argc > 4) {
+    std::cerr << "Usage: " << argv[0] << " PKT_SIZE NB_REPS [PREFETCH]"
+              << std::endl
+              << std::endl;
+    std::cerr << "PKT_SIZE: Size of the packets in bytes (64 to 1500)."
+              << std::endl;
+    std::cerr << "NB_REPS: Number of times to process every batch."
+              << std::endl;
+    std::cerr << "PREFETCH: How many packets ahead to prefetch (default: "
+              << DEFAULT_PREFETCH << ")." << std::endl;
+    return 1;
+  }
+
+  uint32_t pkt_size = atoi(argv[1]);
+  uint32_t nb_reps = atoi(argv[2]);
+  uint32_t prefetch = DEFAULT_PREFETCH;
+  if (argc > 3) {
+    prefetch = atoi(argv[3]);
+  }
+
+  if (pkt_size < 64 || pkt_size > 1500) {
+    std::cerr << "PKT_SIZE must be between 64 and 1500" << std::endl;
+    return 1;
+  }
+
+  if (nb_reps == 0) {
+    std::cerr << "NB_REPS must be positive" << std::endl;
+    return 1;
+  }
+
+  return run(pkt_size, nb_reps, prefetch);
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Compares QueueMpmc with a mesh of SPSC queues.
+ *
+ * Half of the threads produce and half consume. With SPSC queues, every
+ * producer has one queue per consumer and sends to them in round-robin, while
+ * every consumer polls all the queues that it receives from. With MPMC, all
+ * threads share a single queue. Reports throughput and the latency between
+ * push and pop (in TSC cycles).
+ */
+
+#include <enso/queue.h>
+#include <x86intrin.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Only a sample of the elements is used to measure latency.
+#define LATENCY_SAMPLE_MASK 63
+
+struct Message {
+  uint64_t tsc;
+  uint64_t seq;
+};
+
+struct Result {
+  double mops;
+  std::vector<uint64_t> latencies;
+};
+
+static std::atomic<bool> start_flag;
+static std::atomic<uint32_t> nb_ready;
+static std::atomic<uint32_t> nb_producers_running;
+
+static void wait_start() {
+  ++nb_ready;
+  while (!start_flag.load(std::memory_order_acquire)) {
+  }
+}
+
+static std::string spsc_name(uint32_t producer_id, uint32_t consumer_id) {
+  return "bench_spsc_" + std::to_string(producer_id) + "_" +
+         std::to_string(consumer_id);
+}
+
+static void spsc_producer(uint32_t id, uint32_t nb_consumers,
+                          uint64_t nb_msgs) {
+  std::vector<std::unique_ptr<enso::QueueProducer<Message>>> queues;
+  for (uint32_t i = 0; i < nb_consumers; ++i) {
+    queues.push_back(enso::QueueProducer<Message>::Create(spsc_name(id, i)));
+  }
+
+  wait_start();
+
+  uint32_t next = 0;
+  for (uint64_t seq = 0; seq < nb_msgs; ++seq) {
+    Message msg = {__rdtsc(), seq};
+    while (queues[next]->Push(msg) != 0) {
+      next = (next + 1) % nb_consumers;
+    }
+    next = (next + 1) % nb_consumers;
+  }
+
+  --nb_producers_running;
+}
+
+static void spsc_consumer(uint32_t id, uint32_t nb_producers,
+                          std::vector<uint64_t>* latencies) {
+  std::vector<std::unique_ptr<enso::QueueConsumer<Message>>> queues;
+  for (uint32_t i = 0; i < nb_producers; ++i) {
+    queues.push_back(enso::QueueConsumer<Message>::Create(spsc_name(i, id)));
+  }
+
+  wait_start();
+
+  while (true) {
+    // Check before polling so that we do not miss the last messages.
+    bool producers_done = nb_producers_running.load() == 0;
+    bool empty = true;
+    for (auto& queue : queues) {
+      std::optional<Message> msg = queue->Pop();
+      if (!msg) {
+        continue;
+      }
+      empty = false;
+      if ((msg->seq & LATENCY_SAMPLE_MASK) == 0) {
+        latencies->push_back(__rdtsc() - msg->tsc);
+      }
+    }
+    if (empty && producers_done) {
+      break;
+    }
+  }
+}
+
+static void mpmc_producer(uint64_t nb_msgs) {
+  auto queue = enso::QueueMpmc<Message>::Create("bench_mpmc");
+
+  wait_start();
+
+  for (uint64_t seq = 0; seq < nb_msgs; ++seq) {
+    Message msg = {__rdtsc(), seq};
+    while (queue->Push(msg) != 0) {
+    }
+  }
+
+  --nb_producers_running;
+}
+
+static void mpmc_consumer(std::vector<uint64_t>* latencies) {
+  auto queue = enso::QueueMpmc<Message>::Create("bench_mpmc");
+
+  wait_start();
+
+  while (true) {
+    // Check before polling so that we do not miss the last messages.
+    bool producers_done = nb_producers_running.load() == 0;
+    std::optional<Message> msg = queue->Pop();
+    if (!msg) {
+      if (producers_done) {
+        break;
+      }
+      continue;
+    }
+    if ((msg->seq & LATENCY_SAMPLE_MASK) == 0) {
+      latencies->push_back(__rdtsc() - msg->tsc);
+    }
+  }
+}
+
+static Result run(bool mpmc, uint32_t nb_threads, uint64_t nb_msgs) {
+  uint32_t nb_producers = nb_threads / 2;
+  uint32_t nb_consumers = nb_threads - nb_producers;
+  uint64_t nb_msgs_per_producer = nb_msgs / nb_producers;
+
+  std::vector<std::vector<uint64_t>> latencies(nb_consumers);
+
+  // Keep one handle so that queues are not removed while threads start.
+  std::vector<std::unique_ptr<enso::QueueConsumer<Message>>> spsc_queues;
+  std::unique_ptr<enso::QueueMpmc<Message>> mpmc_queue;
+  if (mpmc) {
+    mpmc_queue = enso::QueueMpmc<Message>::Create("bench_mpmc");
+  } else {
+    for (uint32_t p = 0; p < nb_producers; ++p) {
+      for (uint32_t c = 0; c < nb_consumers; ++c) {
+        spsc_queues.push_back(
+            enso::QueueConsumer<Message>::Create(spsc_name(p, c)));
+      }
+    }
+  }
+
+  start_flag = false;
+  nb_ready = 0;
+  nb_producers_running = nb_producers;
+
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < nb_producers; ++i) {
+    if (mpmc) {
+      threads.emplace_back(mpmc_producer, nb_msgs_per_producer);
+    } else {
+      threads.emplace_back(spsc_producer, i, nb_consumers,
+                           nb_msgs_per_producer);
+    }
+  }
+  for (uint32_t i = 0; i < nb_consumers; ++i) {
+    if (mpmc) {
+      threads.emplace_back(mpmc_consumer, &latencies[i]);
+    } else {
+      threads.emplace_back(spsc_consumer, i, nb_producers, &latencies[i]);
+    }
+  }
+
+  while (nb_ready.load() < nb_threads) {
+    std::this_thread::yield();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  start_flag.store(true, std::memory_order_release);
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  double elapsed_us =
+      std::chrono::duration<double, std::micro>(end - start).count();
+
+  Result result;
+  result.mops = nb_msgs_per_producer * nb_producers / elapsed_us;
+  for (auto& thread_latencies : latencies) {
+    result.latencies.insert(result.latencies.end(), thread_latencies.begin(),
+                            thread_latencies.end());
+  }
+  std::sort(result.latencies.begin(), result.latencies.end());
+
+  return result;
+}
+
+static void print_result(const std::string& name, uint32_t nb_threads,
+                         Result& result) {
+  std::vector<uint64_t>& latencies = result.latencies;
+  std::cout << name << "  threads: " << nb_threads << "  " << result.mops
+            << " Mops";
+  if (!latencies.empty()) {
+    std::cout << "  latency (cycles) p50: " << latencies[latencies.size() / 2]
+              << "  p99: " << latencies[latencies.size() * 99 / 100];
+  }
+  std::cout << std::endl;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2 || argc > 3) {
+    std::cerr << "Usage: " << argv[0] << " MAX_NB_THREADS [NB_MSGS]"
+              << std::endl
+              << std::endl;
+    std::cerr << "MAX_NB_THREADS: Run with 2, 4, ... up to MAX_NB_THREADS "
+                 "threads (half producers, half consumers)."
+              << std::endl;
+    std::cerr << "NB_MSGS: Messages sent per run (default: 10000000)."
+              << std::endl;
+    return 1;
+  }
+
+  uint32_t max_nb_threads = atoi(argv[1]);
+  uint64_t nb_msgs = argc == 3 ? atoll(argv[2]) : 10000000;
+
+  for (uint32_t nb_threads = 2; nb_threads <= max_nb_threads;
+       nb_threads *= 2) {
+    Result spsc = run(false, nb_threads, nb_msgs);
+    print_result("SPSC mesh", nb_threads, spsc);
+
+    Result mpmc = run(true, nb_threads, nb_msgs);
+    print_result("MPMC     ", nb_threads, mpmc);
+  }
+
+  return 0;
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief Compares sending objects from an application cache by copying them to
+ *        a TX pipe with sending them straight from registered memory.
+ *
+ * Runs the NIC emulator in the same process and, as a key-value store would,
+ * answers every request received on `NB_PIPES` RX pipes for `DURATION` seconds
+ * with a value from a cache of preformatted packets. It first copies every
+ * value to a TX pipe with `memcpy_64_align()` and then registers the cache
+ * with `Device::RegisterMemory()` and sends the values with
+ * `TxPipe::SendRegistered()`. Reports the throughput and the CPU time of the
+ * application thread per response of both runs.
+ */
+
+#include <enso/consts.h>
+#include <enso/helpers.h>
+#include <enso/ixy_helpers.h>
+#include <enso/pipe.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+// Must match the address and port used by the emulator's synthetic trace.
+#define BASE_DST_IP 0xc0a80000  // 192.168.0.0
+#define DST_PORT 80
+#define PROTOCOL 0x11
+
+#define REQ_PKT_SIZE 64
+#define DEFAULT_VALUE_SIZE 1024
+#define NB_VALUES 4096
+
+struct RunResult {
+  double mpps;
+  double cpu_ns_per_pkt;
+  uint64_t tx_pkts;
+};
+
+/**
+ * @brief Fills the cache with one packet per value, each padded to
+ *        `value_size` bytes.
+ */
+static void fill_cache(uint8_t* cache, uint32_t value_size) {
+  memset(cache, 0, (uint64_t)NB_VALUES * value_size);
+  for (uint32_t i = 0; i < NB_VALUES; ++i) {
+    uint8_t* pkt = cache + (uint64_t)i * value_size;
+    struct ether_header* l2_hdr = (struct ether_header*)pkt;
+    struct iphdr* l3_hdr = (struct iphdr*)(l2_hdr + 1);
+    l2_hdr->ether_type = htons(ETHERTYPE_IP);
+    l3_hdr->version = 4;
+    l3_hdr->ihl = 5;
+    l3_hdr->tot_len = htons(value_size - sizeof(*l2_hdr));
+    l3_hdr->protocol = PROTOCOL;
+    l3_hdr->daddr = htonl(BASE_DST_IP + i);
+  }
+}
+
+static int run(enso::emulator::NicEmulator* emulator, uint8_t* cache,
+               uint32_t nb_pipes, uint32_t duration, uint32_t value_size,
+               bool registered, RunResult* result) {
+  std::unique_ptr<enso::Device> dev = enso::Device::Create();
+  if (!dev) {
+    std::cerr << "Problem creating device" << std::endl;
+    return 4;
+  }
+
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    enso::RxPipe* pipe = dev->AllocateRxPipe();
+    if (pipe == nullptr ||
+        pipe->Bind(DST_PORT, 0, BASE_DST_IP + i, 0, PROTOCOL)) {
+      std::cerr << "Problem creating pipe" << std::endl;
+      return 5;
+    }
+  }
+
+  enso::TxPipe* tx_pipe = dev->AllocateTxPipe();
+  if (tx_pipe == nullptr) {
+    std::cerr << "Problem creating TX pipe" << std::endl;
+    return 5;
+  }
+
+  if (registered &&
+      dev->RegisterMemory(cache, (uint64_t)NB_VALUES * value_size)) {
+    std::cerr << "Problem registering cache" << std::endl;
+    return 6;
+  }
+
+  enso::emulator::EmulatorStats start_stats = emulator->GetStats();
+  uint64_t nb_pkts = 0;
+  uint32_t next_value = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  auto end = start + std::chrono::seconds(duration);
+  uint64_t start_ns = enso::bench::thread_time_ns();
+
+  while (std::chrono::steady_clock::now() < end) {
+    for (uint32_t i = 0; i < enso::kBatchSize; ++i) {
+      enso::RxPipe* pipe = dev->NextRxPipeToRecv();
+      if (pipe == nullptr) {
+        continue;
+      }
+      auto batch = pipe->RecvPkts();
+      for (uint8_t* pkt : batch) {
+        (void)pkt;
+        uint8_t* value = cache + (uint64_t)next_value * value_size;
+        next_value = (next_value + 1) % NB_VALUES;
+        if (registered) {
+          tx_pipe->SendRegistered(value, value_size);
+        } else {
+          uint8_t* tx_buf = tx_pipe->AllocateBuf(value_size);
+          enso::memcpy_64_align(tx_buf, value, value_size);
+          tx_pipe->SendAndFree(value_size);
+        }
+        ++nb_pkts;
+      }
+      pipe->Clear();
+    }
+  }
+
+  uint64_t cpu_ns = enso::bench::thread_time_ns() - start_ns;
+
+  // Let the last transmissions complete before the memory goes away.
+  dev->FlushTx();
+  while (tx_pipe->pending_transmission() > 0 ||
+         dev->registered_tx_pending() > 0) {
+    dev->ProcessCompletions();
+  }
+
+  if (registered && dev->DeregisterMemory(cache)) {
+    std::cerr << "Problem deregistering cache" << std::endl;
+    return 6;
+  }
+
+  enso::emulator::EmulatorStats stats = emulator->GetStats();
+
+  result->mpps = (double)nb_pkts / duration / 1e6;
+  result->cpu_ns_per_pkt = nb_pkts ? (double)cpu_ns / nb_pkts : 0;
+  result->tx_pkts = stats.tx_pkts - start_stats.tx_pkts;
+
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc != 3 && argc != 4) {
+    std::cerr << "Usage: " << argv[0] << " NB_PIPES DURATION [VALUE_SIZE]"
+              << std::endl
+              << std::endl;
+    std::cerr << "NB_PIPES: Number of RX pipes (1 to " << enso::kMaxNbFlows
+              << ")." << std::endl;
+    std::cerr << "DURATION: Duration of each run in seconds." << std::endl;
+    std::cerr << "VALUE_SIZE: Size of every value in bytes, a multiple of 64 "
+              << "(default: " << DEFAULT_VALUE_SIZE << ")." << std::endl;
+    return 1;
+  }
+
+  uint32_t nb_pipes = atoi(argv[1]);
+  uint32_t duration = atoi(argv[2]);
+  uint32_t value_size = argc > 3 ? atoi(argv[3]) : DEFAULT_VALUE_SIZE;
+
+  if (nb_pipes == 0 || nb_pipes > enso::kMaxNbFlows) {
+    std::cerr << "NB_PIPES must be between 1 and " << enso::kMaxNbFlows
+              << std::endl;
+    return 1;
+  }
+
+  if (value_size < 64 || value_size > 1536 || value_size % 64) {
+    std::cerr << "VALUE_SIZE must be a multiple of 64 between 64 and 1536"
+              << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(enso::bench::emulator_config(), nb_pipes,
+                                  REQ_PKT_SIZE, BASE_DST_IP, DST_PORT);
+  if (!emulator) {
+    return 3;
+  }
+
+  // The emulator can only access memory in huge page files with the device's
+  // prefix.
+  std::string cache_path =
+      std::string(enso::kHugePageDefaultPrefix) + "_value_cache";
+  uint64_t cache_size = (uint64_t)NB_VALUES * value_size;
+  cache_size = (cache_size - 1) / enso::kBufPageSize * enso::kBufPageSize +
+               enso::kBufPageSize;
+  uint8_t* cache = (uint8_t*)enso::get_huge_page(cache_path, cache_size);
+  if (cache == nullptr) {
+    std::cerr << "Problem allocating cache" << std::endl;
+    emulator->Stop();
+    return 2;
+  }
+  fill_cache(cache, value_size);
+
+  RunResult copy;
+  RunResult registered;
+  int ret = run(emulator.get(), cache, nb_pipes, duration, value_size, false,
+                &copy);
+  if (!ret) {
+    ret = run(emulator.get(), cache, nb_pipes, duration, value_size, true,
+              &registered);
+  }
+
+  emulator->Stop();
+  munmap(cache, cache_size);
+  unlink(cache_path.c_str());
+
+  if (ret) {
+    return ret;
+  }
+
+  std::cout << "Copy:       " << copy.mpps << " Mpps, " << copy.cpu_ns_per_pkt
+            << " ns of CPU time per response, " << copy.tx_pkts
+            << " packets transmitted" << std::endl;
+  std::cout << "Registered: " << registered.mpps << " Mpps, "
+            << registered.cpu_ns_per_pkt << " ns of CPU time per response, "
+            << registered.tx_pkts << " packets transmitted" << std::endl;
+
+  return 0;
+}
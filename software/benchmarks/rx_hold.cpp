@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief Measures how packets held by the application fill an RX pipe.
+ *
+ * Runs the NIC emulator in the same process, sending 64-byte packets to a
+ * single RX pipe at `RATE_MPPS` million packets per second. The application
+ * holds `HOLD_PERCENT` percent of the packets for `HOLD_US` microseconds, as
+ * if waiting for a lookup, and is done with the others right away. Runs for
+ * `DURATION` seconds in each mode:
+ * - fifo: Frees packets in order with `RxPipe::Free()`, so a held packet
+ *   keeps every packet after it in the pipe.
+ * - release: Frees packets out of order with `RxPipe::Release()`.
+ * - spill: Also moves held packets to a pool of `SPILL_SLOTS` slots with
+ *   `RxPipe::Spill()`, holding them in the pipe only when the pool is full.
+ *
+ * Reports the throughput, the packets dropped because the pipe was full and
+ * the average and maximum share of the pipe owned by the application.
+ */
+
+#include <enso/consts.h>
+#include <enso/helpers.h>
+#include <enso/pipe.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+// Must match the address and port used by the emulator's synthetic trace.
+#define DST_IP 0xc0a80000  // 192.168.0.0
+#define DST_PORT 80
+#define PROTOCOL 0x11
+
+#define PKT_SIZE 64
+#define DEFAULT_SPILL_SLOTS 4096
+
+enum class HoldMode : uint8_t { kFifo, kRelease, kSpill };
+
+static constexpr const char* kHoldModeNames[] = {"fifo", "release", "spill"};
+
+using Clock = std::chrono::steady_clock;
+
+struct Packet {
+  uint8_t* addr;
+  uint32_t len;
+  bool spilled;
+  Clock::time_point done_time;  // When the application is done with it.
+};
+
+struct RunResult {
+  double mpps;
+  uint64_t drops;
+  double avg_utilization;
+  double max_utilization;
+};
+
+static int run(enso::emulator::NicEmulator* emulator, HoldMode mode,
+               uint32_t duration, uint32_t hold_percent, uint32_t hold_us,
+               uint32_t nb_spill_slots, RunResult* result) {
+  std::unique_ptr<enso::Device> dev = enso::Device::Create();
+  if (!dev) {
+    std::cerr << "Problem creating device" << std::endl;
+    return 4;
+  }
+
+  enso::RxPipe* pipe = dev->AllocateRxPipe();
+  if (pipe == nullptr || pipe->Bind(DST_PORT, 0, DST_IP, 0, PROTOCOL)) {
+    std::cerr << "Problem creating pipe" << std::endl;
+    return 5;
+  }
+
+  if (mode == HoldMode::kSpill && pipe->EnableSpill(nb_spill_slots)) {
+    return 6;
+  }
+
+  // Packets that the application is holding, oldest first. In fifo mode,
+  // also the packets that it is done with but cannot free yet.
+  std::deque<Packet> held;
+  uint64_t nb_pkts = 0;
+  uint64_t nb_samples = 0;
+  double utilization_sum = 0;
+  double max_utilization = 0;
+
+  enso::emulator::EmulatorStats start_stats = emulator->GetStats();
+
+  Clock::time_point now = Clock::now();
+  Clock::time_point end = now + std::chrono::seconds(duration);
+  std::chrono::microseconds hold_time(hold_us);
+
+  while (now < end) {
+    uint8_t* buf;
+    uint32_t recv = pipe->Recv(&buf, ~0);
+
+    for (uint8_t* pkt = buf; pkt < buf + recv;) {
+      uint8_t* next_pkt = enso::get_next_pkt(pkt);
+      uint32_t len = next_pkt - pkt;
+      bool hold = (nb_pkts % 100) < hold_percent;
+      ++nb_pkts;
+
+      if (hold && mode == HoldMode::kSpill) {
+        uint8_t* spilled = pipe->Spill(pkt, len);
+        if (spilled != nullptr) {
+          held.push_back({spilled, len, true, now + hold_time});
+          pkt = next_pkt;
+          continue;
+        }
+      }
+
+      if (hold || mode == HoldMode::kFifo) {
+        held.push_back({pkt, len, false, hold ? now + hold_time : now});
+      } else {
+        pipe->Release(pkt, len);
+      }
+      pkt = next_pkt;
+    }
+
+    double utilization = (double)pipe->capacity() / pipe->buf_size();
+    utilization_sum += utilization;
+    max_utilization = std::max(max_utilization, utilization);
+    ++nb_samples;
+
+    now = Clock::now();
+
+    // Packets are held for the same time, so they are done in order.
+    while (!held.empty() && held.front().done_time <= now) {
+      Packet& done = held.front();
+      if (done.spilled) {
+        pipe->FreeSpilled(done.addr);
+      } else if (mode == HoldMode::kFifo) {
+        pipe->Free(done.len);
+      } else {
+        pipe->Release(done.addr, done.len);
+      }
+      held.pop_front();
+    }
+  }
+
+  enso::emulator::EmulatorStats stats = emulator->GetStats();
+
+  result->mpps = (double)nb_pkts / duration / 1e6;
+  result->drops = stats.rx_full_drops - start_stats.rx_full_drops;
+  result->avg_utilization = nb_samples ? utilization_sum / nb_samples : 0;
+  result->max_utilization = max_utilization;
+
+  // Let the next run start with an empty pipe.
+  while (!held.empty()) {
+    if (held.front().spilled) {
+      pipe->FreeSpilled(held.front().addr);
+    }
+    held.pop_front();
+  }
+
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 5 || argc > 6) {
+    std::cerr << "Usage: " << argv[0]
+              << " RATE_MPPS DURATION HOLD_PERCENT HOLD_US [SPILL_SLOTS]"
+              << std::endl
+              << std::endl;
+    std::cerr << "RATE_MPPS: Rate at which the emulator sends packets (0 for "
+                 "as fast as it can)."
+              << std::endl;
+    std::cerr << "DURATION: Duration of each run in seconds." << std::endl;
+    std::cerr << "HOLD_PERCENT: Share of the packets that are held (0 to 100)."
+              << std::endl;
+    std::cerr << "HOLD_US: Time that a packet is held in microseconds."
+              << std::endl;
+    std::cerr << "SPILL_SLOTS: Number of packets that can be spilled "
+                 "(default: "
+              << DEFAULT_SPILL_SLOTS << ")." << std::endl;
+    return 1;
+  }
+
+  double rate_mpps = atof(argv[1]);
+  uint32_t duration = atoi(argv[2]);
+  uint32_t hold_percent = atoi(argv[3]);
+  uint32_t hold_us = atoi(argv[4]);
+  uint32_t nb_spill_slots = DEFAULT_SPILL_SLOTS;
+  if (argc > 5) {
+    nb_spill_slots = atoi(argv[5]);
+  }
+
+  if (hold_percent > 100) {
+    std::cerr << "HOLD_PERCENT must be between 0 and 100" << std::endl;
+    return 1;
+  }
+
+  enso::emulator::EmulatorConfig config = enso::bench::emulator_config();
+  config.rx_rate_mpps = rate_mpps;
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(config, 1, PKT_SIZE, DST_IP, DST_PORT);
+  if (!emulator) {
+    return 3;
+  }
+
+  int ret = 0;
+  for (HoldMode mode :
+       {HoldMode::kFifo, HoldMode::kRelease, HoldMode::kSpill}) {
+    RunResult result;
+    ret = run(emulator.get(), mode, duration, hold_percent, hold_us,
+              nb_spill_slots, &result);
+    if (ret) {
+      break;
+    }
+    std::cout << kHoldModeNames[(uint8_t)mode] << ": " << result.mpps
+              << " Mpps, " << result.drops << " drops, pipe "
+              << result.avg_utilization * 100 << "% full on average ("
+              << result.max_utilization * 100 << "% max)" << std::endl;
+  }
+
+  emulator->Stop();
+
+  return ret;
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Measures the latency of a low-rate pipe that shares a device with a
+ *        saturated pipe.
+ *
+ * The NIC emulator sends 64-byte packets as fast as it can to a bulk RX pipe,
+ * which processes every packet it receives. Meanwhile, the application sends a
+ * probe packet every `PROBE_INTERVAL_US` microseconds through the emulator's
+ * loopback to a control RX pipe with a higher priority. Runs for `DURATION`
+ * seconds choosing the pipes with `POLICY` and reports the bulk throughput and
+ * the latency percentiles of the probes, from sending them to receiving them.
+ * With `QUOTA` set, the bulk pipe receives at most `QUOTA` bytes every time it
+ * is chosen.
+ */
+
+#include <arpa/inet.h>
+#include <enso/consts.h>
+#include <enso/helpers.h>
+#include <enso/pipe.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+// Must match the address and port used by the emulator's synthetic trace.
+#define BULK_DST_IP 0xc0a80000  // 192.168.0.0
+#define DST_PORT 80
+
+#define CONTROL_DST_IP 0xc0a90000  // 192.169.0.0
+#define PROTOCOL 0x11
+
+#define PKT_SIZE 64
+#define PROBE_INTERVAL_US 20
+
+// Where probes carry the time they were sent.
+#define TIMESTAMP_OFFSET \
+  (sizeof(struct ether_header) + sizeof(struct iphdr) + sizeof(struct udphdr))
+
+static uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static void send_probe(enso::TxPipe* pipe) {
+  uint8_t* pkt = pipe->AllocateBuf(PKT_SIZE);
+  memset(pkt, 0, PKT_SIZE);
+
+  struct ether_header* l2_hdr = (struct ether_header*)pkt;
+  l2_hdr->ether_type = htons(ETHERTYPE_IP);
+
+  struct iphdr* l3_hdr = (struct iphdr*)(l2_hdr + 1);
+  l3_hdr->version = 4;
+  l3_hdr->ihl = 5;
+  l3_hdr->tot_len = htons(PKT_SIZE - sizeof(*l2_hdr));
+  l3_hdr->protocol = PROTOCOL;
+  l3_hdr->daddr = htonl(CONTROL_DST_IP);
+
+  struct udphdr* l4_hdr = (struct udphdr*)(l3_hdr + 1);
+  l4_hdr->dest = htons(DST_PORT);
+
+  uint64_t timestamp = now_ns();
+  memcpy(pkt + TIMESTAMP_OFFSET, &timestamp, sizeof(timestamp));
+
+  pipe->SendAndFree(PKT_SIZE);
+}
+
+// Latency percentile `p` (in microseconds) of sorted latencies.
+static double percentile(const std::vector<uint64_t>& latencies, double p) {
+  return latencies[(uint64_t)(p / 100 * (latencies.size() - 1))] / 1e3;
+}
+
+// Stands in for the work that an application does for every packet.
+static uint64_t process_pkt(const uint8_t* pkt) {
+  uint64_t hash = 0;
+  for (uint32_t i = 0; i < PKT_SIZE; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, pkt + i, sizeof(word));
+    hash = (hash ^ word) * 0x100000001b3;
+  }
+  return hash;
+}
+
+static int run(enso::RxSchedPolicy policy, uint32_t duration, uint32_t quota,
+               enso::emulator::NicEmulator* emulator) {
+  std::unique_ptr<enso::Device> dev = enso::Device::Create();
+  if (!dev) {
+    std::cerr << "Problem creating device" << std::endl;
+    return 4;
+  }
+
+  dev->SetRxSchedPolicy(policy);
+
+  enso::RxSchedParams bulk_params;
+  bulk_params.quota = quota;
+  enso::RxPipe* bulk_pipe =
+      dev->AllocateRxPipe(false, enso::kDefaultPipeBufSize, bulk_params);
+
+  enso::RxSchedParams control_params;
+  control_params.priority = 1;
+  enso::RxPipe* control_pipe =
+      dev->AllocateRxPipe(false, enso::kDefaultPipeBufSize, control_params);
+
+  enso::TxPipe* tx_pipe = dev->AllocateTxPipe();
+
+  if (bulk_pipe == nullptr || control_pipe == nullptr || tx_pipe == nullptr ||
+      bulk_pipe->Bind(DST_PORT, 0, BULK_DST_IP, 0, PROTOCOL) ||
+      control_pipe->Bind(DST_PORT, 0, CONTROL_DST_IP, 0, PROTOCOL)) {
+    std::cerr << "Problem creating pipes" << std::endl;
+    return 5;
+  }
+
+  enso::emulator::EmulatorStats start_stats = emulator->GetStats();
+
+  std::vector<uint64_t> latencies;
+  uint64_t nb_bulk_pkts = 0;
+  uint64_t nb_probes = 0;
+  uint64_t hash = 0;
+
+  uint64_t start = now_ns();
+  uint64_t end = start + (uint64_t)duration * 1000000000;
+  uint64_t next_probe = start;
+
+  for (uint64_t now = start; now < end; now = now_ns()) {
+    if (now >= next_probe) {
+      send_probe(tx_pipe);
+      ++nb_probes;
+      next_probe += PROBE_INTERVAL_US * 1000;
+    }
+
+    enso::RxPipe* pipe = dev->NextRxPipeToRecv();
+    if (pipe == nullptr) {
+      continue;
+    }
+
+    auto batch = pipe->RecvPkts();
+    if (pipe == control_pipe) {
+      uint64_t recv_time = now_ns();
+      for (auto pkt : batch) {
+        uint64_t timestamp;
+        memcpy(&timestamp, pkt + TIMESTAMP_OFFSET, sizeof(timestamp));
+        latencies.push_back(recv_time - timestamp);
+      }
+    } else {
+      for (auto pkt : batch) {
+        hash += process_pkt(pkt);
+        ++nb_bulk_pkts;
+      }
+    }
+    pipe->Clear();
+  }
+
+  double elapsed_s = (now_ns() - start) / 1e9;
+  enso::emulator::EmulatorStats stats = emulator->GetStats();
+
+  std::cout << "Bulk: " << nb_bulk_pkts / elapsed_s / 1e6 << " Mpps ("
+            << stats.rx_full_drops - start_stats.rx_full_drops
+            << " packets dropped)" << std::endl;
+
+  if (latencies.empty()) {
+    std::cout << "No probes received" << std::endl;
+    return 0;
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+
+  std::cout << "Probes: " << latencies.size() << " of " << nb_probes
+            << " received, latency (us): p50 " << percentile(latencies, 50)
+            << ", p99 " << percentile(latencies, 99) << ", p99.9 "
+            << percentile(latencies, 99.9) << ", max "
+            << percentile(latencies, 100) << std::endl;
+
+  // Keeps the compiler from dropping the packet processing.
+  if (hash == 1) {
+    std::cout << std::endl;
+  }
+
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 3 || argc > 4) {
+    std::cerr << "Usage: " << argv[0] << " POLICY DURATION [QUOTA]" << std::endl
+              << std::endl;
+    std::cerr << "POLICY: How to choose among the pipes with data pending: "
+                 "order, priority, wrr or drr."
+              << std::endl;
+    std::cerr << "DURATION: Duration of the run in seconds." << std::endl;
+    std::cerr << "QUOTA: Maximum number of bytes that the bulk pipe receives "
+                 "every time it is chosen (default: no limit)."
+              << std::endl;
+    return 1;
+  }
+
+  std::string policy_name = argv[1];
+  uint32_t duration = atoi(argv[2]);
+  uint32_t quota = 0;
+  if (argc > 3) {
+    quota = atoi(argv[3]);
+  }
+
+  enso::RxSchedPolicy policy;
+  if (policy_name == "order") {
+    policy = enso::RxSchedPolicy::kNotificationOrder;
+  } else if (policy_name == "priority") {
+    policy = enso::RxSchedPolicy::kStrictPriority;
+  } else if (policy_name == "wrr") {
+    policy = enso::RxSchedPolicy::kWeightedRoundRobin;
+  } else if (policy_name == "drr") {
+    policy = enso::RxSchedPolicy::kDeficitRoundRobin;
+  } else {
+    std::cerr << "Unknown policy: " << policy_name << std::endl;
+    return 1;
+  }
+
+  enso::emulator::EmulatorConfig config = enso::bench::emulator_config();
+  config.loopback = true;
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(config, 1, PKT_SIZE, BULK_DST_IP, DST_PORT);
+  if (!emulator) {
+    return 3;
+  }
+
+  int ret = run(policy, duration, quota, emulator.get());
+
+  emulator->Stop();
+
+  return ret;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Measures the cost of polling with many RX/TX pipes.
+ *
+ * Allocates `NB_PIPES` RX/TX pipes, of which only the first `NB_ACTIVE` receive
+ * packets from the NIC emulator, and calls `Device::NextRxTxPipeToRecv()` for
+ * `DURATION` seconds, echoing the packets it receives. Reports the CPU time of
+ * the polling thread per poll, which excludes the emulator threads sharing the
+ * same core, and the echo throughput. With `NB_ACTIVE` set to 0 it measures
+ * the cost of polling idle pipes.
+ *
+ * Every pipe uses a buffer of `kDefaultPipeBufSize` bytes, so the number of
+ * pipes is limited by the number of available huge pages.
+ */
+
+#include <enso/consts.h>
+#include <enso/helpers.h>
+#include <enso/pipe.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+// Must match the address and port used by the emulator's synthetic trace.
+#define BASE_DST_IP 0xc0a80000  // 192.168.0.0
+#define DST_PORT 80
+#define PROTOCOL 0x11
+
+#define PKT_SIZE 64
+
+static int run(uint32_t nb_pipes, uint32_t duration) {
+  std::unique_ptr<enso::Device> dev = enso::Device::Create();
+  if (!dev) {
+    std::cerr << "Problem creating device" << std::endl;
+    return 4;
+  }
+
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    enso::RxTxPipe* pipe = dev->AllocateRxTxPipe();
+    if (pipe == nullptr ||
+        pipe->Bind(DST_PORT, 0, BASE_DST_IP + i, 0, PROTOCOL)) {
+      std::cerr << "Problem creating pipe" << std::endl;
+      return 5;
+    }
+  }
+
+  uint64_t nb_polls = 0;
+  uint64_t nb_bytes = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  auto end = start + std::chrono::seconds(duration);
+  uint64_t start_ns = enso::bench::thread_time_ns();
+
+  while (std::chrono::steady_clock::now() < end) {
+    for (uint32_t i = 0; i < enso::kBatchSize; ++i) {
+      enso::RxTxPipe* pipe = dev->NextRxTxPipeToRecv();
+      ++nb_polls;
+      if (pipe == nullptr) {
+        continue;
+      }
+      uint8_t* buf;
+      uint32_t recv = pipe->Recv(&buf, ~0);
+      pipe->SendAndFree(recv);
+      nb_bytes += recv;
+    }
+  }
+
+  uint64_t cpu_ns = enso::bench::thread_time_ns() - start_ns;
+
+  std::cout << nb_pipes << " pipes: " << (double)cpu_ns / nb_polls
+            << " ns of CPU time per poll, "
+            << (double)nb_bytes / PKT_SIZE / duration / 1e6 << " Mpps"
+            << std::endl;
+
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 3 || argc > 4) {
+    std::cerr << "Usage: " << argv[0] << " NB_PIPES DURATION [NB_ACTIVE]"
+              << std::endl
+              << std::endl;
+    std::cerr << "NB_PIPES: Number of RX/TX pipes (1 to " << enso::kMaxNbFlows
+              << ")." << std::endl;
+    std::cerr << "DURATION: Duration of the run in seconds." << std::endl;
+    std::cerr << "NB_ACTIVE: Number of pipes that receive packets (default: 1)."
+              << std::endl;
+    return 1;
+  }
+
+  uint32_t nb_pipes = atoi(argv[1]);
+  uint32_t duration = atoi(argv[2]);
+  uint32_t nb_active = 1;
+  if (argc > 3) {
+    nb_active = atoi(argv[3]);
+  }
+
+  if (nb_pipes == 0 || nb_pipes > enso::kMaxNbFlows || nb_active > nb_pipes) {
+    std::cerr << "NB_PIPES must be between 1 and " << enso::kMaxNbFlows
+              << " and NB_ACTIVE cannot be larger than NB_PIPES" << std::endl;
+    return 1;
+  }
+
+  enso::emulator::EmulatorConfig config = enso::bench::emulator_config();
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator;
+  if (nb_active > 0) {
+    emulator = enso::bench::start_emulator(config, nb_active, PKT_SIZE,
+                                           BASE_DST_IP, DST_PORT);
+  } else {
+    config.nb_rx_threads = 0;
+    emulator = enso::bench::start_emulator(config);
+  }
+  if (!emulator) {
+    return 3;
+  }
+
+  int ret = run(nb_pipes, duration);
+
+  emulator->Stop();
+
+  return ret;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Measures the effect of TX batching on an echo application.
+ *
+ * Runs the NIC emulator in the same process and echoes the packets received on
+ * `NB_PIPES` RX/TX pipes for `DURATION` seconds, first ringing the TX doorbell
+ * for every transmission and then with TX batching enabled. With batching,
+ * the application flushes the queued transmissions once per poll iteration.
+ * Reports the throughput, the number of register writes per packet and the
+ * number of TX notifications per packet of both runs.
+ *
+ * If `PER_PKT_SEND` is 1, the application sends every packet individually, as
+ * a small-packet sender would. Contiguous sends on the same pipe are then
+ * coalesced into a single TX notification when batching is enabled.
+ */
+
+#include <enso/helpers.h>
+#include <enso/pipe.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+// Must match the address and port used by the emulator's synthetic trace.
+#define BASE_DST_IP 0xc0a80000  // 192.168.0.0
+#define DST_PORT 80
+#define PROTOCOL 0x11
+
+#define PKT_SIZE 64
+
+struct RunResult {
+  double mpps;
+  double writes_per_pkt;
+  double notifications_per_pkt;
+};
+
+static int run(enso::emulator::NicEmulator* emulator, uint32_t nb_pipes,
+               uint32_t duration, uint32_t batch_size, uint64_t delay_cycles,
+               bool per_pkt_send, RunResult* result) {
+  std::unique_ptr<enso::Device> dev = enso::Device::Create();
+  if (!dev) {
+    std::cerr << "Problem creating device" << std::endl;
+    return 4;
+  }
+
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    enso::RxTxPipe* pipe = dev->AllocateRxTxPipe();
+    if (pipe == nullptr ||
+        pipe->Bind(DST_PORT, 0, BASE_DST_IP + i, 0, PROTOCOL)) {
+      std::cerr << "Problem creating pipe" << std::endl;
+      return 5;
+    }
+  }
+
+  bool batching = batch_size > 1;
+  if (batching && dev->EnableTxBatching(batch_size, delay_cycles)) {
+    return 6;
+  }
+
+  enso::emulator::EmulatorStats start_stats = emulator->GetStats();
+  uint64_t nb_bytes = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  auto end = start + std::chrono::seconds(duration);
+
+  while (std::chrono::steady_clock::now() < end) {
+    for (uint32_t i = 0; i < enso::kBatchSize; ++i) {
+      enso::RxTxPipe* pipe = dev->NextRxTxPipeToRecv();
+      if (pipe == nullptr) {
+        continue;
+      }
+      uint8_t* buf;
+      uint32_t recv = pipe->Recv(&buf, ~0);
+      if (per_pkt_send) {
+        for (uint8_t* pkt = buf; pkt < buf + recv;) {
+          uint8_t* next_pkt = enso::get_next_pkt(pkt);
+          pipe->SendAndFree(next_pkt - pkt);
+          pkt = next_pkt;
+        }
+      } else {
+        pipe->SendAndFree(recv);
+      }
+      nb_bytes += recv;
+    }
+    if (batching) {
+      dev->FlushTx();
+    }
+  }
+
+  enso::emulator::EmulatorStats stats = emulator->GetStats();
+  uint64_t nb_writes = stats.mmio_writes - start_stats.mmio_writes +
+                       stats.mmio_coalesced_writes -
+                       start_stats.mmio_coalesced_writes;
+  uint64_t nb_notifications =
+      stats.tx_notifications - start_stats.tx_notifications;
+  uint64_t nb_pkts = nb_bytes / PKT_SIZE;
+
+  result->mpps = (double)nb_pkts / duration / 1e6;
+  result->writes_per_pkt = nb_pkts ? (double)nb_writes / nb_pkts : 0;
+  result->notifications_per_pkt =
+      nb_pkts ? (double)nb_notifications / nb_pkts : 0;
+
+  std::cout << (batching ? "TX batching: " : "No batching: ") << result->mpps
+            << " Mpps, " << result->writes_per_pkt
+            << " register writes per packet, "
+            << result->notifications_per_pkt << " TX notifications per packet"
+            << std::endl;
+
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 3 || argc > 6) {
+    std::cerr << "Usage: " << argv[0]
+              << " NB_PIPES DURATION [BATCH_SIZE] [DELAY_CYCLES] [PER_PKT_SEND]"
+              << std::endl
+              << std::endl;
+    std::cerr << "NB_PIPES: Number of pipes to echo packets on." << std::endl;
+    std::cerr << "DURATION: Duration of each run in seconds." << std::endl;
+    std::cerr << "BATCH_SIZE: Descriptors queued before ringing the TX "
+                 "doorbell (default: "
+              << enso::kDefaultTxBatchSize << ")." << std::endl;
+    std::cerr << "DELAY_CYCLES: Maximum cycles that a descriptor is queued "
+                 "(default: "
+              << enso::kDefaultTxBatchDelayCycles << ")." << std::endl;
+    std::cerr << "PER_PKT_SEND: Send every packet individually (default: 0)."
+              << std::endl;
+    return 1;
+  }
+
+  uint32_t nb_pipes = atoi(argv[1]);
+  uint32_t duration = atoi(argv[2]);
+  uint32_t batch_size = enso::kDefaultTxBatchSize;
+  uint64_t delay_cycles = enso::kDefaultTxBatchDelayCycles;
+  if (argc > 3) {
+    batch_size = atoi(argv[3]);
+  }
+  if (argc > 4) {
+    delay_cycles = strtoull(argv[4], nullptr, 10);
+  }
+  bool per_pkt_send = false;
+  if (argc > 5) {
+    per_pkt_send = atoi(argv[5]);
+  }
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(enso::bench::emulator_config(), nb_pipes,
+                                  PKT_SIZE, BASE_DST_IP, DST_PORT);
+  if (!emulator) {
+    return 3;
+  }
+
+  RunResult eager;
+  RunResult batched;
+  int ret = run(emulator.get(), nb_pipes, duration, 1, delay_cycles,
+                per_pkt_send, &eager);
+  if (ret == 0) {
+    ret = run(emulator.get(), nb_pipes, duration, batch_size, delay_cycles,
+              per_pkt_send, &batched);
+  }
+
+  if (ret == 0 && eager.writes_per_pkt > 0 &&
+      eager.notifications_per_pkt > 0 && eager.mpps > 0) {
+    std::cout << "Register writes saved: "
+              << 100 * (1 - batched.writes_per_pkt / eager.writes_per_pkt)
+              << "%, TX notifications saved: "
+              << 100 * (1 - batched.notifications_per_pkt /
+                                eager.notifications_per_pkt)
+              << "%, throughput gain: "
+              << 100 * (batched.mpps / eager.mpps - 1) << "%" << std::endl;
+  }
+
+  emulator->Stop();
+
+  return ret;
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Measures the cost of processing TX completions with many TX pipes.
+ *
+ * Sends single 64-byte packets round robin on `NB_PIPES` TX pipes for
+ * `DURATION` seconds, so that every transmission completes as a separate
+ * request, and then waits for all of them to complete. All pipes share the same
+ * buffer, which holds valid packets, so that the number of pipes is not limited
+ * by the number of huge pages. Reports the completion rate and the CPU time of
+ * the sending thread per completion, which excludes the emulator threads
+ * sharing the same core.
+ */
+
+#include <arpa/inet.h>
+#include <enso/consts.h>
+#include <enso/helpers.h>
+#include <enso/ixy_helpers.h>
+#include <enso/pipe.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+#define PKT_SIZE 64
+
+static void fill_pkts(uint8_t* buf, uint32_t buf_size) {
+  memset(buf, 0, buf_size);
+  for (uint32_t offset = 0; offset < buf_size; offset += PKT_SIZE) {
+    struct ether_header* l2_hdr = (struct ether_header*)(buf + offset);
+    l2_hdr->ether_type = htons(ETHERTYPE_IP);
+
+    struct iphdr* l3_hdr = (struct iphdr*)(l2_hdr + 1);
+    l3_hdr->version = 4;
+    l3_hdr->ihl = 5;
+    l3_hdr->tot_len = htons(PKT_SIZE - sizeof(*l2_hdr));
+  }
+}
+
+static int run(uint32_t nb_pipes, uint32_t duration, uint8_t* buf,
+               enso::emulator::NicEmulator* emulator) {
+  std::unique_ptr<enso::Device> dev = enso::Device::Create();
+  if (!dev) {
+    std::cerr << "Problem creating device" << std::endl;
+    return 4;
+  }
+
+  std::vector<enso::TxPipe*> pipes;
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    enso::TxPipe* pipe = dev->AllocateTxPipe(buf, enso::kBufPageSize);
+    if (pipe == nullptr) {
+      std::cerr << "Problem creating pipe" << std::endl;
+      return 5;
+    }
+    pipes.push_back(pipe);
+  }
+
+  enso::emulator::EmulatorStats start_stats = emulator->GetStats();
+  uint64_t nb_completions = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  auto end = start + std::chrono::seconds(duration);
+  uint64_t start_ns = enso::bench::thread_time_ns();
+
+  while (std::chrono::steady_clock::now() < end) {
+    for (enso::TxPipe* pipe : pipes) {
+      if (pipe->capacity() < PKT_SIZE && pipe->TryExtendBuf() < PKT_SIZE) {
+        continue;
+      }
+      pipe->SendAndFree(PKT_SIZE);
+      ++nb_completions;
+    }
+    dev->ProcessCompletions();
+  }
+
+  // Wait for the remaining completions.
+  for (enso::TxPipe* pipe : pipes) {
+    while (pipe->pending_transmission() != 0) {
+      dev->ProcessCompletions();
+    }
+  }
+
+  uint64_t cpu_ns = enso::bench::thread_time_ns() - start_ns;
+  double elapsed_s = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+  enso::emulator::EmulatorStats stats = emulator->GetStats();
+
+  std::cout << "Completions: " << nb_completions << " ("
+            << nb_completions / elapsed_s / 1e6 << " M/s), "
+            << (double)cpu_ns / nb_completions << " ns of CPU time each"
+            << std::endl;
+  std::cout << "TX notifications: "
+            << stats.tx_notifications - start_stats.tx_notifications
+            << std::endl;
+
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " NB_PIPES DURATION" << std::endl
+              << std::endl;
+    std::cerr << "NB_PIPES: Number of TX pipes to send packets on."
+              << std::endl;
+    std::cerr << "DURATION: Duration of the run in seconds." << std::endl;
+    return 1;
+  }
+
+  uint32_t nb_pipes = atoi(argv[1]);
+  uint32_t duration = atoi(argv[2]);
+
+  if (nb_pipes == 0) {
+    std::cerr << "NB_PIPES must be positive" << std::endl;
+    return 1;
+  }
+
+  // The emulator only transmits.
+  enso::emulator::EmulatorConfig config = enso::bench::emulator_config();
+  config.nb_rx_threads = 0;
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(config);
+  if (!emulator) {
+    return 3;
+  }
+
+  std::string buf_path =
+      std::string(enso::kHugePageDefaultPrefix) + "tx_completions";
+  uint8_t* buf =
+      (uint8_t*)enso::get_huge_page(buf_path, enso::kBufPageSize, true);
+  if (buf == nullptr) {
+    std::cerr << "Problem allocating buffer" << std::endl;
+    emulator->Stop();
+    return 2;
+  }
+  fill_pkts(buf, enso::kBufPageSize);
+
+  int ret = run(nb_pipes, duration, buf, emulator.get());
+
+  munmap(buf, 2 * enso::kBufPageSize);
+  unlink(buf_path.c_str());
+  emulator->Stop();
+
+  return ret;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file
+ * @brief Compares forwarding packets by copying them to a TX pipe with
+ *        sending them straight from the RX pipes.
+ *
+ * Runs the NIC emulator in the same process and forwards the packets received
+ * on `NB_PIPES` RX pipes for `DURATION` seconds, swapping their MAC addresses
+ * as an L2 forwarder would. It first copies every packet to a TX pipe with
+ * `memcpy_64_align()`, as in `l2_forward.cpp`, and then sends the packets from
+ * the RX pipes with `TxPipe::SendFromRxPipe()`. Reports the throughput and the
+ * CPU time of the forwarding thread per packet of both runs.
+ */
+
+#include <enso/consts.h>
+#include <enso/helpers.h>
+#include <enso/pipe.h>
+#include <net/ethernet.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+#include "../emulator/nic_emulator.h"
+#include "bench_common.h"
+
+// Must match the address and port used by the emulator's synthetic trace.
+#define BASE_DST_IP 0xc0a80000  // 192.168.0.0
+#define DST_PORT 80
+#define PROTOCOL 0x11
+
+#define PKT_SIZE 64
+
+struct RunResult {
+  double mpps;
+  double cpu_ns_per_pkt;
+  uint64_t tx_pkts;
+};
+
+static void swap_macs(uint8_t* pkt) {
+  struct ether_header* l2_hdr = (struct ether_header*)pkt;
+  struct ether_addr src_mac = *((struct ether_addr*)l2_hdr->ether_shost);
+  *((struct ether_addr*)l2_hdr->ether_shost) =
+      *((struct ether_addr*)l2_hdr->ether_dhost);
+  *((struct ether_addr*)l2_hdr->ether_dhost) = src_mac;
+}
+
+static uint64_t forward_copy(enso::RxPipe* rx_pipe, enso::TxPipe* tx_pipe) {
+  uint64_t nb_pkts = 0;
+  auto batch = rx_pipe->PeekPkts();
+  uint32_t nb_bytes = std::min(batch.available_bytes(),
+                               enso::TxPipe::kMaxCapacity);
+  uint8_t* tx_buf = tx_pipe->AllocateBuf(nb_bytes);
+  uint8_t* tx_buf_end = tx_buf + nb_bytes;
+
+  for (uint8_t* pkt : batch) {
+    uint16_t pkt_len_64 = ((enso::get_pkt_len(pkt) - 1) / 64 + 1) * 64;
+    if (tx_buf + pkt_len_64 > tx_buf_end) {
+      break;
+    }
+    enso::memcpy_64_align(tx_buf, pkt, pkt_len_64);
+    swap_macs(tx_buf);
+    tx_buf += pkt_len_64;
+    ++nb_pkts;
+  }
+
+  uint32_t batch_length = batch.processed_bytes();
+  rx_pipe->ConfirmBytes(batch_length);
+  rx_pipe->Clear();
+  if (batch_length > 0) {
+    tx_pipe->SendAndFree(batch_length);
+  }
+  return nb_pkts;
+}
+
+static uint64_t forward_zero_copy(enso::RxPipe* rx_pipe,
+                                  enso::TxPipe* tx_pipe) {
+  uint64_t nb_pkts = 0;
+  auto batch = rx_pipe->RecvPkts();
+  for (uint8_t* pkt : batch) {
+    swap_macs(pkt);
+    ++nb_pkts;
+  }
+
+  // The bytes are freed from the RX pipe once they are transmitted.
+  tx_pipe->SendFromRxPipe(rx_pipe, batch.buf(), batch.processed_bytes());
+  return nb_pkts;
+}
+
+static int run(enso::emulator::NicEmulator* emulator, uint32_t nb_pipes,
+               uint32_t duration, bool zero_copy, RunResult* result) {
+  std::unique_ptr<enso::Device> dev = enso::Device::Create();
+  if (!dev) {
+    std::cerr << "Problem creating device" << std::endl;
+    return 4;
+  }
+
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    enso::RxPipe* pipe = dev->AllocateRxPipe();
+    if (pipe == nullptr ||
+        pipe->Bind(DST_PORT, 0, BASE_DST_IP + i, 0, PROTOCOL)) {
+      std::cerr << "Problem creating pipe" << std::endl;
+      return 5;
+    }
+  }
+
+  enso::TxPipe* tx_pipe = dev->AllocateTxPipe();
+  if (tx_pipe == nullptr) {
+    std::cerr << "Problem creating TX pipe" << std::endl;
+    return 5;
+  }
+
+  enso::emulator::EmulatorStats start_stats = emulator->GetStats();
+  uint64_t nb_pkts = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  auto end = start + std::chrono::seconds(duration);
+  uint64_t start_ns = enso::bench::thread_time_ns();
+
+  while (std::chrono::steady_clock::now() < end) {
+    for (uint32_t i = 0; i < enso::kBatchSize; ++i) {
+      enso::RxPipe* pipe = dev->NextRxPipeToRecv();
+      if (pipe == nullptr) {
+        continue;
+      }
+      if (zero_copy) {
+        nb_pkts += forward_zero_copy(pipe, tx_pipe);
+      } else {
+        nb_pkts += forward_copy(pipe, tx_pipe);
+      }
+    }
+  }
+
+  uint64_t cpu_ns = enso::bench::thread_time_ns() - start_ns;
+
+  // Let the last transmissions complete before the pipes go away.
+  dev->FlushTx();
+  while (tx_pipe->pending_transmission() > 0) {
+    dev->ProcessCompletions();
+  }
+  dev->ProcessCompletions();
+
+  enso::emulator::EmulatorStats stats = emulator->GetStats();
+
+  result->mpps = (double)nb_pkts / duration / 1e6;
+  result->cpu_ns_per_pkt = nb_pkts ? (double)cpu_ns / nb_pkts : 0;
+  result->tx_pkts = stats.tx_pkts - start_stats.tx_pkts;
+
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " NB_PIPES DURATION" << std::endl
+              << std::endl;
+    std::cerr << "NB_PIPES: Number of RX pipes (1 to " << enso::kMaxNbFlows
+              << ")." << std::endl;
+    std::cerr << "DURATION: Duration of each run in seconds." << std::endl;
+    return 1;
+  }
+
+  uint32_t nb_pipes = atoi(argv[1]);
+  uint32_t duration = atoi(argv[2]);
+
+  if (nb_pipes == 0 || nb_pipes > enso::kMaxNbFlows) {
+    std::cerr << "NB_PIPES must be between 1 and " << enso::kMaxNbFlows
+              << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::bench::start_emulator(enso::bench::emulator_config(), nb_pipes,
+                                  PKT_SIZE, BASE_DST_IP, DST_PORT);
+  if (!emulator) {
+    return 3;
+  }
+
+  RunResult copy;
+  RunResult zero_copy;
+  int ret = run(emulator.get(), nb_pipes, duration, false, &copy);
+  if (!ret) {
+    ret = run(emulator.get(), nb_pipes, duration, true, &zero_copy);
+  }
+
+  emulator->Stop();
+
+  if (ret) {
+    return ret;
+  }
+
+  std::cout << "Copy:      " << copy.mpps << " Mpps, " << copy.cpu_ns_per_pkt
+            << " ns of CPU time per packet, " << copy.tx_pkts
+            << " packets transmitted" << std::endl;
+  std::cout << "Zero copy: " << zero_copy.mpps << " Mpps, "
+            << zero_copy.cpu_ns_per_pkt << " ns of CPU time per packet, "
+            << zero_copy.tx_pkts << " packets transmitted" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Implementation of the flow table model. @see flow_table.h
+ */
+
+#include "flow_table.h"
+
+#include <netinet/ether.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+
+namespace enso {
+namespace emulator {
+
+FlowTuple parse_flow_tuple(const uint8_t* pkt, uint16_t len) {
+  FlowTuple tuple = {};
+
+  if (len < sizeof(struct ether_header) + sizeof(struct iphdr)) {
+    return tuple;
+  }
+
+  const struct ether_header* l2_hdr = (const struct ether_header*)pkt;
+  if (l2_hdr->ether_type != htons(ETHERTYPE_IP)) {
+    return tuple;
+  }
+
+  const struct iphdr* l3_hdr = (const struct iphdr*)(l2_hdr + 1);
+  tuple.dst_ip = ntohl(l3_hdr->daddr);
+
+  // The hardware parser assumes there are no IP options.
+  const uint8_t* l4_hdr = (const uint8_t*)(l3_hdr + 1);
+  uint16_t l4_offset = l4_hdr - pkt;
+
+  if (l3_hdr->protocol == IPPROTO_TCP) {
+    if (len < l4_offset + sizeof(struct tcphdr)) {
+      return tuple;
+    }
+    const struct tcphdr* tcp_hdr = (const struct tcphdr*)l4_hdr;
+    tuple.dst_port = ntohs(tcp_hdr->dest);
+
+    // The first packet of a connection should find a pipe based on the
+    // destination only.
+    if (!tcp_hdr->syn) {
+      tuple.src_ip = ntohl(l3_hdr->saddr);
+      tuple.src_port = ntohs(tcp_hdr->source);
+    }
+  } else if (l3_hdr->protocol == IPPROTO_UDP) {
+    if (len < l4_offset + sizeof(struct udphdr)) {
+      return tuple;
+    }
+    const struct udphdr* udp_hdr = (const struct udphdr*)l4_hdr;
+    tuple.dst_port = ntohs(udp_hdr->dest);
+  }
+
+  return tuple;
+}
+
+std::unique_ptr<FlowTable> FlowTable::Create() noexcept {
+  std::unique_ptr<FlowTable> flow_table(new (std::nothrow) FlowTable());
+  return flow_table;
+}
+
+static inline uint64_t pack_ips(const FlowTuple& tuple) {
+  return ((uint64_t)tuple.src_ip << 32) | tuple.dst_ip;
+}
+
+static inline uint64_t pack_ports(const FlowTuple& tuple) {
+  return ((uint64_t)tuple.src_port << 48) | ((uint64_t)tuple.dst_port << 32);
+}
+
+void FlowTable::Write(Entry* entry, uint64_t ips, uint64_t other) noexcept {
+  uint32_t seq = entry->seq.load(std::memory_order_relaxed);
+  entry->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  entry->ips.store(ips, std::memory_order_relaxed);
+  entry->other.store(other, std::memory_order_relaxed);
+  entry->seq.store(seq + 2, std::memory_order_release);
+}
+
+void FlowTable::Read(const Entry* entry, uint64_t* ips,
+                     uint64_t* other) const noexcept {
+  uint32_t seq_before;
+  uint32_t seq_after;
+  do {
+    seq_before = entry->seq.load(std::memory_order_acquire);
+    *ips = entry->ips.load(std::memory_order_relaxed);
+    *other = entry->other.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    seq_after = entry->seq.load(std::memory_order_relaxed);
+  } while ((seq_before & 1) || seq_before != seq_after);
+}
+
+int FlowTable::Insert(const FlowTuple& tuple, uint32_t pipe_id) noexcept {
+  uint64_t ips = pack_ips(tuple);
+  uint64_t ports = pack_ports(tuple);
+  uint64_t new_other = ports | kValidBit | pipe_id;
+
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+
+  Entry* empty_entry = nullptr;
+  for (uint32_t i = 0; i < kNbSubtables; ++i) {
+    uint32_t index = flow_hash(tuple, i) % kSubtableDepth;
+    Entry* entry = &entries_[i][index];
+
+    // We are the only writer, so there is no need to use the sequence lock.
+    uint64_t other = entry->other.load(std::memory_order_relaxed);
+    if (!(other & kValidBit)) {
+      if (empty_entry == nullptr) {
+        empty_entry = entry;
+      }
+      continue;
+    }
+
+    uint64_t entry_ips = entry->ips.load(std::memory_order_relaxed);
+    if (entry_ips == ips && (other & ~0xffffffffUL) == ports) {
+      Write(entry, ips, new_other);
+      return 0;
+    }
+  }
+
+  if (empty_entry == nullptr) {
+    eviction_count_.fetch_add(1, std::memory_order_relaxed);
+    return -1;
+  }
+
+  Write(empty_entry, ips, new_other);
+  return 0;
+}
+
+int32_t FlowTable::Lookup(const FlowTuple& tuple,
+                          uint32_t* hash0) const noexcept {
+  uint64_t ips = pack_ips(tuple);
+  uint64_t ports = pack_ports(tuple);
+
+  for (uint32_t i = 0; i < kNbSubtables; ++i) {
+    uint32_t hash = flow_hash(tuple, i);
+    if (i == 0) {
+      *hash0 = hash;
+    }
+
+    uint64_t entry_ips;
+    uint64_t other;
+    Read(&entries_[i][hash % kSubtableDepth], &entry_ips, &other);
+
+    if ((other & kValidBit) && entry_ips == ips &&
+        (other & ~0xffffffffUL) == ports) {
+      return other & (kValidBit - 1);
+    }
+  }
+
+  return -1;
+}
+
+int32_t FlowTable::FindSubtable(const FlowTuple& tuple) const noexcept {
+  uint64_t ips = pack_ips(tuple);
+  uint64_t ports = pack_ports(tuple);
+
+  for (uint32_t i = 0; i < kNbSubtables; ++i) {
+    uint64_t entry_ips;
+    uint64_t other;
+    Read(&entries_[i][flow_hash(tuple, i) % kSubtableDepth], &entry_ips,
+         &other);
+
+    if ((other & kValidBit) && entry_ips == ips &&
+        (other & ~0xffffffffUL) == ports) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+uint32_t FlowTable::CountEntries(uint32_t subtable) const noexcept {
+  uint32_t nb_entries = 0;
+  for (uint32_t i = 0; i < kSubtableDepth; ++i) {
+    uint64_t ips;
+    uint64_t other;
+    Read(&entries_[subtable][i], &ips, &other);
+    nb_entries += (other & kValidBit) != 0;
+  }
+  return nb_entries;
+}
+
+int FlowTable::Remove(const FlowTuple& tuple) noexcept {
+  uint64_t ips = pack_ips(tuple);
+  uint64_t ports = pack_ports(tuple);
+
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+
+  for (uint32_t i = 0; i < kNbSubtables; ++i) {
+    Entry* entry = &entries_[i][flow_hash(tuple, i) % kSubtableDepth];
+
+    // We are the only writer, so there is no need to use the sequence lock.
+    uint64_t other = entry->other.load(std::memory_order_relaxed);
+    uint64_t entry_ips = entry->ips.load(std::memory_order_relaxed);
+    if ((other & kValidBit) && entry_ips == ips &&
+        (other & ~0xffffffffUL) == ports) {
+      Write(entry, 0, 0);
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+void FlowTable::Clear() noexcept {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  for (uint32_t i = 0; i < kNbSubtables; ++i) {
+    for (uint32_t j = 0; j < kSubtableDepth; ++j) {
+      Write(&entries_[i][j], 0, 0);
+    }
+  }
+  eviction_count_.store(0, std::memory_order_relaxed);
+}
+
+}  // namespace emulator
+}  // namespace enso
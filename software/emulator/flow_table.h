@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Software model of the hardware flow table used by the NIC emulator.
+ *
+ * Mirrors `hardware/src/flow_table_wrapper.sv`: four subtables indexed by
+ * independent hashes of the packet tuple, using the same hash model as the
+ * library's `FlowTable` shadow. Lookups are
+ * lock-free so that many RX threads can steer packets concurrently while
+ * configuration updates are applied.
+ */
+
+#ifndef SOFTWARE_EMULATOR_FLOW_TABLE_H_
+#define SOFTWARE_EMULATOR_FLOW_TABLE_H_
+
+#include <enso/flow_table.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace enso {
+namespace emulator {
+
+/**
+ * @brief Extracts the tuple from a packet, following the hardware parser.
+ *
+ * Only fields that the hardware parser extracts are filled. UDP packets and
+ * TCP packets with the SYN flag set have the source IP and port zeroed, other
+ * IP protocols only keep the destination IP. Non-IPv4 packets produce an
+ * all-zero tuple.
+ *
+ * @param pkt Pointer to the start of the Ethernet header.
+ * @param len Packet length in bytes.
+ * @return The extracted tuple.
+ */
+FlowTuple parse_flow_tuple(const uint8_t* pkt, uint16_t len);
+
+class FlowTable {
+ public:
+  static constexpr uint32_t kNbSubtables = enso::FlowTable::kNbSubtables;
+  static constexpr uint32_t kSubtableDepth = enso::FlowTable::kSubtableDepth;
+
+  /**
+   * @brief Factory method to create a FlowTable.
+   *
+   * @return A unique pointer to the FlowTable or nullptr on failure.
+   */
+  static std::unique_ptr<FlowTable> Create() noexcept;
+
+  /**
+   * @brief Inserts (or updates) an entry.
+   *
+   * Follows the hardware policy: an existing entry for the same tuple is
+   * updated, otherwise the first empty subtable is used. If all candidate
+   * entries are occupied, the insertion is dropped and the eviction counter is
+   * incremented.
+   *
+   * Safe to call concurrently with `Lookup`.
+   *
+   * @param tuple Tuple to insert.
+   * @param pipe_id Enso Pipe that should receive packets for this tuple.
+   * @return 0 on success, -1 if the insertion was dropped.
+   */
+  int Insert(const FlowTuple& tuple, uint32_t pipe_id) noexcept;
+
+  /**
+   * @brief Looks up a tuple.
+   *
+   * @param tuple Tuple to look up.
+   * @param hash0 Output: hash of the tuple for the first subtable. The hardware
+   *              uses this same hash to select a fallback pipe.
+   * @return Enso Pipe ID or -1 if the tuple is not in the table.
+   */
+  int32_t Lookup(const FlowTuple& tuple, uint32_t* hash0) const noexcept;
+
+  /**
+   * @brief Finds the subtable that holds the entry for a tuple.
+   *
+   * @param tuple Tuple to look for.
+   * @return Subtable index or -1 if the tuple is not in the table.
+   */
+  int32_t FindSubtable(const FlowTuple& tuple) const noexcept;
+
+  /**
+   * @brief Counts the valid entries in a subtable.
+   *
+   * Scans the whole subtable, meant for tests and debugging.
+   */
+  uint32_t CountEntries(uint32_t subtable) const noexcept;
+
+  /**
+   * @brief Removes the entry for a tuple, if there is one.
+   *
+   * Safe to call concurrently with `Lookup`.
+   *
+   * @param tuple Tuple to remove.
+   * @return 0 on success, -1 if the tuple is not in the table.
+   */
+  int Remove(const FlowTuple& tuple) noexcept;
+
+  /**
+   * @brief Removes all entries.
+   */
+  void Clear() noexcept;
+
+  inline uint64_t eviction_count() const noexcept {
+    return eviction_count_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  /**
+   * Entries are protected by a sequence lock. The tuple and the pipe ID are
+   * packed into two words so that readers never observe a torn entry.
+   */
+  struct Entry {
+    std::atomic<uint32_t> seq;
+    std::atomic<uint64_t> ips;    // src_ip << 32 | dst_ip
+    std::atomic<uint64_t> other;  // src_port << 48 | dst_port << 32 |
+                                  // valid << 31 | pipe_id
+  };
+
+  static constexpr uint64_t kValidBit = 1UL << 31;
+
+  FlowTable() noexcept = default;
+
+  FlowTable(const FlowTable& other) = delete;
+  FlowTable& operator=(const FlowTable& other) = delete;
+  FlowTable(FlowTable&& other) = delete;
+  FlowTable& operator=(FlowTable&& other) = delete;
+
+  void Write(Entry* entry, uint64_t ips, uint64_t other) noexcept;
+
+  void Read(const Entry* entry, uint64_t* ips, uint64_t* other) const noexcept;
+
+  Entry entries_[kNbSubtables][kSubtableDepth] = {};
+  std::mutex writer_mutex_;
+  std::atomic<uint64_t> eviction_count_ = 0;
+};
+
+}  // namespace emulator
+}  // namespace enso
+
+#endif  // SOFTWARE_EMULATOR_FLOW_TABLE_H_
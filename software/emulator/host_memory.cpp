@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Implementation of the emulator's view of application memory.
+ * @see host_memory.h
+ */
+
+#include "host_memory.h"
+
+#include <dirent.h>
+#include <enso/consts.h>
+#include <enso/ixy_helpers.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <iostream>
+
+namespace enso {
+namespace emulator {
+
+std::unique_ptr<HostMemory> HostMemory::Create(
+    const std::string& huge_page_prefix) noexcept {
+  size_t separator = huge_page_prefix.rfind('/');
+  if (separator == std::string::npos) {
+    std::cerr << "Huge page prefix must be an absolute path" << std::endl;
+    return nullptr;
+  }
+
+  std::string dir = huge_page_prefix.substr(0, separator + 1);
+  std::string file_prefix = huge_page_prefix.substr(separator + 1);
+
+  std::unique_ptr<HostMemory> host_memory(new (std::nothrow)
+                                              HostMemory(dir, file_prefix));
+  if (host_memory == nullptr) {
+    return nullptr;
+  }
+
+  if (host_memory->Rescan(0)) {
+    return nullptr;
+  }
+
+  return host_memory;
+}
+
+HostMemory::~HostMemory() noexcept {
+  for (auto& file : mapped_files_) {
+    munmap(file.addr, file.size);
+    close(file.fd);
+  }
+  for (auto& file : retired_files_) {
+    munmap(file.addr, file.size);
+    close(file.fd);
+  }
+}
+
+int HostMemory::MapFile(const std::string& path) noexcept {
+  int fd = open(path.c_str(), O_RDWR);
+  if (fd == -1) {
+    // The application may have removed the file in the meantime.
+    return 0;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat)) {
+    close(fd);
+    return 0;
+  }
+
+  // Applications truncate the file before using it. Files with an unexpected
+  // size are still being created, we will get them in a future scan.
+  size_t size = file_stat.st_size;
+  if (size == 0 || size % kBufPageSize) {
+    close(fd);
+    return 0;
+  }
+
+  uint8_t* addr = (uint8_t*)mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    std::cerr << "(" << errno << ") Could not mmap " << path << std::endl;
+    close(fd);
+    return -1;
+  }
+
+  for (size_t offset = 0; offset < size; offset += kBufPageSize) {
+    uint64_t phys_addr = virt_to_phys(addr + offset);
+    if (phys_addr == 0) {
+      std::cerr << "Could not get physical address for " << path
+                << " (are you running as root?)" << std::endl;
+      munmap(addr, size);
+      close(fd);
+      return -1;
+    }
+    phys_to_virt_[phys_addr] = (uint64_t)(addr + offset);
+  }
+
+  mapped_files_.push_back(
+      {file_stat.st_dev, file_stat.st_ino, fd, addr, size, 0});
+
+  return 0;
+}
+
+int HostMemory::ScanDirectory(uint64_t epoch) noexcept {
+  // Retire files that applications have removed.
+  for (auto it = mapped_files_.begin(); it != mapped_files_.end();) {
+    struct stat file_stat;
+    if (fstat(it->fd, &file_stat) == 0 && file_stat.st_nlink > 0) {
+      ++it;
+      continue;
+    }
+
+    for (size_t offset = 0; offset < it->size; offset += kBufPageSize) {
+      uint64_t phys_addr = virt_to_phys(it->addr + offset);
+      phys_to_virt_.erase(phys_addr);
+    }
+
+    it->retired_epoch = epoch;
+    retired_files_.push_back(*it);
+    it = mapped_files_.erase(it);
+  }
+
+  DIR* dir = opendir(dir_.c_str());
+  if (dir == nullptr) {
+    std::cerr << "(" << errno << ") Could not open " << dir_ << std::endl;
+    return -1;
+  }
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    std::string name = entry->d_name;
+    if (name.compare(0, file_prefix_.size(), file_prefix_) != 0) {
+      continue;
+    }
+
+    // IPC queues are never used for DMA.
+    if (name.find(kHugePageQueuePathPrefix) != std::string::npos) {
+      continue;
+    }
+
+    std::string path = dir_ + name;
+    struct stat file_stat;
+    if (stat(path.c_str(), &file_stat)) {
+      continue;
+    }
+
+    bool already_mapped = false;
+    for (auto& file : mapped_files_) {
+      if (file.dev == file_stat.st_dev && file.ino == file_stat.st_ino) {
+        already_mapped = true;
+        break;
+      }
+    }
+
+    if (already_mapped) {
+      continue;
+    }
+
+    if (MapFile(path)) {
+      closedir(dir);
+      return -1;
+    }
+  }
+
+  closedir(dir);
+
+  return 0;
+}
+
+uint64_t HostMemory::Translate(uint64_t phys_addr) noexcept {
+  uint64_t page_mask = kBufPageSize - 1;
+  uint64_t page_phys_addr = phys_addr & ~page_mask;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = phys_to_virt_.find(page_phys_addr);
+  if (it == phys_to_virt_.end()) {
+    if (ScanDirectory(last_epoch_)) {
+      return 0;
+    }
+    it = phys_to_virt_.find(page_phys_addr);
+    if (it == phys_to_virt_.end()) {
+      return 0;
+    }
+  }
+
+  return it->second + (phys_addr & page_mask);
+}
+
+int HostMemory::Rescan(uint64_t epoch) noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  last_epoch_ = epoch;
+  return ScanDirectory(epoch);
+}
+
+void HostMemory::ReleaseRetired(uint64_t safe_epoch) noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = retired_files_.begin(); it != retired_files_.end();) {
+    if (it->retired_epoch >= safe_epoch) {
+      ++it;
+      continue;
+    }
+    munmap(it->addr, it->size);
+    close(it->fd);
+    it = retired_files_.erase(it);
+  }
+}
+
+uint32_t HostMemory::nb_mapped_files() noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return mapped_files_.size();
+}
+
+}  // namespace emulator
+}  // namespace enso
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Gives the NIC emulator access to the application's DMA buffers.
+ *
+ * Applications using the software backend place all their DMA buffers in
+ * hugetlbfs files. The emulator maps the same files and keeps a table from
+ * physical huge page addresses to its own virtual addresses. The address that
+ * the emulator returns when the application asks to translate a physical
+ * address (`NotifType::kTranslAddr`) is the emulator's virtual address, so DMA
+ * becomes a regular memory copy.
+ */
+
+#ifndef SOFTWARE_EMULATOR_HOST_MEMORY_H_
+#define SOFTWARE_EMULATOR_HOST_MEMORY_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace enso {
+namespace emulator {
+
+class HostMemory {
+ public:
+  /**
+   * @brief Factory method to create a HostMemory.
+   *
+   * @param huge_page_prefix Prefix used by applications when creating huge
+   *                         page files (e.g., `/mnt/huge/enso`).
+   * @return A unique pointer to the HostMemory or nullptr on failure.
+   */
+  static std::unique_ptr<HostMemory> Create(
+      const std::string& huge_page_prefix) noexcept;
+
+  ~HostMemory() noexcept;
+
+  /**
+   * @brief Translates a physical address to an address in the emulator's
+   *        address space.
+   *
+   * If the address is unknown, the huge page directory is scanned again to
+   * find new files.
+   *
+   * @param phys_addr Physical address.
+   * @return Emulator address or 0 if the address cannot be translated.
+   */
+  uint64_t Translate(uint64_t phys_addr) noexcept;
+
+  /**
+   * @brief Maps new huge page files and retires the ones that were removed.
+   *
+   * Retired files remain mapped until `ReleaseRetired` is called with a
+   * larger epoch, so that threads that may still be accessing them finish.
+   *
+   * @param epoch Current epoch, used to tag retired files.
+   * @return 0 on success, -1 on failure.
+   */
+  int Rescan(uint64_t epoch) noexcept;
+
+  /**
+   * @brief Unmaps retired files that were retired before `safe_epoch`.
+   *
+   * @param safe_epoch Smallest epoch observed by all threads that access
+   *                   application memory.
+   */
+  void ReleaseRetired(uint64_t safe_epoch) noexcept;
+
+  /**
+   * @brief Number of files currently mapped.
+   */
+  uint32_t nb_mapped_files() noexcept;
+
+ private:
+  struct MappedFile {
+    dev_t dev;
+    ino_t ino;
+    int fd;
+    uint8_t* addr;
+    size_t size;
+    uint64_t retired_epoch;
+  };
+
+  HostMemory(const std::string& dir, const std::string& file_prefix) noexcept
+      : dir_(dir), file_prefix_(file_prefix) {}
+
+  HostMemory(const HostMemory& other) = delete;
+  HostMemory& operator=(const HostMemory& other) = delete;
+  HostMemory(HostMemory&& other) = delete;
+  HostMemory& operator=(HostMemory&& other) = delete;
+
+  int MapFile(const std::string& path) noexcept;
+
+  int ScanDirectory(uint64_t epoch) noexcept;
+
+  std::string dir_;
+  std::string file_prefix_;
+  std::mutex mutex_;
+  std::vector<MappedFile> mapped_files_;
+  std::vector<MappedFile> retired_files_;
+  std::unordered_map<uint64_t, uint64_t> phys_to_virt_;  // Per huge page.
+  uint64_t last_epoch_ = 0;
+};
+
+}  // namespace emulator
+}  // namespace enso
+
+#endif  // SOFTWARE_EMULATOR_HOST_MEMORY_H_
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Software NIC emulator to use with the `software` device backend.
+ *
+ * Start the emulator before the application. Packets are generated
+ * synthetically (by default) or replayed from a pcap file. Use `--loopback` to
+ * deliver transmitted packets back to the RX path.
+ */
+
+#include <arpa/inet.h>
+#include <enso/consts.h>
+#include <getopt.h>
+#include <signal.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "nic_emulator.h"
+#include "packet_trace.h"
+
+// Default number of flows used by the synthetic packet generator.
+#define DEFAULT_NB_FLOWS 1
+
+// Default packet size used by the synthetic packet generator.
+#define DEFAULT_PKT_SIZE 64
+
+// Default delay between displayed stats (in milliseconds).
+#define DEFAULT_STATS_DELAY 1000
+
+// Must match the address and port used by the examples.
+#define BASE_DST_IP 0xc0a80000  // 192.168.0.0
+#define DST_PORT 80
+
+static volatile bool keep_running = true;
+
+void int_handler([[maybe_unused]] int signal) { keep_running = false; }
+
+static void print_usage(const char* program_name) {
+  printf(
+      "%s\n"
+      " [--help]\n"
+      " [--pcap PCAP_FILE]\n"
+      " [--flows NB_FLOWS]\n"
+      " [--pkt-size PKT_SIZE]\n"
+      " [--rate RATE_MPPS]\n"
+      " [--burst BURST_SIZE]\n"
+      " [--app-cores NB_APP_CORES]\n"
+      " [--control-threads NB_THREADS]\n"
+      " [--rx-threads NB_THREADS]\n"
+      " [--tx-threads NB_THREADS]\n"
+      " [--core CORE_ID]\n"
+      " [--loopback]\n"
+      " [--huge-page-prefix PREFIX]\n"
+      " [--stats-delay STATS_DELAY]\n\n"
+
+      "  --help: Show this help and exit.\n"
+      "  --pcap: Replay packets from PCAP_FILE instead of generating them.\n"
+      "  --flows: Number of flows to generate (default: %d). Flow i is sent\n"
+      "           to 192.168.0.i, port %d.\n"
+      "  --pkt-size: Size of generated packets (default: %d).\n"
+      "  --rate: RX rate in millions of packets per second (default:\n"
+      "          unlimited).\n"
+      "  --burst: Number of packets delivered at once by each RX thread\n"
+      "           (default: %d).\n"
+      "  --app-cores: Number of application cores to serve (default: number\n"
+      "               of cores in the system).\n"
+      "  --control-threads: Threads serving applications (default: 1).\n"
+      "  --rx-threads: Threads delivering packets (default: 1). Use 0 to\n"
+      "                disable RX packet generation.\n"
+      "  --tx-threads: Threads consuming TX notifications (default: 1).\n"
+      "  --core: Pin threads to consecutive cores starting at CORE_ID.\n"
+      "  --loopback: Deliver transmitted packets to the RX path.\n"
+      "  --huge-page-prefix: Prefix used by the applications for huge page\n"
+      "                      files (default: %s).\n"
+      "  --stats-delay: Delay between displayed stats in milliseconds\n"
+      "                 (default: %d).\n",
+      program_name, DEFAULT_NB_FLOWS, DST_PORT, DEFAULT_PKT_SIZE,
+      enso::kBatchSize, std::string(enso::kHugePageDefaultPrefix).c_str(),
+      DEFAULT_STATS_DELAY);
+}
+
+#define CMD_OPT_HELP "help"
+#define CMD_OPT_PCAP "pcap"
+#define CMD_OPT_FLOWS "flows"
+#define CMD_OPT_PKT_SIZE "pkt-size"
+#define CMD_OPT_RATE "rate"
+#define CMD_OPT_BURST "burst"
+#define CMD_OPT_APP_CORES "app-cores"
+#define CMD_OPT_CONTROL_THREADS "control-threads"
+#define CMD_OPT_RX_THREADS "rx-threads"
+#define CMD_OPT_TX_THREADS "tx-threads"
+#define CMD_OPT_CORE "core"
+#define CMD_OPT_LOOPBACK "loopback"
+#define CMD_OPT_HUGE_PAGE_PREFIX "huge-page-prefix"
+#define CMD_OPT_STATS_DELAY "stats-delay"
+
+// Map long options to short options.
+enum {
+  CMD_OPT_HELP_NUM = 256,
+  CMD_OPT_PCAP_NUM,
+  CMD_OPT_FLOWS_NUM,
+  CMD_OPT_PKT_SIZE_NUM,
+  CMD_OPT_RATE_NUM,
+  CMD_OPT_BURST_NUM,
+  CMD_OPT_APP_CORES_NUM,
+  CMD_OPT_CONTROL_THREADS_NUM,
+  CMD_OPT_RX_THREADS_NUM,
+  CMD_OPT_TX_THREADS_NUM,
+  CMD_OPT_CORE_NUM,
+  CMD_OPT_LOOPBACK_NUM,
+  CMD_OPT_HUGE_PAGE_PREFIX_NUM,
+  CMD_OPT_STATS_DELAY_NUM
+};
+
+static const char short_options[] = "";
+
+static const struct option long_options[] = {
+    {CMD_OPT_HELP, no_argument, NULL, CMD_OPT_HELP_NUM},
+    {CMD_OPT_PCAP, required_argument, NULL, CMD_OPT_PCAP_NUM},
+    {CMD_OPT_FLOWS, required_argument, NULL, CMD_OPT_FLOWS_NUM},
+    {CMD_OPT_PKT_SIZE, required_argument, NULL, CMD_OPT_PKT_SIZE_NUM},
+    {CMD_OPT_RATE, required_argument, NULL, CMD_OPT_RATE_NUM},
+    {CMD_OPT_BURST, required_argument, NULL, CMD_OPT_BURST_NUM},
+    {CMD_OPT_APP_CORES, required_argument, NULL, CMD_OPT_APP_CORES_NUM},
+    {CMD_OPT_CONTROL_THREADS, required_argument, NULL,
+     CMD_OPT_CONTROL_THREADS_NUM},
+    {CMD_OPT_RX_THREADS, required_argument, NULL, CMD_OPT_RX_THREADS_NUM},
+    {CMD_OPT_TX_THREADS, required_argument, NULL, CMD_OPT_TX_THREADS_NUM},
+    {CMD_OPT_CORE, required_argument, NULL, CMD_OPT_CORE_NUM},
+    {CMD_OPT_LOOPBACK, no_argument, NULL, CMD_OPT_LOOPBACK_NUM},
+    {CMD_OPT_HUGE_PAGE_PREFIX, required_argument, NULL,
+     CMD_OPT_HUGE_PAGE_PREFIX_NUM},
+    {CMD_OPT_STATS_DELAY, required_argument, NULL, CMD_OPT_STATS_DELAY_NUM},
+    {0, 0, 0, 0}};
+
+struct parsed_args_t {
+  enso::emulator::EmulatorConfig config;
+  std::string pcap_file;
+  uint32_t nb_flows;
+  uint16_t pkt_size;
+  uint32_t stats_delay;
+};
+
+static int parse_args(int argc, char** argv,
+                      struct parsed_args_t& parsed_args) {
+  int opt;
+  int long_index;
+
+  parsed_args.config.nb_app_cores = std::thread::hardware_concurrency();
+  parsed_args.nb_flows = DEFAULT_NB_FLOWS;
+  parsed_args.pkt_size = DEFAULT_PKT_SIZE;
+  parsed_args.stats_delay = DEFAULT_STATS_DELAY;
+
+  while ((opt = getopt_long(argc, argv, short_options, long_options,
+                            &long_index)) != EOF) {
+    switch (opt) {
+      case CMD_OPT_HELP_NUM:
+        return 1;
+      case CMD_OPT_PCAP_NUM:
+        parsed_args.pcap_file = optarg;
+        break;
+      case CMD_OPT_FLOWS_NUM:
+        parsed_args.nb_flows = atoi(optarg);
+        break;
+      case CMD_OPT_PKT_SIZE_NUM:
+        parsed_args.pkt_size = atoi(optarg);
+        break;
+      case CMD_OPT_RATE_NUM:
+        parsed_args.config.rx_rate_mpps = atof(optarg);
+        break;
+      case CMD_OPT_BURST_NUM:
+        parsed_args.config.rx_burst_size = atoi(optarg);
+        break;
+      case CMD_OPT_APP_CORES_NUM:
+        parsed_args.config.nb_app_cores = atoi(optarg);
+        break;
+      case CMD_OPT_CONTROL_THREADS_NUM:
+        parsed_args.config.nb_control_threads = atoi(optarg);
+        break;
+      case CMD_OPT_RX_THREADS_NUM:
+        parsed_args.config.nb_rx_threads = atoi(optarg);
+        break;
+      case CMD_OPT_TX_THREADS_NUM:
+        parsed_args.config.nb_tx_threads = atoi(optarg);
+        break;
+      case CMD_OPT_CORE_NUM:
+        parsed_args.config.first_core = atoi(optarg);
+        break;
+      case CMD_OPT_LOOPBACK_NUM:
+        parsed_args.config.loopback = true;
+        break;
+      case CMD_OPT_HUGE_PAGE_PREFIX_NUM:
+        parsed_args.config.huge_page_prefix = optarg;
+        break;
+      case CMD_OPT_STATS_DELAY_NUM:
+        parsed_args.stats_delay = atoi(optarg);
+        break;
+      default:
+        return -1;
+    }
+  }
+
+  if (optind != argc) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  struct parsed_args_t parsed_args;
+  int ret = parse_args(argc, argv, parsed_args);
+  if (ret) {
+    print_usage(argv[0]);
+    if (ret == 1) {
+      return 0;
+    }
+    return 1;
+  }
+
+  std::unique_ptr<enso::emulator::PacketTrace> trace;
+  if (parsed_args.config.nb_rx_threads > 0) {
+    if (parsed_args.pcap_file.empty()) {
+      trace = enso::emulator::PacketTrace::CreateSynthetic(
+          parsed_args.nb_flows, parsed_args.pkt_size, BASE_DST_IP, DST_PORT);
+    } else {
+      trace =
+          enso::emulator::PacketTrace::CreateFromPcap(parsed_args.pcap_file);
+    }
+    if (trace == nullptr) {
+      std::cerr << "Could not create packet trace" << std::endl;
+      return 2;
+    }
+  }
+
+  std::unique_ptr<enso::emulator::NicEmulator> emulator =
+      enso::emulator::NicEmulator::Create(parsed_args.config, std::move(trace));
+  if (emulator == nullptr) {
+    std::cerr << "Could not create emulator" << std::endl;
+    return 3;
+  }
+
+  signal(SIGINT, int_handler);
+
+  if (emulator->Start()) {
+    std::cerr << "Could not start emulator" << std::endl;
+    return 4;
+  }
+
+  std::cout << "Emulator running. Press Ctrl+C to stop." << std::endl;
+
+  enso::emulator::EmulatorStats last_stats = emulator->GetStats();
+  auto last_time = std::chrono::steady_clock::now();
+
+  while (keep_running) {
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(parsed_args.stats_delay));
+
+    enso::emulator::EmulatorStats stats = emulator->GetStats();
+    auto now = std::chrono::steady_clock::now();
+    double interval_s = std::chrono::duration<double>(now - last_time).count();
+
+    double rx_mpps = (stats.rx_pkts - last_stats.rx_pkts) / interval_s / 1e6;
+    double rx_gbps =
+        (stats.rx_bytes - last_stats.rx_bytes) * 8 / interval_s / 1e9;
+    double tx_mpps = (stats.tx_pkts - last_stats.tx_pkts) / interval_s / 1e6;
+    double tx_gbps =
+        (stats.tx_bytes - last_stats.tx_bytes) * 8 / interval_s / 1e9;
+
+    std::cout << std::dec << "RX: " << rx_mpps << " Mpps, " << rx_gbps
+              << " Gbps (no pipe: "
+              << stats.rx_no_pipe_drops - last_stats.rx_no_pipe_drops
+              << ", full: " << stats.rx_full_drops - last_stats.rx_full_drops
+              << ", notif: "
+              << stats.rx_notifications - last_stats.rx_notifications
+              << ")  TX: " << tx_mpps << " Mpps, " << tx_gbps
+              << " Gbps (notif: "
+              << stats.tx_notifications - last_stats.tx_notifications
+              << ", config: "
+              << stats.config_notifications - last_stats.config_notifications
+              << ")  MMIO: " << stats.mmio_writes - last_stats.mmio_writes
+              << " W (msgs: "
+              << stats.mmio_write_msgs - last_stats.mmio_write_msgs
+              << ", coalesced: "
+              << stats.mmio_coalesced_writes - last_stats.mmio_coalesced_writes
+              << "), " << stats.mmio_reads - last_stats.mmio_reads << " R"
+              << std::endl;
+
+    last_stats = stats;
+    last_time = now;
+  }
+
+  emulator->Stop();
+
+  return 0;
+}
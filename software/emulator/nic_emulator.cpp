@@ -0,0 +1,1215 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Implementation of the NIC emulator. @see nic_emulator.h
+ */
+
+#include "nic_emulator.h"
+
+#include <endian.h>
+#include <enso/helpers.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+namespace enso {
+namespace emulator {
+
+static constexpr uint32_t kRxTailReg =
+    offsetof(struct QueueRegs, rx_tail) / sizeof(uint32_t);
+static constexpr uint32_t kRxHeadReg =
+    offsetof(struct QueueRegs, rx_head) / sizeof(uint32_t);
+static constexpr uint32_t kRxMemLowReg =
+    offsetof(struct QueueRegs, rx_mem_low) / sizeof(uint32_t);
+static constexpr uint32_t kRxMemHighReg =
+    offsetof(struct QueueRegs, rx_mem_high) / sizeof(uint32_t);
+static constexpr uint32_t kRxSizeReg =
+    offsetof(struct QueueRegs, rx_size) / sizeof(uint32_t);
+static constexpr uint32_t kTxTailReg =
+    offsetof(struct QueueRegs, tx_tail) / sizeof(uint32_t);
+static constexpr uint32_t kTxHeadReg =
+    offsetof(struct QueueRegs, tx_head) / sizeof(uint32_t);
+static constexpr uint32_t kTxMemLowReg =
+    offsetof(struct QueueRegs, tx_mem_low) / sizeof(uint32_t);
+static constexpr uint32_t kTxMemHighReg =
+    offsetof(struct QueueRegs, tx_mem_high) / sizeof(uint32_t);
+
+// The least significant bits of the pipe address carry the notification
+// buffer ID.
+static constexpr uint64_t kNotifBufIdMask = kMaxNbApps - 1;
+
+// Interval between maintenance operations (e.g., unmapping huge pages that
+// applications removed).
+static constexpr std::chrono::milliseconds kMaintenanceInterval(100);
+
+// Counters have a single writer, so there is no need for an atomic increment.
+static inline void inc(std::atomic<uint64_t>& counter, uint64_t value = 1) {
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+}
+
+static inline double now_ns() {
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static inline uint32_t timestamp_cycles() {
+  return (uint64_t)now_ns() / kNsPerTimestampCycle;
+}
+
+std::unique_ptr<NicEmulator> NicEmulator::Create(
+    const EmulatorConfig& config, std::unique_ptr<PacketTrace> trace) noexcept {
+  std::unique_ptr<NicEmulator> emulator(
+      new (std::nothrow) NicEmulator(config, std::move(trace)));
+
+  if (unlikely(!emulator)) {
+    return nullptr;
+  }
+
+  if (emulator->Init()) {
+    return nullptr;
+  }
+
+  return emulator;
+}
+
+int NicEmulator::Init() noexcept {
+  if (config_.nb_app_cores == 0 || config_.nb_control_threads == 0) {
+    std::cerr << "Need at least one application core and control thread"
+              << std::endl;
+    return -1;
+  }
+
+  if (config_.nb_rx_threads > 0 && (trace_ == nullptr || trace_->size() == 0)) {
+    std::cerr << "RX threads require a packet trace" << std::endl;
+    return -1;
+  }
+
+  if (config_.rx_burst_size == 0 || config_.rx_burst_size > kMaxBurstSize) {
+    std::cerr << "RX burst size must be between 1 and " << kMaxBurstSize
+              << std::endl;
+    return -1;
+  }
+
+  host_memory_ = HostMemory::Create(config_.huge_page_prefix);
+  if (host_memory_ == nullptr) {
+    std::cerr << "Could not access huge pages" << std::endl;
+    return -1;
+  }
+
+  flow_table_ = FlowTable::Create();
+  if (flow_table_ == nullptr) {
+    return -1;
+  }
+
+  regs_.reset(new (std::nothrow) std::atomic<uint32_t>[(
+      kMaxNbFlows + kMaxNbApps) * kRegsPerQueue]());
+  pipes_.reset(new (std::nothrow) PipeState[kMaxNbFlows]);
+  notif_bufs_.reset(new (std::nothrow) NotifBufState[kMaxNbApps]);
+
+  nb_workers_ = config_.nb_control_threads + config_.nb_rx_threads +
+                config_.nb_tx_threads;
+  worker_states_.reset(new (std::nothrow) WorkerState[nb_workers_]);
+
+  if (!regs_ || !pipes_ || !notif_bufs_ || !worker_states_) {
+    std::cerr << "Could not allocate memory" << std::endl;
+    return -1;
+  }
+
+  if (config_.loopback) {
+    for (uint32_t i = 0; i < nb_workers_; ++i) {
+      worker_states_[i].loopback_buf.reset(new (
+          std::nothrow) uint8_t[kMaxBurstSize * kMaxLoopbackPktSize]);
+      if (!worker_states_[i].loopback_buf) {
+        std::cerr << "Could not allocate memory" << std::endl;
+        return -1;
+      }
+    }
+  }
+
+  for (uint32_t core_id = 0; core_id < config_.nb_app_cores; ++core_id) {
+    std::string queue_to_app_name =
+        std::string(kIpcQueueToAppName) + std::to_string(core_id) + "_";
+    std::string queue_from_app_name =
+        std::string(kIpcQueueFromAppName) + std::to_string(core_id) + "_";
+
+    auto queue_from_app = QueueConsumer<PipeNotification>::Create(
+        queue_from_app_name, 0, true, config_.huge_page_prefix);
+    if (queue_from_app == nullptr) {
+      std::cerr << "Could not create queue from app" << std::endl;
+      return -1;
+    }
+
+    auto queue_to_app = QueueProducer<PipeNotification>::Create(
+        queue_to_app_name, 0, true, config_.huge_page_prefix);
+    if (queue_to_app == nullptr) {
+      std::cerr << "Could not create queue to app" << std::endl;
+      return -1;
+    }
+
+    queues_from_app_.push_back(std::move(queue_from_app));
+    queues_to_app_.push_back(std::move(queue_to_app));
+  }
+
+  return 0;
+}
+
+NicEmulator::~NicEmulator() noexcept { Stop(); }
+
+int NicEmulator::Start() noexcept {
+  if (running_.exchange(true)) {
+    return -1;
+  }
+
+  uint32_t worker_id = 0;
+  auto launch = [this, &worker_id](auto&& function) {
+    threads_.emplace_back(function);
+    if (config_.first_core >= 0) {
+      set_core_id(threads_.back(), config_.first_core + worker_id);
+    }
+    ++worker_id;
+  };
+
+  for (uint32_t i = 0; i < config_.nb_control_threads; ++i) {
+    launch([this, i] { ControlThread(i); });
+  }
+
+  for (uint32_t i = 0; i < config_.nb_rx_threads; ++i) {
+    launch([this, i] { RxThread(i); });
+  }
+
+  for (uint32_t i = 0; i < config_.nb_tx_threads; ++i) {
+    launch([this, i] { TxThread(i); });
+  }
+
+  return 0;
+}
+
+void NicEmulator::Stop() noexcept {
+  running_ = false;
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+}
+
+EmulatorStats NicEmulator::GetStats() const noexcept {
+  EmulatorStats stats = {};
+  for (uint32_t i = 0; i < nb_workers_; ++i) {
+    const WorkerState& state = worker_states_[i];
+    stats.rx_pkts += state.rx_pkts.load(std::memory_order_relaxed);
+    stats.rx_bytes += state.rx_bytes.load(std::memory_order_relaxed);
+    stats.rx_no_pipe_drops +=
+        state.rx_no_pipe_drops.load(std::memory_order_relaxed);
+    stats.rx_full_drops += state.rx_full_drops.load(std::memory_order_relaxed);
+    stats.rx_notifications +=
+        state.rx_notifications.load(std::memory_order_relaxed);
+    stats.notif_buf_full +=
+        state.notif_buf_full.load(std::memory_order_relaxed);
+    stats.tx_pkts += state.tx_pkts.load(std::memory_order_relaxed);
+    stats.tx_bytes += state.tx_bytes.load(std::memory_order_relaxed);
+    stats.tx_notifications +=
+        state.tx_notifications.load(std::memory_order_relaxed);
+    stats.config_notifications +=
+        state.config_notifications.load(std::memory_order_relaxed);
+    stats.mmio_writes += state.mmio_writes.load(std::memory_order_relaxed);
+    stats.mmio_coalesced_writes +=
+        state.mmio_coalesced_writes.load(std::memory_order_relaxed);
+    stats.mmio_write_msgs +=
+        state.mmio_write_msgs.load(std::memory_order_relaxed);
+    stats.mmio_reads += state.mmio_reads.load(std::memory_order_relaxed);
+  }
+  stats.flow_table_evictions = flow_table_->eviction_count();
+  return stats;
+}
+
+// Control path.
+
+void NicEmulator::ControlThread(uint32_t thread_id) noexcept {
+  WorkerState* state = &worker_states_[thread_id];
+  auto next_maintenance = std::chrono::steady_clock::now();
+
+  while (running_.load(std::memory_order_relaxed)) {
+    PublishEpoch(state);
+
+    bool idle = true;
+    for (uint32_t core_id = thread_id; core_id < config_.nb_app_cores;
+         core_id += config_.nb_control_threads) {
+      QueueConsumer<PipeNotification>* queue_from_app =
+          queues_from_app_[core_id].get();
+      QueueProducer<PipeNotification>* queue_to_app =
+          queues_to_app_[core_id].get();
+
+      for (uint32_t i = 0; i < kBatchSize; ++i) {
+        std::optional<PipeNotification> notification = queue_from_app->Pop();
+        if (!notification) {
+          break;
+        }
+        idle = false;
+
+        if (!HandleRequest(&notification.value(), state)) {
+          continue;
+        }
+
+        while (queue_to_app->Push(notification.value()) != 0) {
+          if (!running_.load(std::memory_order_relaxed)) {
+            return;
+          }
+        }
+      }
+    }
+
+    if (thread_id == 0) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= next_maintenance) {
+        Maintenance();
+        next_maintenance = now + kMaintenanceInterval;
+      }
+    }
+
+    if (idle) {
+      _mm_pause();
+    }
+  }
+}
+
+bool NicEmulator::HandleRequest(struct PipeNotification* notification,
+                                WorkerState* state) noexcept {
+  switch (notification->type) {
+    case NotifType::kWrite: {
+      struct MmioNotification* request =
+          (struct MmioNotification*)notification;
+      WriteRegister(request->address, (uint32_t)request->value);
+      inc(state->mmio_writes);
+      inc(state->mmio_write_msgs);
+      return false;  // Writes are posted.
+    }
+    case NotifType::kWriteBatch: {
+      struct MmioBatchNotification* request =
+          (struct MmioBatchNotification*)notification;
+      uint32_t nb_writes = std::min(request->nb_writes, kMaxMmioBatchSize);
+      for (uint32_t i = 0; i < nb_writes; ++i) {
+        WriteRegister(request->writes[i].address, request->writes[i].value);
+      }
+      inc(state->mmio_writes, nb_writes);
+      inc(state->mmio_coalesced_writes, request->nb_coalesced);
+      inc(state->mmio_write_msgs);
+      return false;  // Writes are posted.
+    }
+    case NotifType::kRead: {
+      struct MmioNotification* request =
+          (struct MmioNotification*)notification;
+      request->value = ReadRegister(request->address);
+      inc(state->mmio_reads);
+      return true;
+    }
+    case NotifType::kTranslAddr: {
+      struct MmioNotification* request =
+          (struct MmioNotification*)notification;
+      request->value = host_memory_->Translate(request->address);
+      if (request->value == 0) {
+        std::cerr << "Could not translate address 0x" << std::hex
+                  << request->address << std::dec << std::endl;
+      }
+      return true;
+    }
+    case NotifType::kAllocatePipe: {
+      struct AllocatePipeNotification* request =
+          (struct AllocatePipeNotification*)notification;
+      request->pipe_id = (int64_t)AllocatePipe(request->fallback);
+      return true;
+    }
+    case NotifType::kAllocateNotifBuf: {
+      struct NotifBufNotification* request =
+          (struct NotifBufNotification*)notification;
+      request->notif_buf_id = (int64_t)AllocateNotifBuf();
+      return true;
+    }
+    case NotifType::kGetNbFallbackQueues: {
+      struct FallbackNotification* request =
+          (struct FallbackNotification*)notification;
+      std::lock_guard<std::mutex> lock(alloc_mutex_);
+      request->nb_fallback_queues = nb_fallback_pipes_;
+      request->result = 0;
+      return true;
+    }
+    case NotifType::kSetRrStatus: {
+      struct RoundRobinNotification* request =
+          (struct RoundRobinNotification*)notification;
+      std::lock_guard<std::mutex> lock(alloc_mutex_);
+      round_robin_ = request->round_robin;
+      request->result = 0;
+      return true;
+    }
+    case NotifType::kGetRrStatus: {
+      struct RoundRobinNotification* request =
+          (struct RoundRobinNotification*)notification;
+      std::lock_guard<std::mutex> lock(alloc_mutex_);
+      request->round_robin = round_robin_;
+      request->result = 0;
+      return true;
+    }
+    case NotifType::kFreeNotifBuf: {
+      struct NotifBufNotification* request =
+          (struct NotifBufNotification*)notification;
+      request->result = (int64_t)FreeNotifBuf(request->notif_buf_id);
+      return true;
+    }
+    case NotifType::kFreePipe: {
+      struct FreePipeNotification* request =
+          (struct FreePipeNotification*)notification;
+      request->result = (int64_t)FreePipe(request->pipe_id);
+      return true;
+    }
+  }
+
+  std::cerr << "Unknown request type: " << (int)notification->type
+            << std::endl;
+  return false;
+}
+
+uint32_t NicEmulator::ReadRegister(uint64_t address) noexcept {
+  uint64_t queue = address / kMemorySpacePerQueue;
+  uint32_t reg = (address % kMemorySpacePerQueue) / sizeof(uint32_t);
+
+  if (unlikely(queue >= kMaxNbFlows + kMaxNbApps)) {
+    std::cerr << "Invalid register read: 0x" << std::hex << address
+              << std::dec << std::endl;
+    return 0;
+  }
+
+  return Reg(queue, reg).load(std::memory_order_acquire);
+}
+
+void NicEmulator::WriteRegister(uint64_t address, uint32_t value) noexcept {
+  uint64_t queue = address / kMemorySpacePerQueue;
+  uint32_t reg = (address % kMemorySpacePerQueue) / sizeof(uint32_t);
+
+  if (unlikely(queue >= kMaxNbFlows + kMaxNbApps)) {
+    std::cerr << "Invalid register write: 0x" << std::hex << address
+              << std::dec << std::endl;
+    return;
+  }
+
+  if (queue < kMaxNbFlows) {
+    WritePipeRegister(queue, reg, value);
+  } else {
+    WriteNotifBufRegister(queue - kMaxNbFlows, reg, value);
+  }
+}
+
+void NicEmulator::DisablePipe(uint32_t pipe_id) noexcept {
+  PipeState* pipe = &pipes_[pipe_id];
+  NotifBufState* notif_buf = &notif_bufs_[pipe->notif_buf_id];
+  std::lock_guard<SpinLock> lock(notif_buf->lock);
+  pipe->buf.store(nullptr, std::memory_order_release);
+}
+
+void NicEmulator::WritePipeRegister(uint32_t pipe_id, uint32_t reg,
+                                    uint32_t value) noexcept {
+  PipeState* pipe = &pipes_[pipe_id];
+
+  switch (reg) {
+    case kRxTailReg: {
+      NotifBufState* notif_buf = &notif_bufs_[pipe->notif_buf_id];
+      std::lock_guard<SpinLock> lock(notif_buf->lock);
+      pipe->tail = value & pipe->size_mask;
+      Reg(pipe_id, reg).store(pipe->tail, std::memory_order_release);
+      return;
+    }
+    case kRxHeadReg: {
+      uint32_t notif_buf_id = pipe->notif_buf_id;
+      NotifBufState* notif_buf = &notif_bufs_[notif_buf_id];
+      std::lock_guard<SpinLock> lock(notif_buf->lock);
+      Reg(pipe_id, reg).store(value, std::memory_order_release);
+
+      // Writing the same head again is how applications ask for a new
+      // notification with the latest tail (see `prefetch_pipe`).
+      bool prefetch = value == pipe->last_head;
+      pipe->last_head = value;
+
+      if (prefetch && pipe->buf.load(std::memory_order_relaxed) != nullptr &&
+          pipe->tail != value && !pipe->notification_pending) {
+        pipe->notification_pending = true;
+        notif_buf->pending_pipes.push_back(pipe_id);
+        FlushNotifications(notif_buf_id, notif_buf, nullptr);
+      }
+      return;
+    }
+    case kRxMemLowReg:
+      Reg(pipe_id, reg).store(value, std::memory_order_release);
+      if (value == 0) {
+        DisablePipe(pipe_id);
+      }
+      return;
+    case kRxMemHighReg: {
+      Reg(pipe_id, reg).store(value, std::memory_order_release);
+      uint64_t low = Reg(pipe_id, kRxMemLowReg).load(std::memory_order_relaxed);
+      uint64_t addr = ((uint64_t)value << 32) | low;
+      DisablePipe(pipe_id);
+      if (addr == 0) {
+        return;
+      }
+
+      // Setting the address enables the pipe.
+      uint32_t notif_buf_id = addr & kNotifBufIdMask;
+      NotifBufState* notif_buf = &notif_bufs_[notif_buf_id];
+      std::lock_guard<SpinLock> lock(notif_buf->lock);
+
+      // Applications that do not set the size use the default one.
+      uint32_t size = Reg(pipe_id, kRxSizeReg).load(std::memory_order_relaxed);
+      if (size == 0 || (size & (size - 1)) || size > kMaxPipeBufSize / 64) {
+        size = kEnsoPipeSize;
+      }
+
+      pipe->notif_buf_id = notif_buf_id;
+      pipe->size_mask = size - 1;
+      pipe->tail = Reg(pipe_id, kRxTailReg).load(std::memory_order_relaxed) &
+                   pipe->size_mask;
+      pipe->last_head =
+          Reg(pipe_id, kRxHeadReg).load(std::memory_order_relaxed);
+      pipe->notification_pending = false;
+      pipe->buf.store((uint8_t*)(addr & ~kNotifBufIdMask),
+                      std::memory_order_release);
+      return;
+    }
+    default:
+      Reg(pipe_id, reg).store(value, std::memory_order_release);
+      return;
+  }
+}
+
+void NicEmulator::WriteNotifBufRegister(uint32_t notif_buf_id, uint32_t reg,
+                                        uint32_t value) noexcept {
+  NotifBufState* notif_buf = &notif_bufs_[notif_buf_id];
+  uint32_t queue = notif_buf_id + kMaxNbFlows;
+  uint64_t tx_enabled_mask = 1UL << (notif_buf_id % 64);
+  std::atomic<uint64_t>& tx_enabled = tx_enabled_[notif_buf_id / 64];
+
+  switch (reg) {
+    case kRxTailReg: {
+      std::lock_guard<SpinLock> lock(notif_buf->lock);
+      notif_buf->rx_tail = value % kNotificationBufSize;
+      Reg(queue, reg).store(notif_buf->rx_tail, std::memory_order_release);
+      return;
+    }
+    case kRxHeadReg: {
+      std::lock_guard<SpinLock> lock(notif_buf->lock);
+      Reg(queue, reg).store(value, std::memory_order_release);
+
+      // The application freed space in the notification buffer, we may now be
+      // able to send notifications that were pending.
+      if (!notif_buf->pending_pipes.empty()) {
+        FlushNotifications(notif_buf_id, notif_buf, nullptr);
+      }
+      return;
+    }
+    case kRxMemLowReg:
+    case kRxMemHighReg: {
+      Reg(queue, reg).store(value, std::memory_order_release);
+      uint64_t addr =
+          ((uint64_t)Reg(queue, kRxMemHighReg).load(std::memory_order_relaxed)
+           << 32) |
+          Reg(queue, kRxMemLowReg).load(std::memory_order_relaxed);
+
+      std::lock_guard<SpinLock> lock(notif_buf->lock);
+      if (reg == kRxMemLowReg || addr == 0) {
+        notif_buf->rx_buf.store(nullptr, std::memory_order_release);
+        return;
+      }
+      notif_buf->rx_tail =
+          Reg(queue, kRxTailReg).load(std::memory_order_relaxed);
+      notif_buf->rx_buf.store((struct RxNotification*)addr,
+                              std::memory_order_release);
+      return;
+    }
+    case kTxHeadReg:
+      // The TX thread owns the head while TX is enabled.
+      if (notif_buf->tx_buf.load(std::memory_order_acquire) == nullptr) {
+        notif_buf->tx_head = value % kNotificationBufSize;
+        Reg(queue, reg).store(notif_buf->tx_head, std::memory_order_release);
+      }
+      return;
+    case kTxMemLowReg:
+    case kTxMemHighReg: {
+      Reg(queue, reg).store(value, std::memory_order_release);
+      uint64_t addr =
+          ((uint64_t)Reg(queue, kTxMemHighReg).load(std::memory_order_relaxed)
+           << 32) |
+          Reg(queue, kTxMemLowReg).load(std::memory_order_relaxed);
+
+      if (reg == kTxMemLowReg || addr == 0) {
+        tx_enabled.fetch_and(~tx_enabled_mask, std::memory_order_release);
+        notif_buf->tx_buf.store(nullptr, std::memory_order_release);
+        return;
+      }
+      notif_buf->tx_missing_bytes = 0;
+      notif_buf->reassembly_len = 0;
+      notif_buf->tx_buf.store((struct TxNotification*)addr,
+                              std::memory_order_release);
+      tx_enabled.fetch_or(tx_enabled_mask, std::memory_order_release);
+      return;
+    }
+    default:
+      Reg(queue, reg).store(value, std::memory_order_release);
+      return;
+  }
+}
+
+int NicEmulator::AllocatePipe(bool fallback) noexcept {
+  std::lock_guard<std::mutex> lock(alloc_mutex_);
+
+  // Same policy as the kernel driver: fallback pipes are allocated
+  // contiguously at the front, other pipes at the back.
+  int pipe_id = -1;
+  if (fallback) {
+    for (uint32_t i = 0; i < kMaxNbFlows; ++i) {
+      if (!pipe_status_[i]) {
+        pipe_id = i;
+        break;
+      }
+    }
+    if (pipe_id < 0 || (uint32_t)pipe_id != nb_fallback_pipes_) {
+      std::cerr << "Could not allocate contiguous fallback pipe" << std::endl;
+      return -1;
+    }
+    ++nb_fallback_pipes_;
+  } else {
+    for (int32_t i = kMaxNbFlows - 1; i >= 0; --i) {
+      if (!pipe_status_[i]) {
+        pipe_id = i;
+        break;
+      }
+    }
+    if (pipe_id < 0) {
+      std::cerr << "Could not allocate pipe" << std::endl;
+      return -1;
+    }
+  }
+
+  pipe_status_[pipe_id] = true;
+
+  return pipe_id;
+}
+
+int NicEmulator::FreePipe(uint32_t pipe_id) noexcept {
+  std::lock_guard<std::mutex> lock(alloc_mutex_);
+
+  if (pipe_id >= kMaxNbFlows || !pipe_status_[pipe_id]) {
+    return -1;
+  }
+
+  pipe_status_[pipe_id] = false;
+  Reg(pipe_id, kRxSizeReg).store(0, std::memory_order_relaxed);
+
+  if (pipe_id < nb_fallback_pipes_) {
+    --nb_fallback_pipes_;
+  }
+
+  return 0;
+}
+
+int NicEmulator::AllocateNotifBuf() noexcept {
+  std::lock_guard<std::mutex> lock(alloc_mutex_);
+
+  for (uint32_t i = 0; i < kMaxNbApps; ++i) {
+    if (!notif_buf_status_[i]) {
+      notif_buf_status_[i] = true;
+      return i;
+    }
+  }
+
+  std::cerr << "Could not allocate notification buffer" << std::endl;
+  return -1;
+}
+
+int NicEmulator::FreeNotifBuf(uint32_t notif_buf_id) noexcept {
+  std::lock_guard<std::mutex> lock(alloc_mutex_);
+
+  if (notif_buf_id >= kMaxNbApps) {
+    return -1;
+  }
+
+  notif_buf_status_[notif_buf_id] = false;
+
+  return 0;
+}
+
+void NicEmulator::Maintenance() noexcept {
+  uint64_t epoch = global_epoch_.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+  host_memory_->Rescan(epoch);
+
+  // Files retired before every thread observed a newer epoch may still be in
+  // use.
+  PublishEpoch(&worker_states_[0]);
+  uint64_t safe_epoch = epoch;
+  for (uint32_t i = 0; i < nb_workers_; ++i) {
+    safe_epoch = std::min(
+        safe_epoch, worker_states_[i].epoch.load(std::memory_order_acquire));
+  }
+
+  host_memory_->ReleaseRetired(safe_epoch);
+}
+
+// RX path.
+
+void NicEmulator::RxThread(uint32_t thread_id) noexcept {
+  WorkerState* state = &worker_states_[config_.nb_control_threads + thread_id];
+
+  const uint32_t trace_size = trace_->size();
+  const uint32_t burst_size = config_.rx_burst_size;
+  uint32_t next_pkt = (uint64_t)trace_size * thread_id / config_.nb_rx_threads;
+
+  double ns_per_pkt = 0;
+  if (config_.rx_rate_mpps > 0) {
+    ns_per_pkt = 1e3 * config_.nb_rx_threads / config_.rx_rate_mpps;
+  }
+  double next_burst_time = now_ns();
+
+  const uint8_t* pkts[kMaxBurstSize];
+  uint16_t lens[kMaxBurstSize];
+
+  while (running_.load(std::memory_order_relaxed)) {
+    PublishEpoch(state);
+
+    if (ns_per_pkt > 0) {
+      double now = now_ns();
+      if (now < next_burst_time) {
+        _mm_pause();
+        continue;
+      }
+      // Do not try to catch up after long pauses.
+      next_burst_time =
+          std::max(next_burst_time, now - 1e6) + ns_per_pkt * burst_size;
+    }
+
+    for (uint32_t i = 0; i < burst_size; ++i) {
+      pkts[i] = trace_->pkt(next_pkt);
+      lens[i] = trace_->len(next_pkt);
+      next_pkt = (next_pkt + 1 == trace_size) ? 0 : next_pkt + 1;
+    }
+
+    DeliverBurst(pkts, lens, burst_size, state);
+  }
+}
+
+int32_t NicEmulator::Steer(const uint8_t* pkt, uint16_t len,
+                           WorkerState* state) noexcept {
+  FlowTuple tuple = parse_flow_tuple(pkt, len);
+  uint32_t hash0;
+
+  int32_t pipe_id = flow_table_->Lookup(tuple, &hash0);
+  if (pipe_id >= 0) {
+    return pipe_id;
+  }
+
+  // Packets that do not match any entry in the flow table are sent to a
+  // fallback pipe. If there are no fallback pipes, the packet is dropped.
+  if (nb_fallback_queues_.load(std::memory_order_relaxed) == 0) {
+    return -1;
+  }
+
+  uint32_t mask = fallback_queue_mask_.load(std::memory_order_relaxed);
+  if (enable_rr_.load(std::memory_order_relaxed)) {
+    pipe_id = state->next_rr_queue & mask;
+    state->next_rr_queue = (state->next_rr_queue + 1) & mask;
+  } else {
+    pipe_id = hash0 & mask;
+  }
+
+  return pipe_id;
+}
+
+bool NicEmulator::CopyToPipe(PipeState* pipe, uint8_t* buf, uint32_t pipe_id,
+                             const uint8_t* pkt, uint16_t len) noexcept {
+  uint32_t head = Reg(pipe_id, kRxHeadReg).load(std::memory_order_acquire);
+  uint32_t tail = pipe->tail;
+  uint32_t nb_flits = (len - 1) / kCacheLineSize + 1;
+  uint32_t size_mask = pipe->size_mask;
+  uint32_t free_flits = (head - tail - 1) & size_mask;
+
+  if (unlikely(nb_flits > free_flits)) {
+    return false;
+  }
+
+  uint8_t* dst = buf + tail * kCacheLineSize;
+  uint32_t contiguous_bytes = (size_mask + 1 - tail) * kCacheLineSize;
+
+  if (likely(len <= contiguous_bytes)) {
+    memcpy(dst, pkt, len);
+  } else {
+    memcpy(dst, pkt, contiguous_bytes);
+    memcpy(buf, pkt + contiguous_bytes, len - contiguous_bytes);
+  }
+
+  if (timestamp_enabled_.load(std::memory_order_relaxed)) {
+    // The timestamp offset is always within the first flit, which is never
+    // split.
+    uint8_t offset = timestamp_offset_.load(std::memory_order_relaxed);
+    if (offset + sizeof(uint32_t) <= len) {
+      uint32_t* timestamp = (uint32_t*)(dst + offset);
+      uint32_t rtt = timestamp_cycles() - be32toh(*timestamp);
+      *timestamp = htobe32(rtt);
+    }
+  }
+
+  pipe->tail = (tail + nb_flits) & size_mask;
+  Reg(pipe_id, kRxTailReg).store(pipe->tail, std::memory_order_relaxed);
+
+  return true;
+}
+
+void NicEmulator::FlushNotifications(uint32_t notif_buf_id,
+                                     NotifBufState* notif_buf,
+                                     WorkerState* state) noexcept {
+  std::vector<uint32_t>& pending_pipes = notif_buf->pending_pipes;
+  struct RxNotification* rx_buf =
+      notif_buf->rx_buf.load(std::memory_order_acquire);
+
+  if (unlikely(rx_buf == nullptr)) {
+    for (uint32_t pipe_id : pending_pipes) {
+      pipes_[pipe_id].notification_pending = false;
+    }
+    pending_pipes.clear();
+    return;
+  }
+
+  uint32_t queue = notif_buf_id + kMaxNbFlows;
+  uint32_t head = Reg(queue, kRxHeadReg).load(std::memory_order_acquire);
+  uint32_t tail = notif_buf->rx_tail;
+  uint32_t nb_sent = 0;
+  uint32_t i = 0;
+
+  for (; i < pending_pipes.size(); ++i) {
+    if (unlikely((tail + 1) % kNotificationBufSize == head)) {
+      if (state != nullptr) {
+        inc(state->notif_buf_full);
+      }
+      break;
+    }
+
+    uint32_t pipe_id = pending_pipes[i];
+    PipeState* pipe = &pipes_[pipe_id];
+    pipe->notification_pending = false;
+
+    // The pipe may have been disabled or moved to another notification buffer
+    // after the notification became pending.
+    if (pipe->buf.load(std::memory_order_relaxed) == nullptr ||
+        pipe->notif_buf_id.load(std::memory_order_relaxed) != notif_buf_id) {
+      continue;
+    }
+
+    struct RxNotification* notification = rx_buf + tail;
+    notification->queue_id = pipe_id;
+    notification->tail = pipe->tail;
+
+    // Make sure the data and the notification are visible before the signal.
+    // Applications that are about to sleep mark the signal and must be woken
+    // up, the exchange guarantees that we do not miss the mark.
+    uint64_t* signal = (uint64_t*)(rx_buf + tail);  // Signal comes first.
+    uint64_t prev_signal = __atomic_exchange_n(signal, 1, __ATOMIC_RELEASE);
+    if (unlikely(prev_signal == kSignalWaiting)) {
+      futex_wake((volatile uint32_t*)signal);
+    }
+
+    tail = (tail + 1) % kNotificationBufSize;
+    ++nb_sent;
+  }
+
+  pending_pipes.erase(pending_pipes.begin(), pending_pipes.begin() + i);
+
+  notif_buf->rx_tail = tail;
+  Reg(queue, kRxTailReg).store(tail, std::memory_order_relaxed);
+
+  if (state != nullptr) {
+    inc(state->rx_notifications, nb_sent);
+  }
+}
+
+void NicEmulator::DeliverBurst(const uint8_t* const* pkts, const uint16_t* lens,
+                               uint32_t nb_pkts, WorkerState* state) noexcept {
+  int32_t pipe_ids[kMaxBurstSize];
+  uint32_t notif_buf_ids[kMaxBurstSize];
+  uint32_t distinct_notif_buf_ids[kMaxBurstSize];
+  uint32_t nb_distinct_notif_bufs = 0;
+  uint32_t nb_no_pipe_drops = 0;
+
+  for (uint32_t i = 0; i < nb_pkts; ++i) {
+    int32_t pipe_id = Steer(pkts[i], lens[i], state);
+    if (unlikely(pipe_id < 0 || (uint32_t)pipe_id >= kMaxNbFlows ||
+                 pipes_[pipe_id].buf.load(std::memory_order_relaxed) ==
+                     nullptr)) {
+      pipe_ids[i] = -1;
+      ++nb_no_pipe_drops;
+      continue;
+    }
+    pipe_ids[i] = pipe_id;
+
+    uint32_t notif_buf_id =
+        pipes_[pipe_id].notif_buf_id.load(std::memory_order_relaxed);
+    notif_buf_ids[i] = notif_buf_id;
+
+    bool found = false;
+    for (uint32_t j = 0; j < nb_distinct_notif_bufs; ++j) {
+      if (distinct_notif_buf_ids[j] == notif_buf_id) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      distinct_notif_buf_ids[nb_distinct_notif_bufs++] = notif_buf_id;
+    }
+  }
+
+  uint64_t nb_delivered_pkts = 0;
+  uint64_t nb_delivered_bytes = 0;
+  uint64_t nb_full_drops = 0;
+
+  // Take each notification buffer lock once per burst.
+  for (uint32_t j = 0; j < nb_distinct_notif_bufs; ++j) {
+    uint32_t notif_buf_id = distinct_notif_buf_ids[j];
+    NotifBufState* notif_buf = &notif_bufs_[notif_buf_id];
+    std::lock_guard<SpinLock> lock(notif_buf->lock);
+
+    for (uint32_t i = 0; i < nb_pkts; ++i) {
+      if (pipe_ids[i] < 0 || notif_buf_ids[i] != notif_buf_id) {
+        continue;
+      }
+
+      uint32_t pipe_id = pipe_ids[i];
+      PipeState* pipe = &pipes_[pipe_id];
+      uint8_t* buf = pipe->buf.load(std::memory_order_acquire);
+
+      if (unlikely(buf == nullptr ||
+                   pipe->notif_buf_id.load(std::memory_order_relaxed) !=
+                       notif_buf_id)) {
+        ++nb_no_pipe_drops;
+        continue;
+      }
+
+      if (unlikely(!CopyToPipe(pipe, buf, pipe_id, pkts[i], lens[i]))) {
+        ++nb_full_drops;
+        continue;
+      }
+
+      ++nb_delivered_pkts;
+      nb_delivered_bytes += lens[i];
+
+      if (!pipe->notification_pending) {
+        pipe->notification_pending = true;
+        notif_buf->pending_pipes.push_back(pipe_id);
+      }
+    }
+
+    FlushNotifications(notif_buf_id, notif_buf, state);
+  }
+
+  inc(state->rx_pkts, nb_delivered_pkts);
+  inc(state->rx_bytes, nb_delivered_bytes);
+  inc(state->rx_no_pipe_drops, nb_no_pipe_drops);
+  inc(state->rx_full_drops, nb_full_drops);
+}
+
+// TX path.
+
+void NicEmulator::TxThread(uint32_t thread_id) noexcept {
+  WorkerState* state =
+      &worker_states_[config_.nb_control_threads + config_.nb_rx_threads +
+                      thread_id];
+  state->next_tx_time_ns = now_ns();
+
+  while (running_.load(std::memory_order_relaxed)) {
+    PublishEpoch(state);
+
+    uint32_t nb_processed = 0;
+    for (uint32_t word = 0; word < kMaxNbApps / 64; ++word) {
+      uint64_t enabled = tx_enabled_[word].load(std::memory_order_acquire);
+      while (enabled) {
+        uint32_t notif_buf_id = word * 64 + __builtin_ctzll(enabled);
+        enabled &= enabled - 1;
+        if (notif_buf_id % config_.nb_tx_threads != thread_id) {
+          continue;
+        }
+        nb_processed += ProcessTxNotifications(notif_buf_id, state);
+      }
+    }
+
+    FlushLoopback(state);
+
+    if (nb_processed == 0) {
+      _mm_pause();
+    }
+  }
+}
+
+uint32_t NicEmulator::ProcessTxNotifications(uint32_t notif_buf_id,
+                                             WorkerState* state) noexcept {
+  NotifBufState* notif_buf = &notif_bufs_[notif_buf_id];
+  struct TxNotification* tx_buf =
+      notif_buf->tx_buf.load(std::memory_order_acquire);
+  if (unlikely(tx_buf == nullptr)) {
+    return 0;
+  }
+
+  uint32_t queue = notif_buf_id + kMaxNbFlows;
+  uint32_t tail =
+      Reg(queue, kTxTailReg).load(std::memory_order_acquire) %
+      kNotificationBufSize;
+  uint32_t head = notif_buf->tx_head;
+  uint32_t nb_processed = 0;
+
+  while (head != tail && nb_processed < kBatchSize) {
+    struct TxNotification* notification = tx_buf + head;
+    uint64_t signal = __atomic_load_n(&notification->signal, __ATOMIC_ACQUIRE);
+
+    if (unlikely(signal == 0)) {
+      break;
+    }
+
+    if (signal == 1) {
+      Transmit(notif_buf, (const uint8_t*)notification->phys_addr,
+               notification->length, state);
+      inc(state->tx_notifications);
+    } else {
+      ApplyConfig(notification);
+      inc(state->config_notifications);
+    }
+
+    // Signal completion to the application.
+    __atomic_store_n(&notification->signal, 0, __ATOMIC_RELEASE);
+
+    head = (head + 1) % kNotificationBufSize;
+    ++nb_processed;
+  }
+
+  if (nb_processed > 0) {
+    notif_buf->tx_head = head;
+    Reg(queue, kTxHeadReg).store(head, std::memory_order_release);
+  }
+
+  return nb_processed;
+}
+
+void NicEmulator::Transmit(NotifBufState* notif_buf, const uint8_t* data,
+                           uint32_t len, WorkerState* state) noexcept {
+  if (unlikely(data == nullptr || len == 0)) {
+    return;
+  }
+
+  inc(state->tx_bytes, len);
+
+  uint32_t offset = 0;
+
+  // Transfers are split at huge page boundaries, so a packet may start in the
+  // previous notification.
+  if (notif_buf->tx_missing_bytes > 0) {
+    uint32_t chunk = std::min(notif_buf->tx_missing_bytes, len);
+    if (notif_buf->reassembly_buf) {
+      memcpy(notif_buf->reassembly_buf.get() + notif_buf->reassembly_len, data,
+             chunk);
+      notif_buf->reassembly_len += chunk;
+    }
+    notif_buf->tx_missing_bytes -= chunk;
+
+    if (notif_buf->tx_missing_bytes > 0) {
+      return;
+    }
+
+    if (notif_buf->reassembly_buf) {
+      TransmitPkt(notif_buf->reassembly_buf.get(),
+                  notif_buf->reassembly_pkt_len, state);
+    } else {
+      TransmitPkt(nullptr, notif_buf->reassembly_pkt_len, state);
+    }
+    notif_buf->reassembly_len = 0;
+
+    offset = (chunk - 1) / kCacheLineSize * kCacheLineSize + kCacheLineSize;
+  }
+
+  while (offset < len) {
+    const uint8_t* pkt = data + offset;
+    uint32_t remaining = len - offset;
+
+    // Headers are never split since packets are aligned to flits and
+    // transfers are only split at huge page boundaries.
+    if (unlikely(remaining < sizeof(struct ether_header) +
+                                 sizeof(struct iphdr))) {
+      break;
+    }
+
+    uint16_t pkt_len = get_pkt_len(pkt);
+    uint32_t pkt_flits_len =
+        ((pkt_len - 1) / kCacheLineSize + 1) * kCacheLineSize;
+
+    if (unlikely(pkt_len > remaining)) {
+      // Packet continues in the next notification.
+      notif_buf->tx_missing_bytes = pkt_len - remaining;
+      notif_buf->reassembly_pkt_len = pkt_len;
+      if (config_.loopback && pkt_len <= kMaxLoopbackPktSize) {
+        if (!notif_buf->reassembly_buf) {
+          notif_buf->reassembly_buf.reset(
+              new (std::nothrow) uint8_t[kMaxLoopbackPktSize]);
+        }
+      } else {
+        notif_buf->reassembly_buf.reset();
+      }
+      if (notif_buf->reassembly_buf) {
+        memcpy(notif_buf->reassembly_buf.get(), pkt, remaining);
+        notif_buf->reassembly_len = remaining;
+      }
+      break;
+    }
+
+    TransmitPkt(pkt, pkt_len, state);
+    offset += pkt_flits_len;
+  }
+}
+
+void NicEmulator::TransmitPkt(const uint8_t* pkt, uint16_t len,
+                              WorkerState* state) noexcept {
+  inc(state->tx_pkts);
+
+  if (rate_limit_enabled_.load(std::memory_order_relaxed)) {
+    uint16_t num = rate_limit_num_.load(std::memory_order_relaxed);
+    uint16_t den = rate_limit_den_.load(std::memory_order_relaxed);
+    if (num > 0) {
+      // The rate is split evenly among TX threads.
+      double ns_per_flit = 1e9 * den * config_.nb_tx_threads /
+                           ((double)num * kMaxHardwareFlitRate);
+      uint32_t nb_flits = (len - 1) / kCacheLineSize + 1;
+      double now = now_ns();
+      state->next_tx_time_ns = std::max(state->next_tx_time_ns, now - 1e6);
+      while (now < state->next_tx_time_ns) {
+        _mm_pause();
+        now = now_ns();
+      }
+      state->next_tx_time_ns += nb_flits * ns_per_flit;
+    }
+  }
+
+  if (!config_.loopback || pkt == nullptr || len > kMaxLoopbackPktSize) {
+    return;
+  }
+
+  uint8_t* dst = state->loopback_buf.get() +
+                 state->nb_loopback_pkts * kMaxLoopbackPktSize;
+  memcpy(dst, pkt, len);
+
+  if (timestamp_enabled_.load(std::memory_order_relaxed)) {
+    uint8_t offset = timestamp_offset_.load(std::memory_order_relaxed);
+    if (offset + sizeof(uint32_t) <= len) {
+      *((uint32_t*)(dst + offset)) = htobe32(timestamp_cycles());
+    }
+  }
+
+  state->loopback_lens[state->nb_loopback_pkts] = len;
+  if (++state->nb_loopback_pkts == kMaxBurstSize) {
+    FlushLoopback(state);
+  }
+}
+
+void NicEmulator::FlushLoopback(WorkerState* state) noexcept {
+  if (state->nb_loopback_pkts == 0) {
+    return;
+  }
+
+  const uint8_t* pkts[kMaxBurstSize];
+  for (uint32_t i = 0; i < state->nb_loopback_pkts; ++i) {
+    pkts[i] = state->loopback_buf.get() + i * kMaxLoopbackPktSize;
+  }
+
+  DeliverBurst(pkts, state->loopback_lens, state->nb_loopback_pkts, state);
+  state->nb_loopback_pkts = 0;
+}
+
+void NicEmulator::ApplyConfig(
+    const struct TxNotification* notification) noexcept {
+  uint64_t config_id = ((const struct FlowTableConfig*)notification)->config_id;
+
+  switch (config_id) {
+    case FLOW_TABLE_CONFIG_ID: {
+      const struct FlowTableConfig* config =
+          (const struct FlowTableConfig*)notification;
+      FlowTuple tuple;
+      tuple.src_ip = config->src_ip;
+      tuple.dst_ip = config->dst_ip;
+      tuple.src_port = config->src_port;
+      tuple.dst_port = config->dst_port;
+
+      // Like the hardware, only the lowest bit is used and removing a missing
+      // entry does nothing.
+      if (config->remove & 1) {
+        flow_table_->Remove(tuple);
+      } else if (flow_table_->Insert(tuple, config->enso_pipe_id)) {
+        std::cerr << "Flow table full, dropping entry for pipe "
+                  << config->enso_pipe_id << std::endl;
+      }
+      break;
+    }
+    case TIMESTAMP_CONFIG_ID: {
+      const struct TimestampConfig* config =
+          (const struct TimestampConfig*)notification;
+      timestamp_offset_ = config->offset;
+      timestamp_enabled_ = config->enable != 0;
+      break;
+    }
+    case RATE_LIMIT_CONFIG_ID: {
+      const struct RateLimitConfig* config =
+          (const struct RateLimitConfig*)notification;
+      rate_limit_num_ = config->numerator;
+      rate_limit_den_ = config->denominator;
+      rate_limit_enabled_ = config->enable != 0;
+      break;
+    }
+    case FALLBACK_QUEUES_CONFIG_ID: {
+      const struct FallbackQueueConfig* config =
+          (const struct FallbackQueueConfig*)notification;
+      fallback_queue_mask_ = config->fallback_queue_mask;
+      enable_rr_ = config->enable_rr != 0;
+      nb_fallback_queues_ = config->nb_fallback_queues;
+      break;
+    }
+    default:
+      std::cerr << "Unknown config notification: " << config_id << std::endl;
+      break;
+  }
+}
+
+}  // namespace emulator
+}  // namespace enso
@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Software emulation of the Enso NIC.
+ *
+ * The emulator is the counterpart of the `software` device backend. It serves
+ * the IPC queues used by the backend (MMIO, address translation, pipe and
+ * notification buffer allocation), DMAs packets to RX Enso Pipes, sends RX
+ * notifications, and consumes TX notifications, including configuration
+ * notifications (flow table, timestamp, rate limit, and fallback queues).
+ *
+ * It is split into three kinds of threads:
+ * - Control threads, which serve the IPC queues of the applications.
+ * - RX threads, which steer packets from a `PacketTrace` to pipes.
+ * - TX threads, which consume TX notifications. Transmitted packets may be
+ *   looped back to the RX path.
+ */
+
+#ifndef SOFTWARE_EMULATOR_NIC_EMULATOR_H_
+#define SOFTWARE_EMULATOR_NIC_EMULATOR_H_
+
+#include <enso/consts.h>
+#include <enso/internals.h>
+#include <enso/queue.h>
+#include <immintrin.h>
+
+#include <atomic>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "flow_table.h"
+#include "host_memory.h"
+#include "packet_trace.h"
+
+namespace enso {
+namespace emulator {
+
+struct EmulatorConfig {
+  // Prefix used by applications for huge page files.
+  std::string huge_page_prefix = std::string(kHugePageDefaultPrefix);
+
+  // Number of application cores to serve. The software backend uses one pair
+  // of IPC queues per core.
+  uint32_t nb_app_cores = 1;
+
+  uint32_t nb_control_threads = 1;
+  uint32_t nb_rx_threads = 1;
+  uint32_t nb_tx_threads = 1;
+
+  // First core to pin the emulator threads to. Threads are pinned to
+  // consecutive cores. If negative, threads are not pinned.
+  int first_core = -1;
+
+  // Maximum number of packets that an RX thread steers at once.
+  uint32_t rx_burst_size = kBatchSize;
+
+  // Aggregate RX rate in millions of packets per second (0 means unlimited).
+  double rx_rate_mpps = 0;
+
+  // If true, transmitted packets are delivered back to the RX path.
+  bool loopback = false;
+};
+
+struct EmulatorStats {
+  uint64_t rx_pkts;
+  uint64_t rx_bytes;
+  uint64_t rx_no_pipe_drops;
+  uint64_t rx_full_drops;
+  uint64_t rx_notifications;
+  uint64_t notif_buf_full;
+  uint64_t tx_pkts;
+  uint64_t tx_bytes;
+  uint64_t tx_notifications;
+  uint64_t config_notifications;
+  uint64_t mmio_writes;
+  uint64_t mmio_coalesced_writes;  // Merged by the application.
+  uint64_t mmio_write_msgs;        // IPC messages carrying writes.
+  uint64_t mmio_reads;
+  uint64_t flow_table_evictions;
+};
+
+class SpinLock {
+ public:
+  inline void lock() noexcept {
+    while (locked_.exchange(true, std::memory_order_acquire)) {
+      while (locked_.load(std::memory_order_relaxed)) {
+        _mm_pause();
+      }
+    }
+  }
+
+  inline void unlock() noexcept {
+    locked_.store(false, std::memory_order_release);
+  }
+
+ private:
+  std::atomic<bool> locked_ = false;
+};
+
+class NicEmulator {
+ public:
+  /**
+   * @brief Factory method to create a NicEmulator.
+   *
+   * @param config Emulator configuration.
+   * @param trace Packets to inject in the RX path. May be nullptr if there are
+   *              no RX threads.
+   * @return A unique pointer to the NicEmulator or nullptr on failure.
+   */
+  static std::unique_ptr<NicEmulator> Create(
+      const EmulatorConfig& config,
+      std::unique_ptr<PacketTrace> trace) noexcept;
+
+  ~NicEmulator() noexcept;
+
+  /**
+   * @brief Starts all emulator threads.
+   *
+   * @return 0 on success, -1 on failure.
+   */
+  int Start() noexcept;
+
+  /**
+   * @brief Stops all emulator threads and waits for them to finish.
+   */
+  void Stop() noexcept;
+
+  /**
+   * @brief Returns the aggregate statistics for all threads.
+   */
+  EmulatorStats GetStats() const noexcept;
+
+  /**
+   * @brief Returns the flow table model. Tests use it to check where entries
+   *        were placed and to start from an empty table.
+   */
+  inline FlowTable& flow_table() noexcept { return *flow_table_; }
+
+ private:
+  static constexpr uint32_t kRegsPerQueue =
+      kMemorySpacePerQueue / sizeof(uint32_t);
+  static constexpr uint32_t kMaxBurstSize = kBatchSize;
+  static constexpr uint32_t kMaxLoopbackPktSize = 9216;
+
+  struct alignas(kCacheLineSize) PipeState {
+    std::atomic<uint8_t*> buf = nullptr;  // nullptr if disabled.
+    std::atomic<uint32_t> notif_buf_id = 0;
+
+    // The following are protected by the notification buffer lock.
+    uint32_t tail = 0;
+    uint32_t last_head = 0;
+    uint32_t size_mask = kEnsoPipeSize - 1;  // Buffer size in flits minus one.
+    bool notification_pending = false;
+  };
+
+  struct alignas(kCacheLineSize) NotifBufState {
+    std::atomic<struct RxNotification*> rx_buf = nullptr;
+    std::atomic<struct TxNotification*> tx_buf = nullptr;
+
+    SpinLock lock;
+
+    // Protected by `lock`.
+    uint32_t rx_tail = 0;
+    std::vector<uint32_t> pending_pipes;
+
+    // Owned by the TX thread responsible for this notification buffer.
+    uint32_t tx_head = 0;
+    uint32_t tx_missing_bytes = 0;  // Remaining bytes of a split packet.
+    uint32_t reassembly_len = 0;
+    uint16_t reassembly_pkt_len = 0;
+    std::unique_ptr<uint8_t[]> reassembly_buf;
+  };
+
+  struct alignas(kCacheLineSize) WorkerState {
+    std::atomic<uint64_t> epoch = 0;
+    uint32_t next_rr_queue = 0;
+    double next_tx_time_ns = 0;
+
+    // Loopback packets waiting to be delivered.
+    uint32_t nb_loopback_pkts = 0;
+    uint16_t loopback_lens[kMaxBurstSize];
+    std::unique_ptr<uint8_t[]> loopback_buf;
+
+    std::atomic<uint64_t> rx_pkts = 0;
+    std::atomic<uint64_t> rx_bytes = 0;
+    std::atomic<uint64_t> rx_no_pipe_drops = 0;
+    std::atomic<uint64_t> rx_full_drops = 0;
+    std::atomic<uint64_t> rx_notifications = 0;
+    std::atomic<uint64_t> notif_buf_full = 0;
+    std::atomic<uint64_t> tx_pkts = 0;
+    std::atomic<uint64_t> tx_bytes = 0;
+    std::atomic<uint64_t> tx_notifications = 0;
+    std::atomic<uint64_t> config_notifications = 0;
+    std::atomic<uint64_t> mmio_writes = 0;
+    std::atomic<uint64_t> mmio_coalesced_writes = 0;
+    std::atomic<uint64_t> mmio_write_msgs = 0;
+    std::atomic<uint64_t> mmio_reads = 0;
+  };
+
+  explicit NicEmulator(const EmulatorConfig& config,
+                       std::unique_ptr<PacketTrace> trace) noexcept
+      : config_(config), trace_(std::move(trace)) {}
+
+  NicEmulator(const NicEmulator& other) = delete;
+  NicEmulator& operator=(const NicEmulator& other) = delete;
+  NicEmulator(NicEmulator&& other) = delete;
+  NicEmulator& operator=(NicEmulator&& other) = delete;
+
+  int Init() noexcept;
+
+  inline std::atomic<uint32_t>& Reg(uint32_t queue, uint32_t reg) noexcept {
+    return regs_[queue * kRegsPerQueue + reg];
+  }
+
+  // Control path.
+  void ControlThread(uint32_t thread_id) noexcept;
+  bool HandleRequest(struct PipeNotification* notification,
+                     WorkerState* state) noexcept;
+  void WriteRegister(uint64_t address, uint32_t value) noexcept;
+  uint32_t ReadRegister(uint64_t address) noexcept;
+  void WritePipeRegister(uint32_t pipe_id, uint32_t reg,
+                         uint32_t value) noexcept;
+  void WriteNotifBufRegister(uint32_t notif_buf_id, uint32_t reg,
+                             uint32_t value) noexcept;
+  void DisablePipe(uint32_t pipe_id) noexcept;
+  int AllocatePipe(bool fallback) noexcept;
+  int FreePipe(uint32_t pipe_id) noexcept;
+  int AllocateNotifBuf() noexcept;
+  int FreeNotifBuf(uint32_t notif_buf_id) noexcept;
+  void Maintenance() noexcept;
+
+  // RX path.
+  void RxThread(uint32_t thread_id) noexcept;
+  int32_t Steer(const uint8_t* pkt, uint16_t len, WorkerState* state) noexcept;
+  void DeliverBurst(const uint8_t* const* pkts, const uint16_t* lens,
+                    uint32_t nb_pkts, WorkerState* state) noexcept;
+  bool CopyToPipe(PipeState* pipe, uint8_t* buf, uint32_t pipe_id,
+                  const uint8_t* pkt, uint16_t len) noexcept;
+  void FlushNotifications(uint32_t notif_buf_id, NotifBufState* notif_buf,
+                          WorkerState* state) noexcept;
+
+  // TX path.
+  void TxThread(uint32_t thread_id) noexcept;
+  uint32_t ProcessTxNotifications(uint32_t notif_buf_id,
+                                  WorkerState* state) noexcept;
+  void Transmit(NotifBufState* notif_buf, const uint8_t* data, uint32_t len,
+                WorkerState* state) noexcept;
+  void TransmitPkt(const uint8_t* pkt, uint16_t len,
+                   WorkerState* state) noexcept;
+  void FlushLoopback(WorkerState* state) noexcept;
+  void ApplyConfig(const struct TxNotification* notification) noexcept;
+
+  void PublishEpoch(WorkerState* state) noexcept {
+    state->epoch.store(global_epoch_.load(std::memory_order_acquire),
+                       std::memory_order_release);
+  }
+
+  EmulatorConfig config_;
+  std::unique_ptr<PacketTrace> trace_;
+  std::unique_ptr<HostMemory> host_memory_;
+  std::unique_ptr<FlowTable> flow_table_;
+
+  std::vector<std::unique_ptr<QueueConsumer<PipeNotification>>>
+      queues_from_app_;
+  std::vector<std::unique_ptr<QueueProducer<PipeNotification>>> queues_to_app_;
+
+  std::unique_ptr<std::atomic<uint32_t>[]> regs_;
+  std::unique_ptr<PipeState[]> pipes_;
+  std::unique_ptr<NotifBufState[]> notif_bufs_;
+
+  // Notification buffers with TX enabled (one bit per notification buffer).
+  std::atomic<uint64_t> tx_enabled_[kMaxNbApps / 64] = {};
+
+  // Allocation state, mirrors what the kernel driver keeps.
+  std::mutex alloc_mutex_;
+  std::bitset<kMaxNbFlows> pipe_status_;
+  std::bitset<kMaxNbApps> notif_buf_status_;
+  uint32_t nb_fallback_pipes_ = 0;
+  bool round_robin_ = false;
+
+  // Configuration applied through TX notifications.
+  std::atomic<uint32_t> nb_fallback_queues_ = 0;
+  std::atomic<uint32_t> fallback_queue_mask_ = 0;
+  std::atomic<bool> enable_rr_ = false;
+  std::atomic<bool> timestamp_enabled_ = false;
+  std::atomic<uint8_t> timestamp_offset_ = kDefaultRttOffset;
+  std::atomic<bool> rate_limit_enabled_ = false;
+  std::atomic<uint16_t> rate_limit_num_ = 0;
+  std::atomic<uint16_t> rate_limit_den_ = 0;
+
+  std::atomic<bool> running_ = false;
+  std::atomic<uint64_t> global_epoch_ = 1;
+  std::vector<std::thread> threads_;
+  std::unique_ptr<WorkerState[]> worker_states_;
+  uint32_t nb_workers_ = 0;
+};
+
+}  // namespace emulator
+}  // namespace enso
+
+#endif  // SOFTWARE_EMULATOR_NIC_EMULATOR_H_
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Implementation of packet traces. @see packet_trace.h
+ */
+
+#include "packet_trace.h"
+
+#include <arpa/inet.h>
+#include <netinet/ether.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <pcap/pcap.h>
+
+#include <cstring>
+#include <iostream>
+
+namespace enso {
+namespace emulator {
+
+// Packets are copied to the pipes in 64-byte chunks, keep them aligned in the
+// trace as well.
+static constexpr uint64_t kPktAlignment = 64;
+
+// Minimum Ethernet frame size without the FCS.
+static constexpr uint16_t kMinPktSize = 60;
+
+// Maximum packet size that we accept (jumbo frame without the FCS).
+static constexpr uint16_t kMaxPktSize = 9000 + sizeof(struct ether_header);
+
+static uint16_t ip_checksum(const struct iphdr* ip_hdr) {
+  const uint16_t* words = (const uint16_t*)ip_hdr;
+  uint32_t sum = 0;
+  for (uint32_t i = 0; i < sizeof(*ip_hdr) / 2; ++i) {
+    sum += words[i];
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum;
+}
+
+void PacketTrace::AddPacket(const uint8_t* pkt, uint16_t len) noexcept {
+  uint64_t offset = data_.size();
+  uint64_t aligned_len = (len + kPktAlignment - 1) & ~(kPktAlignment - 1);
+  data_.resize(offset + aligned_len, 0);
+  memcpy(data_.data() + offset, pkt, len);
+  offsets_.push_back(offset);
+  lens_.push_back(len);
+  nb_bytes_ += len;
+}
+
+std::unique_ptr<PacketTrace> PacketTrace::CreateSynthetic(
+    uint32_t nb_flows, uint16_t pkt_size, uint32_t base_dst_ip,
+    uint16_t dst_port) noexcept {
+  if (nb_flows == 0) {
+    std::cerr << "Number of flows must be greater than 0" << std::endl;
+    return nullptr;
+  }
+
+  if (pkt_size < kMinPktSize || pkt_size > kMaxPktSize) {
+    std::cerr << "Packet size must be between " << kMinPktSize << " and "
+              << kMaxPktSize << " bytes" << std::endl;
+    return nullptr;
+  }
+
+  std::unique_ptr<PacketTrace> trace(new (std::nothrow) PacketTrace());
+  if (trace == nullptr) {
+    return nullptr;
+  }
+
+  uint8_t pkt[kMaxPktSize] = {};
+
+  struct ether_header* l2_hdr = (struct ether_header*)pkt;
+  struct iphdr* l3_hdr = (struct iphdr*)(l2_hdr + 1);
+  struct udphdr* l4_hdr = (struct udphdr*)(l3_hdr + 1);
+
+  const uint8_t dst_mac[ETH_ALEN] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x02};
+  const uint8_t src_mac[ETH_ALEN] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x01};
+  memcpy(l2_hdr->ether_dhost, dst_mac, ETH_ALEN);
+  memcpy(l2_hdr->ether_shost, src_mac, ETH_ALEN);
+  l2_hdr->ether_type = htons(ETHERTYPE_IP);
+
+  uint16_t ip_len = pkt_size - sizeof(*l2_hdr);
+
+  l3_hdr->version = 4;
+  l3_hdr->ihl = 5;
+  l3_hdr->tot_len = htons(ip_len);
+  l3_hdr->ttl = 64;
+  l3_hdr->protocol = IPPROTO_UDP;
+  l3_hdr->saddr = htonl(0x0a000001);  // 10.0.0.1
+
+  l4_hdr->dest = htons(dst_port);
+  l4_hdr->len = htons(ip_len - sizeof(*l3_hdr));
+
+  for (uint32_t i = 0; i < nb_flows; ++i) {
+    l3_hdr->daddr = htonl(base_dst_ip + i);
+    l3_hdr->check = 0;
+    l3_hdr->check = ip_checksum(l3_hdr);
+    l4_hdr->source = htons(1024 + i % (65536 - 1024));
+    trace->AddPacket(pkt, pkt_size);
+  }
+
+  return trace;
+}
+
+std::unique_ptr<PacketTrace> PacketTrace::CreateFromPcap(
+    const std::string& path) noexcept {
+  char errbuf[PCAP_ERRBUF_SIZE];
+
+  pcap_t* pcap = pcap_open_offline(path.c_str(), errbuf);
+  if (pcap == nullptr) {
+    std::cerr << "Error loading pcap file (" << errbuf << ")" << std::endl;
+    return nullptr;
+  }
+
+  if (pcap_datalink(pcap) != DLT_EN10MB) {
+    std::cerr << "Pcap file must have Ethernet link type" << std::endl;
+    pcap_close(pcap);
+    return nullptr;
+  }
+
+  std::unique_ptr<PacketTrace> trace(new (std::nothrow) PacketTrace());
+  if (trace == nullptr) {
+    pcap_close(pcap);
+    return nullptr;
+  }
+
+  uint64_t nb_skipped = 0;
+  struct pcap_pkthdr* pkt_hdr;
+  const u_char* pkt_bytes;
+  int ret;
+  while ((ret = pcap_next_ex(pcap, &pkt_hdr, &pkt_bytes)) == 1) {
+    // Applications find the next packet using the IP length, so we cannot
+    // deliver truncated packets.
+    if (pkt_hdr->caplen != pkt_hdr->len || pkt_hdr->len > kMaxPktSize) {
+      ++nb_skipped;
+      continue;
+    }
+    trace->AddPacket(pkt_bytes, pkt_hdr->len);
+  }
+
+  if (ret == PCAP_ERROR) {
+    std::cerr << "Error reading pcap file (" << pcap_geterr(pcap) << ")"
+              << std::endl;
+    pcap_close(pcap);
+    return nullptr;
+  }
+
+  pcap_close(pcap);
+
+  if (nb_skipped > 0) {
+    std::cerr << "Skipped " << nb_skipped << " truncated or oversized packets"
+              << std::endl;
+  }
+
+  if (trace->size() == 0) {
+    std::cerr << "Pcap file has no usable packets" << std::endl;
+    return nullptr;
+  }
+
+  return trace;
+}
+
+}  // namespace emulator
+}  // namespace enso
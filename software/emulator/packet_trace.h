@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Packets that the NIC emulator injects in the RX path.
+ *
+ * Packets are either generated synthetically or loaded from a pcap file. They
+ * are kept in memory so that RX threads can replay them at high rates.
+ */
+
+#ifndef SOFTWARE_EMULATOR_PACKET_TRACE_H_
+#define SOFTWARE_EMULATOR_PACKET_TRACE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace enso {
+namespace emulator {
+
+class PacketTrace {
+ public:
+  /**
+   * @brief Creates a trace with UDP packets for `nb_flows` different flows.
+   *
+   * Flow `i` has destination IP `base_dst_ip + i` and destination port
+   * `dst_port`, which matches what the examples bind to.
+   *
+   * @param nb_flows Number of flows (one packet per flow).
+   * @param pkt_size Packet size in bytes (without the FCS).
+   * @param base_dst_ip Destination IP of the first flow (host byte order).
+   * @param dst_port Destination port of all flows (host byte order).
+   * @return A unique pointer to the trace or nullptr on failure.
+   */
+  static std::unique_ptr<PacketTrace> CreateSynthetic(
+      uint32_t nb_flows, uint16_t pkt_size, uint32_t base_dst_ip,
+      uint16_t dst_port) noexcept;
+
+  /**
+   * @brief Creates a trace by loading all packets from a pcap file.
+   *
+   * @param path Path to the pcap file. Must have Ethernet link type.
+   * @return A unique pointer to the trace or nullptr on failure.
+   */
+  static std::unique_ptr<PacketTrace> CreateFromPcap(
+      const std::string& path) noexcept;
+
+  inline uint32_t size() const noexcept { return lens_.size(); }
+
+  inline const uint8_t* pkt(uint32_t index) const noexcept {
+    return data_.data() + offsets_[index];
+  }
+
+  inline uint16_t len(uint32_t index) const noexcept { return lens_[index]; }
+
+  /**
+   * @brief Total number of bytes in the trace.
+   */
+  inline uint64_t nb_bytes() const noexcept { return nb_bytes_; }
+
+ private:
+  PacketTrace() noexcept = default;
+
+  PacketTrace(const PacketTrace& other) = delete;
+  PacketTrace& operator=(const PacketTrace& other) = delete;
+  PacketTrace(PacketTrace&& other) = delete;
+  PacketTrace& operator=(PacketTrace&& other) = delete;
+
+  void AddPacket(const uint8_t* pkt, uint16_t len) noexcept;
+
+  std::vector<uint8_t> data_;
+  std::vector<uint64_t> offsets_;
+  std::vector<uint16_t> lens_;
+  uint64_t nb_bytes_ = 0;
+};
+
+}  // namespace emulator
+}  // namespace enso
+
+#endif  // SOFTWARE_EMULATOR_PACKET_TRACE_H_
@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Software packet classifier with wildcard rules.
+ *
+ * The NIC flow table only supports exact matches. Packets that miss it go to
+ * the fallback pipes, where this classifier can steer them further using
+ * prefixes, port ranges and protocol wildcards.
+ */
+
+#ifndef SOFTWARE_INCLUDE_ENSO_CLASSIFIER_H_
+#define SOFTWARE_INCLUDE_ENSO_CLASSIFIER_H_
+
+#include <enso/consts.h>
+#include <enso/pipe.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace enso {
+
+/**
+ * @brief Classification rule. All fields are in host byte order.
+ *
+ * A packet matches the rule if all fields match. Set a prefix length or the
+ * protocol mask to 0 and a port range to [0, 65535] to match anything.
+ * Packets that are not TCP or UDP have both ports set to 0.
+ */
+struct ClassifierRule {
+  uint32_t dst_ip;
+  uint32_t src_ip;
+  uint8_t dst_prefix_len;  // Number of leading bits of `dst_ip` to match.
+  uint8_t src_prefix_len;  // Number of leading bits of `src_ip` to match.
+  uint8_t protocol;
+  uint8_t protocol_mask;  // Bits of `protocol` to match.
+  uint16_t dst_port_min;
+  uint16_t dst_port_max;
+  uint16_t src_port_min;
+  uint16_t src_port_max;
+  uint32_t class_id;  // Class assigned to matching packets.
+};
+
+/**
+ * @brief Classifies IPv4 packets using a list of wildcard rules.
+ *
+ * Rules are matched in order, i.e., a packet gets the class of the first rule
+ * that it matches, or the default class if it matches none. Packets that are
+ * not IPv4 always get the default class.
+ *
+ * `Create()` compiles the rules into a multibit trie that cuts 8 bits of the
+ * destination or source IP at every level, choosing the field that splits the
+ * rules best. Every leaf keeps the (few) rules that may match packets that
+ * reach it, which are checked 16 at a time with vector instructions when
+ * AVX512F is available.
+ *
+ * Classification does not modify the classifier and can be done concurrently
+ * by multiple threads.
+ *
+ * Example:
+ * @code
+ *    std::vector<enso::ClassifierRule> rules = ...;
+ *    auto classifier = enso::Classifier::Create(rules.data(), rules.size(),
+ *                                                kDefaultClass);
+ *    auto batch = fallback_pipe->RecvPkts();
+ *    classifier->Dispatch(batch, [&](uint32_t class_id, uint8_t* pkt) {
+ *      // Handle packet.
+ *    });
+ *    fallback_pipe->Clear();
+ * @endcode
+ */
+class Classifier {
+ public:
+  /**
+   * @brief Classifier compilation statistics.
+   */
+  struct Stats {
+    uint32_t nb_rules;
+    uint32_t nb_nodes;      // Including leaves.
+    uint32_t nb_leaves;
+    uint32_t depth;         // Maximum number of cuts to reach a leaf.
+    uint32_t max_leaf_rules;
+    uint64_t nb_leaf_rules;  // Sum of the rules in all leaves.
+  };
+
+  Classifier(const Classifier&) = delete;
+  Classifier& operator=(const Classifier&) = delete;
+  Classifier(Classifier&&) = delete;
+  Classifier& operator=(Classifier&&) = delete;
+
+  /**
+   * @brief Factory method that compiles the rules into a classifier.
+   *
+   * @param rules Array of `nb_rules` rules, in priority order.
+   * @param nb_rules Number of rules.
+   * @param default_class Class of packets that do not match any rule.
+   *
+   * @return A unique pointer to the classifier or nullptr if a rule is invalid
+   *         or on failure.
+   */
+  static std::unique_ptr<Classifier> Create(const ClassifierRule* rules,
+                                            uint32_t nb_rules,
+                                            uint32_t default_class) noexcept;
+
+  /**
+   * @brief Classifies a single packet.
+   *
+   * @param pkt Pointer to the start of the Ethernet header.
+   * @return The packet's class.
+   */
+  uint32_t Classify(const uint8_t* pkt) const noexcept;
+
+  /**
+   * @brief Classifies multiple packets.
+   *
+   * Faster than calling `Classify()` for every packet, as the memory accesses
+   * for different packets overlap.
+   *
+   * @param pkts Array of `nb_pkts` pointers to packets.
+   * @param nb_pkts Number of packets.
+   * @param classes Array of `nb_pkts` classes, set by this function.
+   */
+  void ClassifyBurst(const uint8_t* const* pkts, uint32_t nb_pkts,
+                     uint32_t* classes) const noexcept;
+
+  /**
+   * @brief Classifies every packet in a batch and calls `f` for each of them.
+   *
+   * @param batch Batch of packets, e.g., from `RxPipe::RecvPkts()` or
+   *              `RxPipe::PeekPkts()` on a fallback pipe.
+   * @param f Function called as `f(class_id, pkt)` for every packet, in the
+   *          order in which they appear in the batch.
+   *
+   * @return Number of packets in the batch.
+   */
+  template <typename T, typename F>
+  uint32_t Dispatch(RxPipe::MessageBatch<T>& batch, F&& f) {
+    uint8_t* pkts[kBatchSize];
+    uint32_t classes[kBatchSize];
+    uint32_t nb_pkts = 0;
+    uint32_t total_nb_pkts = 0;
+
+    for (auto pkt : batch) {
+      pkts[nb_pkts++] = pkt;
+      if (nb_pkts == kBatchSize) {
+        ClassifyBurst(pkts, nb_pkts, classes);
+        for (uint32_t i = 0; i < nb_pkts; ++i) {
+          f(classes[i], pkts[i]);
+        }
+        total_nb_pkts += nb_pkts;
+        nb_pkts = 0;
+      }
+    }
+
+    ClassifyBurst(pkts, nb_pkts, classes);
+    for (uint32_t i = 0; i < nb_pkts; ++i) {
+      f(classes[i], pkts[i]);
+    }
+
+    return total_nb_pkts + nb_pkts;
+  }
+
+  /**
+   * @brief Classifies every packet in a batch and pushes a pointer to it to
+   *        the queue of its class.
+   *
+   * The packets are not copied. They must stay in the pipe (e.g., by using
+   * `RxPipe::PeekPkts()` and only freeing them later) until the consumers are
+   * done with them.
+   *
+   * @param batch Batch of packets.
+   * @param queues Array of `nb_queues` queues, indexed by class. May contain
+   *               null entries. Usually `QueueProducer<uint8_t*>` from
+   *               `enso/queue.h`.
+   * @param nb_queues Number of queues.
+   *
+   * @return Number of packets pushed. Packets whose class has no queue or
+   *         whose queue is full are skipped.
+   */
+  template <typename T, typename Producer>
+  uint32_t Dispatch(RxPipe::MessageBatch<T>& batch, Producer* const* queues,
+                    uint32_t nb_queues) {
+    uint32_t nb_pushed = 0;
+    Dispatch(batch, [&](uint32_t class_id, uint8_t* pkt) {
+      if (class_id < nb_queues && queues[class_id] != nullptr &&
+          queues[class_id]->Push(pkt) == 0) {
+        ++nb_pushed;
+      }
+    });
+    return nb_pushed;
+  }
+
+  /**
+   * @brief Returns compilation statistics.
+   */
+  Stats GetStats() const noexcept;
+
+ private:
+  class Compiler;
+
+  /**
+   * Internal nodes cut 8 bits of a field, starting at `shift`, and have 256
+   * consecutive children starting at `first`. Leaves use `first` as the index
+   * of the leaf instead.
+   */
+  struct Node {
+    uint32_t first;
+    uint8_t field;  // kLeafNode, kDstIpField or kSrcIpField.
+    uint8_t shift;
+  };
+
+  struct Leaf {
+    uint32_t first_chunk;
+    uint32_t nb_chunks;
+  };
+
+  static constexpr uint8_t kLeafNode = 0;
+  static constexpr uint8_t kDstIpField = 1;
+  static constexpr uint8_t kSrcIpField = 2;
+  static constexpr uint32_t kRulesPerChunk = 16;
+  static constexpr uint32_t kNoRule = ~0U;
+
+  /**
+   * Leaf rules are stored in chunks of `kRulesPerChunk` rules, in structure of
+   * arrays layout, so that every field of a chunk fits in a vector register.
+   * Every leaf starts at a new chunk and is padded with rules that never
+   * match.
+   */
+  struct alignas(kCacheLineSize) RuleChunk {
+    uint32_t rule_ids[kRulesPerChunk];  // In priority order.
+    uint32_t dst_ips[kRulesPerChunk];
+    uint32_t dst_masks[kRulesPerChunk];
+    uint32_t src_ips[kRulesPerChunk];
+    uint32_t src_masks[kRulesPerChunk];
+    uint32_t dst_port_mins[kRulesPerChunk];
+    uint32_t dst_port_maxs[kRulesPerChunk];
+    uint32_t src_port_mins[kRulesPerChunk];
+    uint32_t src_port_maxs[kRulesPerChunk];
+    uint32_t protocols[kRulesPerChunk];
+    uint32_t protocol_masks[kRulesPerChunk];
+  };
+
+  /**
+   * @brief Finds the first rule in `leaf` that matches the given fields.
+   *
+   * @return Index of the rule, if it is lower than `best`, or `best`
+   *         otherwise.
+   */
+  uint32_t MatchLeaf(const Leaf& leaf, uint32_t dst_ip, uint32_t src_ip,
+                     uint32_t dst_port, uint32_t src_port, uint32_t protocol,
+                     uint32_t best) const noexcept;
+
+  explicit Classifier(uint32_t default_class) noexcept;
+
+  uint32_t default_class_;
+  Stats stats_ = {};
+
+  // Rules are split among up to three tries: rules with a long enough
+  // destination prefix, rules with a long enough source prefix and the rest.
+  std::vector<uint32_t> roots_;
+  std::vector<Node> nodes_;
+  std::vector<Leaf> leaves_;
+  std::vector<RuleChunk> chunks_;
+  bool prefetch_leaves_ = false;
+  std::vector<uint32_t> rule_classes_;  // Indexed by rule.
+};
+
+}  // namespace enso
+
+#endif  // SOFTWARE_INCLUDE_ENSO_CLASSIFIER_H_
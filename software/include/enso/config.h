@@ -45,6 +45,24 @@
 
 namespace enso {
 
+/**
+ * @brief Identifies configurations sent asynchronously. Completes once the
+ *        NIC applied the configuration.
+ */
+using ConfigTicket = uint32_t;
+
+/**
+ * @brief Flow entry that directs matching packets to an Enso Pipe. All fields
+ *        are in host byte order. @see RxPipe::Bind
+ */
+struct FlowEntry {
+  uint16_t dst_port;
+  uint16_t src_port;
+  uint32_t dst_ip;
+  uint32_t src_ip;
+  uint32_t protocol;
+};
+
 /**
  * @brief Inserts flow entry in the data plane flow table that will direct all
  *        packets matching the flow entry to the `enso_pipe_id`.
@@ -66,6 +84,27 @@ int insert_flow_entry(struct NotificationBufPair* notification_buf_pair,
                       uint32_t src_ip, uint32_t protocol,
                       uint32_t enso_pipe_id);
 
+/**
+ * @brief Inserts multiple flow entries in the data plane flow table without
+ *        waiting for them to be applied. All the entries direct packets to the
+ *        same `enso_pipe_id`.
+ *
+ * Entries are written to the notification buffer in batches, so the NIC
+ * applies them back to back instead of one round trip per entry.
+ *
+ * @param notification_buf_pair Notification buffer to send configuration
+ *                              through.
+ * @param entries Array of `nb_entries` flow entries.
+ * @param nb_entries Number of flow entries to insert.
+ * @param enso_pipe_id Enso Pipe ID that will be associated with the entries.
+ * @param ticket Set to a ticket that completes once all entries are applied.
+ *
+ * @return Return 0 if configuration was sent successfully, -1 otherwise.
+ */
+int insert_flow_entries(struct NotificationBufPair* notification_buf_pair,
+                        const struct FlowEntry* entries, uint32_t nb_entries,
+                        uint32_t enso_pipe_id, ConfigTicket* ticket);
+
 /**
  * @brief Enables hardware timestamping.
  *
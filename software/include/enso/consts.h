@@ -87,14 +87,36 @@ static constexpr std::string_view kHugePageRxPipePathPrefix = "_rx_pipe:";
 static constexpr std::string_view kHugePagePathPrefix = "_tx_pipe:";
 static constexpr std::string_view kHugePageNotifBufPathPrefix = "_notif_buf:";
 static constexpr std::string_view kHugePageQueuePathPrefix = "_queue:";
+static constexpr std::string_view kHugePageArenaPathPrefix = "_arena:";
 
-// We need this to allow the same huge page to be mapped to adjacent memory
+// Default size of the huge page arena (in bytes). Use a hugetlbfs mount with
+// 1GB pages to back the entire arena with a single page.
+constexpr uint64_t kHugePageArenaSize = 1UL << 30;
+
+// Pipes carved from the huge page arena are not mirrored. Instead, they are
+// followed by a guard region that receives a copy of the part of the packet
+// that wraps around. Must fit the largest packet.
+constexpr uint32_t kPipeGuardSize = 16384;
+
+// Default size of a pipe buffer (in bytes). Pipes may also be allocated with
+// other sizes, as long as they are a power-of-two multiple of `kBufPageSize`
+// and not larger than `kMaxPipeBufSize`. Pipes carved from the huge page arena
+// are not mirrored and may be as small as `kPipeGuardSize`.
+constexpr uint32_t kDefaultPipeBufSize = kEnsoPipeSize * 64;
+
+// Pipe offsets are kept in 32 bits, we limit pipes to a single 1GB page.
+constexpr uint32_t kMaxPipeBufSize = 1UL << 30;
+
+// We need this to allow the same huge pages to be mapped to adjacent memory
 // regions.
-// TODO(sadok): support other buffer sizes. It may be possible to support
-// other buffer sizes by overlaying regular pages on top of the huge pages.
-// We might use those only for requests that overlap to avoid adding too
-// many entries to the TLB.
-static_assert(ENSO_PIPE_SIZE * 64 == kBufPageSize, "Unsupported buffer size");
+// TODO(sadok): support buffers smaller than a huge page. It may be possible to
+// support them by overlaying regular pages on top of the huge pages. We might
+// use those only for requests that overlap to avoid adding too many entries to
+// the TLB.
+static_assert(kDefaultPipeBufSize % kBufPageSize == 0 &&
+                  (kEnsoPipeSize & (kEnsoPipeSize - 1)) == 0 &&
+                  kDefaultPipeBufSize <= kMaxPipeBufSize,
+              "Unsupported buffer size");
 
 /**
  * Sizes aligned to the huge page size, but if both buffers fit in a single
@@ -129,6 +151,69 @@ constexpr uint32_t kMemorySpacePerQueue = 1 << 12;
 
 constexpr uint32_t kCacheLineSize = 64;  // bytes.
 
+/**
+ * @brief Value that a consumer writes to the `signal` of an empty queue element
+ *        or notification before sleeping.
+ *
+ * Producers that overwrite a signal with this value must wake the consumer up
+ * with `futex_wake`.
+ */
+constexpr uint64_t kSignalWaiting = 2;
+
+/**
+ * @brief Default time that consumers spin before sleeping when waiting for new
+ *        data (in microseconds).
+ */
+constexpr uint32_t kDefaultWaitSpinUs = 50;
+
+/**
+ * @brief Default maximum number of TX descriptors queued before ringing the
+ *        doorbell when TX batching is enabled.
+ */
+constexpr uint32_t kDefaultTxBatchSize = 32;
+
+/**
+ * @brief Default maximum time that a TX descriptor waits for the doorbell when
+ *        TX batching is enabled (in cycles).
+ */
+constexpr uint64_t kDefaultTxBatchDelayCycles = 10000;
+
+/**
+ * @brief Default share of an RX ring (in percent) that must be freed before
+ *        its head is written to the device when lazy RX heads are enabled.
+ */
+constexpr uint32_t kDefaultRxHeadFlushPercent = 25;
+
+/**
+ * @brief Default maximum time that an RX head update is deferred when lazy RX
+ *        heads are enabled (in cycles).
+ */
+constexpr uint64_t kDefaultRxHeadDelayCycles = 100000;
+
+/**
+ * @brief Number of priorities that RX pipes can have when scheduling them.
+ */
+constexpr uint32_t kNbRxPriorities = 8;
+
+/**
+ * @brief Bytes that an RX pipe with weight 1 can receive per round with
+ *        deficit round robin.
+ */
+constexpr uint32_t kRxSchedQuantum = 2048;
+
+/**
+ * @brief Size of every slot in an RX pipe's spill pool (in bytes). Bounds the
+ *        size of the packets that can be spilled.
+ */
+constexpr uint32_t kRxSpillSlotSize = 2048;
+
+/**
+ * @brief Maximum number of separate regions of an RX pipe that can be waiting
+ *        to be transmitted with `TxPipe::SendFromRxPipe()`. Regions that
+ *        follow each other count as one.
+ */
+constexpr uint32_t kMaxRxForwardedRegions = 1024;
+
 // Software backend definitions.
 
 // IPC queue names for software backend.
@@ -147,7 +232,8 @@ enum class NotifType : uint8_t {
   kSetRrStatus = 6,
   kGetRrStatus = 7,
   kFreeNotifBuf = 8,
-  kFreePipe = 9
+  kFreePipe = 9,
+  kWriteBatch = 10  // Multiple posted register writes in a single message.
 };
 
 struct MmioNotification {
@@ -186,11 +272,36 @@ struct FreePipeNotification {
   uint64_t result;
 };
 
+// Maximum number of register writes carried by a single `kWriteBatch`
+// message. Chosen so that the message fills the queue element (a cache line).
+constexpr uint32_t kMaxMmioBatchSize = 5;
+
+// Maximum number of register writes (including coalesced ones) that the
+// software backend may hold before sending them.
+constexpr uint32_t kMmioBurstSize = 32;
+
+struct MmioBatchWrite {
+  uint32_t address;
+  uint32_t value;
+};
+
+struct MmioBatchNotification {
+  NotifType type;
+  // Fields must not overlap with the padding after `PipeNotification::type`,
+  // which is not preserved when the notification is copied.
+  alignas(8) uint32_t nb_writes;
+  uint32_t nb_coalesced;  // Writes that were merged into the ones below.
+  struct MmioBatchWrite writes[kMaxMmioBatchSize];
+};
+
 struct PipeNotification {
   NotifType type;
-  uint64_t data[2];
+  uint64_t data[6];
 };
 
+static_assert(sizeof(MmioBatchNotification) <= sizeof(PipeNotification),
+              "MmioBatchNotification must fit in a PipeNotification");
+
 }  // namespace enso
 
 #endif  // SOFTWARE_INCLUDE_ENSO_CONSTS_H_
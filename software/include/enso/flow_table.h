@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2022, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Software shadow of the NIC flow table.
+ *
+ * Keeps track of the flow entries installed on the NIC and models the
+ * hardware flow table (`hardware/src/flow_table_wrapper.sv`), so that
+ * insertions that the hardware would drop can be detected before they are
+ * sent.
+ */
+
+#ifndef SOFTWARE_INCLUDE_ENSO_FLOW_TABLE_H_
+#define SOFTWARE_INCLUDE_ENSO_FLOW_TABLE_H_
+
+#include <enso/config.h>
+
+#include <cstdint>
+#include <memory>
+
+namespace enso {
+
+class Device;
+
+/**
+ * @brief Tuple used by the hardware to look up the flow table.
+ *
+ * All fields are in host byte order. Note that the protocol is not part of the
+ * tuple.
+ */
+struct FlowTuple {
+  uint32_t src_ip;
+  uint32_t dst_ip;
+  uint16_t src_port;
+  uint16_t dst_port;
+};
+
+/**
+ * @brief Computes the same hash as the hardware for a given tuple.
+ *
+ * Mirrors `hardware/src/hash_func.sv`.
+ *
+ * @param tuple Tuple to hash.
+ * @param initval Seed. The hardware uses the subtable index as the seed.
+ * @return The hash value.
+ */
+uint32_t flow_hash(const FlowTuple& tuple, uint32_t initval);
+
+/**
+ * @brief Manages the flow entries of a device.
+ *
+ * The hardware flow table has `kNbSubtables` subtables, each indexed by a
+ * different hash of the flow tuple. A new entry is placed in the first
+ * subtable with a free slot and is dropped if all the slots are taken. The
+ * `FlowTable` keeps an exact copy of the table in software, so it can tell
+ * where an entry will land, refuse insertions that would be dropped, and
+ * report occupancy without talking to the NIC.
+ *
+ * Moving a flow to a different pipe updates the existing entry in place, so
+ * packets are always steered to either the old or the new pipe and never to
+ * the fallback pipes in between.
+ *
+ * The shadow assumes that it is the only one inserting entries and that the
+ * table starts empty. Do not mix it with `RxPipe::Bind()` on the same device.
+ * It is not thread safe.
+ *
+ * Example:
+ * @code
+ *    auto flow_table = enso::FlowTable::Create(device.get());
+ *    enso::FlowEntry flow = {dst_port, src_port, dst_ip, src_ip, protocol};
+ *    flow_table->Insert(flow, rx_pipe->id());
+ *    // ...
+ *    flow_table->Replace(flow, other_rx_pipe->id());
+ *    // ...
+ *    flow_table->Remove(flow);
+ * @endcode
+ */
+class FlowTable {
+ public:
+  static constexpr uint32_t kNbSubtables = 4;
+  static constexpr uint32_t kSubtableDepth = 2048;
+  static constexpr uint32_t kCapacity = kNbSubtables * kSubtableDepth;
+
+  /**
+   * @brief Flow table occupancy and operation counters.
+   */
+  struct Stats {
+    uint32_t nb_entries;                      // Entries currently installed.
+    uint32_t subtable_entries[kNbSubtables];  // Entries in each subtable.
+    uint64_t nb_inserts;
+    uint64_t nb_updates;   // Entries moved to a different pipe.
+    uint64_t nb_removals;
+    uint64_t nb_collisions;  // Inserts that did not land in the first
+                             // subtable.
+    uint64_t nb_rejected;    // Inserts refused because the hardware would
+                             // drop them.
+  };
+
+  FlowTable(const FlowTable&) = delete;
+  FlowTable& operator=(const FlowTable&) = delete;
+  FlowTable(FlowTable&&) = delete;
+  FlowTable& operator=(FlowTable&&) = delete;
+
+  /**
+   * @brief Factory method to create a FlowTable.
+   *
+   * @param device Device whose flow table will be managed. Must outlive the
+   *               FlowTable.
+   * @return A unique pointer to the FlowTable or nullptr on failure.
+   */
+  static std::unique_ptr<FlowTable> Create(Device* device) noexcept;
+
+  /**
+   * @brief Directs packets matching `flow` to the pipe with ID `pipe_id`.
+   *
+   * If there is already an entry for the flow, it is updated instead.
+   *
+   * @param flow Flow to insert. The protocol is not part of the key.
+   * @param pipe_id ID of the RX pipe that should receive the flow.
+   * @param ticket If not null, returns without waiting for the NIC to apply
+   *               the entry and sets `ticket`. @see Device::WaitForConfig
+   *
+   * @return 0 on success, -1 if the hardware would drop the entry (in which
+   *         case nothing is sent) or on failure.
+   */
+  int Insert(const FlowEntry& flow, uint32_t pipe_id,
+             ConfigTicket* ticket = nullptr) noexcept;
+
+  /**
+   * @brief Moves an existing flow to the pipe with ID `pipe_id`.
+   *
+   * @param flow Flow to move.
+   * @param pipe_id ID of the RX pipe that should receive the flow.
+   * @param ticket If not null, returns without waiting for the NIC to apply
+   *               the change and sets `ticket`.
+   *
+   * @return 0 on success, -1 if the flow is not installed or on failure.
+   */
+  int Replace(const FlowEntry& flow, uint32_t pipe_id,
+              ConfigTicket* ticket = nullptr) noexcept;
+
+  /**
+   * @brief Removes the entry for `flow`. Matching packets will go to the
+   *        fallback pipes.
+   *
+   * @param flow Flow to remove.
+   * @param ticket If not null, returns without waiting for the NIC to apply
+   *               the change and sets `ticket`.
+   *
+   * @return 0 on success, -1 if the flow is not installed or on failure.
+   */
+  int Remove(const FlowEntry& flow, ConfigTicket* ticket = nullptr) noexcept;
+
+  /**
+   * @brief Moves all flows from one pipe to another.
+   *
+   * All updates are sent to the NIC back to back.
+   *
+   * @param from_pipe_id ID of the RX pipe that currently receives the flows.
+   * @param to_pipe_id ID of the RX pipe that should receive the flows.
+   * @param ticket If not null, returns without waiting for the NIC to apply
+   *               the changes and sets `ticket`.
+   *
+   * @return Number of flows moved on success, -1 on failure.
+   */
+  int Migrate(uint32_t from_pipe_id, uint32_t to_pipe_id,
+              ConfigTicket* ticket = nullptr) noexcept;
+
+  /**
+   * @brief Looks up the pipe that receives `flow`.
+   *
+   * @param flow Flow to look up.
+   * @return ID of the pipe or -1 if the flow is not installed.
+   */
+  int32_t Lookup(const FlowEntry& flow) const noexcept;
+
+  /**
+   * @brief Predicts where the hardware would place `flow`.
+   *
+   * @param flow Flow to check.
+   * @return Subtable that holds (or would hold) the entry for `flow`, or -1 if
+   *         all candidate slots are taken by other flows and the hardware
+   *         would drop the entry.
+   */
+  int32_t PredictSubtable(const FlowEntry& flow) const noexcept;
+
+  /**
+   * @brief Returns occupancy and operation counters.
+   */
+  Stats GetStats() const noexcept;
+
+  /**
+   * @brief Forgets all entries, without changing the NIC.
+   *
+   * Use it after the NIC flow table is reset.
+   */
+  void Clear() noexcept;
+
+ private:
+  struct Entry {
+    FlowTuple tuple;
+    uint32_t protocol;
+    uint32_t pipe_id;
+    bool valid;
+  };
+
+  /**
+   * Use `Create` factory method to instantiate objects externally.
+   */
+  explicit FlowTable(Device* device) noexcept : device_(device) {}
+
+  /**
+   * @brief Finds the subtable that holds the entry for `tuple`.
+   *
+   * @param tuple Tuple to look for.
+   * @param empty_subtable Set to the first subtable with a free slot for
+   *                       `tuple`, or -1 if there is none.
+   * @return Subtable with the entry for `tuple` or -1 if it is not installed.
+   */
+  int32_t Find(const FlowTuple& tuple, int32_t* empty_subtable) const noexcept;
+
+  /**
+   * @brief Returns the slot for `tuple` in `subtable`.
+   */
+  inline Entry* Slot(const FlowTuple& tuple, uint32_t subtable) noexcept {
+    return &entries_[subtable][flow_hash(tuple, subtable) % kSubtableDepth];
+  }
+
+  /**
+   * @brief Sends a flow table configuration to the NIC.
+   *
+   * @return 0 on success, -1 on failure.
+   */
+  int Apply(const FlowTuple& tuple, uint32_t protocol, uint32_t pipe_id,
+            bool remove, ConfigTicket* ticket) noexcept;
+
+  Device* device_;
+  Entry entries_[kNbSubtables][kSubtableDepth] = {};
+  uint32_t nb_entries_[kNbSubtables] = {};
+  uint64_t nb_inserts_ = 0;
+  uint64_t nb_updates_ = 0;
+  uint64_t nb_removals_ = 0;
+  uint64_t nb_collisions_ = 0;
+  uint64_t nb_rejected_ = 0;
+};
+
+}  // namespace enso
+
+#endif  // SOFTWARE_INCLUDE_ENSO_FLOW_TABLE_H_
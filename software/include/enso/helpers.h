@@ -120,6 +120,30 @@ _enso_always_inline uint8_t* get_next_pkt(uint8_t* pkt) {
   return pkt + nb_flits * 64;
 }
 
+/**
+ * @brief Finds the offset and length of every packet in a buffer at once.
+ *
+ * Gives the same packets as following `get_next_pkt()` from the start of the
+ * buffer, but, with AVX-512, reads the lengths of up to 16 small packets with
+ * a single gather instead of one after the other.
+ *
+ * @param buf Buffer with back-to-back packets, each starting at a multiple of
+ *            64 bytes from `buf`.
+ * @param nb_bytes Number of bytes in the buffer. Packets that do not fit in
+ *                 the buffer are not included.
+ * @param offsets Set to the offset of every packet from `buf`.
+ * @param lens Set to the length of every packet (as in `get_pkt_len()`).
+ * @param max_nb_pkts Maximum number of packets to find, i.e., the size of
+ *                    `offsets` and `lens`.
+ * @param nb_indexed_bytes Set to the number of bytes from `buf` to the end of
+ *                         the last packet found.
+ *
+ * @return The number of packets found.
+ */
+uint32_t index_pkts(const uint8_t* buf, uint32_t nb_bytes, uint32_t* offsets,
+                    uint16_t* lens, uint32_t max_nb_pkts,
+                    uint32_t* nb_indexed_bytes);
+
 uint16_t get_bdf_from_pcie_addr(const std::string& pcie_addr);
 
 void print_ip(uint32_t ip);
@@ -132,6 +156,30 @@ void print_buf(void* buf, const uint32_t nb_cache_lines);
 
 int set_core_id(std::thread& thread, int core_id);
 
+/**
+ * @brief Sleeps while `*addr` is equal to `expected`.
+ *
+ * @param addr Address to wait on. May be shared with other processes.
+ * @param expected Value that `*addr` must have for the thread to sleep.
+ * @param timeout_us Maximum time to sleep (in microseconds). If 0, sleeps
+ *                   until woken up.
+ *
+ * @return 0 if woken up. On timeout, if `*addr` is not equal to `expected`, or
+ *         on error, -1 is returned and errno is set.
+ */
+int futex_wait(volatile uint32_t* addr, uint32_t expected,
+               uint32_t timeout_us);
+
+/**
+ * @brief Wakes up all threads sleeping on `addr`.
+ *
+ * @param addr Address that threads are waiting on.
+ *
+ * @return Number of threads woken up. On error, -1 is returned and errno is
+ *         set.
+ */
+int futex_wake(volatile uint32_t* addr);
+
 void show_stats(const std::vector<stats_t>& thread_stats,
                 volatile bool* keep_running);
 
@@ -63,7 +63,8 @@ struct QueueRegs {
   uint32_t tx_head;
   uint32_t tx_mem_low;
   uint32_t tx_mem_high;
-  uint32_t padding[8];
+  uint32_t rx_size;  // In flits. Only used by backends with per-pipe sizes.
+  uint32_t padding[7];
 };
 
 struct __attribute__((__packed__)) RxNotification {
@@ -80,6 +81,62 @@ struct __attribute__((__packed__)) TxNotification {
   uint64_t pad[5];
 };
 
+// Completion record of a TX notification. Records are only used by software
+// and are kept apart from the notifications, in `tx_completions`, since the
+// device overwrites the whole notification when it consumes it.
+struct TxCompletion {
+  uint32_t* completed_bytes;  // Incremented by `completion_len`. May be null.
+  uint32_t completion_len;    // Zero if it does not complete a request.
+};
+
+// Configuration notifications. They are sent through the TX notification
+// buffer and must be kept in sync with the hardware.
+enum ConfigId {
+  FLOW_TABLE_CONFIG_ID = 1,
+  TIMESTAMP_CONFIG_ID = 2,
+  RATE_LIMIT_CONFIG_ID = 3,
+  FALLBACK_QUEUES_CONFIG_ID = 4
+};
+
+struct __attribute__((__packed__)) FlowTableConfig {
+  uint64_t signal;
+  uint64_t config_id;
+  uint16_t dst_port;
+  uint16_t src_port;
+  uint32_t dst_ip;
+  uint32_t src_ip;
+  uint32_t protocol;
+  uint32_t enso_pipe_id;
+  uint8_t remove;  // Set to 1 to remove the entry instead of inserting it.
+  uint8_t pad[27];
+};
+
+struct __attribute__((__packed__)) TimestampConfig {
+  uint64_t signal;
+  uint64_t config_id;
+  uint64_t enable;
+  uint64_t offset;
+  uint8_t pad[32];
+};
+
+struct __attribute__((__packed__)) RateLimitConfig {
+  uint64_t signal;
+  uint64_t config_id;
+  uint16_t denominator;
+  uint16_t numerator;
+  uint32_t enable;
+  uint8_t pad[40];
+};
+
+struct __attribute__((__packed__)) FallbackQueueConfig {
+  uint64_t signal;
+  uint64_t config_id;
+  uint32_t nb_fallback_queues;
+  uint32_t fallback_queue_mask;
+  uint64_t enable_rr;
+  uint8_t pad[32];
+};
+
 struct NotificationBufPair {
   // First cache line:
   struct RxNotification* rx_buf;
@@ -97,13 +154,38 @@ struct NotificationBufPair {
 
   // Second cache line:
   struct QueueRegs* regs;
+  struct TxCompletion* tx_completions;  // One per slot in `tx_buf`.
   uint64_t tx_full_cnt;
   uint32_t ref_cnt;
 
-  uint8_t* wrap_tracker;
   uint32_t* pending_rx_pipe_tails;
+  uint64_t* rx_ready_pipes;  // Bitmap of pipes queued in `next_rx_pipe_ids`.
+
+  // Deferred TX doorbell. Descriptors up to `tx_tail` that were not yet
+  // signaled to the device.
+  uint32_t nb_unflushed_tx;
+  uint32_t tx_batch_size;  // Ring the doorbell after this many descriptors.
+  uint64_t tx_batch_delay_cycles;   // Or after this many cycles.
+  uint64_t first_unflushed_tx_tsc;  // When the oldest descriptor was queued.
+
+  // Configuration notifications, counted apart from data completions. Both
+  // counters wrap around.
+  uint32_t nb_issued_configs;
+  uint32_t nb_completed_configs;
+
+  // Deferred RX head updates, for both the pipes and the notification buffer.
+  uint32_t rx_head_flush_percent;  // Share of a ring to free. 0 means eager.
+  uint32_t written_rx_head;        // Notification buffer head the device has.
+  uint64_t rx_head_delay_cycles;   // Maximum time that a head is deferred.
+  uint64_t first_deferred_rx_head_tsc;
+  uint32_t nb_deferred_rx_pipes;
+  struct RxEnsoPipeInternal** deferred_rx_pipes;  // Pipes with `head_deferred`.
+  uint64_t rx_head_doorbells;         // Head updates written to the device.
+  uint64_t elided_rx_head_doorbells;  // Head updates that were deferred.
 
   void* fpga_dev;            // Avoid exposing `DevBackend` externally.
+  bool owns_fpga_dev;        // False if `fpga_dev` is shared with others.
+  void* arena;               // `HugePageArena`, nullptr if not in use.
   void* uio_mmap_bar2_addr;  // UIO mmap address for BAR 2.
   std::string huge_page_prefix;
 };
@@ -115,6 +197,10 @@ struct RxEnsoPipeInternal {
   uint32_t* buf_head_ptr;
   uint32_t rx_head;
   uint32_t rx_tail;
+  uint32_t written_head;     // Last head written to the device.
+  uint32_t size_mask;        // Buffer size in flits minus one.
+  bool mirrored;             // If false, the buffer has a guard region.
+  bool head_deferred;        // If in the `deferred_rx_pipes` list.
   uint64_t phys_buf_offset;  // Use to convert between phys and virt address.
   enso_pipe_id_t id;
   std::string huge_page_prefix;
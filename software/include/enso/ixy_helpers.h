@@ -51,6 +51,21 @@ namespace enso {
  */
 uint64_t virt_to_phys(void* virt);
 
+/**
+ * Converts the virtual addresses of consecutive pages to physical addresses.
+ *
+ * Unlike calling `virt_to_phys()` for every page, the page map is only opened
+ * and read once.
+ *
+ * @param virt Address of the first page. Must be aligned to the system's
+ *             page size.
+ * @param nb_pages Number of pages, of the system's page size, to convert.
+ * @param phys_addrs Array of `nb_pages` elements used to save the physical
+ *                   address of every page, 0 if a page is not present.
+ * @return 0 on success, -1 on failure.
+ */
+int virt_to_phys_range(void* virt, uint64_t nb_pages, uint64_t* phys_addrs);
+
 /**
  * Allocates a huge page and returns a pointer to it.
  *
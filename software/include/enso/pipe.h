@@ -42,16 +42,20 @@
 #ifndef SOFTWARE_INCLUDE_ENSO_PIPE_H_
 #define SOFTWARE_INCLUDE_ENSO_PIPE_H_
 
+#include <enso/config.h>
 #include <enso/consts.h>
 #include <enso/helpers.h>
 #include <enso/internals.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 namespace enso {
@@ -59,19 +63,56 @@ namespace enso {
 class RxPipe;
 class TxPipe;
 class RxTxPipe;
+class DeviceGroup;
 
 class PktIterator;
 class PeekPktIterator;
+class HugePageArena;
 
 uint32_t external_peek_next_batch_from_queue(
     struct RxEnsoPipeInternal* enso_pipe,
     struct NotificationBufPair* notification_buf_pair, void** buf);
 
+/**
+ * @brief Policies to choose among the pipes that have data pending.
+ *
+ * Pipes with a higher priority are always chosen first. The policy decides the
+ * order among pipes with the same priority.
+ *
+ * @see Device::SetRxSchedPolicy
+ * @see RxSchedParams
+ */
+enum class RxSchedPolicy : uint8_t {
+  kNotificationOrder = 0,   ///< Order of the device's notifications. Ignores
+                            ///< the pipes' scheduling parameters.
+  kStrictPriority = 1,      ///< Round robin among pipes with the same priority.
+  kWeightedRoundRobin = 2,  ///< Every pipe is chosen `weight` times in a row
+                            ///< per round.
+  kDeficitRoundRobin = 3    ///< Every pipe can receive `weight` times
+                            ///< `kRxSchedQuantum` bytes per round.
+};
+
+/**
+ * @brief Scheduling parameters of an RX pipe.
+ *
+ * @see RxSchedPolicy
+ */
+struct RxSchedParams {
+  uint8_t priority = 0;  ///< Pipes with a higher priority are chosen first.
+                         ///< Must be smaller than `kNbRxPriorities`.
+  uint16_t weight = 1;   ///< Share of the pipe among pipes with the same
+                         ///< priority. Must be at least 1.
+  uint32_t quota = 0;    ///< Maximum number of bytes that the pipe can receive
+                         ///< every time it is chosen. 0 means no limit.
+};
+
 /**
  * @brief A class that represents a device.
  *
  * Should be instantiated using the factory method `Create()`. Use separate
- * instances for each thread.
+ * instances for each thread. Multi-threaded applications that need to move
+ * pipes between threads should instantiate their devices with a `DeviceGroup`
+ * instead.
  *
  * Example:
  * @code
@@ -88,12 +129,20 @@ class Device {
    *                  device found.
    * @param huge_page_prefix The prefix to use for huge pages file. If empty,
    *                         uses the default prefix.
+   * @param huge_page_arena_size If not zero, the notification buffer and the
+   *                             RX pipes are carved out of a single huge page
+   *                             arena with this size (in bytes) that is shared
+   *                             by all devices in the process, instead of using
+   *                             one huge page file each. Use a hugetlbfs mount
+   *                             with 1GB pages to reduce TLB misses (e.g.,
+   *                             with `kHugePageArenaSize`).
    * @return A unique pointer to the device. May be null if the device cannot be
    *         created.
    */
   static std::unique_ptr<Device> Create(
       const std::string& pcie_addr = "",
-      const std::string& huge_page_prefix = "") noexcept;
+      const std::string& huge_page_prefix = "",
+      uint64_t huge_page_arena_size = 0) noexcept;
 
   Device(const Device&) = delete;
   Device& operator=(const Device&) = delete;
@@ -117,9 +166,22 @@ class Device {
    *          If multiple applications use fallback pipes at once, the behavior
    *          is undefined.
    *
+   * @param buf_size Size of the pipe buffer in bytes. Must be a power-of-two
+   *                 multiple of the huge page size, up to `kMaxPipeBufSize`.
+   *                 If the device uses a huge page arena, the buffer is not
+   *                 mirrored and may be any power of two from
+   *                 `kPipeGuardSize` up. Sizes other than
+   *                 `kDefaultPipeBufSize` are only supported by the software
+   *                 backend, the hardware uses the same RX buffer size for all
+   *                 pipes.
+   * @param sched_params Scheduling parameters of the pipe.
+   *                     @see SetRxSchedPolicy
+   *
    * @return A pointer to the pipe. May be null if the pipe cannot be created.
    */
-  RxPipe* AllocateRxPipe(bool fallback = false) noexcept;
+  RxPipe* AllocateRxPipe(bool fallback = false,
+                         uint32_t buf_size = kDefaultPipeBufSize,
+                         const RxSchedParams& sched_params = {}) noexcept;
 
   /**
    * @brief Allocates a TX pipe.
@@ -127,10 +189,14 @@ class Device {
    * @param buf Buffer address to use for the pipe. It must be a pinned
    *            hugepage. If not specified, the buffer is allocated
    *            internally.
+   * @param buf_size Size of the pipe buffer in bytes. Must be a power-of-two
+   *                 multiple of the huge page size, up to `kMaxPipeBufSize`.
+   *                 If `buf` is specified, it must be mirrored with this size.
    * @return A pointer to the pipe. May be null if the pipe cannot be
    *         created.
    */
-  TxPipe* AllocateTxPipe(uint8_t* buf = nullptr) noexcept;
+  TxPipe* AllocateTxPipe(uint8_t* buf = nullptr,
+                         uint32_t buf_size = kDefaultPipeBufSize) noexcept;
 
   /**
    * @brief Retrieves the number of fallback queues for this device.
@@ -152,9 +218,61 @@ class Device {
    *          If multiple applications use fallback pipes at once, the behavior
    *          is undefined.
    *
+   * @param buf_size Size of the pipe buffer in bytes, used for both RX and TX.
+   *                 @see AllocateRxPipe() for the supported sizes.
+   * @param sched_params Scheduling parameters of the pipe.
+   *                     @see SetRxSchedPolicy
+   *
    * @return A pointer to the pipe. May be null if the pipe cannot be created.
    */
-  RxTxPipe* AllocateRxTxPipe(bool fallback = false) noexcept;
+  RxTxPipe* AllocateRxTxPipe(bool fallback = false,
+                             uint32_t buf_size = kDefaultPipeBufSize,
+                             const RxSchedParams& sched_params = {}) noexcept;
+
+  /**
+   * @brief Allocates multiple RX pipes at once.
+   *
+   * Faster than calling `AllocateRxPipe()` for every pipe, as it allocates all
+   * pipes with a single request to the device, waits only once for the device
+   * to reset them and updates the fallback configuration only once.
+   *
+   * @param nb_pipes Number of pipes to allocate.
+   * @param fallback Whether the pipes are fallback pipes.
+   *                 @see AllocateRxPipe()
+   * @param buf_size Size of the buffer of each pipe in bytes.
+   *                 @see AllocateRxPipe() for the supported sizes.
+   * @param sched_params Scheduling parameters of every pipe.
+   *                     @see SetRxSchedPolicy
+   *
+   * @return Pointers to the pipes. Empty if the pipes cannot be created, in
+   *         which case no pipe is allocated.
+   */
+  std::vector<RxPipe*> AllocateRxPipes(
+      uint32_t nb_pipes, bool fallback = false,
+      uint32_t buf_size = kDefaultPipeBufSize,
+      const RxSchedParams& sched_params = {}) noexcept;
+
+  /**
+   * @brief Allocates multiple RX/TX pipes at once.
+   *
+   * Faster than calling `AllocateRxTxPipe()` for every pipe.
+   * @see AllocateRxPipes()
+   *
+   * @param nb_pipes Number of pipes to allocate.
+   * @param fallback Whether the pipes are fallback pipes.
+   *                 @see AllocateRxTxPipe()
+   * @param buf_size Size of the buffer of each pipe in bytes, used for both RX
+   *                 and TX. @see AllocateRxPipe() for the supported sizes.
+   * @param sched_params Scheduling parameters of every pipe.
+   *                     @see SetRxSchedPolicy
+   *
+   * @return Pointers to the pipes. Empty if the pipes cannot be created, in
+   *         which case no pipe is allocated.
+   */
+  std::vector<RxTxPipe*> AllocateRxTxPipes(
+      uint32_t nb_pipes, bool fallback = false,
+      uint32_t buf_size = kDefaultPipeBufSize,
+      const RxSchedParams& sched_params = {}) noexcept;
 
   /**
    * @brief Gets the next RxPipe that has data pending.
@@ -178,11 +296,284 @@ class Device {
    */
   RxTxPipe* NextRxTxPipeToRecv();
 
+  /**
+   * @brief Sets how `NextRxPipeToRecv()` and `NextRxTxPipeToRecv()` choose
+   *        among the pipes that have data pending.
+   *
+   * By default, pipes are returned in the order that the device notifies them,
+   * so a pipe that receives a lot of data can delay the others that share the
+   * same device. With the other policies, pipes are chosen according to their
+   * `RxSchedParams`, which can be set when allocating them or with
+   * `RxPipe::SetSchedParams()`.
+   *
+   * A pipe is chosen again until it has no more data pending, so the
+   * application does not need to receive all of its data at once. The bytes
+   * that the application receives from a pipe are accounted to it until the
+   * next call to `NextRxPipeToRecv()` or `NextRxTxPipeToRecv()`. If the pipe
+   * has a quota, `RxPipe::Recv()`, `RxPipe::Peek()` and `RxPipe::RecvPkts()`
+   * only return up to the quota in this period. They return whole packets and
+   * at least one per period, even if it is larger than the quota.
+   *
+   * @note `ForEachReadyPipe()` always uses the order of the notifications.
+   *
+   * @param policy The policy to use.
+   */
+  void SetRxSchedPolicy(RxSchedPolicy policy) noexcept;
+
+  /**
+   * @brief Gets the policy set with `SetRxSchedPolicy()`.
+   */
+  RxSchedPolicy GetRxSchedPolicy() const noexcept { return rx_sched_policy_; }
+
+  /**
+   * @brief Calls `f` for every pipe that has data pending.
+   *
+   * A pipe is reported once, no matter how many notifications the device sent
+   * for it since it was last reported. Pipes that receive data while `f` runs
+   * are reported by the next call.
+   *
+   * `f` takes either an `RxPipe*` or an `RxTxPipe*`. The same restrictions of
+   * `NextRxPipeToRecv()` and `NextRxTxPipeToRecv()`, respectively, apply.
+   *
+   * @param f Function to call for every pipe with data pending.
+   *
+   * @return The number of pipes for which `f` was called.
+   */
+  template <typename F>
+  uint32_t ForEachReadyPipe(F&& f) {
+    constexpr bool kRxTxPipes = std::is_invocable_v<F, RxTxPipe*> &&
+                                !std::is_invocable_v<F, RxPipe*>;
+    if constexpr (kRxTxPipes) {
+      ProcessCompletions();
+    }
+
+    uint32_t nb_visited = 0;
+    for (uint32_t i = FetchReadyPipes(); i > 0; --i) {
+      if constexpr (kRxTxPipes) {
+        RxTxPipe* pipe = PopReadyRxTxPipe();
+        if (pipe == nullptr) {
+          continue;
+        }
+        f(pipe);
+      } else {
+        RxPipe* pipe = PopReadyRxPipe();
+        if (pipe == nullptr) {
+          continue;
+        }
+        f(pipe);
+      }
+      ++nb_visited;
+    }
+
+    return nb_visited;
+  }
+
+  /**
+   * @brief Waits until the device receives new data.
+   *
+   * Applications that receive little traffic can call this function when
+   * `NextRxPipeToRecv` or `NextRxTxPipeToRecv` return nullptr, instead of
+   * busy polling. It spins for up to `spin_us` microseconds and then sleeps
+   * until the device signals a new notification.
+   *
+   * @note The FPGA does not raise interrupts. With the FPGA backend, the
+   *       kernel driver polls for the notification on behalf of the sleeping
+   *       application every 50 microseconds, so waking up may take up to
+   *       that much longer.
+   *
+   * @param spin_us Time to spin before sleeping (in microseconds).
+   * @param timeout_us Maximum time to wait (in microseconds). If 0, waits
+   *                   until new data arrives.
+   *
+   * @return 0 if new data may be available, -1 on timeout or error.
+   */
+  int WaitForRx(uint32_t spin_us = kDefaultWaitSpinUs,
+                uint32_t timeout_us = 0);
+
   /**
    * @brief Processes completions for all pipes associated with this device.
    */
   void ProcessCompletions();
 
+  /**
+   * @brief Defers TX doorbells so that multiple transmissions share them.
+   *
+   * By default, every transmission rings the device's TX doorbell with an MMIO
+   * write. With TX batching enabled, transmissions are only signaled to the
+   * device once `batch_size` descriptors are queued, once the oldest queued
+   * descriptor has waited for `delay_cycles` or when the application calls
+   * `FlushTx()`. The delay is only checked when sending or processing
+   * completions, applications that stop sending should call `FlushTx()`.
+   *
+   * @note This setting applies to all pipes that use this device.
+   *
+   * @see DisableTxBatching
+   * @see FlushTx
+   *
+   * @param batch_size Maximum number of descriptors to queue.
+   * @param delay_cycles Maximum number of cycles that a descriptor is queued.
+   *
+   * @return 0 on success, -1 if `batch_size` or `delay_cycles` is 0.
+   */
+  int EnableTxBatching(uint32_t batch_size = kDefaultTxBatchSize,
+                       uint64_t delay_cycles = kDefaultTxBatchDelayCycles);
+
+  /**
+   * @brief Disables TX batching, signaling all queued transmissions.
+   *
+   * @see EnableTxBatching
+   */
+  void DisableTxBatching();
+
+  /**
+   * @brief Signals all queued transmissions to the device.
+   *
+   * Only needed when TX batching is enabled.
+   *
+   * @see EnableTxBatching
+   */
+  void FlushTx();
+
+  /**
+   * @brief Registers application memory so that it can be sent directly with
+   *        `TxPipe::SendRegistered()`, without copying it to a TX pipe.
+   *
+   * Locks the memory in RAM and translates all of its pages to addresses that
+   * the device can use in a single pass, so that sends only need a table
+   * lookup. The memory may use regular or huge pages and does not need to be
+   * physically contiguous.
+   *
+   * @note With the software backend, the emulator can only access memory in
+   *       huge page files that use the device's huge page prefix (e.g., memory
+   *       allocated with `get_huge_page()`).
+   *
+   * @param addr Start of the memory to register.
+   * @param size Size of the memory to register in bytes. Must not overlap, or
+   *             share pages, with memory that is already registered.
+   *
+   * @return 0 on success, -1 on failure.
+   */
+  int RegisterMemory(void* addr, size_t size) noexcept;
+
+  /**
+   * @brief Deregisters memory registered with `RegisterMemory()`.
+   *
+   * Fails if the device did not transmit all the bytes sent from registered
+   * memory yet.
+   *
+   * @param addr The address that was given to `RegisterMemory()`.
+   *
+   * @return 0 on success, -1 on failure.
+   */
+  int DeregisterMemory(void* addr) noexcept;
+
+  /**
+   * @brief Returns the number of bytes sent with `TxPipe::SendRegistered()`
+   *        that the device did not transmit yet.
+   *
+   * Updated when processing completions. Transmissions complete in order, so
+   * applications can keep track of the buffers they sent to know which ones
+   * they can modify again.
+   */
+  inline uint32_t registered_tx_pending() const noexcept {
+    return registered_tx_sent_bytes_ - registered_tx_completed_bytes_;
+  }
+
+  /**
+   * @brief Defers RX head updates so that multiple frees share them.
+   *
+   * By default, freeing received bytes writes the pipe's new head to the
+   * device with an MMIO write, and so does consuming notifications for the
+   * notification buffer. With lazy RX heads enabled, the heads are only written
+   * once `flush_percent` of the ring has been freed, once the oldest deferred
+   * update has waited for `delay_cycles` or when there is nothing new to
+   * receive. A pipe's head is still written right away when the device would
+   * otherwise see less than `flush_percent` of the pipe free, so that it does
+   * not drop packets.
+   *
+   * @note This setting applies to all pipes that use this device.
+   *
+   * @see DisableLazyRxHead
+   * @see FlushRxHeads
+   * @see GetRxHeadStats
+   *
+   * @param flush_percent Share of a ring (in percent) to free before writing
+   *                      its head.
+   * @param delay_cycles Maximum number of cycles that a head update is
+   *                     deferred.
+   *
+   * @return 0 on success, -1 if `flush_percent` is not between 1 and 100 or if
+   *         `delay_cycles` is 0.
+   */
+  int EnableLazyRxHead(uint32_t flush_percent = kDefaultRxHeadFlushPercent,
+                       uint64_t delay_cycles = kDefaultRxHeadDelayCycles);
+
+  /**
+   * @brief Disables lazy RX heads, writing all deferred heads.
+   *
+   * @see EnableLazyRxHead
+   */
+  void DisableLazyRxHead();
+
+  /**
+   * @brief Writes all deferred RX heads to the device.
+   *
+   * Only needed when lazy RX heads are enabled.
+   *
+   * @see EnableLazyRxHead
+   */
+  void FlushRxHeads();
+
+  /**
+   * @brief Number of RX head updates that were written to the device and that
+   *        were deferred.
+   */
+  struct RxHeadStats {
+    uint64_t doorbells;         ///< Head updates written to the device.
+    uint64_t elided_doorbells;  ///< Head updates that were deferred.
+  };
+
+  /**
+   * @brief Gets the RX head counters of this device.
+   *
+   * Counts head updates when freeing data and consuming notifications.
+   *
+   * @return The counters since the device was created.
+   */
+  RxHeadStats GetRxHeadStats() const noexcept;
+
+  /**
+   * @brief Moves an RX pipe to another device in the same `DeviceGroup`.
+   *
+   * From then on, the pipe's notifications go to the notification buffer of
+   * `dst`. Data that the pipe already received is kept and reported by `dst`.
+   *
+   * Must be called by the thread that uses this device, when it is not using
+   * the pipe. The thread that uses `dst` picks up the pipe in its next call to
+   * `NextRxPipeToRecv()`, `NextRxTxPipeToRecv()` or `ProcessCompletions()` and
+   * only it may use the pipe afterwards.
+   *
+   * @param pipe The pipe to move. Must belong to this device.
+   * @param dst The device that will own the pipe.
+   *
+   * @return 0 on success, -1 on failure.
+   */
+  int MoveRxPipe(RxPipe* pipe, Device* dst) noexcept;
+
+  /**
+   * @brief Moves an RX/TX pipe to another device in the same `DeviceGroup`.
+   *
+   * Waits until the device transmits all the data that the pipe already sent.
+   * Future transmissions use the notification buffer of `dst`. The same
+   * threading rules of `MoveRxPipe()` apply.
+   *
+   * @param pipe The pipe to move. Must belong to this device.
+   * @param dst The device that will own the pipe.
+   *
+   * @return 0 on success, -1 on failure.
+   */
+  int MoveRxTxPipe(RxTxPipe* pipe, Device* dst) noexcept;
+
   /**
    * @brief Enables hardware time stamping.
    *
@@ -306,17 +697,47 @@ class Device {
    */
   int ApplyConfig(struct TxNotification* config_notification);
 
- private:
-  struct TxPendingRequest {
-    uint32_t pipe_id;
-    uint32_t nb_bytes;
-  };
+  /**
+   * @brief Sends the given config notifications to the device without waiting
+   *        for them to be applied.
+   *
+   * All notifications are signaled to the device together. Use the ticket
+   * with `IsConfigDone()` or `WaitForConfig()` to know when they are applied.
+   *
+   * @param config_notifications Array of `nb_configs` config notifications.
+   * @param nb_configs Number of config notifications.
+   * @param ticket Set to a ticket that completes once all notifications are
+   *               applied.
+   * @return 0 on success, -1 on failure.
+   */
+  int ApplyConfigAsync(struct TxNotification* config_notifications,
+                       uint32_t nb_configs, ConfigTicket* ticket);
+
+  /**
+   * @brief Checks if the configuration associated with `ticket` was applied.
+   *
+   * Configurations are applied in order, so this also implies that every
+   * configuration sent before it was applied.
+   *
+   * @param ticket Ticket returned by an asynchronous configuration call.
+   * @return true if the configuration was applied, false otherwise.
+   */
+  bool IsConfigDone(ConfigTicket ticket);
+
+  /**
+   * @brief Blocks until the configuration associated with `ticket` is applied.
+   *
+   * @param ticket Ticket returned by an asynchronous configuration call.
+   */
+  void WaitForConfig(ConfigTicket ticket);
 
+ private:
   /**
    * Use `Create` factory method to instantiate objects externally.
    */
-  Device(const std::string& pcie_addr, std::string huge_page_prefix) noexcept
-      : kPcieAddr(pcie_addr) {
+  Device(const std::string& pcie_addr, std::string huge_page_prefix,
+         uint64_t huge_page_arena_size) noexcept
+      : kPcieAddr(pcie_addr), kHugePageArenaSize(huge_page_arena_size) {
 #ifndef NDEBUG
     std::cerr << "Warning: assertions are enabled. Performance may be affected."
               << std::endl;
@@ -330,29 +751,124 @@ class Device {
   /**
    * @brief Initializes the device.
    *
+   * @param fpga_dev Device handle to share with another device in the same
+   *                 group. If null, opens a new handle.
+   *
    * @return 0 on success and a non-zero error code on failure.
    */
-  int Init() noexcept;
+  int Init(void* fpga_dev = nullptr) noexcept;
 
   /**
    * @brief Sends a certain number of bytes to the device. This is designed to
    * be used by a TxPipe object.
    *
-   * @param tx_enso_pipe_id The ID of the TxPipe.
+   * The device reports the completion directly to `tx_pipe`.
+   *
+   * @param tx_pipe The TxPipe that is sending the data.
    * @param phys_addr The physical address of the buffer region to send.
    * @param nb_bytes The number of bytes to send.
    * @return The number of bytes sent.
    */
-  void Send(uint32_t tx_enso_pipe_id, uint64_t phys_addr, uint32_t nb_bytes);
+  void Send(TxPipe* tx_pipe, uint64_t phys_addr, uint32_t nb_bytes);
+
+  /**
+   * @brief Sends bytes straight from an RX pipe's buffer. This is designed to
+   *        be used by a TxPipe object.
+   *
+   * The bytes are released from the RX pipe once the device reports that they
+   * were transmitted.
+   *
+   * @see TxPipe::SendFromRxPipe
+   *
+   * @return 0 on success, -1 on failure.
+   */
+  int SendFromRxPipe(RxPipe* rx_pipe, uint8_t* buf, uint32_t nb_bytes);
+
+  /**
+   * @brief Sends bytes from memory registered with `RegisterMemory()`. This is
+   *        designed to be used by a TxPipe object.
+   *
+   * @see TxPipe::SendRegistered
+   *
+   * @return 0 on success, -1 on failure.
+   */
+  int SendRegistered(const uint8_t* buf, uint32_t nb_bytes);
+
+  /**
+   * @brief Detaches an RX pipe from this device and makes it send its
+   *        notifications to `dst`.
+   */
+  void DetachRxPipe(RxPipe* pipe, Device* dst) noexcept;
+
+  /**
+   * @brief Takes ownership of the pipes that other devices moved to this one.
+   */
+  void AdoptMovedPipes() noexcept;
+
+  /**
+   * @brief Consumes new notifications if no pipe is ready.
+   *
+   * @return The number of ready pipes that can be popped with
+   *         `PopReadyRxPipe()` or `PopReadyRxTxPipe()`.
+   */
+  uint32_t FetchReadyPipes() noexcept;
+
+  /**
+   * @brief Pops the next ready pipe. Must only be called after
+   *        `FetchReadyPipes()` reported a ready pipe.
+   *
+   * @return The pipe or nullptr if the pipe was moved to another device or, if
+   *         LATENCY_OPT is enabled, has no new data.
+   */
+  RxPipe* PopReadyRxPipe() noexcept;
+  RxTxPipe* PopReadyRxTxPipe() noexcept;
+
+  /**
+   * @brief Chooses the next pipe to receive from according to the policy set
+   *        with `SetRxSchedPolicy()`.
+   *
+   * @return The pipe or nullptr if no pipe has data pending.
+   */
+  RxPipe* NextScheduledRxPipe() noexcept;
+
+  /**
+   * @brief Accounts the bytes received from the last pipe returned by
+   *        `NextScheduledRxPipe()` and queues it again if it still has data.
+   */
+  void EndRxTurn() noexcept;
+
+  /**
+   * @brief Queues a pipe to be chosen by `NextScheduledRxPipe()`.
+   *
+   * @param pipe The pipe to queue.
+   * @param front Whether the pipe is chosen before the others with the same
+   *              priority.
+   */
+  void QueueRxPipe(RxPipe* pipe, bool front = false) noexcept;
+
+  /**
+   * @brief Checks if the device notified data that `pipe` did not receive yet.
+   */
+  bool HasPendingRx(const RxPipe* pipe) const noexcept;
+
+  /**
+   * @brief Frees the last `nb_pipes` RX pipes that were allocated.
+   *
+   * Used to undo a bulk allocation that failed.
+   */
+  void FreeLastRxPipes(uint32_t nb_pipes) noexcept;
 
   friend class RxPipe;
   friend class TxPipe;
   friend class RxTxPipe;
+  friend class DeviceGroup;
 
   const std::string kPcieAddr;
+  const uint64_t kHugePageArenaSize;
 
-  struct NotificationBufPair notification_buf_pair_;
-  int16_t core_id_;
+  std::shared_ptr<HugePageArena> arena_;  // Must outlive the pipes.
+  struct NotificationBufPair notification_buf_pair_ = {};
+  int16_t core_id_ = -1;
   uint16_t bdf_;
   std::string huge_page_prefix_;
 
@@ -360,17 +876,136 @@ class Device {
   std::vector<TxPipe*> tx_pipes_;
   std::vector<RxTxPipe*> rx_tx_pipes_;
 
+  // RxTx pipes that sent data since their last completion was processed.
+  std::vector<RxTxPipe*> pending_tx_rx_tx_pipes_;
+
+  // RX pipes with bytes sent by `SendFromRxPipe()` that did not complete yet.
+  std::vector<RxPipe*> pending_tx_rx_pipes_;
+
+  // Memory registered with `RegisterMemory()`, sorted by address. Every page
+  // keeps its device address and the offset where the range of pages that are
+  // contiguous in the device's address space ends.
+  struct RegisteredPage {
+    uint64_t dev_addr;
+    uint64_t contiguous_end;
+  };
+
+  struct RegisteredMemory {
+    uint8_t* addr;  // As given to `RegisterMemory()`.
+    uint8_t* first_page;
+    uint64_t size;  // From the first page.
+    uint32_t page_shift;
+    std::vector<RegisteredPage> pages;
+  };
+
+  std::vector<RegisteredMemory> registered_memory_;
+  uint32_t registered_tx_sent_bytes_ = 0;
+  uint32_t registered_tx_completed_bytes_ = 0;
+
   std::array<RxPipe*, kMaxNbFlows> rx_pipes_map_ = {};
   std::array<RxTxPipe*, kMaxNbFlows> rx_tx_pipes_map_ = {};
 
   int32_t next_pipe_id_ = -1;
+  uint32_t next_tx_pipe_id_ = 0;
+
+  // Pipes with data pending for `NextScheduledRxPipe()`, one ring per
+  // priority. A ring may keep the ID of a pipe that was moved to another
+  // device, which is skipped when popped.
+  struct RxSchedRing {
+    std::vector<enso_pipe_id_t> ids;
+    uint32_t head = 0;
+    uint32_t nb_ids = 0;
+  };
+
+  RxSchedPolicy rx_sched_policy_ = RxSchedPolicy::kNotificationOrder;
+  std::array<RxSchedRing, kNbRxPriorities> rx_sched_rings_;
+  uint32_t rx_sched_levels_ = 0;  // Bitmap of rings that are not empty.
+  std::array<bool, kMaxNbFlows> rx_sched_queued_ = {};  // If in a ring.
+  RxPipe* rx_sched_pipe_ = nullptr;  // Last pipe returned, until the next call.
+
+  // Pipes that other devices moved to this one but that were not adopted yet.
+  // Other threads push to these lists, only the thread using this device pops.
+  std::atomic<RxPipe*> moved_rx_pipes_ = nullptr;
+  std::atomic<RxTxPipe*> moved_rx_tx_pipes_ = nullptr;
+};
+
+/**
+ * @brief A group of devices that share the same hardware device handle.
+ *
+ * Each device in the group has its own notification buffer and keeps track of
+ * its own pending transmissions, so threads can use different devices of the
+ * same group concurrently without synchronization. Different from independent
+ * `Device` instances, pipes can be moved between devices in the same group at
+ * runtime, e.g., to balance load among threads.
+ *
+ * Should be instantiated using the factory method `Create()`.
+ *
+ * @note With the software backend, each thread must run on a different core.
+ *
+ * Example:
+ * @code
+ *    auto group = DeviceGroup::Create(nb_threads, pcie_addr);
+ *
+ *    // In thread i:
+ *    Device* device = group->GetDevice(i);
+ *    RxPipe* pipe = device->AllocateRxPipe();
+ *    ...
+ *    device->MoveRxPipe(pipe, group->GetDevice(j));
+ * @endcode
+ */
+class DeviceGroup {
+ public:
+  /**
+   * @brief Factory method to create a device group.
+   *
+   * @param nb_devices Number of devices (i.e., notification buffers) in the
+   *                   group. Must be between 1 and `kMaxNbApps`.
+   * @param pcie_addr The PCIe address of the device. If empty, uses the first
+   *                  device found.
+   * @param huge_page_prefix The prefix to use for huge pages file. If empty,
+   *                         uses the default prefix.
+   * @param huge_page_arena_size If not zero, carves the notification buffers
+   *                             and RX pipes of all devices out of a single
+   *                             huge page arena. @see Device::Create()
+   * @return A unique pointer to the group. May be null if the group cannot be
+   *         created.
+   */
+  static std::unique_ptr<DeviceGroup> Create(
+      uint32_t nb_devices, const std::string& pcie_addr = "",
+      const std::string& huge_page_prefix = "",
+      uint64_t huge_page_arena_size = 0) noexcept;
 
-  uint32_t tx_pr_head_ = 0;
-  uint32_t tx_pr_tail_ = 0;
-  std::array<TxPendingRequest, kMaxPendingTxRequests + 1> tx_pending_requests_;
-  static constexpr uint32_t kPendingTxRequestsBufMask = kMaxPendingTxRequests;
-  static_assert((kMaxPendingTxRequests & (kMaxPendingTxRequests + 1)) == 0,
-                "kMaxPendingTxRequests + 1 must be a power of 2");
+  DeviceGroup(const DeviceGroup&) = delete;
+  DeviceGroup& operator=(const DeviceGroup&) = delete;
+  DeviceGroup(DeviceGroup&&) = delete;
+  DeviceGroup& operator=(DeviceGroup&&) = delete;
+
+  /**
+   * @note All threads must stop using the devices before the group is
+   *       destroyed.
+   */
+  ~DeviceGroup();
+
+  /**
+   * @brief Gets a device in the group.
+   *
+   * @param index Index of the device, must be smaller than `nb_devices()`.
+   * @return A pointer to the device, owned by the group.
+   */
+  inline Device* GetDevice(uint32_t index) const {
+    return devices_[index].get();
+  }
+
+  /**
+   * @brief Returns the number of devices in the group.
+   */
+  inline uint32_t nb_devices() const { return devices_.size(); }
+
+ private:
+  DeviceGroup() noexcept = default;
+
+  // The first device owns the hardware device handle shared by the others.
+  std::vector<std::unique_ptr<Device>> devices_;
 };
 
 /**
@@ -464,6 +1099,52 @@ class RxPipe {
      */
     uint8_t* buf() const { return buf_; }
 
+    /**
+     * @brief Finds the offset and length of every packet in the batch at once,
+     *        instead of one packet at a time as when iterating over the batch.
+     *
+     * Knowing where all the packets are upfront lets the application prefetch
+     * packets ahead of the one it is processing or hand them out to be
+     * processed in any order. For batches of small packets, the lengths are
+     * also read in parallel using AVX-512 (see `index_pkts()`).
+     *
+     * Like iterating over the batch, it finds at most `message_limit()`
+     * packets and updates `processed_bytes()`. If the batch came from
+     * `RecvPkts()`, the packets found are also consumed from the pipe, so
+     * their addresses should not be used after the next call to the pipe.
+     *
+     * @warning Index a batch only once and do not iterate over a batch that
+     *          was indexed. Both would process the same packets twice.
+     *
+     * @param offsets Set to the offset of every packet from `buf()`.
+     * @param lens Set to the length of every packet.
+     * @param max_nb_pkts Maximum number of packets to find, i.e., the size of
+     *                    `offsets` and `lens`.
+     *
+     * @return The number of packets found.
+     */
+    uint32_t IndexPkts(uint32_t* offsets, uint16_t* lens,
+                       uint32_t max_nb_pkts) {
+      static_assert(std::is_same_v<T, PktIterator> ||
+                        std::is_same_v<T, PeekPktIterator>,
+                    "Only batches of packets can be indexed");
+
+      if (message_limit_ >= 0) {
+        max_nb_pkts = std::min(max_nb_pkts, (uint32_t)message_limit_);
+      }
+
+      uint32_t nb_bytes;
+      uint32_t nb_pkts = index_pkts(buf_, available_bytes_, offsets, lens,
+                                    max_nb_pkts, &nb_bytes);
+
+      if constexpr (std::is_same_v<T, PktIterator>) {
+        pipe_->ConfirmBytes(nb_bytes);
+      }
+      NotifyProcessedBytes(nb_bytes);
+
+      return nb_pkts;
+    }
+
    private:
     /**
      * Can only be constructed by RxPipe.
@@ -548,6 +1229,25 @@ class RxPipe {
   int Bind(uint16_t dst_port, uint16_t src_port, uint32_t dst_ip,
            uint32_t src_ip, uint32_t protocol);
 
+  /**
+   * @brief Binds the pipe to multiple flows at once.
+   *
+   * Behaves like calling `Bind()` for every flow but sends all the flow
+   * entries to the NIC back to back, instead of waiting for each one to be
+   * applied before sending the next.
+   *
+   * @param flows Array of `nb_flows` flows to bind to.
+   * @param nb_flows Number of flows.
+   * @param ticket If not null, returns without waiting for the entries to be
+   *               applied and sets `ticket`, which can be used with
+   *               `Device::IsConfigDone()` or `Device::WaitForConfig()`.
+   *               Otherwise, only returns once all entries are applied.
+   *
+   * @return 0 on success, a different value otherwise.
+   */
+  int BindMany(const FlowEntry* flows, uint32_t nb_flows,
+               ConfigTicket* ticket = nullptr);
+
   /**
    * @brief Receives a batch of bytes.
    *
@@ -582,7 +1282,7 @@ class RxPipe {
    */
   constexpr void ConfirmBytes(uint32_t nb_bytes) {
     uint32_t rx_tail = internal_rx_pipe_.rx_tail;
-    rx_tail = (rx_tail + nb_bytes / 64) % kEnsoPipeSize;
+    rx_tail = (rx_tail + nb_bytes / 64) & internal_rx_pipe_.size_mask;
     internal_rx_pipe_.rx_tail = rx_tail;
   }
 
@@ -595,9 +1295,26 @@ class RxPipe {
   constexpr uint32_t capacity() const {
     uint32_t rx_head = internal_rx_pipe_.rx_head;
     uint32_t rx_tail = internal_rx_pipe_.rx_tail;
-    return ((rx_head - rx_tail) % kEnsoPipeSize) * 64;
+    return ((rx_tail - rx_head) & internal_rx_pipe_.size_mask) * 64;
   }
 
+  /**
+   * @brief Returns the size of the pipe's buffer in bytes.
+   *
+   * @return The size of the pipe's buffer in bytes.
+   */
+  constexpr uint32_t buf_size() const {
+    return (internal_rx_pipe_.size_mask + 1) * 64;
+  }
+
+  /**
+   * @brief Returns the maximum capacity achievable by this pipe. There should
+   *        always be at least one buffer quantum available.
+   *
+   * @return The maximum capacity in bytes.
+   */
+  constexpr uint32_t max_capacity() const { return buf_size() - kQuantumSize; }
+
   /**
    * @brief Receives a batch of generic messages.
    *
@@ -643,6 +1360,24 @@ class RxPipe {
     return RecvMessages<PeekPktIterator>(max_nb_pkts);
   }
 
+  /**
+   * @brief Receives a burst of packets, returning their addresses and lengths
+   *        in arrays.
+   *
+   * An alternative to iterating over `RecvPkts()` for applications written
+   * around arrays of packets. Like `RecvPkts()`, and unlike `Recv()`, it only
+   * receives whole packets. The packets stay in the pipe's buffer until they
+   * are freed with `Free()` or `Clear()`.
+   *
+   * @param pkts Set to the address of every packet received.
+   * @param lens Set to the length of every packet received.
+   * @param max_nb_pkts The maximum number of packets to receive, i.e., the
+   *                    size of `pkts` and `lens`.
+   *
+   * @return The number of packets received.
+   */
+  uint16_t RecvBurst(uint8_t** pkts, uint16_t* lens, uint16_t max_nb_pkts);
+
   /**
    * @brief Prefetches the next batch of bytes to be received on the RxPipe.
    *
@@ -670,6 +1405,75 @@ class RxPipe {
    */
   void Clear();
 
+  /**
+   * @brief Frees bytes previously received on the RxPipe, in any order.
+   *
+   * Unlike `Free()`, which always frees the oldest bytes, this can free any
+   * region that was received, e.g., a single packet. The pipe keeps track of
+   * the released regions and only gives space back to the device once all
+   * the older bytes have also been released. Applications can therefore keep
+   * some packets, e.g., while waiting for a lookup, and release the others as
+   * soon as they are done with them.
+   *
+   * @note A packet that is kept for long still stops the device from reusing
+   *       all the space after it. Use `Spill()` to move it out of the pipe.
+   *
+   * @param buf Start of the region to release. Must be a multiple of 64 bytes
+   *            from the start of a batch.
+   * @param nb_bytes Number of bytes to release (rounded up to 64 bytes). Does
+   *                 nothing if zero.
+   */
+  void Release(uint8_t* buf, uint32_t nb_bytes);
+
+  /**
+   * @brief Sets aside a pool of `nb_slots` slots for `Spill()`.
+   *
+   * Can be called again to resize the pool, as long as no slots are in use.
+   *
+   * @param nb_slots Number of slots in the pool. Every slot holds one packet
+   *                 of up to `kRxSpillSlotSize` bytes.
+   *
+   * @return 0 on success, -1 on failure.
+   */
+  int EnableSpill(uint32_t nb_slots) noexcept;
+
+  /**
+   * @brief Copies a received packet out of the pipe and releases it.
+   *
+   * The copy goes into the pipe's spill pool, so that the device can reuse
+   * the packet's space while the application keeps it. The application must
+   * use the returned address from then on and call `FreeSpilled()` once it is
+   * done with the packet.
+   *
+   * @see EnableSpill()
+   * @see Release()
+   *
+   * @param buf Address of the packet in the pipe.
+   * @param nb_bytes Size of the packet in bytes.
+   *
+   * @return The address of the copy or nullptr if the packet is empty or
+   *         larger than `kRxSpillSlotSize`, or if the pool has no free slots.
+   *         In that case, the packet is not released.
+   */
+  uint8_t* Spill(uint8_t* buf, uint32_t nb_bytes);
+
+  /**
+   * @brief Frees a packet returned by `Spill()`.
+   *
+   * @param buf The address returned by `Spill()`.
+   */
+  void FreeSpilled(uint8_t* buf);
+
+  /**
+   * @brief Returns the number of packets in the spill pool, i.e., packets
+   *        returned by `Spill()` that were not freed yet.
+   *
+   * @return The number of spilled packets.
+   */
+  inline uint32_t nb_spilled() const {
+    return nb_spill_slots_ - free_spill_slots_.size();
+  }
+
   /**
    * @brief Returns the pipe's internal buffer.
    *
@@ -705,6 +1509,23 @@ class RxPipe {
    */
   inline void set_context(void* new_context) { context_ = new_context; }
 
+  /**
+   * @brief Sets the scheduling parameters of the pipe.
+   *
+   * @see Device::SetRxSchedPolicy()
+   *
+   * @param params The new parameters. They apply from the next time that the
+   *               device chooses the pipe.
+   *
+   * @return 0 on success, -1 if the parameters are invalid.
+   */
+  int SetSchedParams(const RxSchedParams& params) noexcept;
+
+  /**
+   * @brief Returns the scheduling parameters of the pipe.
+   */
+  inline const RxSchedParams& sched_params() const { return sched_params_; }
+
   /**
    * The size of a "buffer quantum" in bytes. This is the minimum unit that can
    * be sent at a time. Every transfer should be a multiple of this size.
@@ -712,10 +1533,12 @@ class RxPipe {
   static constexpr uint32_t kQuantumSize = 64;
 
   /**
-   * Maximum capacity achievable by the pipe. There should always be at least
-   * one buffer quantum available.
+   * Maximum capacity achievable by a pipe with the default buffer size. There
+   * should always be at least one buffer quantum available.
+   *
+   * @see RxPipe::max_capacity() for pipes allocated with other sizes.
    */
-  static constexpr uint32_t kMaxCapacity = kEnsoPipeSize * 64 - kQuantumSize;
+  static constexpr uint32_t kMaxCapacity = kDefaultPipeBufSize - kQuantumSize;
 
  private:
   /**
@@ -737,13 +1560,71 @@ class RxPipe {
    * @brief Initializes the RX pipe.
    *
    * @param fallback Whether this pipe is a fallback pipe.
+   * @param buf_size Size of the pipe buffer in bytes.
    *
    * @return 0 on success and a non-zero error code on failure.
    */
-  int Init(bool fallback) noexcept;
+  int Init(bool fallback, uint32_t buf_size) noexcept;
 
   void SetAsNextPipe() noexcept { next_pipe_ = true; }
 
+  /**
+   * @brief Limits a batch to the bytes that the pipe can still receive before
+   *        the device chooses another pipe.
+   *
+   * @param buf Start of the batch.
+   * @param nb_bytes Number of bytes in the batch.
+   *
+   * @return The number of bytes that can be received.
+   */
+  uint32_t ApplyRxBudget(uint8_t* buf, uint32_t nb_bytes) noexcept;
+
+  /**
+   * @brief Marks flits as released or not released.
+   *
+   * @param first_flit The first flit to mark (may wrap around the buffer).
+   * @param nb_flits Number of flits to mark.
+   * @param released Whether to mark them as released.
+   */
+  void MarkReleasedFlits(uint32_t first_flit, uint32_t nb_flits,
+                         bool released) noexcept;
+
+  /**
+   * @brief Frees the flits released out of order that directly follow the
+   *        head.
+   */
+  void FreeReleasedFlits() noexcept;
+
+  /**
+   * @brief Keeps track of flits sent by `Device::SendFromRxPipe()` until they
+   *        are transmitted.
+   *
+   * @param first_flit The first flit sent.
+   * @param nb_flits Number of flits sent.
+   *
+   * @return 0 on success, -1 if there are already `kMaxRxForwardedRegions`
+   *         regions waiting.
+   */
+  int AddForwardedFlits(uint32_t first_flit, uint32_t nb_flits) noexcept;
+
+  /**
+   * @brief Releases the flits sent by `Device::SendFromRxPipe()` that were
+   *        transmitted.
+   */
+  void ProcessForwardCompletions() noexcept;
+
+  /**
+   * @brief Returns whether the pipe has flits sent by
+   *        `Device::SendFromRxPipe()` that were not transmitted yet.
+   */
+  inline bool forward_pending() const { return nb_forwarded_regions_ > 0; }
+
+  static constexpr uint32_t kNoRxBudget = ~0U;
+
+  struct alignas(kCacheLineSize) SpillSlot {
+    uint8_t data[kRxSpillSlotSize];
+  };
+
   friend class Device;
 
   bool next_pipe_ = false;  ///< Whether this pipe is the next pipe to be
@@ -751,8 +1632,37 @@ class RxPipe {
                             ///< conjunction with NextRxPipeToRecv().
   enso_pipe_id_t id_;       ///< The ID of the pipe.
   void* context_;
-  struct RxEnsoPipeInternal internal_rx_pipe_;
+  struct RxEnsoPipeInternal internal_rx_pipe_ = {};
   struct NotificationBufPair* notification_buf_pair_;
+  RxPipe* next_moved_ = nullptr;  // Next pipe in the device's moved list.
+
+  RxSchedParams sched_params_;
+  uint32_t rx_budget_ = kNoRxBudget;  // Bytes that can be received this turn.
+  uint32_t turn_start_tail_ = 0;      // `rx_tail` when the turn started.
+  uint32_t sched_turns_ = 0;          // Weighted round robin turns left.
+  int64_t sched_deficit_ = 0;         // Deficit round robin bytes left.
+
+  // One bit per flit in the buffer, set for flits released out of order that
+  // the head has not passed yet. Empty until `Release()` is first called.
+  std::vector<uint64_t> released_flits_;
+
+  std::unique_ptr<SpillSlot[]> spill_slots_;
+  uint32_t nb_spill_slots_ = 0;
+  std::vector<uint32_t> free_spill_slots_;
+
+  struct ForwardedRegion {
+    uint32_t first_flit;
+    uint32_t nb_flits;
+  };
+
+  // Regions sent by `Device::SendFromRxPipe()` that were not transmitted yet,
+  // in the order that they were sent. Used as a ring with
+  // `kMaxRxForwardedRegions` entries, allocated on the first send.
+  std::vector<ForwardedRegion> forwarded_regions_;
+  uint32_t forwarded_regions_head_ = 0;
+  uint32_t nb_forwarded_regions_ = 0;
+  uint32_t forward_completed_bytes_ = 0;  // Updated by the device.
+  bool pending_tx_ = false;  // If in the device's `pending_tx_rx_pipes_`.
 };
 
 /**
@@ -806,9 +1716,9 @@ class TxPipe {
    * address will still not be valid. But allocating a new buffer will return a
    * a buffers that starts with the remaining data.
    *
-   * @warning The capacity will never be go beyond `TxPipe::kMaxCapacity`.
+   * @warning The capacity will never be go beyond `max_capacity()`.
    *          Therefore, specifying a `target_capacity` larger than
-   *          `TxPipe::kMaxCapacity` will cause this function to block forever.
+   *          `max_capacity()` will cause this function to block forever.
    *
    * @param target_capacity Target capacity of the buffer. It will block until
    *                        the buffer is at least this big. May set it to 0 to
@@ -839,13 +1749,94 @@ class TxPipe {
    *                 `kQuantumSize`.
    */
   inline void SendAndFree(uint32_t nb_bytes) {
-    uint64_t phys_addr = buf_phys_addr_ + app_begin_;
-    assert(nb_bytes <= kMaxCapacity);
+    assert(nb_bytes <= max_capacity());
     assert(nb_bytes / kQuantumSize * kQuantumSize == nb_bytes);
 
-    app_begin_ = (app_begin_ + nb_bytes) & kBufMask;
+    uint32_t offset = app_begin_;
+    app_begin_ = (app_begin_ + nb_bytes) & buf_mask_;
+
+    // Only split the transfer when the buffer is not physically contiguous,
+    // including when it wraps around.
+    while (nb_bytes > 0) {
+      uint32_t page = (offset + page_offset_) / kBufPageSize;
+      uint32_t len = std::min(nb_bytes, contiguous_ends_[page] - offset);
+      uint64_t phys_addr = page_phys_addrs_[page] +
+                           ((offset + page_offset_) & (kBufPageSize - 1));
 
-    device_->Send(kId, phys_addr, nb_bytes);
+      device_->Send(this, phys_addr, len);
+
+      offset += len;
+      if (offset == wrap_offset_) {
+        offset = 0;
+      }
+      nb_bytes -= len;
+    }
+  }
+
+  /**
+   * @brief Copies a burst of packets to the pipe's buffer and sends them.
+   *
+   * An alternative to `AllocateBuf()` and `SendAndFree()` for applications
+   * that keep packets in arrays of pointers. Every packet starts a new
+   * `kQuantumSize` block in the buffer. Only whole packets are sent: if the
+   * pipe does not have enough capacity for all of them, even after checking
+   * for completed transmissions, it sends as many as fit and returns.
+   *
+   * @note The previous buffer address returned by `AllocateBuf()` is no longer
+   *       valid after calling this function.
+   *
+   * @param pkts The address of every packet to send.
+   * @param lens The length of every packet to send. Must be at least 1.
+   * @param nb_pkts The number of packets to send.
+   *
+   * @return The number of packets sent, from the start of `pkts`.
+   */
+  uint16_t SendBurst(const uint8_t* const* pkts, const uint16_t* lens,
+                     uint16_t nb_pkts);
+
+  /**
+   * @brief Sends bytes received on an RX pipe without copying them.
+   *
+   * The device reads the bytes straight from the RX pipe's buffer, so that
+   * forwarding packets from one pipe to another does not require copying them
+   * to this pipe's buffer first. The bytes are released from the RX pipe, as
+   * with `RxPipe::Release()`, once they are transmitted. Completions are
+   * processed when calling `Device::ProcessCompletions()` or any other
+   * function that checks for completions, such as `TryExtendBuf()`.
+   *
+   * @warning The application must not free the bytes that it sends with
+   *          `RxPipe::Free()` or `RxPipe::Clear()`. Use `RxPipe::Release()`
+   *          for the received bytes that it does not send instead.
+   *
+   * @param rx_pipe The RX pipe where the bytes were received. Must use the
+   *                same device as this pipe.
+   * @param buf Start of the bytes to send, in `rx_pipe`'s buffer.
+   * @param nb_bytes The number of bytes to send. Must be a multiple of
+   *                 `kQuantumSize`.
+   *
+   * @return 0 on success, -1 on failure.
+   */
+  inline int SendFromRxPipe(RxPipe* rx_pipe, uint8_t* buf, uint32_t nb_bytes) {
+    return device_->SendFromRxPipe(rx_pipe, buf, nb_bytes);
+  }
+
+  /**
+   * @brief Sends bytes from memory registered with
+   *        `Device::RegisterMemory()` without copying them.
+   *
+   * The bytes must hold packets in the same format as the pipe's buffer, i.e.,
+   * every packet starts at a `kQuantumSize` boundary. The application must not
+   * modify them until they are transmitted, use
+   * `Device::registered_tx_pending()` to know when that happens.
+   *
+   * @param buf Start of the bytes to send. Must be aligned to `kQuantumSize`.
+   * @param nb_bytes The number of bytes to send. Must be a multiple of
+   *                 `kQuantumSize`.
+   *
+   * @return 0 on success, -1 if the bytes are not in registered memory.
+   */
+  inline int SendRegistered(const void* buf, uint32_t nb_bytes) {
+    return device_->SendRegistered((const uint8_t*)buf, nb_bytes);
   }
 
   /**
@@ -859,7 +1850,7 @@ class TxPipe {
    * User may use `capacity()` to check the total number of available bytes
    * after calling this function or simply use the return value.
    *
-   * @note The capacity will never be extended beyond `TxPipe::kMaxCapacity`.
+   * @note The capacity will never be extended beyond `max_capacity()`.
    *
    * @return The new buffer capacity after extending.
    */
@@ -878,21 +1869,35 @@ class TxPipe {
    * User may use `capacity()` to check the total number of available bytes
    * after calling this function or simply use the return value.
    *
-   * @warning The capacity will never be extended beyond `TxPipe::kMaxCapacity`.
+   * @warning The capacity will never be extended beyond `max_capacity()`.
    *          Therefore, specifying a target capacity larger than
-   *          `TxPipe::kMaxCapacity` will block forever.
+   *          `max_capacity()` will block forever.
    *
    * @return The new buffer capacity after extending.
    */
   inline uint32_t ExtendBufToTarget(uint32_t target_capacity) {
     uint32_t _capacity = capacity();
-    assert(target_capacity <= kMaxCapacity);
+    assert(target_capacity <= max_capacity());
+    if (_capacity < target_capacity) {
+      // Transmissions that were not signaled would never complete.
+      device_->FlushTx();
+    }
     while (_capacity < target_capacity) {
       _capacity = TryExtendBuf();
     }
     return _capacity;
   }
 
+  /**
+   * @brief Signals all queued transmissions to the device.
+   *
+   * Only needed when TX batching is enabled. Also signals transmissions from
+   * other pipes that use the same device.
+   *
+   * @see Device::EnableTxBatching
+   */
+  inline void Flush() { device_->FlushTx(); }
+
   /**
    * @brief Returns the allocated buffer's current available capacity.
    *
@@ -902,7 +1907,7 @@ class TxPipe {
    * @return The capacity of the allocated buffer in bytes.
    */
   inline uint32_t capacity() const {
-    return (app_end_ - app_begin_ - 1) & kBufMask;
+    return (app_end_ - app_begin_ - 1) & buf_mask_;
   }
 
   /**
@@ -911,9 +1916,24 @@ class TxPipe {
    * @return Number of bytes pending transmission.
    */
   inline uint32_t pending_transmission() const {
-    return kMaxCapacity - ((app_end_ - app_begin_) & kBufMask);
+    return (app_begin_ - app_end_) & buf_mask_;
   }
 
+  /**
+   * @brief Returns the size of the pipe's buffer in bytes.
+   *
+   * @return The size of the pipe's buffer in bytes.
+   */
+  inline uint32_t buf_size() const { return buf_mask_ + 1; }
+
+  /**
+   * @brief Returns the maximum capacity achievable by this pipe. There should
+   *        always be at least one buffer quantum available.
+   *
+   * @return The maximum capacity in bytes.
+   */
+  inline uint32_t max_capacity() const { return buf_mask_ + 1 - kQuantumSize; }
+
   /**
    * @brief Returns the pipe's internal buffer.
    *
@@ -954,10 +1974,12 @@ class TxPipe {
   static constexpr uint32_t kQuantumSize = 64;
 
   /**
-   * Maximum capacity achievable by the pipe. There should always be at least
-   * one buffer quantum available.
+   * Maximum capacity achievable by a pipe with the default buffer size. There
+   * should always be at least one buffer quantum available.
+   *
+   * @see TxPipe::max_capacity() for pipes allocated with other sizes.
    */
-  static constexpr uint32_t kMaxCapacity = kEnsoPipeSize * 64 - kQuantumSize;
+  static constexpr uint32_t kMaxCapacity = kDefaultPipeBufSize - kQuantumSize;
 
  private:
   /**
@@ -968,9 +1990,15 @@ class TxPipe {
    * @param device The `Device` object that instantiated this pipe.
    * @param buf Buffer address to use for the pipe. It must be a pinned
    *            hugepage. If not specified, the buffer is allocated internally.
+   * @param buf_size Size of the pipe buffer in bytes.
    */
-  explicit TxPipe(uint32_t id, Device* device, uint8_t* buf = nullptr) noexcept
-      : kId(id), device_(device), buf_(buf), internal_buf_(buf == nullptr) {}
+  explicit TxPipe(uint32_t id, Device* device, uint8_t* buf = nullptr,
+                  uint32_t buf_size = kDefaultPipeBufSize) noexcept
+      : kId(id),
+        device_(device),
+        buf_(buf),
+        internal_buf_(buf == nullptr),
+        buf_mask_(buf_size - 1) {}
 
   /**
    * @note TxPipes cannot be deallocated from outside. The `Device` object is in
@@ -985,19 +2013,10 @@ class TxPipe {
    */
   int Init() noexcept;
 
-  /**
-   * @brief Notifies the Pipe that a given number of bytes have been sent.
-   *
-   * Should be used by the `Device` object only.
-   *
-   * @param nb_bytes The number of bytes that have been sent.
-   */
-  inline void NotifyCompletion(uint32_t nb_bytes) {
-    app_end_ = (app_end_ + nb_bytes) & kBufMask;
-  }
-
   inline std::string GetHugePageFilePath() const {
+    // TX pipe IDs are only unique within a device.
     return device_->huge_page_prefix_ + std::string(kHugePagePathPrefix) +
+           std::to_string(device_->notification_buf_pair_.id) + "_" +
            std::to_string(kId);
   }
 
@@ -1009,12 +2028,15 @@ class TxPipe {
   uint8_t* buf_;
   bool internal_buf_;       // If true, the buffer is allocated internally.
   uint32_t app_begin_ = 0;  // The next byte to be sent.
-  uint32_t app_end_ = 0;    // The next byte to be allocated.
-  uint64_t buf_phys_addr_;
+  uint32_t app_end_ = 0;    // The next byte to be allocated (unmasked).
+  uint32_t buf_mask_;       // Buffer size minus one (size is a power of 2).
 
-  static constexpr uint32_t kBufMask = (kMaxCapacity + kQuantumSize) - 1;
-  static_assert((kBufMask & (kBufMask + 1)) == 0,
-                "(kBufMask + 1) must be a power of 2");
+  // Transfers reaching this offset continue from the start of the buffer. It
+  // is past the buffer size for buffers with a guard region.
+  uint32_t wrap_offset_;
+  uint32_t page_offset_;  // Offset of the buffer within its first huge page.
+  std::vector<uint64_t> page_phys_addrs_;  // Physical address of each page.
+  std::vector<uint32_t> contiguous_ends_;  // End of each contiguous region.
 
   // Buffer layout:
   //                                     | app_begin_          | app_end_
@@ -1035,7 +2057,8 @@ class TxPipe {
   // To reclaim space, the user must call `Extend()`, which will check for
   // completions and potentially advance the `hw_begin_`. We can then advance
   // `app_end_` to match `hw_begin_`, increasing the available space to the
-  // user.
+  // user. Completions add the number of bytes sent directly to `app_end_`, so
+  // it must be masked before use.
   //
   // All the buffer pointers (i.e., app_begin_, app_end_, hw_begin_, hw_end_)
   // are in units of 64 bytes. The buffer itself is a circular buffer, so
@@ -1088,6 +2111,14 @@ class RxTxPipe {
     return rx_pipe_->Bind(dst_port, src_port, dst_ip, src_ip, protocol);
   }
 
+  /**
+   * @copydoc RxPipe::BindMany
+   */
+  inline int BindMany(const FlowEntry* flows, uint32_t nb_flows,
+                      ConfigTicket* ticket = nullptr) {
+    return rx_pipe_->BindMany(flows, nb_flows, ticket);
+  }
+
   /**
    * @copydoc RxPipe::Recv
    */
@@ -1137,6 +2168,18 @@ class RxTxPipe {
     return rx_pipe_->PeekPkts(max_nb_pkts);
   }
 
+  /**
+   * @copydoc RxPipe::RecvBurst
+   *
+   * @note The packets can be sent back with `SendAndFree()`, which sends
+   *       everything received so far.
+   */
+  inline uint16_t RecvBurst(uint8_t** pkts, uint16_t* lens,
+                            uint16_t max_nb_pkts) {
+    device_->ProcessCompletions();
+    return rx_pipe_->RecvBurst(pkts, lens, max_nb_pkts);
+  }
+
   /**
    * @brief Prefetches the next batch of bytes to be received on the RxTxPipe.
    *
@@ -1160,8 +2203,20 @@ class RxTxPipe {
   inline void SendAndFree(uint32_t nb_bytes) {
     tx_pipe_->SendAndFree(nb_bytes);
     last_tx_pipe_capacity_ -= nb_bytes;
+
+    // Only pipes with pending transmissions may get completions, so these are
+    // the only ones that the device needs to notify.
+    if (!pending_tx_) {
+      pending_tx_ = true;
+      device_->pending_tx_rx_tx_pipes_.push_back(this);
+    }
   }
 
+  /**
+   * @copydoc TxPipe::Flush
+   */
+  inline void Flush() { tx_pipe_->Flush(); }
+
   /**
    * @brief Process completions for this pipe, potentially freeing up space to
    * receive more data.
@@ -1220,6 +2275,20 @@ class RxTxPipe {
     rx_pipe_->set_context(new_context);
   }
 
+  /**
+   * @copydoc RxPipe::SetSchedParams
+   */
+  inline int SetSchedParams(const RxSchedParams& params) noexcept {
+    return rx_pipe_->SetSchedParams(params);
+  }
+
+  /**
+   * @copydoc RxPipe::sched_params
+   */
+  inline const RxSchedParams& sched_params() const {
+    return rx_pipe_->sched_params();
+  }
+
   /**
    * @copydoc RxPipe::kQuantumSize
    */
@@ -1240,7 +2309,7 @@ class RxTxPipe {
    * Threshold for processing completions. If the RX pipe's capacity is greater
    * than this threshold, we process completions.
    */
-  static constexpr uint32_t kCompletionsThreshold = kEnsoPipeSize * 64 / 2;
+  static constexpr uint32_t kCompletionsThreshold = kDefaultPipeBufSize / 2;
 
   /**
    * RxTxPipes can only be instantiated from a Device object, using the
@@ -1261,10 +2330,23 @@ class RxTxPipe {
    * @brief Initializes the RX/TX pipe.
    *
    * @param fallback Whether this pipe is a fallback pipe.
+   * @param buf_size Size of the pipe buffer in bytes.
+   * @param sched_params Scheduling parameters of the pipe.
+   *
+   * @return 0 on success and a non-zero error code on failure.
+   */
+  int Init(bool fallback, uint32_t buf_size,
+           const RxSchedParams& sched_params) noexcept;
+
+  /**
+   * @brief Initializes the RX/TX pipe with an RX pipe that is already
+   *        allocated.
+   *
+   * @param rx_pipe The RX pipe to use.
    *
    * @return 0 on success and a non-zero error code on failure.
    */
-  int Init(bool fallback) noexcept;
+  int Init(RxPipe* rx_pipe) noexcept;
 
   friend class Device;
 
@@ -1272,6 +2354,8 @@ class RxTxPipe {
   RxPipe* rx_pipe_;
   TxPipe* tx_pipe_;
   uint32_t last_tx_pipe_capacity_;
+  bool pending_tx_ = false;  // If in the device's `pending_tx_rx_tx_pipes_`.
+  RxTxPipe* next_moved_ = nullptr;  // Next pipe in the device's moved list.
 };
 
 /**
@@ -43,8 +43,12 @@
 #include <enso/consts.h>
 #include <enso/helpers.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
 #include <filesystem>
@@ -177,6 +181,22 @@ class Queue {
    */
   inline uint32_t capacity() const noexcept { return capacity_; }
 
+  /**
+   * @brief Checks if the queue's file was removed or replaced since we joined
+   *        the queue, e.g., because the process that created it exited.
+   *
+   * Elements pushed to a stale queue are never seen by the other side.
+   *
+   * @return true if the queue is stale, false otherwise.
+   */
+  bool IsStale() const noexcept {
+    struct stat file_stat;
+    if (stat(huge_page_path_.c_str(), &file_stat) != 0) {
+      return true;
+    }
+    return file_stat.st_dev != file_dev_ || file_stat.st_ino != file_ino_;
+  }
+
   static_assert(std::is_trivially_copyable<T>::value,
                 "T must be trivially copyable");
 
@@ -273,6 +293,12 @@ class Queue {
       memset(buf_addr_, 0, size_);
     }
 
+    struct stat file_stat;
+    if (stat(huge_page_path_.c_str(), &file_stat) == 0) {
+      file_dev_ = file_stat.st_dev;
+      file_ino_ = file_stat.st_ino;
+    }
+
     return 0;
   }
 
@@ -289,6 +315,8 @@ class Queue {
   uint32_t index_mask_;
   Element* buf_addr_ = nullptr;
   std::string huge_page_path_;
+  dev_t file_dev_ = 0;
+  ino_t file_ino_ = 0;
   bool created_queue_ = false;
   std::string queue_name_;
   std::string huge_page_prefix_;
@@ -305,7 +333,8 @@ class QueueProducer : public Queue<T, QueueProducer<T>> {
    */
   inline int Push(const T& data) {
     struct Parent::Element* current_element = &(Parent::buf_addr()[tail_]);
-    if (unlikely(current_element->signal)) {
+    uint64_t signal = current_element->signal;
+    if (unlikely(signal == 1)) {
       return -1;  // Queue is full.
     }
 
@@ -317,11 +346,71 @@ class QueueProducer : public Queue<T, QueueProducer<T>> {
 
     _mm512_storeu_si512((__m512i*)current_element, tmp_element_raw);
 
+    if (unlikely(signal == kSignalWaiting)) {
+      futex_wake((volatile uint32_t*)&current_element->signal);
+    }
+
     tail_ = (tail_ + 1) & Parent::index_mask();
 
     return 0;
   }
 
+  /**
+   * @brief Pushes multiple elements to the queue.
+   *
+   * Elements are written using streaming stores, so that the producer does not
+   * keep the queue cache lines that the consumer is about to read. Consumers
+   * release elements in order, so we can tell that there is room for all the
+   * elements by looking only at the last one.
+   *
+   * @param data array with the elements to push.
+   * @param nb_elements number of elements in `data`.
+   * @return number of elements pushed. May be smaller than `nb_elements` if the
+   *         queue becomes full.
+   */
+  inline uint32_t PushBulk(const T* data, uint32_t nb_elements) {
+    struct Parent::Element* buf = Parent::buf_addr();
+    uint32_t index_mask = Parent::index_mask();
+
+    uint32_t nb_free = std::min(nb_elements, Parent::capacity());
+    if (nb_free == 0) {
+      return 0;
+    }
+
+    if (buf[(tail_ + nb_free - 1) & index_mask].signal == 1) {
+      // Not enough room for all the elements, find how many we can push.
+      nb_free = 0;
+      while (nb_free < nb_elements &&
+             buf[(tail_ + nb_free) & index_mask].signal != 1) {
+        ++nb_free;
+      }
+    }
+
+    // Only the first element may have a consumer waiting on it.
+    struct Parent::Element* first_element = &buf[tail_];
+    bool wake_consumer = first_element->signal == kSignalWaiting;
+
+    __m512i tmp_element_raw;
+    struct Parent::Element* tmp_element =
+        (struct Parent::Element*)(&tmp_element_raw);
+    tmp_element->signal = 1;
+
+    for (uint32_t i = 0; i < nb_free; ++i) {
+      tmp_element->data = data[i];
+      _mm512_stream_si512((__m512i*)&buf[tail_], tmp_element_raw);
+      tail_ = (tail_ + 1) & index_mask;
+    }
+
+    // Streaming stores are weakly ordered, make sure they become visible.
+    _mm_sfence();
+
+    if (unlikely(wake_consumer && nb_free > 0)) {
+      futex_wake((volatile uint32_t*)&first_element->signal);
+    }
+
+    return nb_free;
+  }
+
  protected:
   explicit QueueProducer(const std::string& queue_name, size_t size,
                          const std::string& huge_page_prefix) noexcept
@@ -347,16 +436,16 @@ class QueueProducer : public Queue<T, QueueProducer<T>> {
     // Synchronize the pointer in case the queue is not empty.
     struct Parent::Element* buf = Parent::buf_addr();
     for (uint32_t i = 0; i < Parent::capacity(); ++i) {
-      if (buf[i].signal) {
+      if (buf[i].signal == 1) {
         tail_ = (i + 1) & Parent::index_mask();
       }
 
-      if (buf[tail_].signal == 0) {
+      if (buf[tail_].signal != 1) {
         break;
       }
     }
 
-    if (tail_ == 0 && buf[0].signal) {
+    if (tail_ == 0 && buf[0].signal == 1) {
       std::cerr << "Cannot synchronize a full queue" << std::endl;
       return -1;
     }
@@ -374,7 +463,23 @@ class QueueProducer : public Queue<T, QueueProducer<T>> {
 template <typename T>
 class QueueConsumer : public Queue<T, QueueConsumer<T>> {
  public:
-  ~QueueConsumer() noexcept {}
+  /**
+   * @brief Number of popped elements that the consumer accumulates before
+   *        releasing them back to the producer.
+   */
+  static constexpr uint32_t kReleaseBatchSize = 8;
+
+  /**
+   * @brief Maximum time that `Wait` sleeps before checking the queue again (in
+   *        microseconds).
+   */
+  static constexpr uint32_t kMaxSleepUs = 1000;
+
+  ~QueueConsumer() noexcept {
+    if (Parent::buf_addr() != nullptr) {
+      Release();
+    }
+  }
 
   /**
    * @brief Returns the data at the front of the queue without popping it.
@@ -384,31 +489,195 @@ class QueueConsumer : public Queue<T, QueueConsumer<T>> {
    */
   inline T* Front() {
     struct Parent::Element* current_element = &(Parent::buf_addr()[head_]);
-    if (!current_element->signal) {
+    if (current_element->signal != 1) {
+      Release();
       return nullptr;  // Queue is empty.
     }
     return &(current_element->data);
   }
 
+  /**
+   * @brief Returns pointers to the data at the front of the queue without
+   *        popping it.
+   *
+   * @param data array that will hold pointers to the data.
+   * @param max_nb_elements maximum number of pointers to return.
+   * @return number of pointers written to `data`.
+   */
+  inline uint32_t FrontBulk(T** data, uint32_t max_nb_elements) {
+    struct Parent::Element* buf = Parent::buf_addr();
+    uint32_t index_mask = Parent::index_mask();
+    uint32_t index = head_;
+
+    // Elements that were popped but not released still have the signal set.
+    uint32_t max_nb_valid = Parent::capacity() - nb_unreleased_;
+    max_nb_elements = std::min(max_nb_elements, max_nb_valid);
+
+    uint32_t nb_elements = 0;
+    for (; nb_elements < max_nb_elements; ++nb_elements) {
+      struct Parent::Element* current_element = &buf[index];
+      if (current_element->signal != 1) {
+        Release();
+        break;
+      }
+      data[nb_elements] = &(current_element->data);
+      index = (index + 1) & index_mask;
+    }
+
+    return nb_elements;
+  }
+
   /**
    * @brief Pops data from the queue.
    *
+   * The element is only released back to the producer once
+   * `kReleaseBatchSize` elements are popped or the queue is found empty.
+   *
    * @return the data on success and an empty optional if the queue is empty.
    */
   inline std::optional<T> Pop() {
     struct Parent::Element* current_element = &(Parent::buf_addr()[head_]);
-    if (!current_element->signal) {
+    if (current_element->signal != 1) {
+      Release();
       return {};  // Queue is empty.
     }
 
     T data = current_element->data;
-    current_element->signal = 0;
 
     head_ = (head_ + 1) & Parent::index_mask();
 
+    if (++nb_unreleased_ == release_batch_size_) {
+      Release();
+    }
+
     return data;
   }
 
+  /**
+   * @brief Pops multiple elements from the queue.
+   *
+   * @param data array that will hold the popped data.
+   * @param max_nb_elements maximum number of elements to pop.
+   * @return number of elements popped.
+   */
+  inline uint32_t PopBulk(T* data, uint32_t max_nb_elements) {
+    struct Parent::Element* buf = Parent::buf_addr();
+    uint32_t index_mask = Parent::index_mask();
+
+    // Elements that were popped but not released still have the signal set.
+    uint32_t max_nb_valid = Parent::capacity() - nb_unreleased_;
+    uint32_t max_nb_to_pop = std::min(max_nb_elements, max_nb_valid);
+
+    uint32_t nb_elements = 0;
+    for (; nb_elements < max_nb_to_pop; ++nb_elements) {
+      struct Parent::Element* current_element = &buf[head_];
+      if (current_element->signal != 1) {
+        break;
+      }
+      data[nb_elements] = current_element->data;
+      head_ = (head_ + 1) & index_mask;
+    }
+
+    nb_unreleased_ += nb_elements;
+
+    if (nb_elements < max_nb_elements ||
+        nb_unreleased_ >= release_batch_size_) {
+      Release();
+    }
+
+    return nb_elements;
+  }
+
+  /**
+   * @brief Releases all popped elements back to the producer.
+   *
+   * Called automatically when the queue is empty, after `kReleaseBatchSize`
+   * elements are popped, and when the consumer is destroyed.
+   */
+  inline void Release() {
+    struct Parent::Element* buf = Parent::buf_addr();
+    uint32_t index_mask = Parent::index_mask();
+    uint32_t index = (head_ - nb_unreleased_) & index_mask;
+
+    for (uint32_t i = 0; i < nb_unreleased_; ++i) {
+      buf[index].signal = 0;
+      index = (index + 1) & index_mask;
+    }
+
+    nb_unreleased_ = 0;
+  }
+
+  /**
+   * @brief Waits until the queue has data.
+   *
+   * Spins for up to `spin_us` microseconds and then sleeps until the producer
+   * pushes new data, saving the CPU when the queue is idle.
+   *
+   * @note A producer that is pushing at the same time that the consumer goes
+   *       to sleep may miss the wakeup, so a single sleep never takes longer
+   *       than `kMaxSleepUs`.
+   *
+   * @param spin_us time to spin before sleeping (in microseconds).
+   * @param timeout_us maximum time to wait (in microseconds). If 0, waits
+   *        until the queue has data.
+   * @return 0 if the queue has data and -1 on timeout.
+   */
+  int Wait(uint32_t spin_us = kDefaultWaitSpinUs, uint32_t timeout_us = 0) {
+    volatile uint64_t* signal = &(Parent::buf_addr()[head_].signal);
+    if (*signal == 1) {
+      return 0;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto spin_end = start + std::chrono::microseconds(spin_us);
+
+    // Reading the clock is expensive, so we only do it every few iterations.
+    for (uint32_t i = 1; *signal != 1; ++i) {
+      if ((i % kSpinIterationsPerClockRead) == 0 &&
+          std::chrono::steady_clock::now() >= spin_end) {
+        break;
+      }
+      _mm_pause();
+    }
+
+    if (*signal == 1) {
+      return 0;
+    }
+
+    // The producer may be waiting for elements that we already popped.
+    Release();
+
+    uint64_t expected = 0;
+    __atomic_compare_exchange_n(signal, &expected, kSignalWaiting, false,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+    auto deadline = start + std::chrono::microseconds(timeout_us);
+    while (*signal != 1) {
+      uint32_t sleep_us = kMaxSleepUs;
+      if (timeout_us != 0) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+          // Producers no longer need to wake us up.
+          expected = kSignalWaiting;
+          if (__atomic_compare_exchange_n(signal, &expected, 0, false,
+                                          __ATOMIC_SEQ_CST,
+                                          __ATOMIC_SEQ_CST)) {
+            return -1;
+          }
+
+          // A producer overwrote the mark before we could clear it.
+          return *signal == 1 ? 0 : -1;
+        }
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+            deadline - now);
+        sleep_us = std::min(sleep_us, (uint32_t)remaining.count() + 1);
+      }
+      futex_wait((volatile uint32_t*)signal, kSignalWaiting, sleep_us);
+    }
+
+    return 0;
+  }
+
  protected:
   explicit QueueConsumer(const std::string& queue_name, size_t size,
                          const std::string& huge_page_prefix) noexcept
@@ -427,6 +696,8 @@ class QueueConsumer : public Queue<T, QueueConsumer<T>> {
       return -1;
     }
 
+    release_batch_size_ = std::min(kReleaseBatchSize, Parent::capacity());
+
     if (Parent::created_queue()) {
       return 0;
     }
@@ -434,17 +705,17 @@ class QueueConsumer : public Queue<T, QueueConsumer<T>> {
     // Synchronize the pointer in case the queue is not empty.
     struct Parent::Element* buf = Parent::buf_addr();
     for (uint32_t i = Parent::capacity(); i > 0; --i) {
-      if (buf[i - 1].signal) {
+      if (buf[i - 1].signal == 1) {
         head_ = i - 1;
       }
 
       uint32_t prev_element = (head_ - 1) & Parent::index_mask();
-      if (buf[prev_element].signal == 0) {
+      if (buf[prev_element].signal != 1) {
         break;
       }
     }
 
-    if (head_ == 0 && buf[0].signal) {
+    if (head_ == 0 && buf[0].signal == 1) {
       std::cerr << "Cannot synchronize a full queue" << std::endl;
       return -1;
     }
@@ -457,6 +728,178 @@ class QueueConsumer : public Queue<T, QueueConsumer<T>> {
   friend Parent;
 
   uint32_t head_ = 0;
+  static constexpr uint32_t kSpinIterationsPerClockRead = 64;
+
+  uint32_t nb_unreleased_ = 0;
+  uint32_t release_batch_size_ = kReleaseBatchSize;
+};
+
+/**
+ * @brief Queue that supports multiple producers and multiple consumers.
+ *
+ * Unlike QueueProducer and QueueConsumer, the same class is used by both
+ * producers and consumers and any number of them may join the same queue,
+ * including from different processes. The `signal` in every element holds a
+ * sequence number that tells producers and consumers whether the element is
+ * ready for them. The first elements in the buffer are reserved to keep the
+ * producer and consumer positions, which are shared by all instances.
+ *
+ * Example:
+ *   // Any thread.
+ *   std::unique_ptr<QueueMpmc<int>> queue = QueueMpmc<int>::Create("name");
+ *
+ *   queue->Push(42);
+ *
+ *   int data = queue->Pop().value_or(-1);  // Any thread may get 42.
+ */
+template <typename T>
+class QueueMpmc : public Queue<T, QueueMpmc<T>> {
+ public:
+  ~QueueMpmc() noexcept {}
+
+  /**
+   * @brief Pushes data to the queue.
+   *
+   * @param data data to push.
+   * @return 0 on success and a non-zero error code on failure.
+   */
+  inline int Push(const T& data) {
+    uint64_t pos = metadata_->tail.load(std::memory_order_relaxed);
+    struct Parent::Element* element;
+
+    while (true) {
+      element = &elements_[pos % capacity_];
+      uint64_t seq = __atomic_load_n(&element->signal, __ATOMIC_ACQUIRE);
+      int64_t diff = (int64_t)(seq - pos);
+
+      if (diff == 0) {
+        if (metadata_->tail.compare_exchange_weak(pos, pos + 1,
+                                                  std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return -1;  // Queue is full.
+      } else {
+        pos = metadata_->tail.load(std::memory_order_relaxed);
+      }
+    }
+
+    element->data = data;
+    __atomic_store_n(&element->signal, pos + 1, __ATOMIC_RELEASE);
+
+    return 0;
+  }
+
+  /**
+   * @brief Pops data from the queue.
+   *
+   * @return the data on success and an empty optional if the queue is empty.
+   */
+  inline std::optional<T> Pop() {
+    uint64_t pos = metadata_->head.load(std::memory_order_relaxed);
+    struct Parent::Element* element;
+
+    while (true) {
+      element = &elements_[pos % capacity_];
+      uint64_t seq = __atomic_load_n(&element->signal, __ATOMIC_ACQUIRE);
+      int64_t diff = (int64_t)(seq - (pos + 1));
+
+      if (diff == 0) {
+        if (metadata_->head.compare_exchange_weak(pos, pos + 1,
+                                                  std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return {};  // Queue is empty.
+      } else {
+        pos = metadata_->head.load(std::memory_order_relaxed);
+      }
+    }
+
+    T data = element->data;
+    __atomic_store_n(&element->signal, pos + capacity_, __ATOMIC_RELEASE);
+
+    return data;
+  }
+
+  /**
+   * @brief Returns the capacity of the queue.
+   * @return The capacity of the queue in number of elements.
+   */
+  inline uint32_t capacity() const noexcept { return capacity_; }
+
+ protected:
+  explicit QueueMpmc(const std::string& queue_name, size_t size,
+                     const std::string& huge_page_prefix) noexcept
+      : Queue<T, QueueMpmc<T>>(queue_name, size, huge_page_prefix) {}
+
+  /**
+   * @brief Initializes the Queue object.
+   *
+   * @param join_if_exists If true, the queue will be joined if it already
+   *        exists. If false, the creation will fail if the queue already
+   *        exists.
+   * @return 0 on success and a non-zero error code on failure.
+   */
+  int Init(bool join_if_exists) noexcept {
+    if (Parent::Init(join_if_exists)) {
+      return -1;
+    }
+
+    if (Parent::capacity() <= kNbMetadataElements) {
+      std::cerr << "Queue size must be at least "
+                << (kNbMetadataElements + 1) * sizeof(struct Parent::Element)
+                << " bytes" << std::endl;
+      return -1;
+    }
+
+    metadata_ = reinterpret_cast<struct Metadata*>(Parent::buf_addr());
+    elements_ = Parent::buf_addr() + kNbMetadataElements;
+    capacity_ = Parent::capacity() - kNbMetadataElements;
+
+    if (Parent::created_queue()) {
+      for (uint32_t i = 0; i < capacity_; ++i) {
+        elements_[i].signal = i;
+      }
+      metadata_->head.store(0, std::memory_order_relaxed);
+      metadata_->tail.store(0, std::memory_order_relaxed);
+      metadata_->ready.store(1, std::memory_order_release);
+      return 0;
+    }
+
+    // Wait for the queue creator to initialize the sequence numbers.
+    for (uint32_t i = 0; i < kMaxInitWaitMs; ++i) {
+      if (metadata_->ready.load(std::memory_order_acquire)) {
+        return 0;
+      }
+      usleep(1000);
+    }
+
+    std::cerr << "Queue was not initialized by its creator" << std::endl;
+    return -1;
+  }
+
+ private:
+  using Parent = Queue<T, QueueMpmc<T>>;
+  friend Parent;
+
+  struct Metadata {
+    alignas(kCacheLineSize) std::atomic<uint64_t> tail;
+    alignas(kCacheLineSize) std::atomic<uint64_t> head;
+    alignas(kCacheLineSize) std::atomic<uint64_t> ready;
+  };
+
+  static constexpr uint32_t kNbMetadataElements =
+      sizeof(struct Metadata) / sizeof(struct Parent::Element);
+
+  static constexpr uint32_t kMaxInitWaitMs = 1000;
+
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "Shared memory atomics must be lock free");
+
+  struct Metadata* metadata_ = nullptr;
+  struct Parent::Element* elements_ = nullptr;
+  uint32_t capacity_ = 0;
 };
 
 }  // namespace enso
@@ -83,6 +83,7 @@ ssize_t recv_select(int ref_sockfd, int *sockfd, void **buf, size_t len,
  * Send the bytes pointed by address `phys_addr` through the `sockfd` socket.
  * There are two important differences to a traditional POSIX `send`:
  * - Memory must be pinned (phys_addr needs to be a physical address);
+ * - Memory must be physically contiguous for the entire `len`;
  * - It is not safe to change the buffer content until the transmission is done.
  *
  * This function blocks until it can send but returns before the transmission is
@@ -32,19 +32,37 @@
 
 #include "event_queue.h"
 
+#include <linux/delay.h>
+#include <linux/sched/signal.h>
+#include <linux/uaccess.h>
+
 #include "event_handler.h"
 #include "intel_fpga_pcie_setup.h"
 
 // HACK(sadok) number of queues should not be fixed
 #define NB_QUEUES 2
 
+// The device does not raise interrupts, so waiting for notifications is not
+// event driven. While there are waiters, the kthread polls for them by waking
+// all of them up this often so that they check their notification buffers.
+#define NOTIF_POLL_PERIOD_US 50
+
 int event_queue_loop(event_kthread_data_t* data) {
   int queue_id = 0;
   while (!kthread_should_stop()) {
+    if (atomic_read(&data->nb_notif_waiters) > 0) {
+      usleep_range(NOTIF_POLL_PERIOD_US, 2 * NOTIF_POLL_PERIOD_US);
+      atomic_inc(&data->notif_epoch);
+      wake_up_interruptible_all(&data->notif_queue);
+      continue;
+    }
+
     // FIXME(sadok) this is a very generous sleep that we should remove when
     // doing something useful here
-    // we can also pass a condition here instead of 0
-    wait_event_timeout(data->queue, 0, HZ);
+    wait_event_timeout(data->queue,
+                       atomic_read(&data->nb_notif_waiters) > 0 ||
+                           kthread_should_stop(),
+                       HZ);
 
     handle_event(queue_id);
 
@@ -54,8 +72,63 @@ int event_queue_loop(event_kthread_data_t* data) {
   return 0;
 }
 
+/**
+ * wait_for_notification() - Sleeps until the notification signal at
+ *                           `signal_addr` is set.
+ *
+ * The signal is checked every time the event kthread wakes the waiters up,
+ * i.e., every `NOTIF_POLL_PERIOD_US`. This is polling done in the kernel
+ * instead of in the application, not an interrupt-driven wake up.
+ *
+ * @signal_addr: User address of the `signal` of the next notification.
+ * @timeout_us:  Maximum time to wait. Zero means no timeout.
+ *
+ * Must be called from the context of the process that owns `signal_addr`.
+ *
+ * Return: 0 if the signal is set, negative error code otherwise.
+ */
+long wait_for_notification(uint64_t __user* signal_addr, uint32_t timeout_us) {
+  event_kthread_data_t* data = &global_bk.event_kthread_data;
+  unsigned long deadline = jiffies + usecs_to_jiffies(timeout_us);
+  uint64_t signal;
+  long retval = 0;
+
+  atomic_inc(&data->nb_notif_waiters);
+  wake_up(&data->queue);
+
+  while (1) {
+    int epoch = atomic_read(&data->notif_epoch);
+
+    if (get_user(signal, signal_addr)) {
+      retval = -EFAULT;
+      break;
+    }
+    if (signal) {
+      break;
+    }
+    if (timeout_us && time_after_eq(jiffies, deadline)) {
+      retval = -ETIMEDOUT;
+      break;
+    }
+    if (signal_pending(current)) {
+      retval = -ERESTARTSYS;
+      break;
+    }
+
+    wait_event_interruptible_timeout(
+        data->notif_queue, atomic_read(&data->notif_epoch) != epoch, HZ);
+  }
+
+  atomic_dec(&data->nb_notif_waiters);
+
+  return retval;
+}
+
 int launch_event_kthread(void) {
   init_waitqueue_head(&global_bk.event_kthread_data.queue);
+  init_waitqueue_head(&global_bk.event_kthread_data.notif_queue);
+  atomic_set(&global_bk.event_kthread_data.nb_notif_waiters, 0);
+  atomic_set(&global_bk.event_kthread_data.notif_epoch, 0);
 
   global_bk.event_kthread_data.task = kthread_create_on_node(
       (int (*)(void*))event_queue_loop, &global_bk.event_kthread_data,
@@ -33,15 +33,25 @@
 #ifndef SOFTWARE_KERNEL_LINUX_EVENT_QUEUE_H_
 #define SOFTWARE_KERNEL_LINUX_EVENT_QUEUE_H_
 
+#include <linux/atomic.h>
 #include <linux/kthread.h>
+#include <linux/wait.h>
 
 typedef struct kthread_struct {
   wait_queue_head_t queue;
   struct task_struct* task;
+
+  // Applications sleeping until a notification arrives. The device does not
+  // raise interrupts, so while there are waiters the kthread periodically
+  // bumps `notif_epoch` and wakes them up to check their notification buffer.
+  wait_queue_head_t notif_queue;
+  atomic_t nb_notif_waiters;
+  atomic_t notif_epoch;
 } event_kthread_data_t;
 
 int event_queue_loop(event_kthread_data_t* data);
 int launch_event_kthread(void);
 void stop_event_kthread(void);
+long wait_for_notification(uint64_t __user* signal_addr, uint32_t timeout_us);
 
 #endif  // SOFTWARE_KERNEL_LINUX_EVENT_QUEUE_H_
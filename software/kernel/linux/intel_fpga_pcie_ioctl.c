@@ -75,6 +75,9 @@ static long free_notif_buffer(struct chr_dev_bookkeep *chr_dev_bk,
 static long alloc_pipe(struct chr_dev_bookkeep *chr_dev_bk,
                        unsigned int __user *user_addr);
 static long free_pipe(struct chr_dev_bookkeep *chr_dev_bk, unsigned long uarg);
+static long alloc_pipes(struct chr_dev_bookkeep *chr_dev_bk,
+                        struct intel_fpga_pcie_alloc_pipes __user *user_addr);
+static long wait_notif(struct intel_fpga_pcie_wait_notif __user *user_addr);
 
 /******************************************************************************
  * Device and I/O control function
@@ -202,6 +205,14 @@ long intel_fpga_pcie_unlocked_ioctl(struct file *filp, unsigned int cmd,
     case INTEL_FPGA_PCIE_IOCTL_FREE_PIPE:
       retval = free_pipe(chr_dev_bk, uarg);
       break;
+    case INTEL_FPGA_PCIE_IOCTL_WAIT_NOTIF:
+      retval =
+          wait_notif((struct intel_fpga_pcie_wait_notif __user *)uarg);
+      break;
+    case INTEL_FPGA_PCIE_IOCTL_ALLOC_PIPES:
+      retval = alloc_pipes(
+          chr_dev_bk, (struct intel_fpga_pcie_alloc_pipes __user *)uarg);
+      break;
     default:
       retval = -ENOTTY;
   }
@@ -526,36 +537,22 @@ static long free_notif_buffer(struct chr_dev_bookkeep *chr_dev_bk,
 }
 
 /**
- * alloc_pipe() - Allocates a pipe for the current device.
+ * reserve_pipe() - Reserves a free pipe. Must be called with the device
+ *                  semaphore held.
  *
- * @chr_dev_bk: Structure containing information about the current
- *              character file handle.
- * @user_addr:  Address to an unsigned int in user-space. It is used as input to
- *              determine if the pipe is a fallback pipe (1 to fallback pipe, 0
- *              if not) and as output to save the pipe ID.
+ * @chr_dev_bk:  Structure containing information about the current
+ *               character file handle.
+ * @is_fallback: True to reserve a fallback pipe.
  *
- * Return: 0 if successful, negative error code otherwise.
+ * Return: Pipe ID if successful, negative error code otherwise.
  */
-static long alloc_pipe(struct chr_dev_bookkeep *chr_dev_bk,
-                       unsigned int __user *user_addr) {
+static int32_t reserve_pipe(struct chr_dev_bookkeep *chr_dev_bk,
+                            bool is_fallback) {
   int32_t i, j;
-  bool is_fallback;
   int32_t pipe_id = -1;
   struct dev_bookkeep *dev_bk;
   dev_bk = chr_dev_bk->dev_bk;
 
-  if (unlikely(down_interruptible(&dev_bk->sem))) {
-    INTEL_FPGA_PCIE_DEBUG(
-        "interrupted while attempting to obtain "
-        "device semaphore.");
-    return -ERESTARTSYS;
-  }
-
-  if (copy_from_user(&is_fallback, user_addr, 1)) {
-    INTEL_FPGA_PCIE_DEBUG("couldn't copy is_fallback information from user.");
-    return -EFAULT;
-  }
-
   if (is_fallback) {  // Fallback pipes are allocated at the front.
     for (i = 0; i < MAX_NB_FLOWS / 8; ++i) {
       int32_t set_pipe_id = 0;
@@ -574,7 +571,6 @@ static long alloc_pipe(struct chr_dev_bookkeep *chr_dev_bk,
       // Make sure all fallback pipes are contiguously allocated.
       if (pipe_id != dev_bk->nb_fb_queues) {
         INTEL_FPGA_PCIE_DEBUG("fallback pipes are not contiguous.");
-        up(&dev_bk->sem);
         return -EINVAL;
       }
 
@@ -597,8 +593,6 @@ static long alloc_pipe(struct chr_dev_bookkeep *chr_dev_bk,
     }
   }
 
-  up(&dev_bk->sem);
-
   if (pipe_id < 0) {
     INTEL_FPGA_PCIE_DEBUG("couldn't allocate pipe.");
     return -ENOMEM;
@@ -611,6 +605,74 @@ static long alloc_pipe(struct chr_dev_bookkeep *chr_dev_bk,
   dev_bk->pipe_status[i] |= (1 << j);
   chr_dev_bk->pipe_status[i] |= (1 << j);
 
+  return pipe_id;
+}
+
+/**
+ * release_pipe() - Releases a pipe reserved with reserve_pipe(). Must be
+ *                  called with the device semaphore held.
+ *
+ * @chr_dev_bk: Structure containing information about the current
+ *              character file handle.
+ * @pipe_id:    The pipe ID to release.
+ */
+static void release_pipe(struct chr_dev_bookkeep *chr_dev_bk,
+                         int32_t pipe_id) {
+  int32_t i = pipe_id / 8;
+  int32_t j = pipe_id % 8;
+  struct dev_bookkeep *dev_bk;
+  dev_bk = chr_dev_bk->dev_bk;
+
+  // Clear status bit for both the device bitvector and the character device
+  // bitvector.
+  dev_bk->pipe_status[i] &= ~(1 << j);
+  chr_dev_bk->pipe_status[i] &= ~(1 << j);
+
+  // Fallback pipes are allocated at the front.
+  if (pipe_id < dev_bk->nb_fb_queues) {
+    --(dev_bk->nb_fb_queues);
+    --(chr_dev_bk->nb_fb_queues);
+  }
+}
+
+/**
+ * alloc_pipe() - Allocates a pipe for the current device.
+ *
+ * @chr_dev_bk: Structure containing information about the current
+ *              character file handle.
+ * @user_addr:  Address to an unsigned int in user-space. It is used as input to
+ *              determine if the pipe is a fallback pipe (1 to fallback pipe, 0
+ *              if not) and as output to save the pipe ID.
+ *
+ * Return: 0 if successful, negative error code otherwise.
+ */
+static long alloc_pipe(struct chr_dev_bookkeep *chr_dev_bk,
+                       unsigned int __user *user_addr) {
+  bool is_fallback;
+  int32_t pipe_id;
+  struct dev_bookkeep *dev_bk;
+  dev_bk = chr_dev_bk->dev_bk;
+
+  if (copy_from_user(&is_fallback, user_addr, 1)) {
+    INTEL_FPGA_PCIE_DEBUG("couldn't copy is_fallback information from user.");
+    return -EFAULT;
+  }
+
+  if (unlikely(down_interruptible(&dev_bk->sem))) {
+    INTEL_FPGA_PCIE_DEBUG(
+        "interrupted while attempting to obtain "
+        "device semaphore.");
+    return -ERESTARTSYS;
+  }
+
+  pipe_id = reserve_pipe(chr_dev_bk, is_fallback);
+
+  up(&dev_bk->sem);
+
+  if (pipe_id < 0) {
+    return pipe_id;
+  }
+
   if (copy_to_user(user_addr, &pipe_id, sizeof(pipe_id))) {
     INTEL_FPGA_PCIE_DEBUG("couldn't copy buf_id information to user.");
     return -EFAULT;
@@ -619,6 +681,80 @@ static long alloc_pipe(struct chr_dev_bookkeep *chr_dev_bk,
   return 0;
 }
 
+/**
+ * alloc_pipes() - Allocates multiple pipes for the current device at once.
+ *
+ * Either all pipes are allocated or none are.
+ *
+ * @chr_dev_bk: Structure containing information about the current
+ *              character file handle.
+ * @user_addr:  Address to a struct intel_fpga_pcie_alloc_pipes in user space.
+ *
+ * Return: 0 if successful, negative error code otherwise.
+ */
+static long alloc_pipes(struct chr_dev_bookkeep *chr_dev_bk,
+                        struct intel_fpga_pcie_alloc_pipes __user *user_addr) {
+  uint32_t i;
+  int32_t *pipe_ids;
+  long retval = 0;
+  struct intel_fpga_pcie_alloc_pipes arg;
+  struct dev_bookkeep *dev_bk;
+  dev_bk = chr_dev_bk->dev_bk;
+
+  if (copy_from_user(&arg, user_addr, sizeof(arg))) {
+    INTEL_FPGA_PCIE_DEBUG("couldn't copy arg from user.");
+    return -EFAULT;
+  }
+
+  if (arg.nb_pipes == 0 || arg.nb_pipes > MAX_NB_FLOWS) {
+    INTEL_FPGA_PCIE_DEBUG("invalid number of pipes.");
+    return -EINVAL;
+  }
+
+  pipe_ids = kmalloc_array(arg.nb_pipes, sizeof(*pipe_ids), GFP_KERNEL);
+  if (pipe_ids == NULL) {
+    return -ENOMEM;
+  }
+
+  if (unlikely(down_interruptible(&dev_bk->sem))) {
+    INTEL_FPGA_PCIE_DEBUG(
+        "interrupted while attempting to obtain "
+        "device semaphore.");
+    kfree(pipe_ids);
+    return -ERESTARTSYS;
+  }
+
+  for (i = 0; i < arg.nb_pipes; ++i) {
+    pipe_ids[i] = reserve_pipe(chr_dev_bk, arg.fallback != 0);
+    if (pipe_ids[i] < 0) {
+      retval = pipe_ids[i];
+      break;
+    }
+  }
+
+  // Copy the IDs while still holding the semaphore so that, if the copy
+  // fails, the pipes can be released before anyone else reserves pipes.
+  if (retval == 0 &&
+      copy_to_user((void __user *)arg.pipe_ids, pipe_ids,
+                   sizeof(*pipe_ids) * arg.nb_pipes)) {
+    INTEL_FPGA_PCIE_DEBUG("couldn't copy pipe IDs to user.");
+    retval = -EFAULT;
+  }
+
+  // Release in reverse order so that fallback pipes stay contiguous.
+  if (retval != 0) {
+    while (i-- > 0) {
+      release_pipe(chr_dev_bk, pipe_ids[i]);
+    }
+  }
+
+  up(&dev_bk->sem);
+
+  kfree(pipe_ids);
+
+  return retval;
+}
+
 /**
  * free_pipe() - Frees a pipe for the current device.
  *
@@ -656,22 +792,32 @@ static long free_pipe(struct chr_dev_bookkeep *chr_dev_bk, unsigned long uarg) {
     return -EINVAL;
   }
 
-  // Clear status bit for both the device bitvector and the character device
-  // bitvector.
-  dev_bk->pipe_status[i] &= ~(1 << j);
-  chr_dev_bk->pipe_status[i] &= ~(1 << j);
-
-  // Fallback pipes are allocated at the front.
-  if (pipe_id < dev_bk->nb_fb_queues) {
-    --(dev_bk->nb_fb_queues);
-    --(chr_dev_bk->nb_fb_queues);
-  }
+  release_pipe(chr_dev_bk, pipe_id);
 
   up(&dev_bk->sem);
 
   return 0;
 }
 
+/**
+ * wait_notif() - Blocks until a notification arrives or the timeout expires.
+ *
+ * @user_addr: Address to a struct intel_fpga_pcie_wait_notif in user space.
+ *
+ * Return: 0 if successful, negative error code otherwise.
+ */
+static long wait_notif(struct intel_fpga_pcie_wait_notif __user *user_addr) {
+  struct intel_fpga_pcie_wait_notif arg;
+
+  if (copy_from_user(&arg, user_addr, sizeof(arg))) {
+    INTEL_FPGA_PCIE_DEBUG("couldn't copy arg from user.");
+    return -EFAULT;
+  }
+
+  return wait_for_notification((uint64_t __user *)arg.signal_addr,
+                               arg.timeout_us);
+}
+
 /**
  * sel_bar() - Switches the selected device to a potentially different
  *             device.
@@ -89,6 +89,33 @@ struct intel_fpga_pcie_ksize {
   int core_id;
 } __attribute__((packed));
 
+/**
+ * struct intel_fpga_pcie_wait_notif - Structure used by WAIT_NOTIF call
+ */
+struct intel_fpga_pcie_wait_notif {
+  /** @signal_addr: User address of the signal of the next notification. */
+  uint64_t signal_addr;
+
+  /** @timeout_us: Maximum time to wait (in microseconds). Zero means no
+   * timeout. */
+  uint32_t timeout_us;
+} __attribute__((packed));
+
+/**
+ * struct intel_fpga_pcie_alloc_pipes - Structure used by ALLOC_PIPES call
+ */
+struct intel_fpga_pcie_alloc_pipes {
+  /** @pipe_ids: User address of an array of @nb_pipes unsigned ints used to
+   * save the pipe IDs. */
+  uint64_t pipe_ids;
+
+  /** @nb_pipes: Number of pipes to allocate. */
+  uint32_t nb_pipes;
+
+  /** @fallback: 1 to allocate fallback pipes, 0 otherwise. */
+  uint32_t fallback;
+} __attribute__((packed));
+
 #define INTEL_FPGA_PCIE_IOCTL_MAGIC 0x70
 #define INTEL_FPGA_PCIE_IOCTL_CHR_SEL_DEV \
   _IOW(INTEL_FPGA_PCIE_IOCTL_MAGIC, 0, unsigned int)
@@ -126,7 +153,11 @@ struct intel_fpga_pcie_ksize {
   _IOR(INTEL_FPGA_PCIE_IOCTL_MAGIC, 16, unsigned int *)
 #define INTEL_FPGA_PCIE_IOCTL_FREE_PIPE \
   _IOR(INTEL_FPGA_PCIE_IOCTL_MAGIC, 17, unsigned int)
-#define INTEL_FPGA_PCIE_IOCTL_MAXNR 17
+#define INTEL_FPGA_PCIE_IOCTL_WAIT_NOTIF \
+  _IOW(INTEL_FPGA_PCIE_IOCTL_MAGIC, 18, struct intel_fpga_pcie_wait_notif *)
+#define INTEL_FPGA_PCIE_IOCTL_ALLOC_PIPES \
+  _IOW(INTEL_FPGA_PCIE_IOCTL_MAGIC, 19, struct intel_fpga_pcie_alloc_pipes *)
+#define INTEL_FPGA_PCIE_IOCTL_MAXNR 19
 
 long intel_fpga_pcie_unlocked_ioctl(struct file *filp, unsigned int cmd,
                                     unsigned long arg);
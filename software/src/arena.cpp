@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Implementation of the huge page arena. @see arena.h
+ */
+
+#include "arena.h"
+
+#include <enso/consts.h>
+#include <enso/ixy_helpers.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <iterator>
+
+namespace enso {
+
+static_assert(HugePageArena::kAlignment >= kMaxNbApps,
+              "Arena alignment must leave room for the notification buffer ID");
+
+std::shared_ptr<HugePageArena> HugePageArena::GetShared(
+    const std::string& huge_page_prefix, uint64_t size) noexcept {
+  static std::mutex shared_arena_mutex;
+  static std::weak_ptr<HugePageArena> shared_arena;
+
+  std::lock_guard<std::mutex> lock(shared_arena_mutex);
+
+  std::shared_ptr<HugePageArena> arena = shared_arena.lock();
+  if (arena) {
+    return arena;
+  }
+
+  if (size == 0 || size % kBufPageSize) {
+    std::cerr << "Huge page arena size must be a multiple of " << kBufPageSize
+              << " bytes" << std::endl;
+    return nullptr;
+  }
+
+  std::string path = huge_page_prefix + std::string(kHugePageArenaPathPrefix) +
+                     std::to_string(getpid());
+
+  uint8_t* addr = (uint8_t*)get_huge_page(path, size);
+  if (addr == nullptr) {
+    std::cerr << "Could not allocate huge page arena" << std::endl;
+    return nullptr;
+  }
+
+  arena.reset(new (std::nothrow) HugePageArena(path, addr, size));
+  if (!arena) {
+    munmap(addr, size);
+    unlink(path.c_str());
+    return nullptr;
+  }
+
+  shared_arena = arena;
+
+  return arena;
+}
+
+HugePageArena::~HugePageArena() noexcept {
+  munmap(addr_, size_);
+  unlink(path_.c_str());
+}
+
+uint8_t* HugePageArena::Allocate(uint64_t size, uint64_t alignment) noexcept {
+  if (size == 0 || (alignment & (alignment - 1))) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // First fit.
+  for (auto it = free_regions_.begin(); it != free_regions_.end(); ++it) {
+    uint64_t region_start = it->first;
+    uint64_t region_end = region_start + it->second;
+
+    uint64_t aligned_addr =
+        ((uint64_t)(addr_ + region_start) + alignment - 1) & ~(alignment - 1);
+    uint64_t start = aligned_addr - (uint64_t)addr_;
+
+    if (start + size > region_end) {
+      continue;
+    }
+
+    free_regions_.erase(it);
+    if (start > region_start) {
+      free_regions_[region_start] = start - region_start;
+    }
+    if (start + size < region_end) {
+      free_regions_[start + size] = region_end - start - size;
+    }
+
+    allocations_[start] = size;
+
+    return addr_ + start;
+  }
+
+  return nullptr;
+}
+
+void HugePageArena::Free(void* addr) noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  uint64_t start = (uint8_t*)addr - addr_;
+  auto allocation = allocations_.find(start);
+  if (allocation == allocations_.end()) {
+    std::cerr << "Trying to free a buffer that is not in the arena"
+              << std::endl;
+    return;
+  }
+
+  uint64_t size = allocation->second;
+  allocations_.erase(allocation);
+
+  // Merge with the adjacent free regions.
+  auto next = free_regions_.lower_bound(start);
+  if (next != free_regions_.end() && next->first == start + size) {
+    size += next->second;
+    next = free_regions_.erase(next);
+  }
+
+  if (next != free_regions_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == start) {
+      prev->second += size;
+      return;
+    }
+  }
+
+  free_regions_[start] = size;
+}
+
+}  // namespace enso
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Arena allocator that carves pipes and notification buffers out of a
+ *        single huge page mapping.
+ */
+
+#ifndef SOFTWARE_SRC_ARENA_H_
+#define SOFTWARE_SRC_ARENA_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace enso {
+
+/**
+ * @brief Process-wide arena backed by a single huge page file.
+ *
+ * When the huge page prefix points to a hugetlbfs mount with 1GB pages, all
+ * the buffers carved from the arena share a handful of TLB entries instead of
+ * requiring (at least) one 2MB page each.
+ *
+ * Buffers allocated from the arena are not mirrored. RX pipes instead reserve
+ * `kPipeGuardSize` bytes after the buffer, where we copy the part of a packet
+ * that wraps around.
+ *
+ * It is safe to allocate and free buffers from multiple threads.
+ */
+class HugePageArena {
+ public:
+  /**
+   * @brief Returns the arena for this process, creating it if needed.
+   *
+   * The arena is shared by all devices in the process and is released once
+   * the last reference goes away. If the arena already exists, `size` is
+   * ignored.
+   *
+   * @param huge_page_prefix Prefix for the arena's huge page file.
+   * @param size Size of the arena in bytes. Must be a multiple of
+   *             `kBufPageSize`.
+   *
+   * @return A pointer to the arena. May be null if it cannot be created.
+   */
+  static std::shared_ptr<HugePageArena> GetShared(
+      const std::string& huge_page_prefix, uint64_t size) noexcept;
+
+  HugePageArena(const HugePageArena&) = delete;
+  HugePageArena& operator=(const HugePageArena&) = delete;
+  HugePageArena(HugePageArena&&) = delete;
+  HugePageArena& operator=(HugePageArena&&) = delete;
+
+  ~HugePageArena() noexcept;
+
+  /**
+   * @brief Allocates a buffer from the arena.
+   *
+   * @param size Size of the buffer in bytes.
+   * @param alignment Alignment of the buffer in bytes. Must be a power of two.
+   *
+   * @return Address of the buffer or nullptr if there is not enough space.
+   */
+  uint8_t* Allocate(uint64_t size, uint64_t alignment = kAlignment) noexcept;
+
+  /**
+   * @brief Returns a buffer to the arena.
+   *
+   * @param addr Address returned by `Allocate()`.
+   */
+  void Free(void* addr) noexcept;
+
+  /**
+   * @brief Checks if an address belongs to the arena.
+   */
+  inline bool Contains(const void* addr) const {
+    return (const uint8_t*)addr >= addr_ &&
+           (const uint8_t*)addr < addr_ + size_;
+  }
+
+  /**
+   * Minimum alignment of buffers allocated from the arena. The least
+   * significant bits of the RX pipe address carry the notification buffer ID,
+   * so they must be zero.
+   */
+  static constexpr uint64_t kAlignment = 4096;
+
+ private:
+  HugePageArena(const std::string& path, uint8_t* addr, uint64_t size) noexcept
+      : path_(path), addr_(addr), size_(size) {
+    free_regions_[0] = size;
+  }
+
+  const std::string path_;
+  uint8_t* const addr_;
+  const uint64_t size_;
+
+  std::mutex mutex_;
+  std::map<uint64_t, uint64_t> free_regions_;  // Offset -> size.
+  std::map<uint64_t, uint64_t> allocations_;   // Offset -> size.
+};
+
+}  // namespace enso
+
+#endif  // SOFTWARE_SRC_ARENA_H_
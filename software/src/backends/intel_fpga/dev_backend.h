@@ -79,6 +79,13 @@ class DevBackend {
     *addr = value;
   }
 
+  /**
+   * @brief Makes sure that all previous register writes reach the device.
+   *
+   * MMIO writes are not held by this backend, so this is a no-op.
+   */
+  static _enso_always_inline void mmio_flush() {}
+
   static _enso_always_inline uint32_t mmio_read32(volatile uint32_t* addr) {
     _enso_compiler_memory_barrier();
     return *addr;
@@ -95,6 +102,37 @@ class DevBackend {
     return virt_to_phys(virt_addr);
   }
 
+  /**
+   * @brief Converts multiple addresses in the application's virtual address
+   *        space to addresses that can be used by the device.
+   * @param virt_addrs Array of `nb_addrs` addresses in the application's
+   *                   virtual address space.
+   * @param dev_addrs Array of `nb_addrs` elements used to save the addresses
+   *                  that can be used by the device.
+   * @param nb_addrs Number of addresses to convert.
+   */
+  void ConvertVirtAddrsToDevAddrs(void* const* virt_addrs, uint64_t* dev_addrs,
+                                  uint32_t nb_addrs) {
+    for (uint32_t i = 0; i < nb_addrs; ++i) {
+      dev_addrs[i] = virt_to_phys(virt_addrs[i]);
+    }
+  }
+
+  /**
+   * @brief Converts multiple physical addresses to addresses that can be used
+   *        by the device.
+   * @param phys_addrs Array of `nb_addrs` physical addresses.
+   * @param dev_addrs Array of `nb_addrs` elements used to save the addresses
+   *                  that can be used by the device.
+   * @param nb_addrs Number of addresses to convert.
+   */
+  void ConvertPhysAddrsToDevAddrs(const uint64_t* phys_addrs,
+                                  uint64_t* dev_addrs, uint32_t nb_addrs) {
+    for (uint32_t i = 0; i < nb_addrs; ++i) {
+      dev_addrs[i] = phys_addrs[i];
+    }
+  }
+
   /**
    * @brief Retrieves the number of fallback queues currently in use.
    * @return The number of fallback queues currently in use. On error, -1 is
@@ -148,6 +186,21 @@ class DevBackend {
     return dev_->allocate_pipe(fallback);
   }
 
+  /**
+   * @brief Allocates multiple pipes with a single request.
+   *
+   * Either all pipes are allocated or none are.
+   *
+   * @param nb_pipes Number of pipes to allocate.
+   * @param fallback If true, allocates fallback pipes. Otherwise, allocates
+   *                 regular pipes.
+   * @param pipe_ids Array of `nb_pipes` elements used to save the pipe IDs.
+   * @return 0 on success. On error, -1 is returned and errno is set.
+   */
+  int AllocatePipes(uint32_t nb_pipes, bool fallback, int* pipe_ids) {
+    return dev_->allocate_pipes(nb_pipes, fallback, pipe_ids);
+  }
+
   /**
    * @brief Frees a pipe.
    *
@@ -157,6 +210,27 @@ class DevBackend {
    */
   int FreePipe(int pipe_id) { return dev_->free_pipe(pipe_id); }
 
+  /**
+   * @brief Blocks until the device sets a notification signal.
+   *
+   * @param signal_addr Address of the signal.
+   * @param timeout_us Maximum time to wait (in microseconds). If 0, waits
+   *                   until the signal is set.
+   *
+   * @return 0 if the signal is set. On timeout or error, -1 is returned and
+   *         errno is set.
+   */
+  int WaitForSignal(volatile uint64_t* signal_addr, uint32_t timeout_us) {
+    return dev_->wait_notif(signal_addr, timeout_us);
+  }
+
+  /**
+   * @brief Whether RX pipes may use a buffer size other than
+   *        `kDefaultPipeBufSize`. The hardware keeps a single RX buffer size
+   *        for all pipes, which must match `ENSO_PIPE_SIZE`.
+   */
+  static constexpr bool kPerPipeRxSize = false;
+
  private:
   explicit DevBackend(unsigned int bdf, int bar) noexcept
       : bdf_(bdf), bar_(bar) {}
@@ -365,6 +365,17 @@ class IntelFpgaPcieDev {
    */
   int allocate_pipe(bool fallback = false);
 
+  /**
+   * Allocate multiple pipes at once. Either all pipes are allocated or none.
+   * @param nb_pipes Number of pipes to allocate.
+   * @param fallback If true, allocate fallback pipes. Otherwise, allocate
+   *                 regular pipes.
+   * @param pipe_ids Array of `nb_pipes` elements used to save the pipe IDs.
+   * @return 0 on success. On error, -1 is returned and errno is set
+   *         appropriately.
+   */
+  int allocate_pipes(uint32_t nb_pipes, bool fallback, int* pipe_ids);
+
   /**
    * Free a pipe.
    * @param id Pipe ID.
@@ -373,6 +384,16 @@ class IntelFpgaPcieDev {
    */
   int free_pipe(int id);
 
+  /**
+   * Block until a notification arrives.
+   * @param signal_addr Address of the signal of the next notification.
+   * @param timeout_us Maximum time to wait (in microseconds). If 0, waits
+   *                   until the notification arrives.
+   * @return 0 on success. On error (including timeout), -1 is returned and
+   *         errno is set appropriately.
+   */
+  int wait_notif(volatile uint64_t* signal_addr, uint32_t timeout_us);
+
  private:
   /**
    * Class should be instantiated via the Create() factory method.
@@ -502,8 +502,27 @@ int IntelFpgaPcieDev::allocate_pipe(bool fallback) {
   return uarg;
 }
 
+int IntelFpgaPcieDev::allocate_pipes(uint32_t nb_pipes, bool fallback,
+                                     int* pipe_ids) {
+  static_assert(sizeof(*pipe_ids) == sizeof(unsigned int),
+                "Pipe IDs are saved as unsigned ints");
+  struct intel_fpga_pcie_alloc_pipes arg;
+  arg.pipe_ids = (uint64_t)pipe_ids;
+  arg.nb_pipes = nb_pipes;
+  arg.fallback = fallback;
+  return ioctl(m_dev_handle, INTEL_FPGA_PCIE_IOCTL_ALLOC_PIPES, &arg);
+}
+
 int IntelFpgaPcieDev::free_pipe(int id) {
   return ioctl(m_dev_handle, INTEL_FPGA_PCIE_IOCTL_FREE_PIPE, id);
 }
 
+int IntelFpgaPcieDev::wait_notif(volatile uint64_t* signal_addr,
+                                 uint32_t timeout_us) {
+  struct intel_fpga_pcie_wait_notif arg;
+  arg.signal_addr = (uint64_t)signal_addr;
+  arg.timeout_us = timeout_us;
+  return ioctl(m_dev_handle, INTEL_FPGA_PCIE_IOCTL_WAIT_NOTIF, &arg);
+}
+
 }  // namespace intel_fpga_pcie_api
@@ -45,6 +45,12 @@
 #include <sched.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <optional>
@@ -52,6 +58,7 @@
 
 #include "enso/consts.h"
 #include "enso/helpers.h"
+#include "enso/internals.h"
 #include "enso/queue.h"
 
 namespace enso {
@@ -60,6 +67,27 @@ thread_local std::unique_ptr<QueueProducer<PipeNotification>> queue_to_backend_;
 thread_local std::unique_ptr<QueueConsumer<PipeNotification>>
     queue_from_backend_;
 
+// Backend generation that the thread's queues were last checked for.
+thread_local uint64_t queue_generation_ = 0;
+
+// Incremented every time a backend instance is created, since the backend may
+// have been restarted (with new queues) since the thread connected to it.
+std::atomic<uint64_t> backend_generation_ = 0;
+
+/**
+ * @brief Register writes that were posted but not yet sent to the backend.
+ *
+ * Writes to the same doorbell register are coalesced and up to
+ * `kMaxMmioBatchSize` writes to different registers are sent in a single
+ * message.
+ */
+struct PendingMmioWrites {
+  struct MmioBatchNotification batch;
+  uint32_t nb_posted;  // Including coalesced writes.
+};
+
+thread_local struct PendingMmioWrites pending_mmio_writes_ = {};
+
 class DevBackend {
  public:
   static DevBackend* Create(unsigned int bdf, int bar) noexcept {
@@ -79,52 +107,116 @@ class DevBackend {
     return dev;
   }
 
-  ~DevBackend() noexcept {}
+  ~DevBackend() noexcept {
+    if (queue_to_backend_ != nullptr) {
+      mmio_flush();
+    }
+  }
 
   void* uio_mmap([[maybe_unused]] size_t size,
                  [[maybe_unused]] unsigned int mapping) {
     return 0;  // Not a valid address. We use the offset to emulate MMIO access.
   }
 
+  /**
+   * @brief Posts a register write.
+   *
+   * Writes are held and sent in batches. A write to a doorbell register (head
+   * or tail) replaces the pending write to the same register if it has a
+   * different value. Writing the same value again is kept as a separate write
+   * since the device uses it to detect prefetch requests. Writes are sent when
+   * the batch is full, after `kMmioBurstSize` writes, before any request that
+   * expects a response, or when `mmio_flush` is called.
+   *
+   * @param addr Register address.
+   * @param value Value to write.
+   */
   static _enso_always_inline void mmio_write32(volatile uint32_t* addr,
                                                uint32_t value) {
-    // Block if full.
-    struct MmioNotification mmio_notification;
-    mmio_notification.type = NotifType::kWrite;
-    mmio_notification.address = (uint64_t)addr;
-    mmio_notification.value = value;
+    struct PendingMmioWrites* pending = &pending_mmio_writes_;
+    struct MmioBatchNotification* batch = &pending->batch;
+    uint32_t address = (uint32_t)(uint64_t)addr;
+
+    ++(pending->nb_posted);
+
+    if (is_doorbell(address)) {
+      // Only coalesce if there is a single pending write to this register,
+      // otherwise we could drop a repeated (prefetch) write.
+      struct MmioBatchWrite* match = nullptr;
+      uint32_t nb_matches = 0;
+      for (uint32_t i = 0; i < batch->nb_writes; ++i) {
+        if (batch->writes[i].address == address) {
+          match = &batch->writes[i];
+          ++nb_matches;
+        }
+      }
+      if (nb_matches == 1 && match->value != value) {
+        match->value = value;
+        ++(batch->nb_coalesced);
+        if (pending->nb_posted >= kMmioBurstSize) {
+          mmio_flush();
+        }
+        return;
+      }
+    }
 
-    enso::PipeNotification* pipe_notification =
-        (enso::PipeNotification*)&mmio_notification;
+    struct MmioBatchWrite* write = &batch->writes[batch->nb_writes];
+    write->address = address;
+    write->value = value;
+    ++(batch->nb_writes);
 
-    while (queue_to_backend_->Push(*pipe_notification) != 0) {
+    if (batch->nb_writes == kMaxMmioBatchSize ||
+        pending->nb_posted >= kMmioBurstSize) {
+      mmio_flush();
     }
   }
 
+  /**
+   * @brief Sends all pending register writes to the backend.
+   *
+   * Must be called before the application waits for the device to react to
+   * a write, e.g., when it finds no new notifications.
+   */
+  static _enso_always_inline void mmio_flush() {
+    struct PendingMmioWrites* pending = &pending_mmio_writes_;
+    struct MmioBatchNotification* batch = &pending->batch;
+
+    if (batch->nb_writes == 0) {
+      return;
+    }
+
+    if (batch->nb_writes == 1 && batch->nb_coalesced == 0) {
+      struct MmioNotification mmio_notification;
+      mmio_notification.type = NotifType::kWrite;
+      mmio_notification.address = batch->writes[0].address;
+      mmio_notification.value = batch->writes[0].value;
+      push_notification(mmio_notification);
+    } else {
+      batch->type = NotifType::kWriteBatch;
+      push_notification(*batch);
+    }
+
+    // If the thread could not connect to the backend, the writes are dropped,
+    // as they would be by a device that is gone.
+    batch->nb_writes = 0;
+    batch->nb_coalesced = 0;
+    pending->nb_posted = 0;
+  }
+
   static _enso_always_inline uint32_t mmio_read32(volatile uint32_t* addr) {
     struct MmioNotification mmio_notification;
     mmio_notification.type = NotifType::kRead;
     mmio_notification.address = (uint64_t)addr;
     mmio_notification.value = 0;
 
-    enso::PipeNotification* pipe_notification =
-        (enso::PipeNotification*)&mmio_notification;
-
-    while (queue_to_backend_->Push(*pipe_notification) != 0) {
-    }
-
-    std::optional<PipeNotification> notification;
-
-    // Block until receive.
-    while (!(notification = queue_from_backend_->Pop())) {
+    struct MmioNotification result;
+    if (send_request(mmio_notification, &result)) {
+      return ~0;  // Same as a PCIe read that fails.
     }
 
-    struct MmioNotification* result =
-        (struct MmioNotification*)&notification.value();
-
-    assert(result->type == NotifType::kRead);
-    assert(result->address == (uint64_t)addr);
-    return result->value;
+    assert(result.type == NotifType::kRead);
+    assert(result.address == (uint64_t)addr);
+    return result.value;
   }
 
   /**
@@ -143,23 +235,99 @@ class DevBackend {
     mmio_notification.address = (uint64_t)phys_addr;
     mmio_notification.value = 0;
 
-    enso::PipeNotification* pipe_notification =
-        (enso::PipeNotification*)&mmio_notification;
-    while (queue_to_backend_->Push(*pipe_notification) != 0) {
+    struct MmioNotification result;
+    if (send_request(mmio_notification, &result)) {
+      return 0;
     }
 
-    std::optional<PipeNotification> notification;
+    assert(result.type == NotifType::kTranslAddr);
+    assert(result.address == (uint64_t)phys_addr);
+    return result.value;
+  }
 
-    // Block until receive.
-    while (!(notification = queue_from_backend_->Pop())) {
+  /**
+   * @brief Converts multiple addresses in the application's virtual address
+   *        space to addresses that can be used by the device.
+   *
+   * Requests are sent in bursts of up to `kBatchSize` before waiting for the
+   * responses, so the backend handles them back to back.
+   *
+   * @param virt_addrs Array of `nb_addrs` addresses in the application's
+   *                   virtual address space.
+   * @param dev_addrs Array of `nb_addrs` elements used to save the converted
+   *                  addresses, 0 if an address cannot be translated.
+   * @param nb_addrs Number of addresses to convert.
+   */
+  void ConvertVirtAddrsToDevAddrs(void* const* virt_addrs, uint64_t* dev_addrs,
+                                  uint32_t nb_addrs) {
+    struct MmioNotification mmio_notification;
+    mmio_notification.type = NotifType::kTranslAddr;
+    mmio_notification.value = 0;
+
+    mmio_flush();
+
+    for (uint32_t i = 0; i < nb_addrs; i += kBatchSize) {
+      uint32_t burst = std::min(nb_addrs - i, kBatchSize);
+      for (uint32_t j = 0; j < burst; ++j) {
+        mmio_notification.address = virt_to_phys(virt_addrs[i + j]);
+        _enso_compiler_memory_barrier();
+        if (push_notification(mmio_notification)) {
+          std::fill(dev_addrs + i, dev_addrs + nb_addrs, 0);
+          return;
+        }
+      }
+      for (uint32_t j = 0; j < burst; ++j) {
+        struct MmioNotification result;
+        if (receive_response(&result)) {
+          std::fill(dev_addrs + i, dev_addrs + nb_addrs, 0);
+          return;
+        }
+        assert(result.type == NotifType::kTranslAddr);
+        dev_addrs[i + j] = result.value;
+      }
     }
+  }
 
-    struct MmioNotification* result =
-        (struct MmioNotification*)&notification.value();
+  /**
+   * @brief Converts multiple physical addresses to addresses that can be used
+   *        by the device.
+   *
+   * Requests are sent in bursts of up to `kBatchSize` before waiting for the
+   * responses, so the backend handles them back to back.
+   *
+   * @param phys_addrs Array of `nb_addrs` physical addresses.
+   * @param dev_addrs Array of `nb_addrs` elements used to save the converted
+   *                  addresses, 0 if an address cannot be translated.
+   * @param nb_addrs Number of addresses to convert.
+   */
+  void ConvertPhysAddrsToDevAddrs(const uint64_t* phys_addrs,
+                                  uint64_t* dev_addrs, uint32_t nb_addrs) {
+    struct MmioNotification mmio_notification;
+    mmio_notification.type = NotifType::kTranslAddr;
+    mmio_notification.value = 0;
 
-    assert(result->type == NotifType::kTranslAddr);
-    assert(result->address == (uint64_t)phys_addr);
-    return result->value;
+    mmio_flush();
+
+    for (uint32_t i = 0; i < nb_addrs; i += kBatchSize) {
+      uint32_t burst = std::min(nb_addrs - i, kBatchSize);
+      for (uint32_t j = 0; j < burst; ++j) {
+        mmio_notification.address = phys_addrs[i + j];
+        _enso_compiler_memory_barrier();
+        if (push_notification(mmio_notification)) {
+          std::fill(dev_addrs + i, dev_addrs + nb_addrs, 0);
+          return;
+        }
+      }
+      for (uint32_t j = 0; j < burst; ++j) {
+        struct MmioNotification result;
+        if (receive_response(&result)) {
+          std::fill(dev_addrs + i, dev_addrs + nb_addrs, 0);
+          return;
+        }
+        assert(result.type == NotifType::kTranslAddr);
+        dev_addrs[i + j] = result.value;
+      }
+    }
   }
 
   /**
@@ -170,22 +338,14 @@ class DevBackend {
   int GetNbFallbackQueues() {
     struct FallbackNotification fallback_notification;
     fallback_notification.type = NotifType::kGetNbFallbackQueues;
-    enso::PipeNotification* pipe_notification =
-        (enso::PipeNotification*)&fallback_notification;
-    while (queue_to_backend_->Push(*pipe_notification) != 0) {
-    }
 
-    std::optional<PipeNotification> notification;
-
-    // Block until receive.
-    while (!(notification = queue_from_backend_->Pop())) {
+    struct FallbackNotification result;
+    if (send_request(fallback_notification, &result)) {
+      return -1;
     }
 
-    struct FallbackNotification* result =
-        (struct FallbackNotification*)&notification.value();
-
-    assert(result->type == NotifType::kGetNbFallbackQueues);
-    return result->nb_fallback_queues;
+    assert(result.type == NotifType::kGetNbFallbackQueues);
+    return result.nb_fallback_queues;
   }
 
   /**
@@ -200,22 +360,13 @@ class DevBackend {
     rr_notification.type = NotifType::kSetRrStatus;
     rr_notification.round_robin = (uint64_t)round_robin;
 
-    enso::PipeNotification* pipe_notification =
-        (enso::PipeNotification*)&rr_notification;
-    while (queue_to_backend_->Push(*pipe_notification) != 0) {
-    }
-
-    std::optional<PipeNotification> notification;
-
-    // Block until receive.
-    while (!(notification = queue_from_backend_->Pop())) {
+    struct RoundRobinNotification result;
+    if (send_request(rr_notification, &result)) {
+      return -1;
     }
 
-    struct RoundRobinNotification* result =
-        (struct RoundRobinNotification*)&notification.value();
-
-    assert(result->type == NotifType::kSetRrStatus);
-    return result->result;
+    assert(result.type == NotifType::kSetRrStatus);
+    return result.result;
   }
 
   /**
@@ -228,23 +379,13 @@ class DevBackend {
     struct RoundRobinNotification rr_notification;
     rr_notification.type = NotifType::kGetRrStatus;
 
-    enso::PipeNotification* pipe_notification =
-        (enso::PipeNotification*)&rr_notification;
-
-    while (queue_to_backend_->Push(*pipe_notification) != 0) {
-    }
-
-    std::optional<PipeNotification> notification;
-
-    // Block until receive.
-    while (!(notification = queue_from_backend_->Pop())) {
+    struct RoundRobinNotification result;
+    if (send_request(rr_notification, &result)) {
+      return -1;
     }
 
-    struct RoundRobinNotification* result =
-        (struct RoundRobinNotification*)&notification.value();
-
-    assert(result->type == NotifType::kGetRrStatus);
-    return result->round_robin;
+    assert(result.type == NotifType::kGetRrStatus);
+    return result.round_robin;
   }
 
   /**
@@ -256,24 +397,13 @@ class DevBackend {
     struct NotifBufNotification nb_notification;
     nb_notification.type = NotifType::kAllocateNotifBuf;
 
-    enso::PipeNotification* pipe_notification =
-        (enso::PipeNotification*)&nb_notification;
-    while (queue_to_backend_->Push(*pipe_notification) != 0) {
-    }
-
-    std::optional<PipeNotification> queue_value;
-
-    // Block until receive.
-    while (!(queue_value = queue_from_backend_->Pop())) {
+    struct NotifBufNotification result;
+    if (send_request(nb_notification, &result)) {
+      return -1;
     }
 
-    struct PipeNotification notification = queue_value.value();
-
-    struct NotifBufNotification* result =
-        (struct NotifBufNotification*)&notification;
-
-    assert(result->type == NotifType::kAllocateNotifBuf);
-    return result->notif_buf_id;
+    assert(result.type == NotifType::kAllocateNotifBuf);
+    return result.notif_buf_id;
   }
 
   /**
@@ -284,26 +414,17 @@ class DevBackend {
    * @return Return 0 on success. On error, -1 is returned and errno is set.
    */
   int FreeNotifBuf(int notif_buf_id) {
-    (void)notif_buf_id;
     struct NotifBufNotification nb_notification;
     nb_notification.type = NotifType::kFreeNotifBuf;
+    nb_notification.notif_buf_id = notif_buf_id;
 
-    enso::PipeNotification* pipe_notification =
-        (enso::PipeNotification*)&nb_notification;
-    while (queue_to_backend_->Push(*pipe_notification) != 0) {
-    }
-
-    std::optional<PipeNotification> notification;
-
-    // Block until receive.
-    while (!(notification = queue_from_backend_->Pop())) {
+    struct NotifBufNotification result;
+    if (send_request(nb_notification, &result)) {
+      return -1;
     }
 
-    struct NotifBufNotification* result =
-        (struct NotifBufNotification*)&notification.value();
-
-    assert(result->type == NotifType::kFreeNotifBuf);
-    return result->result;
+    assert(result.type == NotifType::kFreeNotifBuf);
+    return result.result;
   }
 
   /**
@@ -318,21 +439,70 @@ class DevBackend {
     alloc_notification.type = NotifType::kAllocatePipe;
     alloc_notification.fallback = fallback;
 
-    enso::PipeNotification* pipe_notification =
-        (enso::PipeNotification*)&alloc_notification;
-    while (queue_to_backend_->Push(*pipe_notification) != 0) {
+    struct AllocatePipeNotification result;
+    if (send_request(alloc_notification, &result)) {
+      return -1;
     }
 
-    std::optional<PipeNotification> notification;
+    assert(result.type == NotifType::kAllocatePipe);
+    return result.pipe_id;
+  }
 
-    // Block until receive.
-    while (!(notification = queue_from_backend_->Pop())) {
+  /**
+   * @brief Allocates multiple pipes.
+   *
+   * Requests are sent in bursts of up to `kBatchSize` before waiting for the
+   * responses, so the backend handles them back to back. Either all pipes are
+   * allocated or none are.
+   *
+   * @param nb_pipes Number of pipes to allocate.
+   * @param fallback If true, allocates fallback pipes. Otherwise, allocates
+   *                 regular pipes.
+   * @param pipe_ids Array of `nb_pipes` elements used to save the pipe IDs.
+   * @return 0 on success. On error, -1 is returned and errno is set.
+   */
+  int AllocatePipes(uint32_t nb_pipes, bool fallback, int* pipe_ids) {
+    struct AllocatePipeNotification alloc_notification;
+    alloc_notification.type = NotifType::kAllocatePipe;
+    alloc_notification.fallback = fallback;
+
+    mmio_flush();
+
+    int ret = 0;
+    for (uint32_t i = 0; i < nb_pipes; i += kBatchSize) {
+      uint32_t burst = std::min(nb_pipes - i, kBatchSize);
+      uint32_t nb_pushed = 0;
+      for (; nb_pushed < burst; ++nb_pushed) {
+        pipe_ids[i + nb_pushed] = -1;
+        if (push_notification(alloc_notification)) {
+          ret = -1;
+          break;
+        }
+      }
+      for (uint32_t j = 0; j < nb_pushed; ++j) {
+        struct AllocatePipeNotification result;
+        if (receive_response(&result)) {
+          ret = -1;
+          break;
+        }
+        assert(result.type == NotifType::kAllocatePipe);
+        pipe_ids[i + j] = result.pipe_id;
+        if ((int)result.pipe_id < 0) {
+          ret = -1;
+        }
+      }
+      if (ret) {
+        // Free in reverse order so that fallback pipes stay contiguous.
+        for (uint32_t j = i + nb_pushed; j-- > 0;) {
+          if (pipe_ids[j] >= 0) {
+            FreePipe(pipe_ids[j]);
+          }
+        }
+        return ret;
+      }
     }
 
-    struct AllocatePipeNotification* result =
-        (struct AllocatePipeNotification*)&notification.value();
-    assert(result->type == NotifType::kAllocatePipe);
-    return result->pipe_id;
+    return 0;
   }
 
   /**
@@ -347,25 +517,152 @@ class DevBackend {
     free_notification.type = NotifType::kFreePipe;
     free_notification.pipe_id = pipe_id;
 
-    enso::PipeNotification* pipe_notification =
-        (enso::PipeNotification*)&free_notification;
-    while (queue_to_backend_->Push(*pipe_notification) != 0) {
+    struct FreePipeNotification result;
+    if (send_request(free_notification, &result)) {
+      return -1;
+    }
+
+    assert(result.type == NotifType::kFreePipe);
+    return result.result;
+  }
+
+  /**
+   * @brief Blocks until the backend sets a notification signal.
+   *
+   * The signal is marked with `kSignalWaiting` before sleeping so that the
+   * backend knows that it must wake us up when writing the notification.
+   *
+   * @param signal_addr Address of the signal.
+   * @param timeout_us Maximum time to wait (in microseconds). If 0, waits
+   *                   until the signal is set.
+   *
+   * @return 0 if the signal is set. On timeout or error, -1 is returned and
+   *         errno is set.
+   */
+  int WaitForSignal(volatile uint64_t* signal_addr, uint32_t timeout_us) {
+    uint64_t expected = 0;
+    __atomic_compare_exchange_n(signal_addr, &expected, kSignalWaiting, false,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::microseconds(timeout_us);
+
+    while (*signal_addr == kSignalWaiting) {
+      uint32_t sleep_us = 0;
+      if (timeout_us != 0) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+          expected = kSignalWaiting;
+          if (__atomic_compare_exchange_n(signal_addr, &expected, 0, false,
+                                          __ATOMIC_SEQ_CST,
+                                          __ATOMIC_SEQ_CST)) {
+            errno = ETIMEDOUT;
+            return -1;
+          }
+          break;
+        }
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+            deadline - now);
+        sleep_us = remaining.count() + 1;
+      }
+      futex_wait((volatile uint32_t*)signal_addr, kSignalWaiting, sleep_us);
+    }
+
+    return 0;
+  }
+
+  /**
+   * @brief Whether RX pipes may use a buffer size other than
+   *        `kDefaultPipeBufSize`. The emulator reads the size of each pipe
+   *        from the `rx_size` register.
+   */
+  static constexpr bool kPerPipeRxSize = true;
+
+ private:
+  /**
+   * @brief Returns true if the register at `address` is a head or tail
+   *        pointer, i.e., only its latest value matters.
+   */
+  static constexpr bool is_doorbell(uint32_t address) {
+    uint32_t offset = address % kMemorySpacePerQueue;
+    return offset == offsetof(struct QueueRegs, rx_tail) ||
+           offset == offsetof(struct QueueRegs, rx_head) ||
+           offset == offsetof(struct QueueRegs, tx_tail) ||
+           offset == offsetof(struct QueueRegs, tx_head);
+  }
+
+  /**
+   * @brief Pushes a notification to the backend, blocking if the queue is full.
+   *
+   * @return 0 on success. On error, -1 is returned and errno is set.
+   */
+  template <typename T>
+  static _enso_always_inline int push_notification(const T& notification) {
+    static_assert(sizeof(T) <= sizeof(PipeNotification),
+                  "Notification must fit in a PipeNotification");
+    // Threads other than the one that created the device (e.g., when using a
+    // `DeviceGroup`) connect to the backend on first use. Threads that are
+    // already connected check that their queues are still valid whenever a new
+    // backend instance is created.
+    if (unlikely(queue_generation_ !=
+                 backend_generation_.load(std::memory_order_acquire)) &&
+        connect_thread()) {
+      return -1;
+    }
+
+    PipeNotification pipe_notification = {};
+    memcpy(&pipe_notification, &notification, sizeof(T));
+
+    // Block if full.
+    while (queue_to_backend_->Push(pipe_notification) != 0) {
+    }
+
+    return 0;
+  }
+
+  /**
+   * @brief Sends a request to the backend and blocks until it responds.
+   *
+   * Pending register writes are sent first so that the backend observes them
+   * before the request.
+   *
+   * @param request The request to send.
+   * @param response Set to the backend's response.
+   * @return 0 on success. On error, -1 is returned and errno is set.
+   */
+  template <typename T>
+  static _enso_always_inline int send_request(const T& request, T* response) {
+    mmio_flush();
+    if (push_notification(request)) {
+      return -1;
+    }
+    return receive_response(response);
+  }
+
+  /**
+   * @brief Blocks until the backend responds to the oldest pending request.
+   *
+   * @param response Set to the backend's response.
+   * @return 0 on success. On error, -1 is returned and errno is set.
+   */
+  template <typename T>
+  static _enso_always_inline int receive_response(T* response) {
+    if (unlikely(queue_from_backend_ == nullptr)) {
+      errno = ENOTCONN;
+      return -1;
     }
 
     std::optional<PipeNotification> notification;
 
-    // Block until receive.
+    // Block until receive, sleeping if the backend takes long to respond.
     while (!(notification = queue_from_backend_->Pop())) {
+      queue_from_backend_->Wait();
     }
 
-    struct FreePipeNotification* result =
-        (struct FreePipeNotification*)&notification.value();
-
-    assert(result->type == NotifType::kFreePipe);
-    return result->result;
+    memcpy(response, &notification.value(), sizeof(T));
+    return 0;
   }
 
- private:
   explicit DevBackend(unsigned int bdf, int bar) noexcept
       : bdf_(bdf), bar_(bar) {}
 
@@ -375,21 +672,23 @@ class DevBackend {
   DevBackend& operator=(DevBackend&& other) = delete;
 
   /**
-   * @brief Initializes the backend.
+   * @brief Connects the calling thread to the backend.
+   *
+   * Uses the queues of the core that the thread is currently running on.
    *
    * @return 0 on success and a non-zero error code on failure.
    */
-  int Init() noexcept {
-    core_id_ = sched_getcpu();
-    if (core_id_ < 0) {
+  static int init_thread_queues() noexcept {
+    int core_id = sched_getcpu();
+    if (core_id < 0) {
       std::cerr << "Could not get CPU ID" << std::endl;
       return -1;
     }
 
     std::string queue_to_app_name =
-        std::string(enso::kIpcQueueToAppName) + std::to_string(core_id_) + "_";
+        std::string(enso::kIpcQueueToAppName) + std::to_string(core_id) + "_";
     std::string queue_from_app_name = std::string(enso::kIpcQueueFromAppName) +
-                                      std::to_string(core_id_) + "_";
+                                      std::to_string(core_id) + "_";
 
     queue_to_backend_ =
         QueueProducer<PipeNotification>::Create(queue_from_app_name);
@@ -401,6 +700,7 @@ class DevBackend {
     queue_from_backend_ =
         QueueConsumer<PipeNotification>::Create(queue_to_app_name);
     if (queue_from_backend_ == nullptr) {
+      queue_to_backend_.reset();
       std::cerr << "Could not create queue from backend" << std::endl;
       return -1;
     }
@@ -408,9 +708,46 @@ class DevBackend {
     return 0;
   }
 
+  /**
+   * @brief Makes sure that the calling thread is connected to the current
+   *        backend.
+   *
+   * Devices that share a thread also share its queues, since joining the
+   * queues again would lose track of the messages that are already in flight.
+   * But if the backend was restarted, the queues that the thread is using
+   * were removed and must be replaced by the new ones.
+   *
+   * @return 0 on success. On error, -1 is returned and errno is set.
+   */
+  static int connect_thread() noexcept {
+    uint64_t generation = backend_generation_.load(std::memory_order_acquire);
+
+    if (queue_to_backend_ == nullptr || queue_to_backend_->IsStale() ||
+        queue_from_backend_->IsStale()) {
+      queue_to_backend_.reset();
+      queue_from_backend_.reset();
+      if (init_thread_queues()) {
+        errno = ENOTCONN;
+        return -1;
+      }
+    }
+
+    queue_generation_ = generation;
+    return 0;
+  }
+
+  /**
+   * @brief Initializes the backend.
+   *
+   * @return 0 on success and a non-zero error code on failure.
+   */
+  int Init() noexcept {
+    backend_generation_.fetch_add(1, std::memory_order_acq_rel);
+    return connect_thread();
+  }
+
   unsigned int bdf_;
   int bar_;
-  int core_id_;
 };
 }  // namespace enso
 
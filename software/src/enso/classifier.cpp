@@ -0,0 +1,505 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Implementation of the wildcard packet classifier. @see classifier.h
+ */
+
+#include <arpa/inet.h>
+#include <enso/classifier.h>
+#include <enso/helpers.h>
+#include <immintrin.h>
+#include <netinet/ether.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+
+#include <algorithm>
+#include <iostream>
+#include <new>
+
+namespace enso {
+
+// Cuts that replicate rules into more than this many times the number of
+// rules in the node are not worth it.
+constexpr uint32_t kMaxCutReplication = 16;
+
+// Bound on the total number of rule copies added by cuts, per rule.
+constexpr uint64_t kMaxReplicationPerRule = 32;
+
+constexpr uint32_t kMinPrefixLenToCut = 8;
+
+// Rules are split by the field with a long enough prefix, if any.
+constexpr uint32_t kMaxNbTries = 3;
+
+// Leaf rules are only prefetched if they are unlikely to fit in the cache.
+constexpr uint64_t kPrefetchMinLeafBytes = 1 << 20;
+
+/**
+ * @brief Fields used for classification, in host byte order.
+ */
+struct PktFields {
+  uint32_t dst_ip;
+  uint32_t src_ip;
+  uint32_t dst_port;
+  uint32_t src_port;
+  uint32_t protocol;
+};
+
+/**
+ * @brief Extracts the classification fields from a packet.
+ *
+ * @return false if the packet is not IPv4.
+ */
+static _enso_always_inline bool parse_fields(const uint8_t* pkt,
+                                             PktFields* fields) {
+  const struct ether_header* l2_hdr = (const struct ether_header*)pkt;
+  if (l2_hdr->ether_type != htons(ETHERTYPE_IP)) {
+    return false;
+  }
+
+  const struct iphdr* l3_hdr = (const struct iphdr*)(l2_hdr + 1);
+  fields->dst_ip = ntohl(l3_hdr->daddr);
+  fields->src_ip = ntohl(l3_hdr->saddr);
+  fields->protocol = l3_hdr->protocol;
+  fields->dst_port = 0;
+  fields->src_port = 0;
+
+  // Only the first fragment has the L4 header.
+  bool first_fragment = (l3_hdr->frag_off & htons(IP_OFFMASK)) == 0;
+  if ((l3_hdr->protocol == IPPROTO_TCP || l3_hdr->protocol == IPPROTO_UDP) &&
+      first_fragment) {
+    // Both TCP and UDP start with the source and destination ports.
+    const uint16_t* ports =
+        (const uint16_t*)((const uint8_t*)l3_hdr + l3_hdr->ihl * 4);
+    fields->src_port = ntohs(ports[0]);
+    fields->dst_port = ntohs(ports[1]);
+  }
+
+  return true;
+}
+
+static inline uint32_t prefix_mask(uint8_t prefix_len) {
+  return prefix_len == 0 ? 0 : ~0U << (32 - prefix_len);
+}
+
+/**
+ * @brief Builds the tries of a `Classifier`.
+ */
+class Classifier::Compiler {
+ public:
+  Compiler(Classifier* classifier, const ClassifierRule* rules,
+           uint32_t nb_rules)
+      : classifier_(classifier),
+        rules_(rules),
+        replication_budget_(kMaxReplicationPerRule * nb_rules) {}
+
+  /**
+   * @brief Builds a trie for the given rules, which must be in priority
+   *        order.
+   *
+   * @return Index of the root node.
+   */
+  uint32_t BuildTrie(const std::vector<uint32_t>& rule_ids) {
+    uint32_t root = classifier_->nodes_.size();
+    classifier_->nodes_.emplace_back();
+    BuildNode(root, rule_ids, 0, 0, 0);
+    return root;
+  }
+
+ private:
+  /**
+   * @brief Computes the children that a rule goes to when cutting the 8 bits
+   *        of a field that start at bit `bits` (from the most significant).
+   */
+  static void ChildRange(uint32_t value, uint8_t prefix_len, uint32_t bits,
+                         uint32_t* first, uint32_t* last) {
+    if (prefix_len <= bits) {
+      *first = 0;
+      *last = 255;
+      return;
+    }
+
+    uint32_t byte = (value >> (24 - bits)) & 0xff;
+    uint32_t free_bits = prefix_len >= bits + 8 ? 0 : bits + 8 - prefix_len;
+    *first = byte & ~((1U << free_bits) - 1);
+    *last = *first | ((1U << free_bits) - 1);
+  }
+
+  void GetChildRange(uint32_t rule_id, uint8_t field, uint32_t bits,
+                     uint32_t* first, uint32_t* last) const {
+    const ClassifierRule& rule = rules_[rule_id];
+    if (field == kDstIpField) {
+      ChildRange(rule.dst_ip, rule.dst_prefix_len, bits, first, last);
+    } else {
+      ChildRange(rule.src_ip, rule.src_prefix_len, bits, first, last);
+    }
+  }
+
+  /**
+   * @brief Evaluates a cut, computing the number of rules in the largest
+   *        child and the total number of rules in all children.
+   */
+  void EvaluateCut(const std::vector<uint32_t>& rule_ids, uint8_t field,
+                   uint32_t bits, uint32_t* max_child,
+                   uint64_t* total) const {
+    int32_t diff[257] = {};
+    *total = 0;
+    for (uint32_t rule_id : rule_ids) {
+      uint32_t first;
+      uint32_t last;
+      GetChildRange(rule_id, field, bits, &first, &last);
+      ++diff[first];
+      --diff[last + 1];
+      *total += last - first + 1;
+    }
+
+    int32_t count = 0;
+    *max_child = 0;
+    for (uint32_t i = 0; i < 256; ++i) {
+      count += diff[i];
+      *max_child = std::max(*max_child, (uint32_t)count);
+    }
+  }
+
+  void BuildNode(uint32_t node, const std::vector<uint32_t>& rule_ids,
+                 uint32_t dst_bits, uint32_t src_bits, uint32_t depth) {
+    Stats& stats = classifier_->stats_;
+    stats.depth = std::max(stats.depth, depth);
+
+    uint8_t best_field = kLeafNode;
+    uint32_t best_max_child = rule_ids.size();
+    uint64_t best_total = 0;
+
+    if (rule_ids.size() > kRulesPerChunk) {
+      const uint8_t fields[] = {kDstIpField, kSrcIpField};
+      for (uint8_t field : fields) {
+        uint32_t bits = field == kDstIpField ? dst_bits : src_bits;
+        if (bits >= 32) {
+          continue;
+        }
+
+        uint32_t max_child;
+        uint64_t total;
+        EvaluateCut(rule_ids, field, bits, &max_child, &total);
+
+        if (max_child < best_max_child ||
+            (max_child == best_max_child && best_field != kLeafNode &&
+             total < best_total)) {
+          best_field = field;
+          best_max_child = max_child;
+          best_total = total;
+        }
+      }
+    }
+
+    uint64_t replication = best_total - rule_ids.size();
+    if (best_field == kLeafNode ||
+        best_total > (uint64_t)kMaxCutReplication * rule_ids.size() ||
+        replication > replication_budget_) {
+      classifier_->nodes_[node] = {AddLeaf(rule_ids), kLeafNode, 0};
+      return;
+    }
+    replication_budget_ -= replication;
+
+    uint32_t bits = best_field == kDstIpField ? dst_bits : src_bits;
+    uint32_t first_child = classifier_->nodes_.size();
+    classifier_->nodes_.resize(first_child + 256);
+    classifier_->nodes_[node] = {first_child, best_field,
+                                 (uint8_t)(24 - bits)};
+
+    std::vector<std::vector<uint32_t>> children(256);
+    for (uint32_t rule_id : rule_ids) {
+      uint32_t first;
+      uint32_t last;
+      GetChildRange(rule_id, best_field, bits, &first, &last);
+      for (uint32_t i = first; i <= last; ++i) {
+        children[i].push_back(rule_id);
+      }
+    }
+
+    uint32_t child_dst_bits = dst_bits + (best_field == kDstIpField ? 8 : 0);
+    uint32_t child_src_bits = src_bits + (best_field == kSrcIpField ? 8 : 0);
+
+    for (uint32_t i = 0; i < 256; ++i) {
+      // Siblings with the same rules share the same subtree.
+      if (i > 0 && children[i] == children[i - 1]) {
+        classifier_->nodes_[first_child + i] =
+            classifier_->nodes_[first_child + i - 1];
+        continue;
+      }
+      BuildNode(first_child + i, children[i], child_dst_bits, child_src_bits,
+                depth + 1);
+    }
+  }
+
+  /**
+   * @brief Adds a leaf with the given rules.
+   *
+   * @return Index of the leaf.
+   */
+  uint32_t AddLeaf(const std::vector<uint32_t>& rule_ids) {
+    Classifier* c = classifier_;
+    Stats& stats = c->stats_;
+
+    uint32_t nb_chunks =
+        (rule_ids.size() + kRulesPerChunk - 1) / kRulesPerChunk;
+    Leaf leaf = {(uint32_t)c->chunks_.size(), nb_chunks};
+    c->chunks_.resize(c->chunks_.size() + nb_chunks);
+
+    for (uint32_t i = 0; i < nb_chunks * kRulesPerChunk; ++i) {
+      RuleChunk& chunk = c->chunks_[leaf.first_chunk + i / kRulesPerChunk];
+      uint32_t j = i % kRulesPerChunk;
+
+      if (i >= rule_ids.size()) {
+        // Padding, the destination port range is empty so it never matches.
+        chunk.rule_ids[j] = kNoRule;
+        chunk.dst_port_mins[j] = 1;
+        continue;
+      }
+
+      const ClassifierRule& rule = rules_[rule_ids[i]];
+      uint32_t dst_mask = prefix_mask(rule.dst_prefix_len);
+      uint32_t src_mask = prefix_mask(rule.src_prefix_len);
+      chunk.rule_ids[j] = rule_ids[i];
+      chunk.dst_ips[j] = rule.dst_ip & dst_mask;
+      chunk.dst_masks[j] = dst_mask;
+      chunk.src_ips[j] = rule.src_ip & src_mask;
+      chunk.src_masks[j] = src_mask;
+      chunk.dst_port_mins[j] = rule.dst_port_min;
+      chunk.dst_port_maxs[j] = rule.dst_port_max;
+      chunk.src_port_mins[j] = rule.src_port_min;
+      chunk.src_port_maxs[j] = rule.src_port_max;
+      chunk.protocols[j] = rule.protocol & rule.protocol_mask;
+      chunk.protocol_masks[j] = rule.protocol_mask;
+    }
+
+    ++stats.nb_leaves;
+    stats.nb_leaf_rules += rule_ids.size();
+    stats.max_leaf_rules =
+        std::max(stats.max_leaf_rules, (uint32_t)rule_ids.size());
+
+    c->leaves_.push_back(leaf);
+    return c->leaves_.size() - 1;
+  }
+
+  Classifier* classifier_;
+  const ClassifierRule* rules_;
+  uint64_t replication_budget_;
+};
+
+Classifier::Classifier(uint32_t default_class) noexcept
+    : default_class_(default_class) {}
+
+std::unique_ptr<Classifier> Classifier::Create(
+    const ClassifierRule* rules, uint32_t nb_rules,
+    uint32_t default_class) noexcept {
+  for (uint32_t i = 0; i < nb_rules; ++i) {
+    const ClassifierRule& rule = rules[i];
+    if (rule.dst_prefix_len > 32 || rule.src_prefix_len > 32 ||
+        rule.dst_port_min > rule.dst_port_max ||
+        rule.src_port_min > rule.src_port_max) {
+      std::cerr << "Invalid classifier rule " << i << std::endl;
+      return std::unique_ptr<Classifier>{};
+    }
+  }
+
+  std::unique_ptr<Classifier> classifier(new (std::nothrow)
+                                             Classifier(default_class));
+  if (!classifier) {
+    return std::unique_ptr<Classifier>{};
+  }
+
+  // Split the rules so that rules with a short prefix in one field do not
+  // need to be replicated when cutting on it.
+  std::vector<uint32_t> groups[kMaxNbTries];
+  for (uint32_t i = 0; i < nb_rules; ++i) {
+    if (rules[i].dst_prefix_len >= kMinPrefixLenToCut) {
+      groups[0].push_back(i);
+    } else if (rules[i].src_prefix_len >= kMinPrefixLenToCut) {
+      groups[1].push_back(i);
+    } else {
+      groups[2].push_back(i);
+    }
+    classifier->rule_classes_.push_back(rules[i].class_id);
+  }
+
+  Compiler compiler(classifier.get(), rules, nb_rules);
+  for (const std::vector<uint32_t>& group : groups) {
+    if (!group.empty()) {
+      classifier->roots_.push_back(compiler.BuildTrie(group));
+    }
+  }
+
+  classifier->prefetch_leaves_ =
+      classifier->chunks_.size() * sizeof(RuleChunk) >= kPrefetchMinLeafBytes;
+
+  classifier->stats_.nb_rules = nb_rules;
+  classifier->stats_.nb_nodes = classifier->nodes_.size();
+
+  return classifier;
+}
+
+uint32_t Classifier::MatchLeaf(const Leaf& leaf, uint32_t dst_ip,
+                               uint32_t src_ip, uint32_t dst_port,
+                               uint32_t src_port, uint32_t protocol,
+                               uint32_t best) const noexcept {
+  const RuleChunk* chunk = &chunks_[leaf.first_chunk];
+  const RuleChunk* end = chunk + leaf.nb_chunks;
+
+#ifdef __AVX512F__
+  const __m512i dst_ip_vec = _mm512_set1_epi32(dst_ip);
+  const __m512i src_ip_vec = _mm512_set1_epi32(src_ip);
+  const __m512i dst_port_vec = _mm512_set1_epi32(dst_port);
+  const __m512i src_port_vec = _mm512_set1_epi32(src_port);
+  const __m512i protocol_vec = _mm512_set1_epi32(protocol);
+
+  for (; chunk < end; ++chunk) {
+    // Rules are in priority order, the remaining ones cannot beat `best`.
+    if (chunk->rule_ids[0] >= best) {
+      break;
+    }
+
+    __mmask16 match = _mm512_cmpeq_epi32_mask(
+        _mm512_and_si512(dst_ip_vec, _mm512_load_si512(chunk->dst_masks)),
+        _mm512_load_si512(chunk->dst_ips));
+    match = _mm512_mask_cmpeq_epi32_mask(
+        match,
+        _mm512_and_si512(src_ip_vec, _mm512_load_si512(chunk->src_masks)),
+        _mm512_load_si512(chunk->src_ips));
+    match = _mm512_mask_cmple_epu32_mask(
+        match, _mm512_load_si512(chunk->dst_port_mins), dst_port_vec);
+    match = _mm512_mask_cmple_epu32_mask(
+        match, dst_port_vec, _mm512_load_si512(chunk->dst_port_maxs));
+    match = _mm512_mask_cmple_epu32_mask(
+        match, _mm512_load_si512(chunk->src_port_mins), src_port_vec);
+    match = _mm512_mask_cmple_epu32_mask(
+        match, src_port_vec, _mm512_load_si512(chunk->src_port_maxs));
+    match = _mm512_mask_cmpeq_epi32_mask(
+        match,
+        _mm512_and_si512(protocol_vec,
+                         _mm512_load_si512(chunk->protocol_masks)),
+        _mm512_load_si512(chunk->protocols));
+
+    if (match) {
+      return std::min(best, chunk->rule_ids[__builtin_ctz(match)]);
+    }
+  }
+#else
+  for (; chunk < end; ++chunk) {
+    // Rules are in priority order, the remaining ones cannot beat `best`.
+    if (chunk->rule_ids[0] >= best) {
+      break;
+    }
+
+    for (uint32_t i = 0; i < kRulesPerChunk; ++i) {
+      if ((dst_ip & chunk->dst_masks[i]) == chunk->dst_ips[i] &&
+          (src_ip & chunk->src_masks[i]) == chunk->src_ips[i] &&
+          chunk->dst_port_mins[i] <= dst_port &&
+          dst_port <= chunk->dst_port_maxs[i] &&
+          chunk->src_port_mins[i] <= src_port &&
+          src_port <= chunk->src_port_maxs[i] &&
+          (protocol & chunk->protocol_masks[i]) == chunk->protocols[i]) {
+        return std::min(best, chunk->rule_ids[i]);
+      }
+    }
+  }
+#endif  // __AVX512F__
+
+  return best;
+}
+
+uint32_t Classifier::Classify(const uint8_t* pkt) const noexcept {
+  uint32_t classes[1];
+  ClassifyBurst(&pkt, 1, classes);
+  return classes[0];
+}
+
+void Classifier::ClassifyBurst(const uint8_t* const* pkts, uint32_t nb_pkts,
+                               uint32_t* classes) const noexcept {
+  PktFields fields[kBatchSize];
+  bool valid[kBatchSize];
+  const Leaf* leaves[kBatchSize][kMaxNbTries];
+  uint32_t nb_roots = roots_.size();
+
+  for (uint32_t first = 0; first < nb_pkts; first += kBatchSize) {
+    uint32_t nb_burst_pkts = std::min(nb_pkts - first, kBatchSize);
+
+    // Parse all headers and walk all tries before matching any rule, so that
+    // the cache misses of different packets overlap.
+    for (uint32_t i = 0; i < nb_burst_pkts; ++i) {
+      valid[i] = parse_fields(pkts[first + i], &fields[i]);
+    }
+
+    for (uint32_t i = 0; i < nb_burst_pkts; ++i) {
+      if (!valid[i]) {
+        continue;
+      }
+      for (uint32_t j = 0; j < nb_roots; ++j) {
+        Node node = nodes_[roots_[j]];
+        while (node.field != kLeafNode) {
+          uint32_t value =
+              node.field == kDstIpField ? fields[i].dst_ip : fields[i].src_ip;
+          node = nodes_[node.first + ((value >> node.shift) & 0xff)];
+        }
+        const Leaf* leaf = &leaves_[node.first];
+        leaves[i][j] = leaf;
+
+        if (prefetch_leaves_) {
+          const uint8_t* chunk = (const uint8_t*)&chunks_[leaf->first_chunk];
+          for (uint32_t k = 0; k < sizeof(RuleChunk); k += kCacheLineSize) {
+            _mm_prefetch(chunk + k, _MM_HINT_T0);
+          }
+        }
+      }
+    }
+
+    for (uint32_t i = 0; i < nb_burst_pkts; ++i) {
+      const PktFields& f = fields[i];
+      uint32_t best = kNoRule;
+
+      if (valid[i]) {
+        for (uint32_t j = 0; j < nb_roots; ++j) {
+          best = MatchLeaf(*leaves[i][j], f.dst_ip, f.src_ip, f.dst_port,
+                           f.src_port, f.protocol, best);
+        }
+      }
+
+      classes[first + i] =
+          best == kNoRule ? default_class_ : rule_classes_[best];
+    }
+  }
+}
+
+Classifier::Stats Classifier::GetStats() const noexcept { return stats_; }
+
+}  // namespace enso
@@ -43,57 +43,13 @@
 #include <enso/internals.h>
 #include <immintrin.h>
 
+#include <algorithm>
 #include <cstdio>
 
 #include "../pcie.h"
 
 namespace enso {
 
-enum ConfigId {
-  FLOW_TABLE_CONFIG_ID = 1,
-  TIMESTAMP_CONFIG_ID = 2,
-  RATE_LIMIT_CONFIG_ID = 3,
-  FALLBACK_QUEUES_CONFIG_ID = 4
-};
-
-struct __attribute__((__packed__)) FlowTableConfig {
-  uint64_t signal;
-  uint64_t config_id;
-  uint16_t dst_port;
-  uint16_t src_port;
-  uint32_t dst_ip;
-  uint32_t src_ip;
-  uint32_t protocol;
-  uint32_t enso_pipe_id;
-  uint8_t pad[28];
-};
-
-struct __attribute__((__packed__)) TimestampConfig {
-  uint64_t signal;
-  uint64_t config_id;
-  uint64_t enable;
-  uint64_t offset;
-  uint8_t pad[32];
-};
-
-struct __attribute__((__packed__)) RateLimitConfig {
-  uint64_t signal;
-  uint64_t config_id;
-  uint16_t denominator;
-  uint16_t numerator;
-  uint32_t enable;
-  uint8_t pad[40];
-};
-
-struct __attribute__((__packed__)) FallbackQueueConfig {
-  uint64_t signal;
-  uint64_t config_id;
-  uint32_t nb_fallback_queues;
-  uint32_t fallback_queue_mask;
-  uint64_t enable_rr;
-  uint8_t pad[32];
-};
-
 int insert_flow_entry(struct NotificationBufPair* notification_buf_pair,
                       uint16_t dst_port, uint16_t src_port, uint32_t dst_ip,
                       uint32_t src_ip, uint32_t protocol,
@@ -108,18 +64,49 @@ int insert_flow_entry(struct NotificationBufPair* notification_buf_pair,
   config.src_ip = src_ip;
   config.protocol = protocol;
   config.enso_pipe_id = enso_pipe_id;
-
-  std::cout << "Inserting flow entry: dst_port=" << dst_port
-            << ", src_port=" << src_port << ", dst_ip=";
-  print_ip(htonl(dst_ip));
-  std::cout << ", src_ip=";
-  print_ip(htonl(src_ip));
-  std::cout << ", protocol=" << protocol << ", enso_pipe_id=" << enso_pipe_id
-            << ")" << std::endl;
+  config.remove = 0;
 
   return send_config(notification_buf_pair, (struct TxNotification*)&config);
 }
 
+int insert_flow_entries(struct NotificationBufPair* notification_buf_pair,
+                        const struct FlowEntry* entries, uint32_t nb_entries,
+                        uint32_t enso_pipe_id, ConfigTicket* ticket) {
+  struct FlowTableConfig configs[kBatchSize];
+
+  *ticket = notification_buf_pair->nb_issued_configs;
+
+  while (nb_entries > 0) {
+    uint32_t nb_configs = std::min(nb_entries, (uint32_t)kBatchSize);
+
+    for (uint32_t i = 0; i < nb_configs; ++i) {
+      struct FlowTableConfig& config = configs[i];
+      const struct FlowEntry& entry = entries[i];
+
+      config.signal = 2;
+      config.config_id = FLOW_TABLE_CONFIG_ID;
+      config.dst_port = entry.dst_port;
+      config.src_port = entry.src_port;
+      config.dst_ip = entry.dst_ip;
+      config.src_ip = entry.src_ip;
+      config.protocol = entry.protocol;
+      config.enso_pipe_id = enso_pipe_id;
+      config.remove = 0;
+    }
+
+    if (send_config_async(notification_buf_pair,
+                          (struct TxNotification*)configs, nb_configs,
+                          ticket)) {
+      return -1;
+    }
+
+    entries += nb_configs;
+    nb_entries -= nb_configs;
+  }
+
+  return 0;
+}
+
 int enable_timestamp(struct NotificationBufPair* notification_buf_pair,
                      uint8_t offset) {
   if (offset > 60) {
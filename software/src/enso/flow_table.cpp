@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2022, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Implementation of the flow table shadow. @see flow_table.h
+ */
+
+#include <enso/flow_table.h>
+#include <enso/internals.h>
+#include <enso/pipe.h>
+
+#include <algorithm>
+#include <iostream>
+#include <new>
+
+namespace enso {
+
+static inline uint32_t rotl(uint32_t value, uint32_t shift) {
+  return (value << shift) | (value >> (32 - shift));
+}
+
+uint32_t flow_hash(const FlowTuple& tuple, uint32_t initval) {
+  // Key layout used by the hardware: {sIP, sPort, dIP, dPort}.
+  uint32_t key0 = ((tuple.dst_ip & 0xffff) << 16) | tuple.dst_port;
+  uint32_t key1 = ((uint32_t)tuple.src_port << 16) | (tuple.dst_ip >> 16);
+  uint32_t key2 = tuple.src_ip;
+
+  // 0xdeadbeef + length (in bytes) of the key.
+  uint32_t a = 0xdeadbefb + key0 + initval;
+  uint32_t b = 0xdeadbefb + key1 + initval;
+  uint32_t c = 0xdeadbefb + key2 + initval;
+
+  c = (c ^ b) - rotl(b, 14);
+  a = (a ^ c) - rotl(c, 11);
+  b = (b ^ a) - rotl(a, 25);
+  c = (c ^ b) - rotl(b, 16);
+  a = (a ^ c) - rotl(c, 4);
+  b = (b ^ a) - rotl(a, 14);
+  return (c ^ b) - rotl(b, 24);
+}
+
+static inline FlowTuple to_tuple(const FlowEntry& flow) {
+  FlowTuple tuple;
+  tuple.src_ip = flow.src_ip;
+  tuple.dst_ip = flow.dst_ip;
+  tuple.src_port = flow.src_port;
+  tuple.dst_port = flow.dst_port;
+  return tuple;
+}
+
+static inline bool same_tuple(const FlowTuple& a, const FlowTuple& b) {
+  return a.src_ip == b.src_ip && a.dst_ip == b.dst_ip &&
+         a.src_port == b.src_port && a.dst_port == b.dst_port;
+}
+
+static inline void fill_config(struct FlowTableConfig* config,
+                               const FlowTuple& tuple, uint32_t protocol,
+                               uint32_t pipe_id, bool remove) {
+  config->signal = 2;
+  config->config_id = FLOW_TABLE_CONFIG_ID;
+  config->dst_port = tuple.dst_port;
+  config->src_port = tuple.src_port;
+  config->dst_ip = tuple.dst_ip;
+  config->src_ip = tuple.src_ip;
+  config->protocol = protocol;
+  config->enso_pipe_id = pipe_id;
+  config->remove = remove;
+}
+
+std::unique_ptr<FlowTable> FlowTable::Create(Device* device) noexcept {
+  if (device == nullptr) {
+    std::cerr << "Invalid device" << std::endl;
+    return std::unique_ptr<FlowTable>{};
+  }
+
+  std::unique_ptr<FlowTable> flow_table(new (std::nothrow) FlowTable(device));
+  return flow_table;
+}
+
+int32_t FlowTable::Find(const FlowTuple& tuple,
+                        int32_t* empty_subtable) const noexcept {
+  *empty_subtable = -1;
+
+  for (uint32_t i = 0; i < kNbSubtables; ++i) {
+    const Entry& entry = entries_[i][flow_hash(tuple, i) % kSubtableDepth];
+
+    if (!entry.valid) {
+      if (*empty_subtable < 0) {
+        *empty_subtable = i;
+      }
+      continue;
+    }
+
+    if (same_tuple(entry.tuple, tuple)) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+int FlowTable::Apply(const FlowTuple& tuple, uint32_t protocol,
+                     uint32_t pipe_id, bool remove,
+                     ConfigTicket* ticket) noexcept {
+  struct FlowTableConfig config;
+  fill_config(&config, tuple, protocol, pipe_id, remove);
+
+  ConfigTicket local_ticket;
+  if (device_->ApplyConfigAsync((struct TxNotification*)&config, 1,
+                                &local_ticket)) {
+    return -1;
+  }
+
+  if (ticket == nullptr) {
+    device_->WaitForConfig(local_ticket);
+  } else {
+    *ticket = local_ticket;
+  }
+
+  return 0;
+}
+
+int FlowTable::Insert(const FlowEntry& flow, uint32_t pipe_id,
+                      ConfigTicket* ticket) noexcept {
+  FlowTuple tuple = to_tuple(flow);
+  int32_t empty_subtable;
+  int32_t subtable = Find(tuple, &empty_subtable);
+
+  if (subtable >= 0) {
+    return Replace(flow, pipe_id, ticket);
+  }
+
+  // The hardware does not evict entries, it drops the new one instead.
+  if (empty_subtable < 0) {
+    ++nb_rejected_;
+    return -1;
+  }
+
+  if (Apply(tuple, flow.protocol, pipe_id, false, ticket)) {
+    return -1;
+  }
+
+  Entry* entry = Slot(tuple, empty_subtable);
+  entry->tuple = tuple;
+  entry->protocol = flow.protocol;
+  entry->pipe_id = pipe_id;
+  entry->valid = true;
+
+  ++nb_entries_[empty_subtable];
+  ++nb_inserts_;
+  if (empty_subtable != 0) {
+    ++nb_collisions_;
+  }
+
+  return 0;
+}
+
+int FlowTable::Replace(const FlowEntry& flow, uint32_t pipe_id,
+                       ConfigTicket* ticket) noexcept {
+  FlowTuple tuple = to_tuple(flow);
+  int32_t empty_subtable;
+  int32_t subtable = Find(tuple, &empty_subtable);
+
+  if (subtable < 0) {
+    return -1;
+  }
+
+  if (Apply(tuple, flow.protocol, pipe_id, false, ticket)) {
+    return -1;
+  }
+
+  Entry* entry = Slot(tuple, subtable);
+  entry->protocol = flow.protocol;
+  entry->pipe_id = pipe_id;
+  ++nb_updates_;
+
+  return 0;
+}
+
+int FlowTable::Remove(const FlowEntry& flow, ConfigTicket* ticket) noexcept {
+  FlowTuple tuple = to_tuple(flow);
+  int32_t empty_subtable;
+  int32_t subtable = Find(tuple, &empty_subtable);
+
+  if (subtable < 0) {
+    return -1;
+  }
+
+  if (Apply(tuple, flow.protocol, 0, true, ticket)) {
+    return -1;
+  }
+
+  Slot(tuple, subtable)->valid = false;
+  --nb_entries_[subtable];
+  ++nb_removals_;
+
+  return 0;
+}
+
+int FlowTable::Migrate(uint32_t from_pipe_id, uint32_t to_pipe_id,
+                       ConfigTicket* ticket) noexcept {
+  struct FlowTableConfig configs[kBatchSize];
+  Entry* batch[kBatchSize];
+  Entry* entries = &entries_[0][0];
+  uint32_t next_entry = 0;
+  int nb_moved = 0;
+  ConfigTicket local_ticket;
+
+  // Always sends at least one (possibly empty) batch, so that there is a
+  // ticket even if there is nothing to move.
+  do {
+    uint32_t nb_configs = 0;
+    for (; next_entry < kCapacity && nb_configs < kBatchSize; ++next_entry) {
+      Entry* entry = &entries[next_entry];
+      if (!entry->valid || entry->pipe_id != from_pipe_id) {
+        continue;
+      }
+      fill_config(&configs[nb_configs], entry->tuple, entry->protocol,
+                  to_pipe_id, false);
+      batch[nb_configs] = entry;
+      ++nb_configs;
+    }
+
+    if (device_->ApplyConfigAsync((struct TxNotification*)configs, nb_configs,
+                                  &local_ticket)) {
+      return -1;
+    }
+
+    // Only update the shadow once the changes were sent.
+    for (uint32_t i = 0; i < nb_configs; ++i) {
+      batch[i]->pipe_id = to_pipe_id;
+    }
+    nb_moved += nb_configs;
+    nb_updates_ += nb_configs;
+  } while (next_entry < kCapacity);
+
+  if (ticket == nullptr) {
+    device_->WaitForConfig(local_ticket);
+  } else {
+    *ticket = local_ticket;
+  }
+
+  return nb_moved;
+}
+
+int32_t FlowTable::Lookup(const FlowEntry& flow) const noexcept {
+  FlowTuple tuple = to_tuple(flow);
+  int32_t empty_subtable;
+  int32_t subtable = Find(tuple, &empty_subtable);
+
+  if (subtable < 0) {
+    return -1;
+  }
+
+  return entries_[subtable][flow_hash(tuple, subtable) % kSubtableDepth]
+      .pipe_id;
+}
+
+int32_t FlowTable::PredictSubtable(const FlowEntry& flow) const noexcept {
+  int32_t empty_subtable;
+  int32_t subtable = Find(to_tuple(flow), &empty_subtable);
+
+  if (subtable >= 0) {
+    return subtable;
+  }
+
+  return empty_subtable;
+}
+
+FlowTable::Stats FlowTable::GetStats() const noexcept {
+  Stats stats;
+
+  stats.nb_entries = 0;
+  for (uint32_t i = 0; i < kNbSubtables; ++i) {
+    stats.subtable_entries[i] = nb_entries_[i];
+    stats.nb_entries += nb_entries_[i];
+  }
+  stats.nb_inserts = nb_inserts_;
+  stats.nb_updates = nb_updates_;
+  stats.nb_removals = nb_removals_;
+  stats.nb_collisions = nb_collisions_;
+  stats.nb_rejected = nb_rejected_;
+
+  return stats;
+}
+
+void FlowTable::Clear() noexcept {
+  std::fill(&entries_[0][0], &entries_[0][0] + kCapacity, Entry{});
+  std::fill(nb_entries_, nb_entries_ + kNbSubtables, 0);
+}
+
+}  // namespace enso
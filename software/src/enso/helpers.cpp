@@ -38,13 +38,118 @@
  */
 
 #include <enso/helpers.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
+#include <climits>
+#include <cstddef>
 #include <cstdio>
 #include <iostream>
 #include <thread>
 #include <vector>
 namespace enso {
 
+// Number of flits whose lengths `index_pkts()` reads at once.
+static constexpr uint32_t kIndexWindowFlits = 16;
+
+// Packets larger than this are found one at a time, as reading the lengths of
+// the flits that follow them would mostly read payload.
+static constexpr uint16_t kMaxIndexWindowPktLen = 256;
+
+uint32_t index_pkts(const uint8_t* buf, uint32_t nb_bytes, uint32_t* offsets,
+                    uint16_t* lens, uint32_t max_nb_pkts,
+                    uint32_t* nb_indexed_bytes) {
+  const uint32_t nb_flits = nb_bytes / 64;
+  uint32_t flit = 0;
+  uint32_t nb_pkts = 0;
+
+#ifdef __AVX512F__
+  // Masked forms with all lanes set are used below as the unmasked ones start
+  // from an undefined vector, which trips -Wmaybe-uninitialized in some GCCs.
+  constexpr __mmask16 kAllLanes = 0xffff;
+  const __m512i lanes =
+      _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  const __m512i lane_offsets = _mm512_maskz_slli_epi32(kAllLanes, lanes, 6);
+  const __m512i byte_mask = _mm512_set1_epi32(0xff);
+  const __m512i l2_hdr_len = _mm512_set1_epi32(sizeof(struct ether_header));
+  const __m512i flit_round_up = _mm512_set1_epi32(63);
+
+  alignas(kCacheLineSize) uint16_t window_next[kIndexWindowFlits];
+#endif  // __AVX512F__
+
+  while (nb_pkts < max_nb_pkts && flit < nb_flits) {
+    const uint8_t* pkt = buf + flit * 64;
+    uint16_t pkt_len = get_pkt_len(pkt);
+
+#ifdef __AVX512F__
+    if (nb_flits - flit >= kIndexWindowFlits &&
+        pkt_len <= kMaxIndexWindowPktLen) {
+      // Read the lengths as if every flit in the window started a packet, so
+      // that the loads do not depend on each other. The IP length is big
+      // endian, in bytes 16 and 17 of the packet.
+      __m512i words = _mm512_mask_i32gather_epi32(
+          _mm512_setzero_si512(), kAllLanes, lane_offsets,
+          pkt + sizeof(struct ether_header) + offsetof(struct iphdr, tot_len),
+          1);
+      __m512i ip_lens = _mm512_or_si512(
+          _mm512_and_si512(_mm512_maskz_srli_epi32(kAllLanes, words, 8),
+                           byte_mask),
+          _mm512_maskz_slli_epi32(kAllLanes,
+                                  _mm512_and_si512(words, byte_mask), 8));
+      __m512i pkt_lens = _mm512_add_epi32(ip_lens, l2_hdr_len);
+      __m512i nb_pkt_flits = _mm512_maskz_srli_epi32(
+          kAllLanes, _mm512_add_epi32(pkt_lens, flit_round_up), 6);
+      __m512i next = _mm512_add_epi32(lanes, nb_pkt_flits);
+      _mm512_mask_cvtepi32_storeu_epi16(window_next, kAllLanes, next);
+
+      // Only follow the packets, which is now cheap.
+      const uint32_t flits_left = nb_flits - flit;
+      const uint32_t pkts_left = max_nb_pkts - nb_pkts;
+      uint32_t idx = 0;
+      uint32_t nb_window_pkts = 0;
+      __mmask16 starts = 0;
+      while (idx < kIndexWindowFlits && window_next[idx] <= flits_left &&
+             nb_window_pkts < pkts_left) {
+        starts |= 1U << idx;
+        idx = window_next[idx];
+        ++nb_window_pkts;
+      }
+
+      __m512i window_offsets =
+          _mm512_add_epi32(_mm512_set1_epi32(flit * 64), lane_offsets);
+      _mm512_mask_compressstoreu_epi32(offsets + nb_pkts, starts,
+                                       window_offsets);
+      _mm512_mask_cvtepi32_storeu_epi16(
+          lens + nb_pkts, (1U << nb_window_pkts) - 1,
+          _mm512_maskz_compress_epi32(starts, pkt_lens));
+
+      nb_pkts += nb_window_pkts;
+      flit += idx;
+
+      // The next packet does not fit or there is no room for it.
+      if (idx < kIndexWindowFlits) {
+        break;
+      }
+      continue;
+    }
+#endif  // __AVX512F__
+
+    uint32_t next_flit = flit + (pkt_len - 1) / 64 + 1;
+    if (next_flit > nb_flits) {
+      break;
+    }
+
+    offsets[nb_pkts] = flit * 64;
+    lens[nb_pkts] = pkt_len;
+    ++nb_pkts;
+    flit = next_flit;
+  }
+
+  *nb_indexed_bytes = flit * 64;
+  return nb_pkts;
+}
+
 uint16_t get_bdf_from_pcie_addr(const std::string& pcie_addr) {
   uint32_t domain, bus, dev, func;
   uint16_t bdf = 0;
@@ -140,6 +245,26 @@ int set_core_id(std::thread& thread, int core_id) {
                                 &cpuset);
 }
 
+int futex_wait(volatile uint32_t* addr, uint32_t expected,
+               uint32_t timeout_us) {
+  struct timespec timeout;
+  struct timespec* timeout_ptr = nullptr;
+  if (timeout_us != 0) {
+    timeout.tv_sec = timeout_us / 1000000;
+    timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+    timeout_ptr = &timeout;
+  }
+
+  // Not using FUTEX_PRIVATE_FLAG as the address may be shared with other
+  // processes.
+  return syscall(SYS_futex, addr, FUTEX_WAIT, expected, timeout_ptr, nullptr,
+                 0);
+}
+
+int futex_wake(volatile uint32_t* addr) {
+  return syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
 static void print_stats_line(uint64_t recv_bytes, uint64_t nb_batches,
                              uint64_t nb_pkts, uint64_t delta_bytes,
                              uint64_t delta_pkts, uint64_t delta_batches) {
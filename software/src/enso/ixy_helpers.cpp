@@ -79,6 +79,39 @@ uint64_t virt_to_phys(void* virt) {
                     ((uintptr_t)virt) % page_size);
 }
 
+int virt_to_phys_range(void* virt, uint64_t nb_pages, uint64_t* phys_addrs) {
+  long page_size = sysconf(_SC_PAGESIZE);
+  int fd = open("/proc/self/pagemap", O_RDONLY);
+
+  if (fd < 0) {
+    return -1;
+  }
+
+  // Entries of consecutive pages are consecutive in the page map, so they can
+  // be read in place and converted afterwards.
+  off_t offset = (uintptr_t)virt / page_size * sizeof(uint64_t);
+  uint8_t* entries = (uint8_t*)phys_addrs;
+  uint64_t missing_bytes = nb_pages * sizeof(uint64_t);
+  while (missing_bytes > 0) {
+    ssize_t nb_read = pread(fd, entries, missing_bytes, offset);
+    if (nb_read <= 0) {
+      close(fd);
+      return -1;
+    }
+    entries += nb_read;
+    offset += nb_read;
+    missing_bytes -= nb_read;
+  }
+  close(fd);
+
+  for (uint64_t i = 0; i < nb_pages; ++i) {
+    // Bits 0-54 are the page number.
+    phys_addrs[i] = (phys_addrs[i] & 0x7fffffffffffffULL) * page_size;
+  }
+
+  return 0;
+}
+
 void* get_huge_page(const std::string& path, size_t size, bool mirror) {
   int fd;
   if (size == 0) {
@@ -107,7 +140,9 @@ void* get_huge_page(const std::string& path, size_t size, bool mirror) {
     return nullptr;
   }
 
-  void* virt_addr = (void*)mmap(nullptr, size * 2, PROT_READ | PROT_WRITE,
+  // Mirrored pages need twice the virtual memory.
+  size_t mapping_size = mirror ? size * 2 : size;
+  void* virt_addr = (void*)mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
                                 MAP_SHARED | MAP_HUGETLB, fd, 0);
 
   if (virt_addr == (void*)-1) {
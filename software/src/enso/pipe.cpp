@@ -47,10 +47,12 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <string>
 
+#include "../arena.h"
 #include "../pcie.h"
 
 namespace enso {
@@ -61,42 +63,329 @@ uint32_t external_peek_next_batch_from_queue(
   return peek_next_batch_from_queue(enso_pipe, notification_buf_pair, buf);
 }
 
+static int check_rx_sched_params(const RxSchedParams& params) {
+  if (params.priority >= kNbRxPriorities || params.weight == 0) {
+    std::cerr << "Pipe priority must be smaller than " << kNbRxPriorities
+              << " and weight must be at least 1" << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
 int RxPipe::Bind(uint16_t dst_port, uint16_t src_port, uint32_t dst_ip,
                  uint32_t src_ip, uint32_t protocol) {
   return insert_flow_entry(notification_buf_pair_, dst_port, src_port, dst_ip,
                            src_ip, protocol, id_);
 }
 
+int RxPipe::BindMany(const FlowEntry* flows, uint32_t nb_flows,
+                     ConfigTicket* ticket) {
+  ConfigTicket local_ticket;
+  ConfigTicket* out_ticket = ticket ? ticket : &local_ticket;
+
+  if (insert_flow_entries(notification_buf_pair_, flows, nb_flows, id_,
+                          out_ticket)) {
+    return -1;
+  }
+
+  if (ticket == nullptr) {
+    wait_for_config(notification_buf_pair_, local_ticket);
+  }
+
+  return 0;
+}
+
 uint32_t RxPipe::Recv(uint8_t** buf, uint32_t max_nb_bytes) {
   uint32_t ret = Peek(buf, max_nb_bytes);
   ConfirmBytes(ret);
   return ret;
 }
 
-inline uint32_t RxPipe::Peek(uint8_t** buf, uint32_t max_nb_bytes) {
+uint32_t RxPipe::Peek(uint8_t** buf, uint32_t max_nb_bytes) {
   if (!next_pipe_) {
     get_new_tails(notification_buf_pair_);
   }
   uint32_t ret = peek_next_batch_from_queue(
       &internal_rx_pipe_, notification_buf_pair_, (void**)buf);
+  if (unlikely(rx_budget_ != kNoRxBudget)) {
+    ret = ApplyRxBudget(*buf, ret);
+  }
   return std::min(ret, max_nb_bytes);
 }
 
+uint16_t RxPipe::RecvBurst(uint8_t** pkts, uint16_t* lens,
+                           uint16_t max_nb_pkts) {
+  uint16_t nb_pkts = 0;
+  for (uint8_t* pkt : RecvPkts(max_nb_pkts)) {
+    pkts[nb_pkts] = pkt;
+    lens[nb_pkts] = get_pkt_len(pkt);
+    ++nb_pkts;
+  }
+  return nb_pkts;
+}
+
+uint32_t RxPipe::ApplyRxBudget(uint8_t* buf, uint32_t nb_bytes) noexcept {
+  uint32_t received_bytes =
+      ((internal_rx_pipe_.rx_tail - turn_start_tail_) &
+       internal_rx_pipe_.size_mask) *
+      64;
+  if (nb_bytes == 0 || received_bytes >= rx_budget_) {
+    return 0;
+  }
+
+  uint32_t budget = rx_budget_ - received_bytes;
+  if (nb_bytes <= budget) {
+    return nb_bytes;
+  }
+
+  // Only return whole packets, and at least one per turn so that packets
+  // larger than the budget do not stall the pipe.
+  uint8_t* batch_end = buf + nb_bytes;
+  uint8_t* budget_end = buf + budget;
+  uint8_t* end = get_next_pkt(buf);
+  if (end > budget_end && received_bytes > 0) {
+    return 0;
+  }
+  while (end < batch_end) {
+    uint8_t* next = get_next_pkt(end);
+    if (next > budget_end) {
+      break;
+    }
+    end = next;
+  }
+
+  return std::min((uint32_t)(end - buf), nb_bytes);
+}
+
+int RxPipe::SetSchedParams(const RxSchedParams& params) noexcept {
+  if (check_rx_sched_params(params)) {
+    return -1;
+  }
+  sched_params_ = params;
+  return 0;
+}
+
 void RxPipe::Free(uint32_t nb_bytes) {
-  advance_pipe(&internal_rx_pipe_, nb_bytes);
+  if (unlikely(!released_flits_.empty())) {
+    if (nb_bytes == 0) {
+      return;
+    }
+    uint32_t nb_flits = (nb_bytes - 1) / 64 + 1;
+    MarkReleasedFlits(internal_rx_pipe_.rx_head, nb_flits, false);
+    advance_pipe(&internal_rx_pipe_, notification_buf_pair_, nb_bytes);
+    FreeReleasedFlits();
+    return;
+  }
+  advance_pipe(&internal_rx_pipe_, notification_buf_pair_, nb_bytes);
 }
 
 void RxPipe::Prefetch() { prefetch_pipe(&internal_rx_pipe_); }
 
-void RxPipe::Clear() { fully_advance_pipe(&internal_rx_pipe_); }
+void RxPipe::Clear() {
+  if (unlikely(!released_flits_.empty())) {
+    uint32_t rx_head = internal_rx_pipe_.rx_head;
+    uint32_t nb_flits =
+        (internal_rx_pipe_.rx_tail - rx_head) & internal_rx_pipe_.size_mask;
+    MarkReleasedFlits(rx_head, nb_flits, false);
+  }
+  fully_advance_pipe(&internal_rx_pipe_, notification_buf_pair_);
+}
+
+void RxPipe::Release(uint8_t* buf, uint32_t nb_bytes) {
+  if (nb_bytes == 0) {
+    return;
+  }
+
+  uint32_t size_mask = internal_rx_pipe_.size_mask;
+  if (released_flits_.empty()) {
+    released_flits_.assign((size_mask + 1) / 64, 0);
+  }
+
+  // Addresses past the end of the buffer (in the mirror or in the guard
+  // region) wrap around to the start.
+  uint32_t first_flit = ((buf - this->buf()) / 64) & size_mask;
+  uint32_t nb_flits = (nb_bytes - 1) / 64 + 1;
+
+  assert(((first_flit - internal_rx_pipe_.rx_head) & size_mask) + nb_flits <=
+         ((internal_rx_pipe_.rx_tail - internal_rx_pipe_.rx_head) & size_mask));
+
+  MarkReleasedFlits(first_flit, nb_flits, true);
+
+  if (first_flit == internal_rx_pipe_.rx_head) {
+    FreeReleasedFlits();
+  }
+}
+
+void RxPipe::MarkReleasedFlits(uint32_t first_flit, uint32_t nb_flits,
+                               bool released) noexcept {
+  uint32_t size_mask = internal_rx_pipe_.size_mask;
+  while (nb_flits > 0) {
+    uint32_t bit = first_flit % 64;
+    uint32_t nb_bits = std::min(nb_flits, 64 - bit);
+    uint64_t mask = (nb_bits == 64) ? ~0ULL : ((1ULL << nb_bits) - 1) << bit;
+
+    if (released) {
+      released_flits_[first_flit / 64] |= mask;
+    } else {
+      released_flits_[first_flit / 64] &= ~mask;
+    }
+
+    first_flit = (first_flit + nb_bits) & size_mask;
+    nb_flits -= nb_bits;
+  }
+}
+
+void RxPipe::FreeReleasedFlits() noexcept {
+  uint32_t size_mask = internal_rx_pipe_.size_mask;
+  uint32_t head = internal_rx_pipe_.rx_head;
+  uint32_t nb_received_flits = (internal_rx_pipe_.rx_tail - head) & size_mask;
+  uint32_t nb_flits = 0;
+
+  while (nb_flits < nb_received_flits) {
+    uint32_t flit = (head + nb_flits) & size_mask;
+    uint32_t bit = flit % 64;
+    uint64_t bits = released_flits_[flit / 64] >> bit;
+    uint32_t run = (~bits == 0) ? 64 : __builtin_ctzll(~bits);
+    run = std::min(run, nb_received_flits - nb_flits);
+    if (run == 0) {
+      break;
+    }
+
+    MarkReleasedFlits(flit, run, false);
+    nb_flits += run;
+
+    // The next flit was not released.
+    if (bit + run < 64) {
+      break;
+    }
+  }
+
+  if (nb_flits > 0) {
+    advance_pipe(&internal_rx_pipe_, notification_buf_pair_, nb_flits * 64);
+  }
+}
+
+int RxPipe::AddForwardedFlits(uint32_t first_flit,
+                              uint32_t nb_flits) noexcept {
+  uint32_t size_mask = internal_rx_pipe_.size_mask;
+  if (released_flits_.empty()) {
+    released_flits_.assign((size_mask + 1) / 64, 0);
+  }
+  if (forwarded_regions_.empty()) {
+    forwarded_regions_.resize(kMaxRxForwardedRegions);
+  }
+
+  // Extends the last region if the new one follows it.
+  if (nb_forwarded_regions_ > 0) {
+    uint32_t last = (forwarded_regions_head_ + nb_forwarded_regions_ - 1) %
+                    kMaxRxForwardedRegions;
+    ForwardedRegion& region = forwarded_regions_[last];
+    if (((region.first_flit + region.nb_flits) & size_mask) == first_flit) {
+      region.nb_flits += nb_flits;
+      return 0;
+    }
+  }
+
+  if (nb_forwarded_regions_ == kMaxRxForwardedRegions) {
+    return -1;
+  }
+
+  uint32_t tail = (forwarded_regions_head_ + nb_forwarded_regions_) %
+                  kMaxRxForwardedRegions;
+  forwarded_regions_[tail] = {first_flit, nb_flits};
+  ++nb_forwarded_regions_;
+
+  return 0;
+}
+
+void RxPipe::ProcessForwardCompletions() noexcept {
+  uint32_t nb_flits = forward_completed_bytes_ / 64;
+  if (nb_flits == 0) {
+    return;
+  }
+  forward_completed_bytes_ = 0;
+
+  // Transmissions complete in the order that they were sent.
+  uint32_t size_mask = internal_rx_pipe_.size_mask;
+  while (nb_flits > 0) {
+    assert(nb_forwarded_regions_ > 0);
+    ForwardedRegion& region = forwarded_regions_[forwarded_regions_head_];
+    uint32_t nb_region_flits = std::min(nb_flits, region.nb_flits);
+
+    MarkReleasedFlits(region.first_flit, nb_region_flits, true);
+    region.first_flit = (region.first_flit + nb_region_flits) & size_mask;
+    region.nb_flits -= nb_region_flits;
+    nb_flits -= nb_region_flits;
+
+    if (region.nb_flits == 0) {
+      forwarded_regions_head_ =
+          (forwarded_regions_head_ + 1) % kMaxRxForwardedRegions;
+      --nb_forwarded_regions_;
+    }
+  }
+
+  FreeReleasedFlits();
+}
+
+int RxPipe::EnableSpill(uint32_t nb_slots) noexcept {
+  if (nb_spilled() > 0) {
+    std::cerr << "Cannot resize the spill pool while packets are spilled"
+              << std::endl;
+    return -1;
+  }
+
+  spill_slots_.reset(nb_slots ? new (std::nothrow) SpillSlot[nb_slots]
+                              : nullptr);
+  if (nb_slots > 0 && !spill_slots_) {
+    std::cerr << "Could not allocate spill pool" << std::endl;
+    nb_spill_slots_ = 0;
+    free_spill_slots_.clear();
+    return -1;
+  }
+
+  nb_spill_slots_ = nb_slots;
+  free_spill_slots_.resize(nb_slots);
+  for (uint32_t i = 0; i < nb_slots; ++i) {
+    free_spill_slots_[i] = nb_slots - 1 - i;
+  }
+
+  return 0;
+}
+
+uint8_t* RxPipe::Spill(uint8_t* buf, uint32_t nb_bytes) {
+  if (nb_bytes == 0 || nb_bytes > kRxSpillSlotSize ||
+      free_spill_slots_.empty()) {
+    return nullptr;
+  }
+
+  uint32_t slot = free_spill_slots_.back();
+  free_spill_slots_.pop_back();
+
+  uint8_t* spilled = spill_slots_[slot].data;
+  memcpy(spilled, buf, nb_bytes);
+  Release(buf, nb_bytes);
+
+  return spilled;
+}
+
+void RxPipe::FreeSpilled(uint8_t* buf) {
+  uint32_t slot = (SpillSlot*)buf - spill_slots_.get();
+  assert(slot < nb_spill_slots_);
+  free_spill_slots_.push_back(slot);
+}
 
 RxPipe::~RxPipe() {
-  enso_pipe_free(notification_buf_pair_, &internal_rx_pipe_, id_);
+  // The pipe was never allocated in the device.
+  if (internal_rx_pipe_.regs == nullptr) {
+    return;
+  }
+  enso_pipe_free(notification_buf_pair_, &internal_rx_pipe_,
+                 internal_rx_pipe_.id);
 }
 
-int RxPipe::Init(bool fallback) noexcept {
-  int ret =
-      enso_pipe_init(&internal_rx_pipe_, notification_buf_pair_, fallback);
+int RxPipe::Init(bool fallback, uint32_t buf_size) noexcept {
+  int ret = enso_pipe_init(&internal_rx_pipe_, notification_buf_pair_,
+                           fallback, buf_size);
   if (ret < 0) {
     return ret;
   }
@@ -108,35 +397,109 @@ int RxPipe::Init(bool fallback) noexcept {
 
 TxPipe::~TxPipe() {
   if (internal_buf_) {
-    munmap(buf_, kMaxCapacity);
+    // The buffer is mirrored, so we need to unmap twice its size.
+    munmap(buf_, (uint64_t)buf_size() * 2);
     std::string path = GetHugePageFilePath();
     unlink(path.c_str());
   }
 }
 
+uint16_t TxPipe::SendBurst(const uint8_t* const* pkts, const uint16_t* lens,
+                           uint16_t nb_pkts) {
+  uint32_t _capacity = capacity();
+  uint8_t* tx_buf = buf_ + app_begin_;
+  uint32_t nb_bytes = 0;
+  uint16_t i;
+
+  for (i = 0; i < nb_pkts; ++i) {
+    assert(lens[i] > 0);
+    uint32_t nb_pkt_bytes = (lens[i] - 1) / kQuantumSize * kQuantumSize +
+                            kQuantumSize;
+    if (nb_bytes + nb_pkt_bytes > _capacity) {
+      _capacity = TryExtendBuf();
+      if (nb_bytes + nb_pkt_bytes > _capacity) {
+        break;
+      }
+    }
+    memcpy(tx_buf + nb_bytes, pkts[i], lens[i]);
+    nb_bytes += nb_pkt_bytes;
+  }
+
+  if (nb_bytes > 0) {
+    SendAndFree(nb_bytes);
+  }
+
+  return i;
+}
+
 int TxPipe::Init() noexcept {
+  // Only buffers of RX/TX pipes may come from the arena, those are not
+  // mirrored.
+  bool in_arena =
+      !internal_buf_ && device_->arena_ && device_->arena_->Contains(buf_);
+  if (!is_valid_pipe_buf_size(buf_size(), !in_arena)) {
+    std::cerr << "Pipe buffer size must be a power of two between "
+              << min_pipe_buf_size(!in_arena) << " and " << kMaxPipeBufSize
+              << " bytes" << std::endl;
+    internal_buf_ = false;
+    return -1;
+  }
+
   if (internal_buf_) {
     std::string path = GetHugePageFilePath();
-    buf_ = (uint8_t*)get_huge_page(path, 0, true);
+    buf_ = (uint8_t*)get_huge_page(path, buf_size(), true);
     if (unlikely(!buf_)) {
+      internal_buf_ = false;
       return -1;
     }
   }
 
   struct NotificationBufPair* notif_buf = &(device_->notification_buf_pair_);
 
-  buf_phys_addr_ = get_dev_addr_from_virt_addr(notif_buf, buf_);
+  // RX/TX pipes carved from the arena send the packets that wrap around from
+  // the guard region, where RX copied them.
+  wrap_offset_ = buf_size();
+  if (in_arena) {
+    wrap_offset_ += kPipeGuardSize;
+  }
+
+  page_offset_ = (uint64_t)buf_ & (kBufPageSize - 1);
+  uint8_t* first_page = buf_ - page_offset_;
+  uint32_t nb_pages = (page_offset_ + wrap_offset_ - 1) / kBufPageSize + 1;
+
+  page_phys_addrs_.resize(nb_pages);
+  contiguous_ends_.resize(nb_pages);
+  for (uint32_t i = 0; i < nb_pages; ++i) {
+    page_phys_addrs_[i] =
+        get_dev_addr_from_virt_addr(notif_buf, first_page + i * kBufPageSize);
+  }
+
+  uint32_t contiguous_end = wrap_offset_;
+  for (uint32_t i = nb_pages; i-- > 0;) {
+    contiguous_ends_[i] = contiguous_end;
+    if (i > 0 &&
+        page_phys_addrs_[i] != page_phys_addrs_[i - 1] + kBufPageSize) {
+      contiguous_end = i * kBufPageSize - page_offset_;
+    }
+  }
 
   return 0;
 }
 
-int RxTxPipe::Init(bool fallback) noexcept {
-  rx_pipe_ = device_->AllocateRxPipe(fallback);
-  if (rx_pipe_ == nullptr) {
+int RxTxPipe::Init(bool fallback, uint32_t buf_size,
+                   const RxSchedParams& sched_params) noexcept {
+  RxPipe* rx_pipe = device_->AllocateRxPipe(fallback, buf_size, sched_params);
+  if (rx_pipe == nullptr) {
     return -1;
   }
 
-  tx_pipe_ = device_->AllocateTxPipe(rx_pipe_->buf());
+  return Init(rx_pipe);
+}
+
+int RxTxPipe::Init(RxPipe* rx_pipe) noexcept {
+  rx_pipe_ = rx_pipe;
+
+  tx_pipe_ = device_->AllocateTxPipe(rx_pipe_->buf(), rx_pipe_->buf_size());
   if (tx_pipe_ == nullptr) {
     return -1;
   }
@@ -146,11 +509,11 @@ int RxTxPipe::Init(bool fallback) noexcept {
   return 0;
 }
 
-std::unique_ptr<Device> Device::Create(
-    const std::string& pcie_addr,
-    const std::string& huge_page_prefix) noexcept {
-  std::unique_ptr<Device> dev(new (std::nothrow)
-                                  Device(pcie_addr, huge_page_prefix));
+std::unique_ptr<Device> Device::Create(const std::string& pcie_addr,
+                                       const std::string& huge_page_prefix,
+                                       uint64_t huge_page_arena_size) noexcept {
+  std::unique_ptr<Device> dev(new (std::nothrow) Device(
+      pcie_addr, huge_page_prefix, huge_page_arena_size));
   if (unlikely(!dev)) {
     return std::unique_ptr<Device>{};
   }
@@ -163,6 +526,8 @@ std::unique_ptr<Device> Device::Create(
 }
 
 Device::~Device() {
+  AdoptMovedPipes();
+
   for (auto& pipe : rx_tx_pipes_) {
     rx_tx_pipes_map_[pipe->rx_id()] = nullptr;
     delete pipe;
@@ -177,21 +542,34 @@ Device::~Device() {
     delete pipe;
   }
 
-  notification_buf_free(&notification_buf_pair_);
+  for (auto& memory : registered_memory_) {
+    munlock(memory.first_page, memory.size);
+  }
+
+  // Init may have failed before the notification buffer was set up.
+  if (notification_buf_pair_.fpga_dev != nullptr) {
+    notification_buf_free(&notification_buf_pair_);
+  }
 }
 
-RxPipe* Device::AllocateRxPipe(bool fallback) noexcept {
+RxPipe* Device::AllocateRxPipe(bool fallback, uint32_t buf_size,
+                               const RxSchedParams& sched_params) noexcept {
+  if (check_rx_sched_params(sched_params)) {
+    return nullptr;
+  }
+
   RxPipe* pipe(new (std::nothrow) RxPipe(this));
 
   if (unlikely(!pipe)) {
     return nullptr;
   }
 
-  if (pipe->Init(fallback)) {
+  if (pipe->Init(fallback, buf_size)) {
     delete pipe;
     return nullptr;
   }
 
+  pipe->sched_params_ = sched_params;
   rx_pipes_.push_back(pipe);
   rx_pipes_map_[pipe->id()] = pipe;
 
@@ -202,8 +580,10 @@ int Device::GetNbFallbackQueues() noexcept {
   return get_nb_fallback_queues(&notification_buf_pair_);
 }
 
-TxPipe* Device::AllocateTxPipe(uint8_t* buf) noexcept {
-  TxPipe* pipe(new (std::nothrow) TxPipe(tx_pipes_.size(), this, buf));
+TxPipe* Device::AllocateTxPipe(uint8_t* buf, uint32_t buf_size) noexcept {
+  // Pipes may move to other devices, so we cannot use the vector size as ID.
+  TxPipe* pipe(new (std::nothrow)
+                   TxPipe(next_tx_pipe_id_, this, buf, buf_size));
 
   if (unlikely(!pipe)) {
     return nullptr;
@@ -214,19 +594,21 @@ TxPipe* Device::AllocateTxPipe(uint8_t* buf) noexcept {
     return nullptr;
   }
 
+  ++next_tx_pipe_id_;
   tx_pipes_.push_back(pipe);
 
   return pipe;
 }
 
-RxTxPipe* Device::AllocateRxTxPipe(bool fallback) noexcept {
+RxTxPipe* Device::AllocateRxTxPipe(bool fallback, uint32_t buf_size,
+                                   const RxSchedParams& sched_params) noexcept {
   RxTxPipe* pipe(new (std::nothrow) RxTxPipe(this));
 
   if (unlikely(!pipe)) {
     return nullptr;
   }
 
-  if (pipe->Init(fallback)) {
+  if (pipe->Init(fallback, buf_size, sched_params)) {
     delete pipe;
     return nullptr;
   }
@@ -237,11 +619,118 @@ RxTxPipe* Device::AllocateRxTxPipe(bool fallback) noexcept {
   return pipe;
 }
 
+std::vector<RxPipe*> Device::AllocateRxPipes(
+    uint32_t nb_pipes, bool fallback, uint32_t buf_size,
+    const RxSchedParams& sched_params) noexcept {
+  if (check_rx_sched_params(sched_params)) {
+    return {};
+  }
+
+  std::vector<RxPipe*> pipes;
+  std::vector<struct RxEnsoPipeInternal*> internal_pipes;
+  pipes.reserve(nb_pipes);
+  internal_pipes.reserve(nb_pipes);
+
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    RxPipe* pipe(new (std::nothrow) RxPipe(this));
+    if (unlikely(!pipe)) {
+      break;
+    }
+    pipes.push_back(pipe);
+    internal_pipes.push_back(&pipe->internal_rx_pipe_);
+  }
+
+  if (pipes.size() != nb_pipes ||
+      enso_pipes_init(internal_pipes.data(), nb_pipes, &notification_buf_pair_,
+                      fallback, buf_size)) {
+    // Free in reverse order so that fallback pipes stay contiguous.
+    for (auto it = pipes.rbegin(); it != pipes.rend(); ++it) {
+      delete *it;
+    }
+    return {};
+  }
+
+  for (RxPipe* pipe : pipes) {
+    pipe->id_ = pipe->internal_rx_pipe_.id;
+    pipe->sched_params_ = sched_params;
+    rx_pipes_.push_back(pipe);
+    rx_pipes_map_[pipe->id()] = pipe;
+  }
+
+  return pipes;
+}
+
+std::vector<RxTxPipe*> Device::AllocateRxTxPipes(
+    uint32_t nb_pipes, bool fallback, uint32_t buf_size,
+    const RxSchedParams& sched_params) noexcept {
+  std::vector<RxPipe*> rx_pipes =
+      AllocateRxPipes(nb_pipes, fallback, buf_size, sched_params);
+  if (rx_pipes.size() != nb_pipes) {
+    return {};
+  }
+
+  std::vector<RxTxPipe*> pipes;
+  pipes.reserve(nb_pipes);
+
+  for (RxPipe* rx_pipe : rx_pipes) {
+    RxTxPipe* pipe(new (std::nothrow) RxTxPipe(this));
+    if (unlikely(!pipe)) {
+      break;
+    }
+    if (pipe->Init(rx_pipe)) {
+      delete pipe;
+      break;
+    }
+    pipes.push_back(pipe);
+  }
+
+  if (pipes.size() != nb_pipes) {
+    // Every pipe that was initialized appended a TX pipe.
+    for (RxTxPipe* pipe : pipes) {
+      delete tx_pipes_.back();
+      tx_pipes_.pop_back();
+      delete pipe;
+    }
+    FreeLastRxPipes(nb_pipes);
+    return {};
+  }
+
+  for (RxTxPipe* pipe : pipes) {
+    rx_tx_pipes_.push_back(pipe);
+    rx_tx_pipes_map_[pipe->rx_id()] = pipe;
+  }
+
+  return pipes;
+}
+
+void Device::FreeLastRxPipes(uint32_t nb_pipes) noexcept {
+  // Free in reverse order so that fallback pipes stay contiguous.
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    RxPipe* pipe = rx_pipes_.back();
+    rx_pipes_.pop_back();
+    rx_pipes_map_[pipe->id()] = nullptr;
+    delete pipe;
+  }
+}
+
 // TODO(sadok): DRY this code.
 RxPipe* Device::NextRxPipeToRecv() {
   // This function can only be used when there are **no** RxTx pipes.
   assert(rx_tx_pipes_.size() == 0);
 
+  // Bytes sent from the pipes' buffers are only freed by their completions.
+  if (unlikely(!pending_tx_rx_pipes_.empty())) {
+    ProcessCompletions();
+  }
+
+  if (rx_sched_policy_ != RxSchedPolicy::kNotificationOrder) {
+    return NextScheduledRxPipe();
+  }
+
+  if (unlikely(moved_rx_pipes_.load(std::memory_order_relaxed) != nullptr)) {
+    AdoptMovedPipes();
+  }
+
   int32_t id;
 
 #ifdef LATENCY_OPT
@@ -250,7 +739,12 @@ RxPipe* Device::NextRxPipeToRecv() {
 
   while (id >= 0) {
     RxPipe* rx_pipe = rx_pipes_map_[id];
-    assert(rx_pipe != nullptr);
+
+    // Skip notifications for pipes that were moved to another device.
+    if (unlikely(rx_pipe == nullptr)) {
+      id = get_next_enso_pipe_id(&notification_buf_pair_);
+      continue;
+    }
 
     RxEnsoPipeInternal& pipe = rx_pipe->internal_rx_pipe_;
     uint32_t enso_pipe_head = pipe.rx_tail;
@@ -274,6 +768,13 @@ RxPipe* Device::NextRxPipeToRecv() {
   }
 
   RxPipe* rx_pipe = rx_pipes_map_[id];
+
+  // The pipe was moved to another device or was not adopted yet. In the latter
+  // case, adopting it requests a new notification.
+  if (unlikely(rx_pipe == nullptr)) {
+    return nullptr;
+  }
+
   rx_pipe->SetAsNextPipe();
   return rx_pipe;
 }
@@ -282,6 +783,15 @@ RxTxPipe* Device::NextRxTxPipeToRecv() {
   ProcessCompletions();
   // This function can only be used when there are only RxTx pipes.
   assert(rx_pipes_.size() == rx_tx_pipes_.size());
+
+  if (rx_sched_policy_ != RxSchedPolicy::kNotificationOrder) {
+    RxPipe* rx_pipe = NextScheduledRxPipe();
+    if (rx_pipe == nullptr) {
+      return nullptr;
+    }
+    return rx_tx_pipes_map_[rx_pipe->id()];
+  }
+
   int32_t id;
 
 #ifdef LATENCY_OPT
@@ -290,7 +800,12 @@ RxTxPipe* Device::NextRxTxPipeToRecv() {
 
   while (id >= 0) {
     RxTxPipe* rx_tx_pipe = rx_tx_pipes_map_[id];
-    assert(rx_tx_pipe->rx_pipe_ != nullptr);
+
+    // Skip notifications for pipes that were moved to another device.
+    if (unlikely(rx_tx_pipe == nullptr)) {
+      id = get_next_enso_pipe_id(&notification_buf_pair_);
+      continue;
+    }
 
     RxEnsoPipeInternal& pipe = rx_tx_pipe->rx_pipe_->internal_rx_pipe_;
     uint32_t enso_pipe_head = pipe.rx_tail;
@@ -314,11 +829,233 @@ RxTxPipe* Device::NextRxTxPipeToRecv() {
   }
 
   RxTxPipe* rx_tx_pipe = rx_tx_pipes_map_[id];
+
+  // The pipe was moved to another device or was not adopted yet.
+  if (unlikely(rx_tx_pipe == nullptr)) {
+    return nullptr;
+  }
+
+  rx_tx_pipe->rx_pipe_->SetAsNextPipe();
+  return rx_tx_pipe;
+}
+
+uint32_t Device::FetchReadyPipes() noexcept {
+  if (unlikely(
+          moved_rx_pipes_.load(std::memory_order_relaxed) != nullptr ||
+          moved_rx_tx_pipes_.load(std::memory_order_relaxed) != nullptr)) {
+    AdoptMovedPipes();
+  }
+
+  if (notification_buf_pair_.next_rx_ids_head ==
+      notification_buf_pair_.next_rx_ids_tail) {
+    get_new_tails(&notification_buf_pair_);
+  }
+
+  return (notification_buf_pair_.next_rx_ids_tail -
+          notification_buf_pair_.next_rx_ids_head + kNotificationBufSize) %
+         kNotificationBufSize;
+}
+
+RxPipe* Device::PopReadyRxPipe() noexcept {
+  int32_t id = get_next_enso_pipe_id(&notification_buf_pair_);
+  RxPipe* rx_pipe = rx_pipes_map_[id];
+
+  // The pipe was moved to another device.
+  if (unlikely(rx_pipe == nullptr)) {
+    return nullptr;
+  }
+
+#ifdef LATENCY_OPT
+  RxEnsoPipeInternal& pipe = rx_pipe->internal_rx_pipe_;
+  if (pipe.rx_tail == notification_buf_pair_.pending_rx_pipe_tails[id]) {
+    return nullptr;
+  }
+  rx_pipe->Prefetch();
+#endif  // LATENCY_OPT
+
+  rx_pipe->SetAsNextPipe();
+  return rx_pipe;
+}
+
+RxTxPipe* Device::PopReadyRxTxPipe() noexcept {
+  int32_t id = get_next_enso_pipe_id(&notification_buf_pair_);
+  RxTxPipe* rx_tx_pipe = rx_tx_pipes_map_[id];
+
+  // The pipe was moved to another device.
+  if (unlikely(rx_tx_pipe == nullptr)) {
+    return nullptr;
+  }
+
+#ifdef LATENCY_OPT
+  RxEnsoPipeInternal& pipe = rx_tx_pipe->rx_pipe_->internal_rx_pipe_;
+  if (pipe.rx_tail == notification_buf_pair_.pending_rx_pipe_tails[id]) {
+    return nullptr;
+  }
+  rx_tx_pipe->Prefetch();
+#endif  // LATENCY_OPT
+
   rx_tx_pipe->rx_pipe_->SetAsNextPipe();
   return rx_tx_pipe;
 }
 
-int Device::Init() noexcept {
+void Device::SetRxSchedPolicy(RxSchedPolicy policy) noexcept {
+  if (policy == rx_sched_policy_) {
+    return;
+  }
+
+  if (rx_sched_pipe_ != nullptr) {
+    EndRxTurn();
+  }
+
+  if (policy == RxSchedPolicy::kNotificationOrder) {
+    // The device only notifies queued pipes again when they receive more data,
+    // so we explicitly ask for a notification.
+    for (RxSchedRing& ring : rx_sched_rings_) {
+      for (; ring.nb_ids > 0; --ring.nb_ids) {
+        enso_pipe_id_t id = ring.ids[ring.head];
+        ring.head = (ring.head + 1) % kMaxNbFlows;
+        rx_sched_queued_[id] = false;
+        if (rx_pipes_map_[id] != nullptr) {
+          rx_pipes_map_[id]->Prefetch();
+        }
+      }
+    }
+    rx_sched_levels_ = 0;
+  } else {
+    // Every pipe is queued at most once.
+    for (RxSchedRing& ring : rx_sched_rings_) {
+      ring.ids.resize(kMaxNbFlows);
+    }
+  }
+
+  rx_sched_policy_ = policy;
+}
+
+RxPipe* Device::NextScheduledRxPipe() noexcept {
+  if (rx_sched_pipe_ != nullptr) {
+    EndRxTurn();
+  }
+
+  // Queue the pipes that the device notified since the last call.
+  for (uint32_t i = FetchReadyPipes(); i > 0; --i) {
+    int32_t id = get_next_enso_pipe_id(&notification_buf_pair_);
+    RxPipe* pipe = rx_pipes_map_[id];
+    if (pipe != nullptr && !rx_sched_queued_[id] && HasPendingRx(pipe)) {
+      QueueRxPipe(pipe);
+    }
+  }
+
+  while (rx_sched_levels_ != 0) {
+    uint32_t priority = 31 - __builtin_clz(rx_sched_levels_);
+    RxSchedRing& ring = rx_sched_rings_[priority];
+    enso_pipe_id_t id = ring.ids[ring.head];
+    ring.head = (ring.head + 1) % kMaxNbFlows;
+    if (--ring.nb_ids == 0) {
+      rx_sched_levels_ &= ~(1U << priority);
+    }
+    rx_sched_queued_[id] = false;
+
+    RxPipe* pipe = rx_pipes_map_[id];
+
+    // The pipe was moved to another device or the application received its
+    // data without calling `NextRxPipeToRecv()`.
+    if (unlikely(pipe == nullptr) || !HasPendingRx(pipe)) {
+      continue;
+    }
+
+    const RxSchedParams& params = pipe->sched_params_;
+    uint32_t budget = params.quota ? params.quota : RxPipe::kNoRxBudget;
+
+    if (rx_sched_policy_ == RxSchedPolicy::kWeightedRoundRobin) {
+      if (pipe->sched_turns_ == 0) {
+        pipe->sched_turns_ = params.weight;
+      }
+    } else if (rx_sched_policy_ == RxSchedPolicy::kDeficitRoundRobin) {
+      pipe->sched_deficit_ += (int64_t)params.weight * kRxSchedQuantum;
+
+      // The pipe is still paying for packets larger than its deficit that it
+      // received in previous rounds.
+      if (pipe->sched_deficit_ <= 0) {
+        QueueRxPipe(pipe);
+        continue;
+      }
+      budget = std::min<int64_t>(budget, pipe->sched_deficit_);
+    }
+
+    pipe->rx_budget_ = budget;
+    pipe->turn_start_tail_ = pipe->internal_rx_pipe_.rx_tail;
+
+#ifdef LATENCY_OPT
+    pipe->Prefetch();
+#endif  // LATENCY_OPT
+
+    pipe->SetAsNextPipe();
+    rx_sched_pipe_ = pipe;
+    return pipe;
+  }
+
+  return nullptr;
+}
+
+void Device::EndRxTurn() noexcept {
+  RxPipe* pipe = rx_sched_pipe_;
+  rx_sched_pipe_ = nullptr;
+
+  RxEnsoPipeInternal& internal_pipe = pipe->internal_rx_pipe_;
+  uint32_t received_bytes =
+      ((internal_pipe.rx_tail - pipe->turn_start_tail_) &
+       internal_pipe.size_mask) *
+      64;
+  pipe->rx_budget_ = RxPipe::kNoRxBudget;
+
+  bool pending = HasPendingRx(pipe);
+  bool front = false;
+
+  if (rx_sched_policy_ == RxSchedPolicy::kWeightedRoundRobin) {
+    if (pipe->sched_turns_ > 0) {
+      --pipe->sched_turns_;
+    }
+    if (!pending) {
+      pipe->sched_turns_ = 0;
+    }
+    front = pipe->sched_turns_ > 0;
+  } else if (rx_sched_policy_ == RxSchedPolicy::kDeficitRoundRobin) {
+    // Pipes that become empty or that do not use their deficit cannot save it
+    // for later rounds. Debts are kept.
+    int64_t max_deficit =
+        pending ? (int64_t)pipe->sched_params_.weight * kRxSchedQuantum : 0;
+    pipe->sched_deficit_ =
+        std::min(pipe->sched_deficit_ - received_bytes, max_deficit);
+  }
+
+  if (pending) {
+    QueueRxPipe(pipe, front);
+  }
+}
+
+void Device::QueueRxPipe(RxPipe* pipe, bool front) noexcept {
+  enso_pipe_id_t id = pipe->id();
+  uint32_t priority = pipe->sched_params_.priority;
+  RxSchedRing& ring = rx_sched_rings_[priority];
+
+  if (front) {
+    ring.head = (ring.head == 0 ? kMaxNbFlows : ring.head) - 1;
+    ring.ids[ring.head] = id;
+  } else {
+    ring.ids[(ring.head + ring.nb_ids) % kMaxNbFlows] = id;
+  }
+
+  ++ring.nb_ids;
+  rx_sched_levels_ |= 1U << priority;
+  rx_sched_queued_[id] = true;
+}
+
+bool Device::HasPendingRx(const RxPipe* pipe) const noexcept {
+  return pipe->internal_rx_pipe_.rx_tail !=
+         notification_buf_pair_.pending_rx_pipe_tails[pipe->id()];
+}
+
+int Device::Init(void* fpga_dev) noexcept {
   if (core_id_ < 0) {
     core_id_ = sched_getcpu();
     if (core_id_ < 0) {
@@ -343,8 +1080,17 @@ int Device::Init() noexcept {
             << std::endl;
   std::cerr << "Running with ENSO_PIPE_SIZE: " << kEnsoPipeSize << std::endl;
 
+  if (kHugePageArenaSize != 0) {
+    arena_ = HugePageArena::GetShared(huge_page_prefix_, kHugePageArenaSize);
+    if (!arena_) {
+      // Could not create huge page arena.
+      return 4;
+    }
+  }
+  notification_buf_pair_.arena = arena_.get();
+
   int ret = notification_buf_init(bdf_, bar, &notification_buf_pair_,
-                                  huge_page_prefix_);
+                                  huge_page_prefix_, fpga_dev);
   if (ret != 0) {
     // Could not initialize notification buffer.
     return 3;
@@ -357,43 +1103,474 @@ int Device::ApplyConfig(struct TxNotification* config_notification) {
   return send_config(&notification_buf_pair_, config_notification);
 }
 
-void Device::Send(uint32_t tx_enso_pipe_id, uint64_t phys_addr,
-                  uint32_t nb_bytes) {
-  // TODO(sadok): We might be able to improve performance by avoiding the wrap
-  // tracker currently used inside send_to_queue.
-  send_to_queue(&notification_buf_pair_, phys_addr, nb_bytes);
+int Device::ApplyConfigAsync(struct TxNotification* config_notifications,
+                             uint32_t nb_configs, ConfigTicket* ticket) {
+  return send_config_async(&notification_buf_pair_, config_notifications,
+                           nb_configs, ticket);
+}
+
+bool Device::IsConfigDone(ConfigTicket ticket) {
+  return is_config_done(&notification_buf_pair_, ticket);
+}
+
+void Device::WaitForConfig(ConfigTicket ticket) {
+  wait_for_config(&notification_buf_pair_, ticket);
+}
+
+void Device::Send(TxPipe* tx_pipe, uint64_t phys_addr, uint32_t nb_bytes) {
+  // Completed bytes are added straight to the pipe's `app_end_`, which frees
+  // them for the application.
+  uint32_t* completed_bytes = &tx_pipe->app_end_;
+
+  // Adjacent sends from the same pipe can share a notification, as long as the
+  // device did not see the previous one yet.
+  if (try_coalesce_send(&notification_buf_pair_, phys_addr, nb_bytes,
+                        completed_bytes)) {
+    return;
+  }
+
+  send_to_queue(&notification_buf_pair_, phys_addr, nb_bytes, completed_bytes);
+}
+
+int Device::SendFromRxPipe(RxPipe* rx_pipe, uint8_t* buf, uint32_t nb_bytes) {
+  // Completions are processed by the device that sends, so the pipe must not
+  // be processed by another one at the same time.
+  if (rx_pipe->notification_buf_pair_ != &notification_buf_pair_) {
+    std::cerr << "RX pipe must use the same device as the TX pipe"
+              << std::endl;
+    return -1;
+  }
+
+  if (nb_bytes == 0) {
+    return 0;
+  }
+  assert(nb_bytes % TxPipe::kQuantumSize == 0);
+
+  RxEnsoPipeInternal& internal_pipe = rx_pipe->internal_rx_pipe_;
+  uint32_t buf_size = (internal_pipe.size_mask + 1) * 64;
 
-  uint32_t nb_pending_requests =
-      (tx_pr_tail_ - tx_pr_head_) & kPendingTxRequestsBufMask;
+  // Addresses past the end of the buffer (in the mirror or in the guard
+  // region) map to the start of the buffer.
+  uint32_t offset = (buf - (uint8_t*)internal_pipe.buf) & (buf_size - 1);
 
-  // This will block until there is enough space to keep at least two requests.
-  // We need space for two requests because the request may be split into two
-  // if the bytes wrap around the end of the buffer.
-  while (unlikely(nb_pending_requests >= (kMaxPendingTxRequests - 2))) {
+  while (rx_pipe->AddForwardedFlits(offset / 64, nb_bytes / 64)) {
+    // Wait for earlier transmissions to complete.
+    FlushTx();
     ProcessCompletions();
-    nb_pending_requests =
-        (tx_pr_tail_ - tx_pr_head_) & kPendingTxRequestsBufMask;
   }
 
-  tx_pending_requests_[tx_pr_tail_].pipe_id = tx_enso_pipe_id;
-  tx_pending_requests_[tx_pr_tail_].nb_bytes = nb_bytes;
-  tx_pr_tail_ = (tx_pr_tail_ + 1) & kPendingTxRequestsBufMask;
+  if (!rx_pipe->pending_tx_) {
+    rx_pipe->pending_tx_ = true;
+    pending_tx_rx_pipes_.push_back(rx_pipe);
+  }
+
+  // The buffer is only physically contiguous up to its end.
+  uint32_t* completed_bytes = &rx_pipe->forward_completed_bytes_;
+  while (nb_bytes > 0) {
+    uint32_t len = std::min(nb_bytes, buf_size - offset);
+    uint64_t phys_addr = internal_pipe.buf_phys_addr + offset;
+
+    if (!try_coalesce_send(&notification_buf_pair_, phys_addr, len,
+                           completed_bytes)) {
+      send_to_queue(&notification_buf_pair_, phys_addr, len, completed_bytes);
+    }
+
+    offset = 0;
+    nb_bytes -= len;
+  }
+
+  return 0;
 }
 
-void Device::ProcessCompletions() {
-  uint32_t tx_completions = get_unreported_completions(&notification_buf_pair_);
-  for (uint32_t i = 0; i < tx_completions; ++i) {
-    TxPendingRequest tx_req = tx_pending_requests_[tx_pr_head_];
-    tx_pr_head_ = (tx_pr_head_ + 1) & kPendingTxRequestsBufMask;
+int Device::SendRegistered(const uint8_t* buf, uint32_t nb_bytes) {
+  assert(nb_bytes % TxPipe::kQuantumSize == 0);
+  assert((uint64_t)buf % TxPipe::kQuantumSize == 0);
+
+  // Binary search for the last region that starts at or before `buf`.
+  uint32_t begin = 0;
+  uint32_t end = registered_memory_.size();
+  while (begin < end) {
+    uint32_t mid = (begin + end) / 2;
+    if (registered_memory_[mid].first_page <= buf) {
+      begin = mid + 1;
+    } else {
+      end = mid;
+    }
+  }
 
-    TxPipe* pipe = tx_pipes_[tx_req.pipe_id];
-    pipe->NotifyCompletion(tx_req.nb_bytes);
+  if (unlikely(begin == 0)) {
+    std::cerr << "Bytes to send are not in registered memory" << std::endl;
+    return -1;
   }
 
+  const RegisteredMemory& memory = registered_memory_[begin - 1];
+  uint64_t offset = buf - memory.first_page;
+  if (unlikely(offset + nb_bytes > memory.size)) {
+    std::cerr << "Bytes to send are not in registered memory" << std::endl;
+    return -1;
+  }
+
+  registered_tx_sent_bytes_ += nb_bytes;
+
+  // Splits the transmission where pages stop being contiguous.
+  uint32_t* completed_bytes = &registered_tx_completed_bytes_;
+  uint64_t page_mask = (1ULL << memory.page_shift) - 1;
+  while (nb_bytes > 0) {
+    const RegisteredPage& page = memory.pages[offset >> memory.page_shift];
+    uint32_t len = std::min((uint64_t)nb_bytes, page.contiguous_end - offset);
+    uint64_t phys_addr = page.dev_addr + (offset & page_mask);
+
+    if (!try_coalesce_send(&notification_buf_pair_, phys_addr, len,
+                           completed_bytes)) {
+      send_to_queue(&notification_buf_pair_, phys_addr, len, completed_bytes);
+    }
+
+    offset += len;
+    nb_bytes -= len;
+  }
+
+  return 0;
+}
+
+int Device::WaitForRx(uint32_t spin_us, uint32_t timeout_us) {
+  if (moved_rx_pipes_.load(std::memory_order_relaxed) != nullptr ||
+      moved_rx_tx_pipes_.load(std::memory_order_relaxed) != nullptr) {
+    return 0;
+  }
+  return wait_for_notification(&notification_buf_pair_, spin_us, timeout_us);
+}
+
+int Device::EnableTxBatching(uint32_t batch_size, uint64_t delay_cycles) {
+  if (batch_size == 0 || delay_cycles == 0) {
+    std::cerr << "TX batch size and delay must be positive" << std::endl;
+    return -1;
+  }
+  set_tx_batching(&notification_buf_pair_, batch_size, delay_cycles);
+  return 0;
+}
+
+void Device::DisableTxBatching() {
+  set_tx_batching(&notification_buf_pair_, 1, kDefaultTxBatchDelayCycles);
+}
+
+void Device::FlushTx() { flush_tx(&notification_buf_pair_); }
+
+int Device::RegisterMemory(void* addr, size_t size) noexcept {
+  if (addr == nullptr || size == 0) {
+    std::cerr << "Memory to register must not be empty" << std::endl;
+    return -1;
+  }
+
+  uint64_t page_size = sysconf(_SC_PAGESIZE);
+  uint64_t page_offset = (uint64_t)addr & (page_size - 1);
+  uint8_t* first_page = (uint8_t*)addr - page_offset;
+  uint64_t nb_pages = (page_offset + size - 1) / page_size + 1;
+  uint64_t total_size = nb_pages * page_size;
+
+  // Keeps the regions sorted and rejects overlapping ones.
+  auto it = registered_memory_.begin();
+  while (it != registered_memory_.end() && it->first_page < first_page) {
+    ++it;
+  }
+  bool overlaps_next = it != registered_memory_.end() &&
+                       it->first_page < first_page + total_size;
+  bool overlaps_prev = it != registered_memory_.begin() &&
+                       (it - 1)->first_page + (it - 1)->size > first_page;
+  if (overlaps_next || overlaps_prev) {
+    std::cerr << "Memory overlaps with memory that is already registered"
+              << std::endl;
+    return -1;
+  }
+
+  // Pins the pages so that their physical addresses do not change. This also
+  // makes sure that all of them are present.
+  if (mlock(first_page, total_size)) {
+    std::cerr << "(" << errno << ") Could not lock memory" << std::endl;
+    return -1;
+  }
+
+  std::vector<uint64_t> dev_addrs(nb_pages);
+  if (get_dev_addrs_from_virt_range(&notification_buf_pair_, first_page,
+                                    nb_pages, dev_addrs.data())) {
+    munlock(first_page, total_size);
+    return -1;
+  }
+
+  RegisteredMemory memory;
+  memory.addr = (uint8_t*)addr;
+  memory.first_page = first_page;
+  memory.size = total_size;
+  memory.page_shift = __builtin_ctzll(page_size);
+  memory.pages.resize(nb_pages);
+
+  uint64_t contiguous_end = total_size;
+  for (uint64_t i = nb_pages; i-- > 0;) {
+    memory.pages[i].dev_addr = dev_addrs[i];
+    memory.pages[i].contiguous_end = contiguous_end;
+    if (i > 0 && dev_addrs[i] != dev_addrs[i - 1] + page_size) {
+      contiguous_end = i * page_size;
+    }
+  }
+
+  registered_memory_.insert(it, std::move(memory));
+
+  return 0;
+}
+
+int Device::DeregisterMemory(void* addr) noexcept {
+  auto it = registered_memory_.begin();
+  while (it != registered_memory_.end() && it->addr != addr) {
+    ++it;
+  }
+
+  if (it == registered_memory_.end()) {
+    std::cerr << "Memory was not registered" << std::endl;
+    return -1;
+  }
+
+  if (registered_tx_pending() != 0) {
+    std::cerr << "Cannot deregister memory while sends from registered "
+                 "memory are pending"
+              << std::endl;
+    return -1;
+  }
+
+  munlock(it->first_page, it->size);
+  registered_memory_.erase(it);
+
+  return 0;
+}
+
+int Device::EnableLazyRxHead(uint32_t flush_percent, uint64_t delay_cycles) {
+  if (flush_percent == 0 || flush_percent > 100 || delay_cycles == 0) {
+    std::cerr << "RX head flush percent must be between 1 and 100 and the "
+                 "delay must be positive"
+              << std::endl;
+    return -1;
+  }
+  set_lazy_rx_head(&notification_buf_pair_, flush_percent, delay_cycles);
+  return 0;
+}
+
+void Device::DisableLazyRxHead() {
+  set_lazy_rx_head(&notification_buf_pair_, 0, kDefaultRxHeadDelayCycles);
+}
+
+void Device::FlushRxHeads() { flush_rx_heads(&notification_buf_pair_); }
+
+Device::RxHeadStats Device::GetRxHeadStats() const noexcept {
+  return {notification_buf_pair_.rx_head_doorbells,
+          notification_buf_pair_.elided_rx_head_doorbells};
+}
+
+void Device::ProcessCompletions() {
+  if (unlikely(moved_rx_tx_pipes_.load(std::memory_order_relaxed) !=
+               nullptr)) {
+    AdoptMovedPipes();
+  }
+
+  // Reports completions directly to the TxPipes.
+  update_tx_head(&notification_buf_pair_);
+
   // RxTx pipes need to be explicitly notified so that they can free space for
-  // more incoming packets.
-  for (RxTxPipe* pipe : rx_tx_pipes_) {
+  // more incoming packets. Pipes without pending transmissions cannot have new
+  // completions and are skipped.
+  for (uint32_t i = 0; i < pending_tx_rx_tx_pipes_.size();) {
+    RxTxPipe* pipe = pending_tx_rx_tx_pipes_[i];
     pipe->ProcessCompletions();
+    if (pipe->tx_pipe_->pending_transmission() == 0) {
+      pipe->pending_tx_ = false;
+      pending_tx_rx_tx_pipes_[i] = pending_tx_rx_tx_pipes_.back();
+      pending_tx_rx_tx_pipes_.pop_back();
+    } else {
+      ++i;
+    }
+  }
+
+  // Same for RX pipes that sent bytes directly from their buffers.
+  for (uint32_t i = 0; i < pending_tx_rx_pipes_.size();) {
+    RxPipe* pipe = pending_tx_rx_pipes_[i];
+    pipe->ProcessForwardCompletions();
+    if (!pipe->forward_pending()) {
+      pipe->pending_tx_ = false;
+      pending_tx_rx_pipes_[i] = pending_tx_rx_pipes_.back();
+      pending_tx_rx_pipes_.pop_back();
+    } else {
+      ++i;
+    }
+  }
+}
+
+int Device::MoveRxPipe(RxPipe* pipe, Device* dst) noexcept {
+  if (dst == this) {
+    return 0;
+  }
+
+  if (dst->notification_buf_pair_.fpga_dev != notification_buf_pair_.fpga_dev) {
+    std::cerr << "Pipes can only move between devices in the same group"
+              << std::endl;
+    return -1;
+  }
+
+  if (rx_pipes_map_[pipe->id()] != pipe || rx_tx_pipes_map_[pipe->id()]) {
+    std::cerr << "Pipe does not belong to this device" << std::endl;
+    return -1;
+  }
+
+  if (pipe->forward_pending()) {
+    std::cerr << "Pipe has bytes waiting to be transmitted" << std::endl;
+    return -1;
+  }
+
+  DetachRxPipe(pipe, dst);
+
+  RxPipe* head = dst->moved_rx_pipes_.load(std::memory_order_relaxed);
+  do {
+    pipe->next_moved_ = head;
+  } while (!dst->moved_rx_pipes_.compare_exchange_weak(
+      head, pipe, std::memory_order_release, std::memory_order_relaxed));
+
+  return 0;
+}
+
+int Device::MoveRxTxPipe(RxTxPipe* pipe, Device* dst) noexcept {
+  if (dst == this) {
+    return 0;
+  }
+
+  if (dst->notification_buf_pair_.fpga_dev != notification_buf_pair_.fpga_dev) {
+    std::cerr << "Pipes can only move between devices in the same group"
+              << std::endl;
+    return -1;
+  }
+
+  if (rx_tx_pipes_map_[pipe->rx_id()] != pipe) {
+    std::cerr << "Pipe does not belong to this device" << std::endl;
+    return -1;
+  }
+
+  // Completions are reported to the device that sent the data, so we cannot
+  // move the pipe while it has pending transmissions.
+  TxPipe* tx_pipe = pipe->tx_pipe_;
+  FlushTx();
+  while (tx_pipe->pending_transmission() != 0) {
+    ProcessCompletions();
+  }
+
+  // Completions may have arrived without `ProcessCompletions()` noticing.
+  if (pipe->pending_tx_) {
+    pipe->ProcessCompletions();
+    pipe->pending_tx_ = false;
+    pending_tx_rx_tx_pipes_.erase(std::find(pending_tx_rx_tx_pipes_.begin(),
+                                            pending_tx_rx_tx_pipes_.end(),
+                                            pipe));
+  }
+
+  rx_tx_pipes_map_[pipe->rx_id()] = nullptr;
+  rx_tx_pipes_.erase(
+      std::find(rx_tx_pipes_.begin(), rx_tx_pipes_.end(), pipe));
+  tx_pipes_.erase(std::find(tx_pipes_.begin(), tx_pipes_.end(), tx_pipe));
+
+  DetachRxPipe(pipe->rx_pipe_, dst);
+  pipe->device_ = dst;
+  tx_pipe->device_ = dst;
+
+  RxTxPipe* head = dst->moved_rx_tx_pipes_.load(std::memory_order_relaxed);
+  do {
+    pipe->next_moved_ = head;
+  } while (!dst->moved_rx_tx_pipes_.compare_exchange_weak(
+      head, pipe, std::memory_order_release, std::memory_order_relaxed));
+
+  return 0;
+}
+
+void Device::DetachRxPipe(RxPipe* pipe, Device* dst) noexcept {
+  rx_pipes_map_[pipe->id()] = nullptr;
+  rx_pipes_.erase(std::find(rx_pipes_.begin(), rx_pipes_.end(), pipe));
+
+  enso_pipe_move(&pipe->internal_rx_pipe_, &notification_buf_pair_,
+                 &dst->notification_buf_pair_);
+  pipe->notification_buf_pair_ = &dst->notification_buf_pair_;
+  pipe->next_pipe_ = false;
+
+  if (rx_sched_pipe_ == pipe) {
+    rx_sched_pipe_ = nullptr;
+  }
+  pipe->rx_budget_ = RxPipe::kNoRxBudget;
+
+  // Request a notification with the latest tail in the new notification
+  // buffer. This also wakes up the thread using `dst` if it is sleeping.
+  pipe->Prefetch();
+}
+
+void Device::AdoptMovedPipes() noexcept {
+  RxPipe* rx_pipe =
+      moved_rx_pipes_.exchange(nullptr, std::memory_order_acquire);
+  while (rx_pipe != nullptr) {
+    rx_pipes_.push_back(rx_pipe);
+    rx_pipes_map_[rx_pipe->id()] = rx_pipe;
+
+    // We may have consumed the notification that the previous device requested
+    // before adopting the pipe, request another one.
+    rx_pipe->Prefetch();
+    rx_pipe = rx_pipe->next_moved_;
+  }
+
+  RxTxPipe* rx_tx_pipe =
+      moved_rx_tx_pipes_.exchange(nullptr, std::memory_order_acquire);
+  while (rx_tx_pipe != nullptr) {
+    rx_tx_pipes_.push_back(rx_tx_pipe);
+    rx_tx_pipes_map_[rx_tx_pipe->rx_id()] = rx_tx_pipe;
+    rx_pipes_.push_back(rx_tx_pipe->rx_pipe_);
+    rx_pipes_map_[rx_tx_pipe->rx_id()] = rx_tx_pipe->rx_pipe_;
+    tx_pipes_.push_back(rx_tx_pipe->tx_pipe_);
+
+    rx_tx_pipe->rx_pipe_->Prefetch();
+    rx_tx_pipe = rx_tx_pipe->next_moved_;
+  }
+}
+
+std::unique_ptr<DeviceGroup> DeviceGroup::Create(
+    uint32_t nb_devices, const std::string& pcie_addr,
+    const std::string& huge_page_prefix,
+    uint64_t huge_page_arena_size) noexcept {
+  if (nb_devices == 0 || nb_devices > kMaxNbApps) {
+    std::cerr << "Number of devices must be between 1 and " << kMaxNbApps
+              << std::endl;
+    return std::unique_ptr<DeviceGroup>{};
+  }
+
+  std::unique_ptr<DeviceGroup> group(new (std::nothrow) DeviceGroup());
+  if (unlikely(!group)) {
+    return std::unique_ptr<DeviceGroup>{};
+  }
+
+  group->devices_.reserve(nb_devices);
+
+  void* fpga_dev = nullptr;
+  for (uint32_t i = 0; i < nb_devices; ++i) {
+    std::unique_ptr<Device> dev(new (std::nothrow) Device(
+        pcie_addr, huge_page_prefix, huge_page_arena_size));
+    if (unlikely(!dev)) {
+      return std::unique_ptr<DeviceGroup>{};
+    }
+
+    if (dev->Init(fpga_dev)) {
+      return std::unique_ptr<DeviceGroup>{};
+    }
+
+    // All other devices share the handle opened by the first one.
+    fpga_dev = dev->notification_buf_pair_.fpga_dev;
+    group->devices_.push_back(std::move(dev));
+  }
+
+  return group;
+}
+
+DeviceGroup::~DeviceGroup() {
+  // The first device owns the handle that the others use, free it last.
+  while (!devices_.empty()) {
+    devices_.pop_back();
   }
 }
 
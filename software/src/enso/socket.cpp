@@ -148,7 +148,7 @@ ssize_t recv(int sockfd, void* buf, size_t len, int flags) {
 
   memcpy(buf, ring_buf, bytes_received);
 
-  advance_pipe(enso_pipe, bytes_received);
+  advance_pipe(enso_pipe, notification_buf_pair, bytes_received);
 
   return bytes_received;
 }
@@ -180,7 +180,7 @@ ssize_t recv_select(int ref_sockfd, int* sockfd, void** buf, size_t len,
 ssize_t send(int sockfd, uint64_t phys_addr, size_t len, int flags) {
   (void)flags;
   return send_to_queue(open_sockets[sockfd].notification_buf_pair, phys_addr,
-                       len);
+                       len, nullptr);
 }
 
 uint32_t get_completions(int ref_sockfd) {
@@ -190,7 +190,8 @@ uint32_t get_completions(int ref_sockfd) {
 }
 
 void free_enso_pipe(int sockfd, size_t len) {
-  advance_pipe(&(open_sockets[sockfd].enso_pipe), len);
+  advance_pipe(&(open_sockets[sockfd].enso_pipe),
+               open_sockets[sockfd].notification_buf_pair, len);
 }
 
 int enable_device_timestamp(int ref_sockfd, uint8_t offset) {
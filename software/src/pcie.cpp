@@ -52,6 +52,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cerrno>
 #include <cstdint>
 #include <cstdlib>
@@ -60,6 +61,9 @@
 #include <iostream>
 #include <limits>
 #include <stdexcept>
+#include <vector>
+
+#include "arena.h"
 
 // Automatically points to the device backend configured at compile time.
 #include <dev_backend.h>
@@ -74,8 +78,13 @@ static _enso_always_inline void try_clflush([[maybe_unused]] void* addr) {
 
 int notification_buf_init(uint32_t bdf, int32_t bar,
                           struct NotificationBufPair* notification_buf_pair,
-                          const std::string& huge_page_prefix) {
-  DevBackend* fpga_dev = DevBackend::Create(bdf, bar);
+                          const std::string& huge_page_prefix,
+                          void* shared_fpga_dev) {
+  DevBackend* fpga_dev = static_cast<DevBackend*>(shared_fpga_dev);
+  notification_buf_pair->owns_fpga_dev = fpga_dev == nullptr;
+  if (fpga_dev == nullptr) {
+    fpga_dev = DevBackend::Create(bdf, bar);
+  }
   if (unlikely(fpga_dev == nullptr)) {
     std::cerr << "Could not create device" << std::endl;
     return -1;
@@ -129,8 +138,18 @@ int notification_buf_init(uint32_t bdf, int32_t bar,
                                std::to_string(notification_buf_pair->id);
 
   notification_buf_pair->regs = (struct QueueRegs*)notification_buf_pair_regs;
-  notification_buf_pair->rx_buf =
-      (struct RxNotification*)get_huge_page(huge_page_path);
+
+  HugePageArena* arena =
+      static_cast<HugePageArena*>(notification_buf_pair->arena);
+  if (arena != nullptr) {
+    // Keep both buffers in the same huge page so that they are physically
+    // contiguous regardless of the page size.
+    notification_buf_pair->rx_buf = (struct RxNotification*)arena->Allocate(
+        kAlignedDscBufPairSize, kBufPageSize);
+  } else {
+    notification_buf_pair->rx_buf =
+        (struct RxNotification*)get_huge_page(huge_page_path);
+  }
   if (notification_buf_pair->rx_buf == NULL) {
     std::cerr << "Could not get huge page" << std::endl;
     return -1;
@@ -171,15 +190,24 @@ int notification_buf_init(uint32_t bdf, int32_t bar,
     std::cerr << "Could not allocate memory" << std::endl;
     return -1;
   }
-  memset(notification_buf_pair->pending_rx_pipe_tails, 0, kMaxNbFlows);
+  memset(notification_buf_pair->pending_rx_pipe_tails, 0,
+         sizeof(*(notification_buf_pair->pending_rx_pipe_tails)) * kMaxNbFlows);
+
+  size_t ready_pipes_size = sizeof(uint64_t) * ((kMaxNbFlows + 63) / 64);
+  notification_buf_pair->rx_ready_pipes = (uint64_t*)malloc(ready_pipes_size);
+  if (notification_buf_pair->rx_ready_pipes == NULL) {
+    std::cerr << "Could not allocate memory" << std::endl;
+    return -1;
+  }
+  memset(notification_buf_pair->rx_ready_pipes, 0, ready_pipes_size);
 
-  notification_buf_pair->wrap_tracker =
-      (uint8_t*)malloc(kNotificationBufSize / 8);
-  if (notification_buf_pair->wrap_tracker == NULL) {
+  notification_buf_pair->deferred_rx_pipes =
+      (struct RxEnsoPipeInternal**)malloc(sizeof(struct RxEnsoPipeInternal*) *
+                                          kMaxNbFlows);
+  if (notification_buf_pair->deferred_rx_pipes == NULL) {
     std::cerr << "Could not allocate memory" << std::endl;
     return -1;
   }
-  memset(notification_buf_pair->wrap_tracker, 0, kNotificationBufSize / 8);
 
   notification_buf_pair->next_rx_pipe_ids =
       (enso_pipe_id_t*)malloc(kNotificationBufSize * sizeof(enso_pipe_id_t));
@@ -188,10 +216,31 @@ int notification_buf_init(uint32_t bdf, int32_t bar,
     return -1;
   }
 
+  size_t tx_completions_size =
+      kNotificationBufSize * sizeof(struct TxCompletion);
+  notification_buf_pair->tx_completions =
+      (struct TxCompletion*)malloc(tx_completions_size);
+  if (notification_buf_pair->tx_completions == NULL) {
+    std::cerr << "Could not allocate memory" << std::endl;
+    return -1;
+  }
+  memset(notification_buf_pair->tx_completions, 0, tx_completions_size);
+
   notification_buf_pair->next_rx_ids_head = 0;
   notification_buf_pair->next_rx_ids_tail = 0;
   notification_buf_pair->tx_full_cnt = 0;
   notification_buf_pair->nb_unreported_completions = 0;
+  notification_buf_pair->nb_issued_configs = 0;
+  notification_buf_pair->nb_completed_configs = 0;
+  notification_buf_pair->nb_unflushed_tx = 0;
+  notification_buf_pair->tx_batch_size = 1;
+  notification_buf_pair->tx_batch_delay_cycles = kDefaultTxBatchDelayCycles;
+  notification_buf_pair->rx_head_flush_percent = 0;
+  notification_buf_pair->written_rx_head = notification_buf_pair->rx_head;
+  notification_buf_pair->rx_head_delay_cycles = kDefaultRxHeadDelayCycles;
+  notification_buf_pair->nb_deferred_rx_pipes = 0;
+  notification_buf_pair->rx_head_doorbells = 0;
+  notification_buf_pair->elided_rx_head_doorbells = 0;
   notification_buf_pair->huge_page_prefix = huge_page_prefix;
 
   // Setting the address enables the queue. Do this last.
@@ -211,64 +260,172 @@ int notification_buf_init(uint32_t bdf, int32_t bar,
   return 0;
 }
 
-int enso_pipe_init(struct RxEnsoPipeInternal* enso_pipe,
-                   struct NotificationBufPair* notification_buf_pair,
-                   bool fallback) {
-  void* uio_mmap_bar2_addr = notification_buf_pair->uio_mmap_bar2_addr;
-  DevBackend* fpga_dev =
-      static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
+uint32_t min_pipe_buf_size(bool mirrored) {
+  return mirrored ? kBufPageSize : kPipeGuardSize;
+}
 
-  int enso_pipe_id = fpga_dev->AllocatePipe(fallback);
+bool is_valid_pipe_buf_size(uint32_t buf_size, bool mirrored) {
+  return buf_size >= min_pipe_buf_size(mirrored) &&
+         buf_size <= kMaxPipeBufSize && (buf_size & (buf_size - 1)) == 0;
+}
 
-  if (enso_pipe_id < 0) {
-    std::cerr << "Could not allocate pipe" << std::endl;
-    return -1;
+/**
+ * @brief Checks if a buffer is contiguous in the device address space.
+ */
+static bool is_dev_contiguous(DevBackend* fpga_dev, uint8_t* buf,
+                              uint64_t size) {
+  uint64_t base_addr = fpga_dev->ConvertVirtAddrToDevAddr(buf);
+  uint64_t offset = kBufPageSize - (uint64_t)buf % kBufPageSize;
+  for (; offset < size; offset += kBufPageSize) {
+    uint64_t addr = fpga_dev->ConvertVirtAddrToDevAddr(buf + offset);
+    if (addr != base_addr + offset) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Checks if the device supports RX pipes with `buf_size` bytes.
+ *
+ * RX pipes carved from the huge page arena are not mirrored, so they may be
+ * smaller than a huge page.
+ */
+static bool __is_valid_rx_pipe_buf_size(
+    uint32_t buf_size, struct NotificationBufPair* notification_buf_pair) {
+  bool mirrored = notification_buf_pair->arena == nullptr;
+  if (!is_valid_pipe_buf_size(buf_size, mirrored)) {
+    std::cerr << "Pipe buffer size must be a power of two between "
+              << min_pipe_buf_size(mirrored) << " and " << kMaxPipeBufSize
+              << " bytes" << std::endl;
+    return false;
+  }
+
+  if (!DevBackend::kPerPipeRxSize && buf_size != kDefaultPipeBufSize) {
+    std::cerr << "This device only supports RX pipes with "
+              << kDefaultPipeBufSize << " bytes" << std::endl;
+    return false;
   }
 
+  return true;
+}
+
+/**
+ * @brief Sets the registers of a newly-allocated pipe and disables it.
+ *
+ * After this call, the pipe can be freed with `enso_pipe_free`.
+ */
+static void __reset_enso_pipe(struct RxEnsoPipeInternal* enso_pipe,
+                              struct NotificationBufPair* notification_buf_pair,
+                              enso_pipe_id_t enso_pipe_id) {
   // Register associated with the enso pipe.
   volatile struct QueueRegs* enso_pipe_regs =
-      (struct QueueRegs*)((uint8_t*)uio_mmap_bar2_addr +
+      (struct QueueRegs*)((uint8_t*)notification_buf_pair->uio_mmap_bar2_addr +
                           enso_pipe_id * kMemorySpacePerQueue);
   enso_pipe->regs = (struct QueueRegs*)enso_pipe_regs;
+  enso_pipe->id = enso_pipe_id;
 
-  // Make sure the queue is disabled.
+  // Make sure the queue is disabled and that head and tail start at zero.
   DevBackend::mmio_write32(&enso_pipe_regs->rx_mem_low, 0);
   DevBackend::mmio_write32(&enso_pipe_regs->rx_mem_high, 0);
+  DevBackend::mmio_write32(&enso_pipe_regs->rx_tail, 0);
+  DevBackend::mmio_write32(&enso_pipe_regs->rx_head, 0);
+}
+
+/**
+ * @brief Waits until the device applies the writes from `__reset_enso_pipe`.
+ *
+ * Register writes are not reordered, so waiting for the last pipe that was
+ * reset also waits for all the pipes that were reset before it.
+ */
+static void __wait_for_enso_pipe_reset(struct RxEnsoPipeInternal* enso_pipe) {
+  volatile struct QueueRegs* enso_pipe_regs = enso_pipe->regs;
   while (DevBackend::mmio_read32(&enso_pipe_regs->rx_mem_low) != 0 ||
          DevBackend::mmio_read32(&enso_pipe_regs->rx_mem_high) != 0)
     continue;
-
-  // Make sure head and tail start at zero.
-  DevBackend::mmio_write32(&enso_pipe_regs->rx_tail, 0);
   while (DevBackend::mmio_read32(&enso_pipe_regs->rx_tail) != 0) continue;
-
-  DevBackend::mmio_write32(&enso_pipe_regs->rx_head, 0);
   while (DevBackend::mmio_read32(&enso_pipe_regs->rx_head) != 0) continue;
+}
+
+/**
+ * @brief Allocates the buffer of a pipe that was reset.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int __alloc_enso_pipe_buf(
+    struct RxEnsoPipeInternal* enso_pipe,
+    struct NotificationBufPair* notification_buf_pair, uint32_t buf_size) {
+  DevBackend* fpga_dev =
+      static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
+  enso_pipe_id_t enso_pipe_id = enso_pipe->id;
+
+  // Needed to free the buffer.
+  enso_pipe->size_mask = buf_size / 64 - 1;
+  enso_pipe->huge_page_prefix = notification_buf_pair->huge_page_prefix;
 
   std::string huge_page_path = notification_buf_pair->huge_page_prefix +
                                std::string(kHugePageRxPipePathPrefix) +
                                std::to_string(enso_pipe_id);
 
-  enso_pipe->buf = (uint32_t*)get_huge_page(huge_page_path, 0, true);
-  if (enso_pipe->buf == NULL) {
-    std::cerr << "Could not get huge page" << std::endl;
-    return -1;
+  HugePageArena* arena =
+      static_cast<HugePageArena*>(notification_buf_pair->arena);
+  if (arena != nullptr) {
+    enso_pipe->buf = (uint32_t*)arena->Allocate(buf_size + kPipeGuardSize);
+    enso_pipe->mirrored = false;
+    if (enso_pipe->buf == NULL) {
+      std::cerr << "Huge page arena is full" << std::endl;
+      return -1;
+    }
+
+    // The device writes to the buffer using a single base address.
+    if (!is_dev_contiguous(fpga_dev, (uint8_t*)enso_pipe->buf, buf_size)) {
+      std::cerr << "Pipe buffer is not physically contiguous, the huge page "
+                   "arena should use 1GB pages"
+                << std::endl;
+      arena->Free(enso_pipe->buf);
+      enso_pipe->buf = nullptr;
+      return -1;
+    }
+  } else {
+    enso_pipe->buf = (uint32_t*)get_huge_page(huge_page_path, buf_size, true);
+    enso_pipe->mirrored = true;
+    if (enso_pipe->buf == NULL) {
+      std::cerr << "Could not get huge page" << std::endl;
+      return -1;
+    }
   }
-  uint64_t phys_addr = fpga_dev->ConvertVirtAddrToDevAddr(enso_pipe->buf);
+
+  return 0;
+}
+
+/**
+ * @brief Enables a pipe whose buffer was allocated.
+ *
+ * @param phys_addr Address of the pipe buffer as seen by the device.
+ */
+static void __enable_enso_pipe(
+    struct RxEnsoPipeInternal* enso_pipe,
+    struct NotificationBufPair* notification_buf_pair, uint64_t phys_addr) {
+  volatile struct QueueRegs* enso_pipe_regs = enso_pipe->regs;
 
   enso_pipe->buf_phys_addr = phys_addr;
   enso_pipe->phys_buf_offset = phys_addr - (uint64_t)(enso_pipe->buf);
 
-  enso_pipe->id = enso_pipe_id;
   enso_pipe->buf_head_ptr = (uint32_t*)&enso_pipe_regs->rx_head;
   enso_pipe->rx_head = 0;
   enso_pipe->rx_tail = 0;
-  enso_pipe->huge_page_prefix = notification_buf_pair->huge_page_prefix;
+  enso_pipe->written_head = 0;
+  enso_pipe->head_deferred = false;
 
   // Make sure the last tail matches the current head.
   notification_buf_pair->pending_rx_pipe_tails[enso_pipe->id] =
       enso_pipe->rx_head;
 
+  if constexpr (DevBackend::kPerPipeRxSize) {
+    DevBackend::mmio_write32(&enso_pipe_regs->rx_size,
+                             enso_pipe->size_mask + 1);
+  }
+
   // Setting the address enables the queue. Do this last.
   // The least significant bits in rx_mem_low are used to keep the notification
   // buffer ID. Therefore we add `notification_buf_pair->id` to the address.
@@ -276,12 +433,90 @@ int enso_pipe_init(struct RxEnsoPipeInternal* enso_pipe,
                            (uint32_t)phys_addr + notification_buf_pair->id);
   DevBackend::mmio_write32(&enso_pipe_regs->rx_mem_high,
                            (uint32_t)(phys_addr >> 32));
+}
+
+int enso_pipe_init(struct RxEnsoPipeInternal* enso_pipe,
+                   struct NotificationBufPair* notification_buf_pair,
+                   bool fallback, uint32_t buf_size) {
+  DevBackend* fpga_dev =
+      static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
+
+  if (!__is_valid_rx_pipe_buf_size(buf_size, notification_buf_pair)) {
+    return -1;
+  }
+
+  int enso_pipe_id = fpga_dev->AllocatePipe(fallback);
+
+  if (enso_pipe_id < 0) {
+    std::cerr << "Could not allocate pipe" << std::endl;
+    return -1;
+  }
+
+  __reset_enso_pipe(enso_pipe, notification_buf_pair, enso_pipe_id);
+  __wait_for_enso_pipe_reset(enso_pipe);
+
+  if (__alloc_enso_pipe_buf(enso_pipe, notification_buf_pair, buf_size)) {
+    return -1;
+  }
+
+  uint64_t phys_addr = fpga_dev->ConvertVirtAddrToDevAddr(enso_pipe->buf);
+  __enable_enso_pipe(enso_pipe, notification_buf_pair, phys_addr);
 
   update_fallback_queues_config(notification_buf_pair);
 
   return enso_pipe_id;
 }
 
+int enso_pipes_init(struct RxEnsoPipeInternal** enso_pipes, uint32_t nb_pipes,
+                    struct NotificationBufPair* notification_buf_pair,
+                    bool fallback, uint32_t buf_size) {
+  DevBackend* fpga_dev =
+      static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
+
+  if (nb_pipes == 0) {
+    return 0;
+  }
+
+  if (!__is_valid_rx_pipe_buf_size(buf_size, notification_buf_pair)) {
+    return -1;
+  }
+
+  std::vector<int> enso_pipe_ids(nb_pipes);
+  if (fpga_dev->AllocatePipes(nb_pipes, fallback, enso_pipe_ids.data())) {
+    std::cerr << "Could not allocate " << nb_pipes << " pipes" << std::endl;
+    return -1;
+  }
+
+  // Reset all pipes before waiting, so that we only wait once.
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    __reset_enso_pipe(enso_pipes[i], notification_buf_pair, enso_pipe_ids[i]);
+  }
+  __wait_for_enso_pipe_reset(enso_pipes[nb_pipes - 1]);
+
+  std::vector<void*> bufs(nb_pipes);
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    if (__alloc_enso_pipe_buf(enso_pipes[i], notification_buf_pair,
+                              buf_size)) {
+      return -1;
+    }
+    bufs[i] = enso_pipes[i]->buf;
+  }
+
+  // Translate all buffers at once, as each translation may need to go through
+  // the device.
+  std::vector<uint64_t> phys_addrs(nb_pipes);
+  fpga_dev->ConvertVirtAddrsToDevAddrs(bufs.data(), phys_addrs.data(),
+                                       nb_pipes);
+
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    __enable_enso_pipe(enso_pipes[i], notification_buf_pair, phys_addrs[i]);
+  }
+
+  update_fallback_queues_config(notification_buf_pair);
+
+  return 0;
+}
+
 int dma_init(struct NotificationBufPair* notification_buf_pair,
              struct RxEnsoPipeInternal* enso_pipe, uint32_t bdf, int32_t bar,
              const std::string& huge_page_prefix, bool fallback) {
@@ -308,6 +543,312 @@ int dma_init(struct NotificationBufPair* notification_buf_pair,
   return enso_pipe_init(enso_pipe, notification_buf_pair, fallback);
 }
 
+static _enso_always_inline void __write_rx_pipe_head(
+    struct NotificationBufPair* notification_buf_pair,
+    struct RxEnsoPipeInternal* enso_pipe) {
+  DevBackend::mmio_write32(enso_pipe->buf_head_ptr, enso_pipe->rx_head);
+  enso_pipe->written_head = enso_pipe->rx_head;
+  ++notification_buf_pair->rx_head_doorbells;
+}
+
+static _enso_always_inline bool __has_deferred_rx_heads(
+    struct NotificationBufPair* notification_buf_pair) {
+  return notification_buf_pair->nb_deferred_rx_pipes != 0 ||
+         notification_buf_pair->written_rx_head !=
+             notification_buf_pair->rx_head;
+}
+
+/**
+ * @brief Writes all deferred RX heads to the device.
+ */
+static void __flush_rx_heads(
+    struct NotificationBufPair* notification_buf_pair) {
+  uint32_t nb_deferred_rx_pipes = notification_buf_pair->nb_deferred_rx_pipes;
+  for (uint32_t i = 0; i < nb_deferred_rx_pipes; ++i) {
+    struct RxEnsoPipeInternal* enso_pipe =
+        notification_buf_pair->deferred_rx_pipes[i];
+    enso_pipe->head_deferred = false;
+    if (enso_pipe->written_head != enso_pipe->rx_head) {
+      __write_rx_pipe_head(notification_buf_pair, enso_pipe);
+    }
+  }
+  notification_buf_pair->nb_deferred_rx_pipes = 0;
+
+  if (notification_buf_pair->written_rx_head !=
+      notification_buf_pair->rx_head) {
+    DevBackend::mmio_write32(notification_buf_pair->rx_head_ptr,
+                             notification_buf_pair->rx_head);
+    notification_buf_pair->written_rx_head = notification_buf_pair->rx_head;
+    ++notification_buf_pair->rx_head_doorbells;
+  }
+}
+
+/**
+ * @brief Starts the delay of the first deferred RX head.
+ */
+static _enso_always_inline void __start_rx_head_delay(
+    struct NotificationBufPair* notification_buf_pair) {
+  if (!__has_deferred_rx_heads(notification_buf_pair)) {
+    notification_buf_pair->first_deferred_rx_head_tsc = __rdtsc();
+  }
+}
+
+/**
+ * @brief Removes a pipe from the list of pipes with deferred heads, writing its
+ *        head if needed.
+ */
+static void __flush_rx_pipe_head(
+    struct NotificationBufPair* notification_buf_pair,
+    struct RxEnsoPipeInternal* enso_pipe) {
+  if (enso_pipe->written_head != enso_pipe->rx_head) {
+    __write_rx_pipe_head(notification_buf_pair, enso_pipe);
+  }
+
+  if (!enso_pipe->head_deferred) {
+    return;
+  }
+  enso_pipe->head_deferred = false;
+
+  struct RxEnsoPipeInternal** deferred_rx_pipes =
+      notification_buf_pair->deferred_rx_pipes;
+  uint32_t nb_deferred_rx_pipes = --notification_buf_pair->nb_deferred_rx_pipes;
+  for (uint32_t i = 0; i < nb_deferred_rx_pipes; ++i) {
+    if (deferred_rx_pipes[i] == enso_pipe) {
+      deferred_rx_pipes[i] = deferred_rx_pipes[nb_deferred_rx_pipes];
+      break;
+    }
+  }
+}
+
+/**
+ * @brief Sets a new head for a pipe, writing it to the device unless the lazy
+ *        RX head policy allows deferring it.
+ */
+static _enso_always_inline void __set_rx_pipe_head(
+    struct NotificationBufPair* notification_buf_pair,
+    struct RxEnsoPipeInternal* enso_pipe, uint32_t rx_head) {
+  enso_pipe->rx_head = rx_head;
+
+  uint32_t flush_percent = notification_buf_pair->rx_head_flush_percent;
+  if (flush_percent == 0) {
+    __write_rx_pipe_head(notification_buf_pair, enso_pipe);
+    return;
+  }
+
+  uint32_t size_mask = enso_pipe->size_mask;
+  uint32_t written_head = enso_pipe->written_head;
+  uint32_t threshold = (uint64_t)(size_mask + 1) * flush_percent / 100;
+  uint32_t nb_deferred_flits = (rx_head - written_head) & size_mask;
+
+  // Occupancy as seen by the device. If it has less than `threshold` flits
+  // left, we write the head right away so that it does not drop packets.
+  uint32_t tail =
+      notification_buf_pair->pending_rx_pipe_tails[enso_pipe->id];
+  uint32_t device_occupancy = (tail - written_head) & size_mask;
+
+  if (nb_deferred_flits >= threshold ||
+      device_occupancy + threshold > size_mask) {
+    __write_rx_pipe_head(notification_buf_pair, enso_pipe);
+    return;
+  }
+
+  ++notification_buf_pair->elided_rx_head_doorbells;
+  if (!enso_pipe->head_deferred) {
+    __start_rx_head_delay(notification_buf_pair);
+    enso_pipe->head_deferred = true;
+    notification_buf_pair
+        ->deferred_rx_pipes[notification_buf_pair->nb_deferred_rx_pipes++] =
+        enso_pipe;
+  }
+}
+
+/**
+ * @brief Sets a new head for the notification buffer, writing it to the device
+ *        unless the lazy RX head policy allows deferring it.
+ */
+static _enso_always_inline void __set_notification_buf_head(
+    struct NotificationBufPair* notification_buf_pair, uint32_t rx_head) {
+  uint32_t flush_percent = notification_buf_pair->rx_head_flush_percent;
+  uint32_t written_rx_head = notification_buf_pair->written_rx_head;
+  uint32_t nb_deferred_notifications =
+      (rx_head - written_rx_head) % kNotificationBufSize;
+
+  if (flush_percent == 0 ||
+      (uint64_t)nb_deferred_notifications * 100 >=
+          (uint64_t)kNotificationBufSize * flush_percent) {
+    notification_buf_pair->rx_head = rx_head;
+    DevBackend::mmio_write32(notification_buf_pair->rx_head_ptr, rx_head);
+    notification_buf_pair->written_rx_head = rx_head;
+    ++notification_buf_pair->rx_head_doorbells;
+    return;
+  }
+
+  __start_rx_head_delay(notification_buf_pair);
+  notification_buf_pair->rx_head = rx_head;
+  ++notification_buf_pair->elided_rx_head_doorbells;
+}
+
+/**
+ * @brief Marks a pipe as ready.
+ *
+ * @return True if the pipe was not ready yet and must be queued.
+ */
+static _enso_always_inline bool __set_pipe_ready(
+    struct NotificationBufPair* notification_buf_pair,
+    enso_pipe_id_t enso_pipe_id) {
+  uint64_t* word = notification_buf_pair->rx_ready_pipes + enso_pipe_id / 64;
+  uint64_t bit = 1ULL << (enso_pipe_id % 64);
+  bool was_ready = *word & bit;
+  *word |= bit;
+  return !was_ready;
+}
+
+/**
+ * @brief Consumes a single notification and queues its pipe id unless the pipe
+ *        is already queued.
+ */
+static _enso_always_inline void __consume_notification(
+    struct NotificationBufPair* notification_buf_pair,
+    struct RxNotification* notification, uint16_t* next_rx_ids_tail) {
+  notification->signal = 0;
+
+  enso_pipe_id_t enso_pipe_id = notification->queue_id;
+  notification_buf_pair->pending_rx_pipe_tails[enso_pipe_id] =
+      (uint32_t)notification->tail;
+
+  if (__set_pipe_ready(notification_buf_pair, enso_pipe_id)) {
+    notification_buf_pair->next_rx_pipe_ids[*next_rx_ids_tail] = enso_pipe_id;
+    *next_rx_ids_tail = (*next_rx_ids_tail + 1) % kNotificationBufSize;
+  }
+}
+
+#ifdef AVX512_NOTIFICATION_SCAN
+
+#if !defined(__AVX512F__) || !defined(__AVX512CD__)
+#error "AVX512_NOTIFICATION_SCAN requires AVX-512F and AVX-512CD"
+#endif
+
+// Number of notifications checked per iteration of the vectorized scan.
+constexpr uint32_t kNotificationsPerVector = 8;
+
+static_assert(sizeof(struct RxNotification) == 8 * sizeof(uint64_t),
+              "Vectorized scan assumes 64-byte notifications");
+static_assert(kBatchSize % kNotificationsPerVector == 0,
+              "Batch size must be a multiple of the vector width");
+
+/**
+ * @brief Consumes up to `kNotificationsPerVector` consecutive notifications
+ *        starting at `notification`, which must not wrap around the end of the
+ *        notification buffer.
+ *
+ * Signals, pipe ids and tails are loaded for all notifications at once. Pipe
+ * ids that repeat within the vector or that are already queued are discarded
+ * and the remaining ones are compressed into `next_rx_pipe_ids`.
+ *
+ * @return The number of consumed notifications.
+ */
+static _enso_always_inline uint32_t __consume_notification_vector(
+    struct NotificationBufPair* notification_buf_pair,
+    struct RxNotification* notification, uint16_t* next_rx_ids_tail) {
+  const __m512i zero = _mm512_setzero_si512();
+
+  // Every notification fills a cache line. Load all of them and transpose
+  // their first words (signal, queue_id and tail) into one vector per field.
+  const __m512i low_halves_idx = _mm512_set_epi64(11, 10, 9, 8, 3, 2, 1, 0);
+  const __m512i high_halves_idx =
+      _mm512_set_epi64(15, 14, 13, 12, 7, 6, 5, 4);
+
+  __m512i pairs[kNotificationsPerVector / 2];
+  for (uint32_t i = 0; i < kNotificationsPerVector / 2; ++i) {
+    __m512i first = _mm512_load_si512(notification + 2 * i);
+    __m512i second = _mm512_load_si512(notification + 2 * i + 1);
+    pairs[i] = _mm512_permutex2var_epi64(first, low_halves_idx, second);
+  }
+
+  const __m512i signal_queue_id_idx =
+      _mm512_set_epi64(13, 9, 5, 1, 12, 8, 4, 0);
+  const __m512i tail_idx = _mm512_set_epi64(14, 10, 6, 2, 14, 10, 6, 2);
+  __m512i low_signal_queue_ids =
+      _mm512_permutex2var_epi64(pairs[0], signal_queue_id_idx, pairs[1]);
+  __m512i high_signal_queue_ids =
+      _mm512_permutex2var_epi64(pairs[2], signal_queue_id_idx, pairs[3]);
+  __m512i low_tails = _mm512_permutex2var_epi64(pairs[0], tail_idx, pairs[1]);
+  __m512i high_tails = _mm512_permutex2var_epi64(pairs[2], tail_idx, pairs[3]);
+
+  __m512i signals = _mm512_permutex2var_epi64(
+      low_signal_queue_ids, low_halves_idx, high_signal_queue_ids);
+  uint32_t ready_mask = _mm512_test_epi64_mask(signals, signals);
+
+  // Only consume the prefix of ready notifications, the NIC fills them in
+  // order.
+  uint32_t nb_ready = _tzcnt_u32(~ready_mask);
+  if (nb_ready == 0) {
+    return 0;
+  }
+  __mmask8 ready = (__mmask8)((1u << nb_ready) - 1);
+
+  __m512i queue_ids = _mm512_permutex2var_epi64(
+      low_signal_queue_ids, high_halves_idx, high_signal_queue_ids);
+  __m512i tails =
+      _mm512_permutex2var_epi64(low_tails, low_halves_idx, high_tails);
+
+  alignas(64) uint64_t lane_queue_ids[kNotificationsPerVector];
+  alignas(64) uint64_t lane_tails[kNotificationsPerVector];
+  _mm512_store_si512(lane_queue_ids, queue_ids);
+  _mm512_store_si512(lane_tails, tails);
+
+  // If a pipe appears more than once the latest tail wins.
+  for (uint32_t i = 0; i < nb_ready; ++i) {
+    notification[i].signal = 0;
+    notification_buf_pair->pending_rx_pipe_tails[lane_queue_ids[i]] =
+        (uint32_t)lane_tails[i];
+  }
+
+  // Keep only the first occurrence of every pipe id in the vector...
+  __m512i conflicts = _mm512_maskz_conflict_epi64(ready, queue_ids);
+  uint32_t first = _mm512_mask_cmpeq_epi64_mask(ready, conflicts, zero);
+
+  // ...and only if the pipe is not already queued.
+  __mmask8 keep = 0;
+  while (first) {
+    uint32_t i = _tzcnt_u32(first);
+    first &= first - 1;
+    keep |= __set_pipe_ready(notification_buf_pair, lane_queue_ids[i]) << i;
+  }
+
+  uint32_t nb_kept = _mm_popcnt_u32(keep);
+  __m512i kept_ids = _mm512_maskz_compress_epi64(keep, queue_ids);
+
+  enso_pipe_id_t new_ids[kNotificationsPerVector];
+  uint16_t tail = *next_rx_ids_tail;
+  enso_pipe_id_t* dst = notification_buf_pair->next_rx_pipe_ids + tail;
+  bool wraps = (tail + nb_kept) > kNotificationBufSize;
+  if (unlikely(wraps)) {
+    dst = new_ids;
+  }
+
+  __mmask8 kept_prefix = (__mmask8)((1u << nb_kept) - 1);
+  if constexpr (sizeof(enso_pipe_id_t) == sizeof(uint16_t)) {
+    _mm512_mask_cvtepi64_storeu_epi16(dst, kept_prefix, kept_ids);
+  } else {
+    _mm512_mask_cvtepi64_storeu_epi32(dst, kept_prefix, kept_ids);
+  }
+
+  if (unlikely(wraps)) {
+    for (uint32_t i = 0; i < nb_kept; ++i) {
+      notification_buf_pair->next_rx_pipe_ids[(tail + i) %
+                                              kNotificationBufSize] =
+          new_ids[i];
+    }
+  }
+
+  *next_rx_ids_tail = (tail + nb_kept) % kNotificationBufSize;
+
+  return nb_ready;
+}
+
+#endif  // AVX512_NOTIFICATION_SCAN
+
 static _enso_always_inline uint16_t
 __get_new_tails(struct NotificationBufPair* notification_buf_pair) {
   struct RxNotification* notification_buf = notification_buf_pair->rx_buf;
@@ -315,8 +856,29 @@ __get_new_tails(struct NotificationBufPair* notification_buf_pair) {
   uint16_t nb_consumed_notifications = 0;
 
   uint16_t next_rx_ids_tail = notification_buf_pair->next_rx_ids_tail;
+  bool scan_more = true;
+
+#ifdef AVX512_NOTIFICATION_SCAN
+  // Vectors never wrap around the end of the notification buffer, the
+  // remaining notifications are handled by the scalar loop below.
+  while (nb_consumed_notifications < kBatchSize &&
+         (notification_buf_head + kNotificationsPerVector) <=
+             kNotificationBufSize) {
+    uint32_t nb_consumed = __consume_notification_vector(
+        notification_buf_pair, notification_buf + notification_buf_head,
+        &next_rx_ids_tail);
+    nb_consumed_notifications += nb_consumed;
+    notification_buf_head =
+        (notification_buf_head + nb_consumed) % kNotificationBufSize;
+
+    if (nb_consumed < kNotificationsPerVector) {
+      scan_more = false;
+      break;
+    }
+  }
+#endif  // AVX512_NOTIFICATION_SCAN
 
-  for (uint16_t i = 0; i < kBatchSize; ++i) {
+  while (scan_more && nb_consumed_notifications < kBatchSize) {
     struct RxNotification* cur_notification =
         notification_buf + notification_buf_head;
 
@@ -325,16 +887,9 @@ __get_new_tails(struct NotificationBufPair* notification_buf_pair) {
       break;
     }
 
-    cur_notification->signal = 0;
+    __consume_notification(notification_buf_pair, cur_notification,
+                           &next_rx_ids_tail);
     notification_buf_head = (notification_buf_head + 1) % kNotificationBufSize;
-
-    enso_pipe_id_t enso_pipe_id = cur_notification->queue_id;
-    notification_buf_pair->pending_rx_pipe_tails[enso_pipe_id] =
-        (uint32_t)cur_notification->tail;
-
-    notification_buf_pair->next_rx_pipe_ids[next_rx_ids_tail] = enso_pipe_id;
-    next_rx_ids_tail = (next_rx_ids_tail + 1) % kNotificationBufSize;
-
     ++nb_consumed_notifications;
   }
 
@@ -342,9 +897,19 @@ __get_new_tails(struct NotificationBufPair* notification_buf_pair) {
 
   if (likely(nb_consumed_notifications > 0)) {
     // Update notification buffer head.
-    DevBackend::mmio_write32(notification_buf_pair->rx_head_ptr,
-                             notification_buf_head);
-    notification_buf_pair->rx_head = notification_buf_head;
+    __set_notification_buf_head(notification_buf_pair, notification_buf_head);
+
+    // Heads that waited too long.
+    if (unlikely(__has_deferred_rx_heads(notification_buf_pair)) &&
+        (__rdtsc() - notification_buf_pair->first_deferred_rx_head_tsc) >=
+            notification_buf_pair->rx_head_delay_cycles) {
+      __flush_rx_heads(notification_buf_pair);
+    }
+  } else {
+    // We are waiting for the device, make sure it sees our last writes. This
+    // includes deferred heads, as there is no work to amortize them with.
+    __flush_rx_heads(notification_buf_pair);
+    DevBackend::mmio_flush();
   }
 
   return nb_consumed_notifications;
@@ -354,6 +919,36 @@ uint16_t get_new_tails(struct NotificationBufPair* notification_buf_pair) {
   return __get_new_tails(notification_buf_pair);
 }
 
+/**
+ * @brief Handles batches that wrap around the end of a buffer that is not
+ *        mirrored.
+ *
+ * Copies the part of the last packet that wraps around to the guard region
+ * after the buffer and truncates the batch right after this packet. The
+ * remaining packets are returned by the next call, starting from the beginning
+ * of the buffer.
+ *
+ * @return The number of bytes that can be consumed contiguously.
+ */
+static __attribute__((noinline)) uint32_t unwrap_batch(
+    struct RxEnsoPipeInternal* enso_pipe, uint32_t enso_pipe_head,
+    uint32_t flit_aligned_size) {
+  uint8_t* buf = (uint8_t*)enso_pipe->buf;
+  uint8_t* buf_end = buf + (enso_pipe->size_mask + 1) * 64;
+  uint8_t* pkt = buf + enso_pipe_head * 64;
+
+  // Packets always start at a flit boundary, so their headers never wrap.
+  while (pkt < buf_end) {
+    pkt = get_next_pkt(pkt);
+  }
+
+  uint32_t wrapped_bytes = std::min((uint32_t)(pkt - buf_end), kPipeGuardSize);
+  memcpy(buf_end, buf, wrapped_bytes);
+
+  uint32_t nb_bytes = buf_end - (buf + enso_pipe_head * 64) + wrapped_bytes;
+  return std::min(nb_bytes, flit_aligned_size);
+}
+
 static _enso_always_inline uint32_t
 __consume_queue(struct RxEnsoPipeInternal* enso_pipe,
                 struct NotificationBufPair* notification_buf_pair, void** buf,
@@ -371,11 +966,18 @@ __consume_queue(struct RxEnsoPipeInternal* enso_pipe,
     return 0;
   }
 
+  uint32_t size_mask = enso_pipe->size_mask;
   uint32_t flit_aligned_size =
-      ((enso_pipe_tail - enso_pipe_head) % ENSO_PIPE_SIZE) * 64;
+      ((enso_pipe_tail - enso_pipe_head) & size_mask) * 64;
+
+  if (unlikely(!enso_pipe->mirrored &&
+               enso_pipe_head + flit_aligned_size / 64 > size_mask + 1)) {
+    flit_aligned_size = unwrap_batch(enso_pipe, enso_pipe_head,
+                                     flit_aligned_size);
+  }
 
   if (!peek) {
-    enso_pipe_head = (enso_pipe_head + flit_aligned_size / 64) % ENSO_PIPE_SIZE;
+    enso_pipe_head = (enso_pipe_head + flit_aligned_size / 64) & size_mask;
     enso_pipe->rx_tail = enso_pipe_head;
   }
 
@@ -414,6 +1016,10 @@ __get_next_enso_pipe_id(struct NotificationBufPair* notification_buf_pair) {
   enso_pipe_id_t enso_pipe_id =
       notification_buf_pair->next_rx_pipe_ids[next_rx_ids_head];
 
+  // The pipe may be queued again by the next notification.
+  notification_buf_pair->rx_ready_pipes[enso_pipe_id / 64] &=
+      ~(1ULL << (enso_pipe_id % 64));
+
   notification_buf_pair->next_rx_ids_head =
       (next_rx_ids_head + 1) % kNotificationBufSize;
 
@@ -425,6 +1031,46 @@ int32_t get_next_enso_pipe_id(
   return __get_next_enso_pipe_id(notification_buf_pair);
 }
 
+int wait_for_notification(struct NotificationBufPair* notification_buf_pair,
+                          uint32_t spin_us, uint32_t timeout_us) {
+  // Do not sleep while holding back transmissions or freed RX space.
+  flush_tx(notification_buf_pair);
+  __flush_rx_heads(notification_buf_pair);
+
+  // Notifications that were already consumed but not yet processed.
+  if (notification_buf_pair->next_rx_ids_head !=
+      notification_buf_pair->next_rx_ids_tail) {
+    return 0;
+  }
+
+  // The signal is the first field of the (cache-aligned) notification.
+  volatile uint64_t* signal = (volatile uint64_t*)(
+      notification_buf_pair->rx_buf + notification_buf_pair->rx_head);
+
+  auto spin_end =
+      std::chrono::steady_clock::now() + std::chrono::microseconds(spin_us);
+
+  // Reading the clock is expensive, so we only do it every few iterations.
+  for (uint32_t i = 1; *signal == 0; ++i) {
+    if ((i % 64) == 0 && std::chrono::steady_clock::now() >= spin_end) {
+      break;
+    }
+    _mm_pause();
+  }
+
+  if (*signal != 0) {
+    return 0;
+  }
+
+  // We are about to sleep, make sure the device sees our last writes.
+  DevBackend::mmio_flush();
+
+  DevBackend* fpga_dev =
+      static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
+
+  return fpga_dev->WaitForSignal(signal, timeout_us);
+}
+
 // Return next batch among all open sockets.
 uint32_t get_next_batch(struct NotificationBufPair* notification_buf_pair,
                         struct SocketInternal* socket_entries,
@@ -443,78 +1089,189 @@ uint32_t get_next_batch(struct NotificationBufPair* notification_buf_pair,
   return __consume_queue(enso_pipe, notification_buf_pair, buf);
 }
 
-void advance_pipe(struct RxEnsoPipeInternal* enso_pipe, size_t len) {
+void advance_pipe(struct RxEnsoPipeInternal* enso_pipe,
+                  struct NotificationBufPair* notification_buf_pair,
+                  size_t len) {
   uint32_t rx_pkt_head = enso_pipe->rx_head;
   uint32_t nb_flits = ((uint64_t)len - 1) / 64 + 1;
-  rx_pkt_head = (rx_pkt_head + nb_flits) % ENSO_PIPE_SIZE;
+  rx_pkt_head = (rx_pkt_head + nb_flits) & enso_pipe->size_mask;
 
-  DevBackend::mmio_write32(enso_pipe->buf_head_ptr, rx_pkt_head);
-  enso_pipe->rx_head = rx_pkt_head;
+  __set_rx_pipe_head(notification_buf_pair, enso_pipe, rx_pkt_head);
 }
 
-void fully_advance_pipe(struct RxEnsoPipeInternal* enso_pipe) {
-  DevBackend::mmio_write32(enso_pipe->buf_head_ptr, enso_pipe->rx_tail);
-  enso_pipe->rx_head = enso_pipe->rx_tail;
+void fully_advance_pipe(struct RxEnsoPipeInternal* enso_pipe,
+                        struct NotificationBufPair* notification_buf_pair) {
+  __set_rx_pipe_head(notification_buf_pair, enso_pipe, enso_pipe->rx_tail);
 }
 
 void prefetch_pipe(struct RxEnsoPipeInternal* enso_pipe) {
+  // The device only takes a write as a prefetch if it repeats the last head,
+  // so a deferred head must be written first.
+  if (enso_pipe->written_head != enso_pipe->rx_head) {
+    DevBackend::mmio_write32(enso_pipe->buf_head_ptr, enso_pipe->rx_head);
+    enso_pipe->written_head = enso_pipe->rx_head;
+  }
   DevBackend::mmio_write32(enso_pipe->buf_head_ptr, enso_pipe->rx_head);
+  DevBackend::mmio_flush();
+}
+
+void set_lazy_rx_head(struct NotificationBufPair* notification_buf_pair,
+                      uint32_t flush_percent, uint64_t delay_cycles) {
+  __flush_rx_heads(notification_buf_pair);
+  notification_buf_pair->rx_head_flush_percent = flush_percent;
+  notification_buf_pair->rx_head_delay_cycles = delay_cycles;
+}
+
+void flush_rx_heads(struct NotificationBufPair* notification_buf_pair) {
+  __flush_rx_heads(notification_buf_pair);
+}
+
+static _enso_always_inline void __flush_tx(
+    struct NotificationBufPair* notification_buf_pair) {
+  if (notification_buf_pair->nb_unflushed_tx == 0) {
+    return;
+  }
+  notification_buf_pair->nb_unflushed_tx = 0;
+  DevBackend::mmio_write32(notification_buf_pair->tx_tail_ptr,
+                           notification_buf_pair->tx_tail);
+}
+
+/**
+ * @brief Rings the TX doorbell for `nb_descriptors` new descriptors, unless
+ *        the TX batching policy allows deferring it.
+ */
+static _enso_always_inline void __tx_doorbell(
+    struct NotificationBufPair* notification_buf_pair,
+    uint32_t nb_descriptors) {
+  uint32_t nb_unflushed =
+      notification_buf_pair->nb_unflushed_tx + nb_descriptors;
+  notification_buf_pair->nb_unflushed_tx = nb_unflushed;
+
+  if (nb_unflushed >= notification_buf_pair->tx_batch_size) {
+    __flush_tx(notification_buf_pair);
+    return;
+  }
+
+  uint64_t now = __rdtsc();
+  if (nb_unflushed == nb_descriptors) {
+    notification_buf_pair->first_unflushed_tx_tsc = now;
+  } else if ((now - notification_buf_pair->first_unflushed_tx_tsc) >=
+             notification_buf_pair->tx_batch_delay_cycles) {
+    __flush_tx(notification_buf_pair);
+  }
 }
 
 static _enso_always_inline uint32_t
 __send_to_queue(struct NotificationBufPair* notification_buf_pair,
-                uint64_t phys_addr, uint32_t len) {
+                uint64_t phys_addr, uint32_t len, uint32_t* completed_bytes) {
   struct TxNotification* tx_buf = notification_buf_pair->tx_buf;
   uint32_t tx_tail = notification_buf_pair->tx_tail;
   uint32_t missing_bytes = len;
 
   uint64_t transf_addr = phys_addr;
-  uint64_t hugepage_mask = ~((uint64_t)kBufPageSize - 1);
-  uint64_t hugepage_base_addr = transf_addr & hugepage_mask;
-  uint64_t hugepage_boundary = hugepage_base_addr + kBufPageSize;
+  uint32_t nb_descriptors = 0;
 
   while (missing_bytes > 0) {
     uint32_t free_slots =
         (notification_buf_pair->tx_head - tx_tail - 1) % kNotificationBufSize;
 
     // Block until we can send.
-    while (unlikely(free_slots == 0)) {
-      ++notification_buf_pair->tx_full_cnt;
-      update_tx_head(notification_buf_pair);
-      free_slots =
-          (notification_buf_pair->tx_head - tx_tail - 1) % kNotificationBufSize;
+    if (unlikely(free_slots == 0)) {
+      // The device only frees slots for descriptors that it knows about.
+      notification_buf_pair->tx_tail = tx_tail;
+      notification_buf_pair->nb_unflushed_tx += nb_descriptors;
+      nb_descriptors = 0;
+      __flush_tx(notification_buf_pair);
+
+      while (free_slots == 0) {
+        ++notification_buf_pair->tx_full_cnt;
+        update_tx_head(notification_buf_pair);
+        free_slots = (notification_buf_pair->tx_head - tx_tail - 1) %
+                     kNotificationBufSize;
+      }
     }
 
     struct TxNotification* tx_notification = tx_buf + tx_tail;
     uint32_t req_length = std::min(missing_bytes, (uint32_t)kMaxTransferLen);
-    uint32_t missing_bytes_in_page = hugepage_boundary - transf_addr;
-    req_length = std::min(req_length, missing_bytes_in_page);
 
-    // If the transmission needs to be split among multiple requests, we
-    // need to set a bit in the wrap tracker.
-    uint8_t wrap_tracker_mask = (missing_bytes > req_length) << (tx_tail & 0x7);
-    notification_buf_pair->wrap_tracker[tx_tail / 8] |= wrap_tracker_mask;
+    // If the transmission needs to be split among multiple notifications,
+    // only the last one completes the request.
+    bool last_notification = missing_bytes == req_length;
 
     tx_notification->length = req_length;
     tx_notification->signal = 1;
     tx_notification->phys_addr = transf_addr;
 
-    uint64_t huge_page_offset = (transf_addr + req_length) % kBufPageSize;
-    transf_addr = hugepage_base_addr + huge_page_offset;
+    struct TxCompletion* tx_completion =
+        notification_buf_pair->tx_completions + tx_tail;
+    tx_completion->completed_bytes = completed_bytes;
+    tx_completion->completion_len = last_notification ? len : 0;
+
+    transf_addr += req_length;
 
     tx_tail = (tx_tail + 1) % kNotificationBufSize;
     missing_bytes -= req_length;
+    ++nb_descriptors;
   }
 
   notification_buf_pair->tx_tail = tx_tail;
-  DevBackend::mmio_write32(notification_buf_pair->tx_tail_ptr, tx_tail);
+  __tx_doorbell(notification_buf_pair, nb_descriptors);
 
   return len;
 }
 
 uint32_t send_to_queue(struct NotificationBufPair* notification_buf_pair,
-                       uint64_t phys_addr, uint32_t len) {
-  return __send_to_queue(notification_buf_pair, phys_addr, len);
+                       uint64_t phys_addr, uint32_t len,
+                       uint32_t* completed_bytes) {
+  return __send_to_queue(notification_buf_pair, phys_addr, len,
+                         completed_bytes);
+}
+
+bool try_coalesce_send(struct NotificationBufPair* notification_buf_pair,
+                       uint64_t phys_addr, uint32_t len,
+                       uint32_t* completed_bytes) {
+  // The device may already be reading the last descriptor.
+  if (notification_buf_pair->nb_unflushed_tx == 0) {
+    return false;
+  }
+
+  uint32_t last = (notification_buf_pair->tx_tail - 1) % kNotificationBufSize;
+  struct TxNotification* tx_notification = notification_buf_pair->tx_buf + last;
+  uint64_t start = tx_notification->phys_addr;
+  uint64_t length = tx_notification->length + len;
+
+  // Must be the end of a request from the same sender.
+  struct TxCompletion* tx_completion =
+      notification_buf_pair->tx_completions + last;
+  if (tx_completion->completion_len == 0 ||
+      tx_completion->completed_bytes != completed_bytes) {
+    return false;
+  }
+
+  if ((start + tx_notification->length) != phys_addr ||
+      length > kMaxTransferLen ||
+      (start / kBufPageSize) != ((start + length - 1) / kBufPageSize)) {
+    return false;
+  }
+
+  tx_notification->length = length;
+  tx_completion->completion_len += len;
+
+  // No new descriptor but the delay still applies.
+  __tx_doorbell(notification_buf_pair, 0);
+
+  return true;
+}
+
+void set_tx_batching(struct NotificationBufPair* notification_buf_pair,
+                     uint32_t batch_size, uint64_t delay_cycles) {
+  __flush_tx(notification_buf_pair);
+  notification_buf_pair->tx_batch_size = batch_size;
+  notification_buf_pair->tx_batch_delay_cycles = delay_cycles;
+}
+
+void flush_tx(struct NotificationBufPair* notification_buf_pair) {
+  __flush_tx(notification_buf_pair);
 }
 
 uint32_t get_unreported_completions(
@@ -532,6 +1289,13 @@ void update_tx_head(struct NotificationBufPair* notification_buf_pair) {
   uint32_t head = notification_buf_pair->tx_head;
   uint32_t tail = notification_buf_pair->tx_tail;
 
+  // Descriptors that waited too long for the doorbell.
+  if (unlikely(notification_buf_pair->nb_unflushed_tx != 0) &&
+      (__rdtsc() - notification_buf_pair->first_unflushed_tx_tsc) >=
+          notification_buf_pair->tx_batch_delay_cycles) {
+    __flush_tx(notification_buf_pair);
+  }
+
   if (head == tail) {
     return;
   }
@@ -548,59 +1312,111 @@ void update_tx_head(struct NotificationBufPair* notification_buf_pair) {
       break;
     }
 
-    // Requests that wrap around need two notifications but should only signal
-    // a single completion notification. Therefore, we only increment
-    // `nb_unreported_completions` in the second notification.
-    // TODO(sadok): If we implement the logic to have two notifications in the
-    // same cache line, we can get rid of `wrap_tracker` and instead check
-    // for two notifications.
-    uint8_t wrap_tracker_mask = 1 << (head & 0x7);
-    uint8_t no_wrap =
-        !(notification_buf_pair->wrap_tracker[head / 8] & wrap_tracker_mask);
-    notification_buf_pair->nb_unreported_completions += no_wrap;
-    notification_buf_pair->wrap_tracker[head / 8] &= ~wrap_tracker_mask;
+    // Requests that are split among multiple notifications only complete on
+    // the last one. Configuration notifications complete on
+    // `nb_completed_configs`.
+    struct TxCompletion* tx_completion =
+        notification_buf_pair->tx_completions + head;
+    uint32_t completion_len = tx_completion->completion_len;
+    if (completion_len != 0) {
+      uint32_t* completed_bytes = tx_completion->completed_bytes;
+      if (completed_bytes != nullptr) {
+        *completed_bytes += completion_len;
+      } else {
+        ++notification_buf_pair->nb_unreported_completions;
+      }
+    }
 
     head = (head + 1) % kNotificationBufSize;
   }
 
+  if (head == notification_buf_pair->tx_head) {
+    // We are waiting for the device, make sure it sees our last writes.
+    DevBackend::mmio_flush();
+  }
+
   notification_buf_pair->tx_head = head;
 }
 
-int send_config(struct NotificationBufPair* notification_buf_pair,
-                struct TxNotification* config_notification) {
+int send_config_async(struct NotificationBufPair* notification_buf_pair,
+                      struct TxNotification* config_notifications,
+                      uint32_t nb_configs, uint32_t* ticket) {
   struct TxNotification* tx_buf = notification_buf_pair->tx_buf;
   uint32_t tx_tail = notification_buf_pair->tx_tail;
-  uint32_t free_slots =
-      (notification_buf_pair->tx_head - tx_tail - 1) % kNotificationBufSize;
 
-  // Make sure it's a config notification.
-  if (config_notification->signal < 2) {
-    return -1;
+  // Make sure they are all config notifications.
+  for (uint32_t i = 0; i < nb_configs; ++i) {
+    if (config_notifications[i].signal < 2) {
+      return -1;
+    }
   }
 
-  // Block until we can send.
-  while (unlikely(free_slots == 0)) {
-    ++notification_buf_pair->tx_full_cnt;
-    update_tx_head(notification_buf_pair);
-    free_slots =
+  // Also signals any deferred descriptors.
+  notification_buf_pair->nb_unflushed_tx = 0;
+
+  for (uint32_t i = 0; i < nb_configs; ++i) {
+    uint32_t free_slots =
         (notification_buf_pair->tx_head - tx_tail - 1) % kNotificationBufSize;
-  }
 
-  struct TxNotification* tx_notification = tx_buf + tx_tail;
-  *tx_notification = *config_notification;
+    // Block until we can send, letting the device consume what we wrote.
+    if (unlikely(free_slots == 0)) {
+      DevBackend::mmio_write32(notification_buf_pair->tx_tail_ptr, tx_tail);
+      while (free_slots == 0) {
+        ++notification_buf_pair->tx_full_cnt;
+        update_tx_head(notification_buf_pair);
+        free_slots = (notification_buf_pair->tx_head - tx_tail - 1) %
+                     kNotificationBufSize;
+      }
+    }
+
+    struct TxNotification* tx_notification = tx_buf + tx_tail;
+    *tx_notification = config_notifications[i];
+
+    // Config completions are counted apart from data completions.
+    struct TxCompletion* tx_completion =
+        notification_buf_pair->tx_completions + tx_tail;
+    tx_completion->completed_bytes =
+        &notification_buf_pair->nb_completed_configs;
+    tx_completion->completion_len = 1;
+
+    tx_tail = (tx_tail + 1) % kNotificationBufSize;
+    notification_buf_pair->tx_tail = tx_tail;
+  }
 
-  tx_tail = (tx_tail + 1) % kNotificationBufSize;
-  notification_buf_pair->tx_tail = tx_tail;
   DevBackend::mmio_write32(notification_buf_pair->tx_tail_ptr, tx_tail);
 
-  // Wait for request to be consumed.
-  uint32_t nb_unreported_completions =
-      notification_buf_pair->nb_unreported_completions;
-  while (notification_buf_pair->nb_unreported_completions ==
-         nb_unreported_completions) {
-    update_tx_head(notification_buf_pair);
+  notification_buf_pair->nb_issued_configs += nb_configs;
+  *ticket = notification_buf_pair->nb_issued_configs;
+
+  return 0;
+}
+
+bool is_config_done(struct NotificationBufPair* notification_buf_pair,
+                    uint32_t ticket) {
+  // Counters wrap around, compare the distance instead.
+  if ((int32_t)(notification_buf_pair->nb_completed_configs - ticket) >= 0) {
+    return true;
   }
-  notification_buf_pair->nb_unreported_completions = nb_unreported_completions;
+  update_tx_head(notification_buf_pair);
+  return (int32_t)(notification_buf_pair->nb_completed_configs - ticket) >= 0;
+}
+
+void wait_for_config(struct NotificationBufPair* notification_buf_pair,
+                     uint32_t ticket) {
+  while (!is_config_done(notification_buf_pair, ticket)) {
+    continue;
+  }
+}
+
+int send_config(struct NotificationBufPair* notification_buf_pair,
+                struct TxNotification* config_notification) {
+  uint32_t ticket;
+  if (send_config_async(notification_buf_pair, config_notification, 1,
+                        &ticket)) {
+    return -1;
+  }
+
+  wait_for_config(notification_buf_pair, ticket);
 
   return 0;
 }
@@ -632,6 +1448,43 @@ uint64_t get_dev_addr_from_virt_addr(
   return dev_addr;
 }
 
+int get_dev_addrs_from_virt_range(
+    struct NotificationBufPair* notification_buf_pair, void* virt_addr,
+    uint64_t nb_pages, uint64_t* dev_addrs) {
+  DevBackend* fpga_dev =
+      static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
+
+  // Physical addresses are converted in place.
+  if (virt_to_phys_range(virt_addr, nb_pages, dev_addrs)) {
+    std::cerr << "Could not read the page map" << std::endl;
+    return -1;
+  }
+
+  for (uint64_t i = 0; i < nb_pages; ++i) {
+    if (dev_addrs[i] == 0) {
+      std::cerr << "Page " << i << " is not present (are you running as "
+                << "root?)" << std::endl;
+      return -1;
+    }
+  }
+
+  for (uint64_t i = 0; i < nb_pages;) {
+    uint32_t nb_addrs = std::min(nb_pages - i, (uint64_t)UINT32_MAX);
+    fpga_dev->ConvertPhysAddrsToDevAddrs(dev_addrs + i, dev_addrs + i,
+                                         nb_addrs);
+    i += nb_addrs;
+  }
+
+  for (uint64_t i = 0; i < nb_pages; ++i) {
+    if (dev_addrs[i] == 0) {
+      std::cerr << "Device cannot access page " << i << std::endl;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
 void notification_buf_free(struct NotificationBufPair* notification_buf_pair) {
   DevBackend* fpga_dev =
       static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
@@ -643,19 +1496,58 @@ void notification_buf_free(struct NotificationBufPair* notification_buf_pair) {
   DevBackend::mmio_write32(&notification_buf_pair->regs->tx_mem_low, 0);
   DevBackend::mmio_write32(&notification_buf_pair->regs->tx_mem_high, 0);
 
-  munmap(notification_buf_pair->rx_buf, kAlignedDscBufPairSize);
+  if (notification_buf_pair->arena != nullptr) {
+    static_cast<HugePageArena*>(notification_buf_pair->arena)
+        ->Free(notification_buf_pair->rx_buf);
+  } else {
+    munmap(notification_buf_pair->rx_buf, kAlignedDscBufPairSize);
 
-  std::string huge_page_path = notification_buf_pair->huge_page_prefix +
-                               std::string(kHugePageNotifBufPathPrefix) +
-                               std::to_string(notification_buf_pair->id);
+    std::string huge_page_path = notification_buf_pair->huge_page_prefix +
+                                 std::string(kHugePageNotifBufPathPrefix) +
+                                 std::to_string(notification_buf_pair->id);
 
-  unlink(huge_page_path.c_str());
+    unlink(huge_page_path.c_str());
+  }
 
   free(notification_buf_pair->pending_rx_pipe_tails);
-  free(notification_buf_pair->wrap_tracker);
+  free(notification_buf_pair->rx_ready_pipes);
+  free(notification_buf_pair->deferred_rx_pipes);
   free(notification_buf_pair->next_rx_pipe_ids);
+  free(notification_buf_pair->tx_completions);
 
-  delete fpga_dev;
+  if (notification_buf_pair->owns_fpga_dev) {
+    delete fpga_dev;
+  }
+}
+
+void enso_pipe_move(struct RxEnsoPipeInternal* enso_pipe,
+                    struct NotificationBufPair* from,
+                    struct NotificationBufPair* to) {
+  enso_pipe_id_t enso_pipe_id = enso_pipe->id;
+
+  // Only `from` keeps track of the pipe's deferred head.
+  __flush_rx_pipe_head(from, enso_pipe);
+
+  // `to` does not get notifications for this pipe until we change the
+  // registers below, so we can safely set its tail here.
+  to->pending_rx_pipe_tails[enso_pipe_id] =
+      from->pending_rx_pipe_tails[enso_pipe_id];
+
+  // The least significant bits in rx_mem_low hold the notification buffer ID.
+  uint64_t phys_addr = enso_pipe->buf_phys_addr;
+  DevBackend::mmio_write32(&enso_pipe->regs->rx_mem_low,
+                           (uint32_t)phys_addr + to->id);
+  DevBackend::mmio_write32(&enso_pipe->regs->rx_mem_high,
+                           (uint32_t)(phys_addr >> 32));
+
+  // Reads cannot pass the writes that the device issued before them. Once the
+  // read returns, all notifications sent to `from` are already in memory.
+  DevBackend::mmio_read32(&enso_pipe->regs->rx_mem_low);
+
+  // Consume them so that their (older) tails cannot overwrite a newer one if
+  // the pipe later moves back to `from`.
+  while (__get_new_tails(from) == kBatchSize) {
+  }
 }
 
 void enso_pipe_free(struct NotificationBufPair* notification_buf_pair,
@@ -664,11 +1556,20 @@ void enso_pipe_free(struct NotificationBufPair* notification_buf_pair,
   DevBackend* fpga_dev =
       static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
 
+  if (enso_pipe->head_deferred) {
+    __flush_rx_pipe_head(notification_buf_pair, enso_pipe);
+  }
+
   DevBackend::mmio_write32(&enso_pipe->regs->rx_mem_low, 0);
   DevBackend::mmio_write32(&enso_pipe->regs->rx_mem_high, 0);
 
-  if (enso_pipe->buf) {
-    munmap(enso_pipe->buf, kBufPageSize);
+  if (enso_pipe->buf && !enso_pipe->mirrored) {
+    static_cast<HugePageArena*>(notification_buf_pair->arena)
+        ->Free(enso_pipe->buf);
+    enso_pipe->buf = nullptr;
+  } else if (enso_pipe->buf) {
+    // The buffer is mirrored, so we need to unmap twice its size.
+    munmap(enso_pipe->buf, (uint64_t)(enso_pipe->size_mask + 1) * 64 * 2);
     std::string huge_page_path = enso_pipe->huge_page_prefix +
                                  std::string(kHugePageRxPipePathPrefix) +
                                  std::to_string(enso_pipe_id);
@@ -62,12 +62,16 @@ struct SocketInternal {
  * @param bar PCIe BAR to use (set to -1 to automatically select one).
  * @param notification_buf_pair Notification buffer pair to initialize.
  * @param huge_page_prefix File prefix to use when allocating the huge pages.
+ * @param fpga_dev Device handle of another notification buffer pair to share.
+ *                 The handle must outlive this notification buffer pair. If
+ *                 null, opens a new handle for the device.
  *
  * @return 0 on success, -1 on failure.
  */
 int notification_buf_init(uint32_t bdf, int32_t bar,
                           struct NotificationBufPair* notification_buf_pair,
-                          const std::string& huge_page_prefix);
+                          const std::string& huge_page_prefix,
+                          void* fpga_dev = nullptr);
 
 /**
  * @brief Initializes an Enso Pipe.
@@ -75,12 +79,59 @@ int notification_buf_init(uint32_t bdf, int32_t bar,
  * @param enso_pipe Enso Pipe to initialize.
  * @param notification_buf_pair Notification buffer pair to use.
  * @param fallback Whether the queues is a fallback queue or not.
+ * @param buf_size Size of the pipe buffer in bytes. Backends that do not
+ *                 support per-pipe RX sizes only accept `kDefaultPipeBufSize`.
  *
  * @return Pipe ID on success, -1 on failure.
  */
 int enso_pipe_init(struct RxEnsoPipeInternal* enso_pipe,
                    struct NotificationBufPair* notification_buf_pair,
-                   bool fallback);
+                   bool fallback, uint32_t buf_size = kDefaultPipeBufSize);
+
+/**
+ * @brief Initializes multiple Enso Pipes at once.
+ *
+ * Allocates all pipes with a single request to the device, only waits once for
+ * their registers to be reset and only updates the fallback queues
+ * configuration once.
+ *
+ * @param enso_pipes Array of `nb_pipes` Enso Pipes to initialize.
+ * @param nb_pipes Number of pipes to initialize.
+ * @param notification_buf_pair Notification buffer pair to use.
+ * @param fallback Whether the queues are fallback queues or not.
+ * @param buf_size Size of the buffer of each pipe in bytes. Backends that do
+ *                 not support per-pipe RX sizes only accept
+ *                 `kDefaultPipeBufSize`.
+ *
+ * @return 0 on success, -1 on failure. On failure, the pipes that have a
+ *         non-null `regs` were allocated and must be freed with
+ *         `enso_pipe_free`.
+ */
+int enso_pipes_init(struct RxEnsoPipeInternal** enso_pipes, uint32_t nb_pipes,
+                    struct NotificationBufPair* notification_buf_pair,
+                    bool fallback, uint32_t buf_size = kDefaultPipeBufSize);
+
+/**
+ * @brief Checks if a pipe buffer size is supported.
+ *
+ * Buffers must be a power of two, so that they can be indexed with a mask, and
+ * cannot exceed `kMaxPipeBufSize`. Mirrored buffers must also be a multiple of
+ * the huge page size. Buffers carved from the huge page arena are not mirrored
+ * and must only be at least `kPipeGuardSize`.
+ *
+ * @param buf_size Size of the pipe buffer in bytes.
+ * @param mirrored Whether the buffer is mirrored.
+ *
+ * @return true if the size is supported, false otherwise.
+ */
+bool is_valid_pipe_buf_size(uint32_t buf_size, bool mirrored = true);
+
+/**
+ * @brief Returns the smallest supported pipe buffer size.
+ *
+ * @param mirrored Whether the buffer is mirrored.
+ */
+uint32_t min_pipe_buf_size(bool mirrored = true);
 
 /**
  * @brief Initializes an enso pipe and the notification buffer if needed.
@@ -138,6 +189,21 @@ uint32_t peek_next_batch_from_queue(
 int32_t get_next_enso_pipe_id(
     struct NotificationBufPair* notification_buf_pair);
 
+/**
+ * @brief Waits until the notification buffer receives a new notification.
+ *
+ * Spins for up to `spin_us` microseconds and then sleeps until the device
+ * writes a new notification.
+ *
+ * @param notification_buf_pair Notification buffer to wait on.
+ * @param spin_us Time to spin before sleeping (in microseconds).
+ * @param timeout_us Maximum time to wait (in microseconds). If 0, waits until
+ *                   a notification arrives.
+ * @return 0 if there are notifications to consume, -1 on timeout or error.
+ */
+int wait_for_notification(struct NotificationBufPair* notification_buf_pair,
+                          uint32_t spin_us, uint32_t timeout_us);
+
 /**
  * @brief Get next batch of data from the next available Enso Pipe.
  *
@@ -156,52 +222,139 @@ uint32_t get_next_batch(struct NotificationBufPair* notification_buf_pair,
  * `socket_entry` socket. If `len` is greater than the number of allocated bytes
  * in the buffer, the behavior is undefined.
  *
+ * The new head may only be written to the device later, according to the lazy
+ * RX head policy set with `set_lazy_rx_head`.
+ *
  * @param enso_pipe Enso pipe to advance.
+ * @param notification_buf_pair Notification buffer that the pipe uses.
  * @param len Number of bytes to free.
  */
-void advance_pipe(struct RxEnsoPipeInternal* enso_pipe, size_t len);
+void advance_pipe(struct RxEnsoPipeInternal* enso_pipe,
+                  struct NotificationBufPair* notification_buf_pair,
+                  size_t len);
 
 /**
  * @brief Frees all the received bytes in the buffer associated with the
  * `socket_entry` socket.
  *
+ * @see advance_pipe
+ *
  * @param enso_pipe Enso pipe to advance.
+ * @param notification_buf_pair Notification buffer that the pipe uses.
  */
-void fully_advance_pipe(struct RxEnsoPipeInternal* enso_pipe);
+void fully_advance_pipe(struct RxEnsoPipeInternal* enso_pipe,
+                        struct NotificationBufPair* notification_buf_pair);
 
 /**
  * @brief Prefetches a given Enso Pipe.
  *
+ * Also writes the pipe's head if it was deferred.
+ *
  * @param enso_pipe Enso pipe to prefetch.
  */
 void prefetch_pipe(struct RxEnsoPipeInternal* enso_pipe);
 
+/**
+ * @brief Sets when RX heads are written to the device.
+ *
+ * By default, every head update of a pipe or of the notification buffer is
+ * written right away. With a non-zero `flush_percent`, updates are deferred
+ * until `flush_percent` of the ring is freed or until the oldest deferred
+ * update waited for `delay_cycles`. Pipe heads are still written right away if
+ * the device would otherwise see less than `flush_percent` of the pipe free.
+ * All deferred heads are written when there are no new notifications.
+ *
+ * @param notification_buf_pair Notification buffer to configure.
+ * @param flush_percent Share of a ring (in percent) to free before writing its
+ *                      head. If 0, heads are always written right away.
+ * @param delay_cycles Maximum time that a head update may be deferred (in
+ *                     cycles). Checked when consuming notifications.
+ */
+void set_lazy_rx_head(struct NotificationBufPair* notification_buf_pair,
+                      uint32_t flush_percent, uint64_t delay_cycles);
+
+/**
+ * @brief Writes all deferred RX heads to the device.
+ *
+ * @param notification_buf_pair Notification buffer to flush.
+ */
+void flush_rx_heads(struct NotificationBufPair* notification_buf_pair);
+
 /**
  * @brief Sends data through a given queue.
  *
  * This function returns as soon as a transmission requests has been enqueued to
  * the TX notification buffer. That means that it is not safe to modify or
  * deallocate the buffer pointed by `phys_addr` right after it returns. Instead,
- * the caller must use `get_unreported_completions` to figure out when the
- * transmission is complete.
+ * the caller must wait for the transmission to complete. Once it does, `len` is
+ * added to `*completed_bytes` or, if `completed_bytes` is null, the completion
+ * is reported by `get_unreported_completions`.
  *
  * This function currently blocks if there is not enough space in the
  * notification buffer.
  *
  * @param notification_buf_pair Notification buffer to send data through.
- * @param phys_addr Physical memory address of the data to be sent.
+ * @param phys_addr Physical memory address of the data to be sent. The data
+ *                  must be physically contiguous.
  * @param len Length, in bytes, of the data.
+ * @param completed_bytes Counter to increment once the transmission completes.
+ *                        May be null.
  *
  * @return number of bytes sent.
  */
 uint32_t send_to_queue(struct NotificationBufPair* notification_buf_pair,
-                       uint64_t phys_addr, uint32_t len);
+                       uint64_t phys_addr, uint32_t len,
+                       uint32_t* completed_bytes);
+
+/**
+ * @brief Appends data to the last transmission queued with `send_to_queue`,
+ *        instead of sending it with a new request.
+ *
+ * Only succeeds if the device was not notified about the last transmission
+ * yet, the last transmission used the same `completed_bytes`, the data starts
+ * right where the last transmission ends and the result fits in a single
+ * descriptor that does not cross a `kBufPageSize` boundary. The extended
+ * transmission still counts as a single completion.
+ *
+ * @param notification_buf_pair Notification buffer to send data through.
+ * @param phys_addr Physical memory address of the data to be sent.
+ * @param len Length, in bytes, of the data.
+ * @param completed_bytes Counter to increment once the transmission completes.
+ *
+ * @return true if the data was appended, false if it must be sent with
+ *         `send_to_queue`.
+ */
+bool try_coalesce_send(struct NotificationBufPair* notification_buf_pair,
+                       uint64_t phys_addr, uint32_t len,
+                       uint32_t* completed_bytes);
+
+/**
+ * @brief Sets when `send_to_queue` rings the TX doorbell.
+ *
+ * @param notification_buf_pair Notification buffer to configure.
+ * @param batch_size Number of descriptors to queue before ringing the doorbell.
+ *                   If 1, rings it for every transmission.
+ * @param delay_cycles Maximum time that a descriptor may wait for the doorbell
+ *                     (in cycles). Checked when sending and when updating the
+ *                     TX head.
+ */
+void set_tx_batching(struct NotificationBufPair* notification_buf_pair,
+                     uint32_t batch_size, uint64_t delay_cycles);
+
+/**
+ * @brief Rings the TX doorbell for all descriptors that were queued but not yet
+ *        signaled to the device.
+ *
+ * @param notification_buf_pair Notification buffer to flush.
+ */
+void flush_tx(struct NotificationBufPair* notification_buf_pair);
 
 /**
  * @brief Returns the number of transmission requests that were completed since
  * the last call to this function.
  *
- * Since transmissions are always completed in order, one can figure out which
+ * Only counts requests sent without a `completed_bytes` counter. Since
+ * transmissions are always completed in order, one can figure out which
  * transmissions were completed by keeping track of all the calls to
  * `send_to_queue`. There can be only up to `kMaxPendingTxRequests` requests
  * completed between two calls to `send_to_queue`. However, if `send` is called
@@ -216,14 +369,17 @@ uint32_t get_unreported_completions(
     struct NotificationBufPair* notification_buf_pair);
 
 /**
- * @brief Updates the tx head and the number of TX completions.
+ * @brief Updates the tx head and reports TX completions.
+ *
+ * Completed requests increment their `completed_bytes` counter or, if they do
+ * not have one, the number of unreported completions.
  *
  * @param notification_buf_pair Notification buffer to be updated.
  */
 void update_tx_head(struct NotificationBufPair* notification_buf_pair);
 
 /**
- * @brief Sends configuration to the NIC.
+ * @brief Sends configuration to the NIC and waits for it to be applied.
  *
  * @param notification_buf_pair The notification buffer pair to send the
  *                              configuration through.
@@ -235,6 +391,53 @@ void update_tx_head(struct NotificationBufPair* notification_buf_pair);
 int send_config(struct NotificationBufPair* notification_buf_pair,
                 struct TxNotification* config_notification);
 
+/**
+ * @brief Sends configuration to the NIC without waiting for it to be applied.
+ *
+ * All notifications are written back to back and signaled to the NIC with a
+ * single doorbell, unless the TX notification buffer fills up. Only blocks in
+ * that case.
+ *
+ * @param notification_buf_pair The notification buffer pair to send the
+ *                              configuration through.
+ * @param config_notifications Array of `nb_configs` configuration
+ *                             notifications. All must be config notifications,
+ *                             i.e., signal >= 2.
+ * @param nb_configs Number of configuration notifications to send.
+ * @param ticket Set to a ticket that completes once the NIC applied all the
+ *               notifications. @see is_config_done @see wait_for_config
+ *
+ * @return 0 on success, -1 on failure. Nothing is sent on failure.
+ */
+int send_config_async(struct NotificationBufPair* notification_buf_pair,
+                      struct TxNotification* config_notifications,
+                      uint32_t nb_configs, uint32_t* ticket);
+
+/**
+ * @brief Checks if the configuration associated with a ticket was applied.
+ *
+ * Configurations are applied in order, so this also means that all the
+ * configurations sent before it were applied.
+ *
+ * @param notification_buf_pair The notification buffer pair that the
+ *                              configuration was sent through.
+ * @param ticket Ticket returned by `send_config_async`.
+ *
+ * @return true if the configuration was applied, false otherwise.
+ */
+bool is_config_done(struct NotificationBufPair* notification_buf_pair,
+                    uint32_t ticket);
+
+/**
+ * @brief Waits until the configuration associated with a ticket is applied.
+ *
+ * @param notification_buf_pair The notification buffer pair that the
+ *                              configuration was sent through.
+ * @param ticket Ticket returned by `send_config_async`.
+ */
+void wait_for_config(struct NotificationBufPair* notification_buf_pair,
+                     uint32_t ticket);
+
 /**
  * @brief Get number of fallback queues currently in use.
  *
@@ -276,6 +479,44 @@ int get_round_robin_status(struct NotificationBufPair* notification_buf_pair);
 uint64_t get_dev_addr_from_virt_addr(
     struct NotificationBufPair* notification_buf_pair, void* virt_addr);
 
+/**
+ * @brief Converts the addresses of consecutive pages in the application's
+ *        virtual address space to addresses that can be used by the device.
+ *
+ * Reads the page map once for the whole range and translates all the pages
+ * together, which is much faster than calling `get_dev_addr_from_virt_addr()`
+ * for every page.
+ *
+ * @param notification_buf_pair Notification buffer pair to use.
+ * @param virt_addr Address of the first page. Must be aligned to the system's
+ *                  page size.
+ * @param nb_pages Number of pages, of the system's page size, to convert.
+ * @param dev_addrs Array of `nb_pages` elements used to save the converted
+ *                  addresses.
+ * @return 0 on success, -1 if any of the pages cannot be translated.
+ */
+int get_dev_addrs_from_virt_range(
+    struct NotificationBufPair* notification_buf_pair, void* virt_addr,
+    uint64_t nb_pages, uint64_t* dev_addrs);
+
+/**
+ * @brief Makes an Enso Pipe send its notifications to a different notification
+ *        buffer pair.
+ *
+ * Must be called by the thread that uses `from`. Both notification buffer pairs
+ * must share the same device handle. Notifications that the device sent to
+ * `from` before the change are consumed before returning. The pipe's data is
+ * only reported to `to` after it receives a new notification, use
+ * `prefetch_pipe` to request one.
+ *
+ * @param enso_pipe Enso Pipe to move.
+ * @param from Notification buffer pair currently used by the pipe.
+ * @param to Notification buffer pair to use from now on.
+ */
+void enso_pipe_move(struct RxEnsoPipeInternal* enso_pipe,
+                    struct NotificationBufPair* from,
+                    struct NotificationBufPair* to);
+
 /**
  * @brief Frees the notification buffer pair.
  *
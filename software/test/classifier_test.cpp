@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <enso/classifier.h>
+#include <gtest/gtest.h>
+#include <netinet/ether.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+static constexpr uint32_t kNbClasses = 16;
+static constexpr uint32_t kDefaultClass = kNbClasses;
+static constexpr uint32_t kPktSize = 64;
+
+// Fields of the packets written by `write_pkt()`, in host byte order.
+struct PktFields {
+  uint16_t ether_type;
+  uint32_t dst_ip;
+  uint32_t src_ip;
+  uint8_t protocol;
+  uint16_t dst_port;
+  uint16_t src_port;
+};
+
+static void write_pkt(uint8_t* pkt, const PktFields& fields) {
+  memset(pkt, 0, kPktSize);
+
+  struct ether_header* l2_hdr = (struct ether_header*)pkt;
+  l2_hdr->ether_type = htons(fields.ether_type);
+
+  struct iphdr* l3_hdr = (struct iphdr*)(l2_hdr + 1);
+  l3_hdr->version = 4;
+  l3_hdr->ihl = 5;
+  l3_hdr->tot_len = htons(kPktSize - sizeof(*l2_hdr));
+  l3_hdr->protocol = fields.protocol;
+  l3_hdr->daddr = htonl(fields.dst_ip);
+  l3_hdr->saddr = htonl(fields.src_ip);
+
+  uint16_t* ports = (uint16_t*)(l3_hdr + 1);
+  ports[0] = htons(fields.src_port);
+  ports[1] = htons(fields.dst_port);
+}
+
+static uint32_t prefix_mask(uint8_t prefix_len) {
+  return prefix_len == 0 ? 0 : ~0U << (32 - prefix_len);
+}
+
+// Reference classification, checking every rule in order. Follows the rules'
+// documentation: packets that are not IPv4 get the default class and packets
+// that are not TCP or UDP have both ports set to 0.
+static uint32_t linear_classify(
+    const PktFields& fields, const std::vector<enso::ClassifierRule>& rules) {
+  if (fields.ether_type != ETHERTYPE_IP) {
+    return kDefaultClass;
+  }
+
+  bool has_ports =
+      fields.protocol == IPPROTO_TCP || fields.protocol == IPPROTO_UDP;
+  uint16_t dst_port = has_ports ? fields.dst_port : 0;
+  uint16_t src_port = has_ports ? fields.src_port : 0;
+
+  for (const enso::ClassifierRule& rule : rules) {
+    uint32_t dst_mask = prefix_mask(rule.dst_prefix_len);
+    uint32_t src_mask = prefix_mask(rule.src_prefix_len);
+    if ((fields.dst_ip & dst_mask) == (rule.dst_ip & dst_mask) &&
+        (fields.src_ip & src_mask) == (rule.src_ip & src_mask) &&
+        dst_port >= rule.dst_port_min && dst_port <= rule.dst_port_max &&
+        src_port >= rule.src_port_min && src_port <= rule.src_port_max &&
+        (fields.protocol & rule.protocol_mask) ==
+            (rule.protocol & rule.protocol_mask)) {
+      return rule.class_id;
+    }
+  }
+
+  return kDefaultClass;
+}
+
+// Classifies the packets with `Classify()` and `ClassifyBurst()` and checks
+// both against `linear_classify()`.
+static void check_classifier(const std::vector<enso::ClassifierRule>& rules,
+                             const std::vector<PktFields>& pkt_fields) {
+  std::unique_ptr<enso::Classifier> classifier =
+      enso::Classifier::Create(rules.data(), rules.size(), kDefaultClass);
+  ASSERT_NE(classifier, nullptr);
+
+  uint32_t nb_pkts = pkt_fields.size();
+  std::vector<uint8_t> pkt_buf((uint64_t)nb_pkts * kPktSize);
+  std::vector<const uint8_t*> pkts(nb_pkts);
+  for (uint32_t i = 0; i < nb_pkts; ++i) {
+    pkts[i] = &pkt_buf[(uint64_t)i * kPktSize];
+    write_pkt(&pkt_buf[(uint64_t)i * kPktSize], pkt_fields[i]);
+  }
+
+  std::vector<uint32_t> classes(nb_pkts);
+  classifier->ClassifyBurst(pkts.data(), nb_pkts, classes.data());
+
+  for (uint32_t i = 0; i < nb_pkts; ++i) {
+    uint32_t expected = linear_classify(pkt_fields[i], rules);
+    ASSERT_EQ(classifier->Classify(pkts[i]), expected) << "packet " << i;
+    ASSERT_EQ(classes[i], expected) << "packet " << i;
+  }
+}
+
+static uint8_t random_prefix_len(std::mt19937* rng) {
+  switch ((*rng)() % 4) {
+    case 0:
+      return 0;
+    case 1:
+      return 32;
+    default:
+      return (*rng)() % 33;
+  }
+}
+
+static void random_port_range(std::mt19937* rng, uint16_t* min,
+                              uint16_t* max) {
+  uint16_t port = (*rng)();
+  switch ((*rng)() % 6) {
+    case 0:
+      *min = 0;
+      *max = 65535;
+      break;
+    case 1:
+      *min = 0;
+      *max = (*rng)() % 2 ? 0 : port;
+      break;
+    case 2:
+      *min = (*rng)() % 2 ? 65535 : port;
+      *max = 65535;
+      break;
+    case 3:
+      *min = port;
+      *max = port;
+      break;
+    default:
+      *min = std::min(port, (uint16_t)(*rng)());
+      *max = std::max(port, (uint16_t)(*rng)());
+      break;
+  }
+}
+
+static uint8_t random_protocol(std::mt19937* rng) {
+  switch ((*rng)() % 4) {
+    case 0:
+      return IPPROTO_TCP;
+    case 1:
+      return IPPROTO_UDP;
+    case 2:
+      return IPPROTO_ICMP;
+    default:
+      return (*rng)();
+  }
+}
+
+static std::vector<enso::ClassifierRule> random_rules(uint32_t nb_rules,
+                                                      std::mt19937* rng) {
+  std::vector<enso::ClassifierRule> rules(nb_rules);
+
+  for (enso::ClassifierRule& rule : rules) {
+    // Rules often share prefixes, so that the tries have to split them.
+    rule.dst_ip = (*rng)() % 4 ? 0x0a000000 | ((*rng)() & 0xffff) : (*rng)();
+    rule.src_ip = (*rng)() % 4 ? 0xc0a80000 | ((*rng)() & 0xff) : (*rng)();
+    rule.dst_prefix_len = random_prefix_len(rng);
+    rule.src_prefix_len = random_prefix_len(rng);
+    random_port_range(rng, &rule.dst_port_min, &rule.dst_port_max);
+    random_port_range(rng, &rule.src_port_min, &rule.src_port_max);
+    rule.protocol = random_protocol(rng);
+    switch ((*rng)() % 3) {
+      case 0:
+        rule.protocol_mask = 0;
+        break;
+      case 1:
+        rule.protocol_mask = 0xff;
+        break;
+      default:
+        rule.protocol_mask = (*rng)();
+        break;
+    }
+    rule.class_id = (*rng)() % kNbClasses;
+  }
+
+  return rules;
+}
+
+// Returns packets that mostly match one of the rules, and some that are random
+// or not IPv4.
+static std::vector<PktFields> random_pkts(
+    uint32_t nb_pkts, const std::vector<enso::ClassifierRule>& rules,
+    std::mt19937* rng) {
+  std::vector<PktFields> pkts(nb_pkts);
+
+  for (PktFields& pkt : pkts) {
+    pkt.ether_type = ETHERTYPE_IP;
+    pkt.dst_ip = (*rng)();
+    pkt.src_ip = (*rng)();
+    pkt.protocol = random_protocol(rng);
+    pkt.dst_port = (*rng)();
+    pkt.src_port = (*rng)();
+
+    uint32_t pct = (*rng)() % 100;
+    if (pct < 5) {
+      pkt.ether_type = (*rng)() % 2 ? ETHERTYPE_ARP : ETHERTYPE_IPV6;
+    }
+    if (pct < 20 || rules.empty()) {
+      continue;
+    }
+
+    const enso::ClassifierRule& rule = rules[(*rng)() % rules.size()];
+    uint32_t dst_mask = prefix_mask(rule.dst_prefix_len);
+    uint32_t src_mask = prefix_mask(rule.src_prefix_len);
+    pkt.dst_ip = (rule.dst_ip & dst_mask) | (pkt.dst_ip & ~dst_mask);
+    pkt.src_ip = (rule.src_ip & src_mask) | (pkt.src_ip & ~src_mask);
+    pkt.protocol = (rule.protocol & rule.protocol_mask) |
+                   (pkt.protocol & ~rule.protocol_mask);
+    pkt.dst_port = rule.dst_port_min +
+                   (*rng)() % ((uint32_t)rule.dst_port_max -
+                               rule.dst_port_min + 1);
+    pkt.src_port = rule.src_port_min +
+                   (*rng)() % ((uint32_t)rule.src_port_max -
+                               rule.src_port_min + 1);
+  }
+
+  return pkts;
+}
+
+TEST(TestClassifier, Random) {
+  // From a single leaf to tries with many levels and leaves with many chunks.
+  for (uint32_t nb_rules : {0, 1, 15, 16, 17, 100, 1000, 10000}) {
+    std::mt19937 rng(nb_rules);
+    std::vector<enso::ClassifierRule> rules = random_rules(nb_rules, &rng);
+    std::vector<PktFields> pkts = random_pkts(20000, rules, &rng);
+    SCOPED_TRACE(nb_rules);
+    check_classifier(rules, pkts);
+    if (HasFatalFailure()) {
+      return;
+    }
+  }
+}
+
+TEST(TestClassifier, Edges) {
+  auto rule = [](uint32_t class_id) {
+    enso::ClassifierRule r = {};
+    r.dst_port_max = 65535;
+    r.src_port_max = 65535;
+    r.class_id = class_id;
+    return r;
+  };
+
+  std::vector<enso::ClassifierRule> rules;
+
+  // Only matches 10.0.0.1.
+  rules.push_back(rule(1));
+  rules.back().dst_ip = 0x0a000001;
+  rules.back().dst_prefix_len = 32;
+  rules.back().protocol = IPPROTO_TCP;
+  rules.back().protocol_mask = 0xff;
+
+  // Any address, but only destination port 65535.
+  rules.push_back(rule(2));
+  rules.back().dst_port_min = 65535;
+
+  // Only port 0, i.e., packets that are not TCP or UDP.
+  rules.push_back(rule(3));
+  rules.back().src_ip = 0xc0a80000;
+  rules.back().src_prefix_len = 16;
+  rules.back().src_port_max = 0;
+
+  // Any protocol in 10.0.0.0/8.
+  rules.push_back(rule(4));
+  rules.back().dst_ip = 0x0a000000;
+  rules.back().dst_prefix_len = 8;
+
+  std::vector<std::pair<PktFields, uint32_t>> cases = {
+      {{ETHERTYPE_IP, 0x0a000001, 0x01020304, IPPROTO_TCP, 80, 1234}, 1},
+      // Same address, but UDP.
+      {{ETHERTYPE_IP, 0x0a000001, 0x01020304, IPPROTO_UDP, 80, 1234}, 4},
+      {{ETHERTYPE_IP, 0x0a000002, 0x01020304, IPPROTO_TCP, 80, 1234}, 4},
+      {{ETHERTYPE_IP, 0x0b000001, 0x01020304, IPPROTO_TCP, 65535, 1}, 2},
+      {{ETHERTYPE_IP, 0x0b000001, 0x01020304, IPPROTO_TCP, 65534, 1},
+       kDefaultClass},
+      // ICMP has no ports, so the ports written to the packet are ignored.
+      {{ETHERTYPE_IP, 0x0b000001, 0xc0a80101, IPPROTO_ICMP, 65535, 1}, 3},
+      {{ETHERTYPE_IP, 0x0b000001, 0xc0a80101, IPPROTO_UDP, 1, 0}, 3},
+      {{ETHERTYPE_IP, 0x0b000001, 0xc0a80101, IPPROTO_UDP, 1, 1},
+       kDefaultClass},
+      {{ETHERTYPE_IP, 0x0b000001, 0xc0a90101, IPPROTO_ICMP, 0, 0},
+       kDefaultClass},
+      // Not IPv4.
+      {{ETHERTYPE_IPV6, 0x0a000001, 0x01020304, IPPROTO_TCP, 80, 1234},
+       kDefaultClass},
+      {{ETHERTYPE_ARP, 0x0a000001, 0x01020304, IPPROTO_TCP, 65535, 1234},
+       kDefaultClass},
+  };
+
+  std::vector<PktFields> pkts;
+  for (const auto& test_case : cases) {
+    EXPECT_EQ(linear_classify(test_case.first, rules), test_case.second);
+    pkts.push_back(test_case.first);
+  }
+
+  check_classifier(rules, pkts);
+}
+
+TEST(TestClassifier, CatchAll) {
+  // A rule that matches everything hides all the rules after it.
+  std::mt19937 rng(0);
+  std::vector<enso::ClassifierRule> rules = random_rules(100, &rng);
+  enso::ClassifierRule catch_all = {};
+  catch_all.dst_port_max = 65535;
+  catch_all.src_port_max = 65535;
+  catch_all.class_id = kNbClasses - 1;
+  rules.insert(rules.begin() + 50, catch_all);
+
+  std::vector<PktFields> pkts = random_pkts(20000, rules, &rng);
+  check_classifier(rules, pkts);
+}
+
+TEST(TestClassifier, InvalidRules) {
+  enso::ClassifierRule rule = {};
+  rule.dst_port_max = 65535;
+  rule.src_port_max = 65535;
+  EXPECT_NE(enso::Classifier::Create(&rule, 1, kDefaultClass), nullptr);
+
+  rule.dst_prefix_len = 33;
+  EXPECT_EQ(enso::Classifier::Create(&rule, 1, kDefaultClass), nullptr);
+
+  rule.dst_prefix_len = 0;
+  rule.src_port_min = 2;
+  rule.src_port_max = 1;
+  EXPECT_EQ(enso::Classifier::Create(&rule, 1, kDefaultClass), nullptr);
+}
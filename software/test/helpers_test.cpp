@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <enso/helpers.h>
+#include <gtest/gtest.h>
+#include <netinet/ether.h>
+#include <netinet/ip.h>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Writes back-to-back packets with the given lengths to `buf`, each starting
+// at a multiple of 64 bytes. Returns the number of bytes used.
+static uint32_t write_pkts(uint8_t* buf, const std::vector<uint16_t>& lens) {
+  uint32_t offset = 0;
+  for (uint16_t len : lens) {
+    struct iphdr* l3_hdr =
+        (struct iphdr*)(buf + offset + sizeof(struct ether_header));
+    l3_hdr->tot_len = htons(len - sizeof(struct ether_header));
+    offset += (len + 63) / 64 * 64;
+  }
+  return offset;
+}
+
+// Checks `index_pkts()` against following `get_next_pkt()` from the start of
+// the buffer.
+static void check_index(uint8_t* buf, uint32_t nb_bytes,
+                        uint32_t max_nb_pkts) {
+  std::vector<uint32_t> offsets(max_nb_pkts);
+  std::vector<uint16_t> lens(max_nb_pkts);
+  uint32_t nb_indexed_bytes = ~0;
+  uint32_t nb_pkts = enso::index_pkts(buf, nb_bytes, offsets.data(),
+                                      lens.data(), max_nb_pkts,
+                                      &nb_indexed_bytes);
+
+  uint32_t nb_expected_pkts = 0;
+  uint8_t* pkt = buf;
+  while (nb_expected_pkts < max_nb_pkts) {
+    uint8_t* next = enso::get_next_pkt(pkt);
+    if (next > buf + nb_bytes) {
+      break;
+    }
+    ASSERT_LT(nb_expected_pkts, nb_pkts);
+    EXPECT_EQ(offsets[nb_expected_pkts], pkt - buf);
+    EXPECT_EQ(lens[nb_expected_pkts], enso::get_pkt_len(pkt));
+    ++nb_expected_pkts;
+    pkt = next;
+  }
+
+  EXPECT_EQ(nb_pkts, nb_expected_pkts);
+  EXPECT_EQ(nb_indexed_bytes, pkt - buf);
+}
+
+TEST(TestHelpers, IndexPktsEmpty) {
+  alignas(64) uint8_t buf[64] = {};
+  write_pkts(buf, {64});
+  check_index(buf, 0, 16);
+}
+
+TEST(TestHelpers, IndexPktsSmall) {
+  alignas(64) uint8_t buf[64 * 64] = {};
+  std::vector<uint16_t> lens(64, 64);
+  uint32_t nb_bytes = write_pkts(buf, lens);
+
+  check_index(buf, nb_bytes, 64);
+  check_index(buf, nb_bytes, 17);
+  check_index(buf, nb_bytes - 64, 64);
+}
+
+TEST(TestHelpers, IndexPktsPartialPkt) {
+  alignas(64) uint8_t buf[8 * 64] = {};
+  uint32_t nb_bytes = write_pkts(buf, {64, 200, 65, 64});
+
+  // The buffer ends in the middle of the second packet.
+  check_index(buf, 128, 16);
+  check_index(buf, nb_bytes, 16);
+}
+
+TEST(TestHelpers, IndexPktsRandom) {
+  std::mt19937 rng(7);
+  std::vector<uint8_t> storage(1 << 20);
+  uint8_t* buf = (uint8_t*)(((uint64_t)storage.data() + 63) & ~63ULL);
+
+  for (uint32_t i = 0; i < 200; ++i) {
+    std::vector<uint16_t> lens(1 + rng() % 256);
+    for (uint16_t& len : lens) {
+      // Mostly small packets, with some large ones in between.
+      len = (rng() % 4) ? 60 + rng() % 200 : 60 + rng() % 1455;
+    }
+    uint32_t nb_bytes = write_pkts(buf, lens);
+
+    check_index(buf, nb_bytes, lens.size());
+    check_index(buf, nb_bytes, 1 + rng() % lens.size());
+    check_index(buf, rng() % (nb_bytes + 1) / 64 * 64, lens.size());
+  }
+}
@@ -0,0 +1,1378 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Tests for the pipes. They use the software backend and run the NIC
+ * emulator in the same process, in loopback mode, so that every packet sent on
+ * a TX pipe is received on the RX pipe bound to its flow.
+ */
+
+#include <arpa/inet.h>
+#include <enso/consts.h>
+#include <enso/flow_table.h>
+#include <enso/helpers.h>
+#include <enso/ixy_helpers.h>
+#include <enso/pipe.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <netinet/ether.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../emulator/nic_emulator.h"
+
+#define DST_IP 0xc0a80000  // 192.168.0.0
+#define DST_PORT 80
+#define PROTOCOL 0x11
+
+#define RECV_TIMEOUT_S 5
+
+// Writes a UDP packet of `len` bytes to `pkt`, carrying `seq` in its payload.
+static void write_pkt(uint8_t* pkt, uint16_t len, uint32_t dst_ip,
+                      uint32_t seq) {
+  memset(pkt, 0, len);
+
+  struct ether_header* l2_hdr = (struct ether_header*)pkt;
+  l2_hdr->ether_type = htons(ETHERTYPE_IP);
+
+  struct iphdr* l3_hdr = (struct iphdr*)(l2_hdr + 1);
+  l3_hdr->version = 4;
+  l3_hdr->ihl = 5;
+  l3_hdr->tot_len = htons(len - sizeof(*l2_hdr));
+  l3_hdr->protocol = PROTOCOL;
+  l3_hdr->daddr = htonl(dst_ip);
+
+  struct udphdr* l4_hdr = (struct udphdr*)(l3_hdr + 1);
+  l4_hdr->dest = htons(DST_PORT);
+
+  memcpy(l4_hdr + 1, &seq, sizeof(seq));
+}
+
+// Returns the sequence number written by `write_pkt()`.
+static uint32_t get_seq(const uint8_t* pkt) {
+  uint32_t seq;
+  memcpy(&seq,
+         pkt + sizeof(struct ether_header) + sizeof(struct iphdr) +
+             sizeof(struct udphdr),
+         sizeof(seq));
+  return seq;
+}
+
+// Changes the destination of a packet written by `write_pkt()`.
+static void set_dst_ip(uint8_t* pkt, uint32_t dst_ip) {
+  struct iphdr* l3_hdr = (struct iphdr*)(pkt + sizeof(struct ether_header));
+  l3_hdr->daddr = htonl(dst_ip);
+}
+
+class PipeTest : public ::testing::Test {
+ protected:
+  // Packet received on `rx_pipe_`.
+  struct RxPkt {
+    uint8_t* addr;
+    uint32_t nb_bytes;  // Including the padding to a multiple of 64 bytes.
+    bool released;
+  };
+
+  static void SetUpTestSuite() {
+    enso::emulator::EmulatorConfig config;
+    config.nb_rx_threads = 0;
+    config.loopback = true;
+    emulator_ = enso::emulator::NicEmulator::Create(config, nullptr);
+    if (emulator_ != nullptr && emulator_->Start()) {
+      emulator_.reset();
+    }
+  }
+
+  static void TearDownTestSuite() { emulator_.reset(); }
+
+  void SetUp() override {
+    ASSERT_NE(emulator_, nullptr);
+
+    device_ = enso::Device::Create();
+    ASSERT_NE(device_, nullptr);
+
+    rx_pipe_ = device_->AllocateRxPipe();
+    tx_pipe_ = device_->AllocateTxPipe();
+    ASSERT_NE(rx_pipe_, nullptr);
+    ASSERT_NE(tx_pipe_, nullptr);
+    ASSERT_EQ(rx_pipe_->Bind(DST_PORT, 0, DST_IP, 0, PROTOCOL), 0);
+
+    nb_delivered_pkts_ = emulator_->GetStats().rx_pkts;
+  }
+
+  void TearDown() override { device_.reset(); }
+
+  // Sends packets with the given lengths to `dst_ip`. Every packet carries its
+  // index in `lens` as sequence number.
+  void Send(const std::vector<uint16_t>& lens, uint32_t dst_ip) {
+    std::vector<std::unique_ptr<uint8_t[]>> bufs;
+    std::vector<const uint8_t*> pkts;
+    for (uint16_t len : lens) {
+      bufs.emplace_back(new uint8_t[len]);
+      write_pkt(bufs.back().get(), len, dst_ip, pkts.size());
+      pkts.push_back(bufs.back().get());
+    }
+
+    uint16_t nb_sent = 0;
+    while (nb_sent < lens.size()) {
+      nb_sent += tx_pipe_->SendBurst(pkts.data() + nb_sent,
+                                     lens.data() + nb_sent,
+                                     lens.size() - nb_sent);
+    }
+  }
+
+  // Waits until the emulator delivers `nb_pkts` packets to the RX pipes,
+  // counting from the last call.
+  void WaitForDelivery(uint32_t nb_pkts) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(RECV_TIMEOUT_S);
+    uint64_t target = nb_delivered_pkts_ + nb_pkts;
+    while (emulator_->GetStats().rx_pkts < target) {
+      ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+
+      // Also makes sure that the emulator sees the last TX doorbell.
+      device_->ProcessCompletions();
+    }
+    nb_delivered_pkts_ = target;
+  }
+
+  // Sends packets with the given lengths and waits until `rx_pipe_` receives
+  // them, appending them to `rx_pkts`.
+  void SendAndRecv(const std::vector<uint16_t>& lens,
+                   std::deque<RxPkt>* rx_pkts) {
+    Send(lens, DST_IP);
+    WaitForDelivery(lens.size());
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(RECV_TIMEOUT_S);
+    uint32_t nb_received = 0;
+    while (nb_received < lens.size()) {
+      ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+
+      uint8_t* buf;
+      uint32_t nb_bytes = rx_pipe_->Recv(&buf, ~0);
+      uint8_t* end = buf + nb_bytes;
+      for (uint8_t* pkt = buf; pkt < end;) {
+        uint8_t* next = enso::get_next_pkt(pkt);
+        ASSERT_EQ(get_seq(pkt), nb_received);
+        ASSERT_EQ(enso::get_pkt_len(pkt), lens[nb_received]);
+        rx_pkts->push_back({pkt, (uint32_t)(next - pkt), false});
+        ++nb_received;
+        pkt = next;
+      }
+    }
+  }
+
+  // Bytes still owned by the application if the pipe frees the packets at
+  // the front of `rx_pkts` that were released.
+  static uint32_t OwnedBytes(std::deque<RxPkt>* rx_pkts) {
+    while (!rx_pkts->empty() && rx_pkts->front().released) {
+      rx_pkts->pop_front();
+    }
+    uint32_t nb_bytes = 0;
+    for (const RxPkt& pkt : *rx_pkts) {
+      nb_bytes += pkt.nb_bytes;
+    }
+    return nb_bytes;
+  }
+
+  static std::unique_ptr<enso::emulator::NicEmulator> emulator_;
+
+  std::unique_ptr<enso::Device> device_;
+  enso::RxPipe* rx_pipe_;
+  enso::TxPipe* tx_pipe_;
+  uint64_t nb_delivered_pkts_;
+};
+
+std::unique_ptr<enso::emulator::NicEmulator> PipeTest::emulator_;
+
+TEST_F(PipeTest, AllocateRxPipes) {
+  const uint32_t nb_pipes = 8;
+
+  std::vector<enso::RxPipe*> pipes = device_->AllocateRxPipes(nb_pipes);
+  ASSERT_EQ(pipes.size(), nb_pipes);
+
+  std::set<uint32_t> ids = {rx_pipe_->id()};
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    ids.insert(pipes[i]->id());
+    ASSERT_EQ(pipes[i]->Bind(DST_PORT, 0, DST_IP + 1 + i, 0, PROTOCOL), 0);
+  }
+  EXPECT_EQ(ids.size(), nb_pipes + 1);
+
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    Send({64}, DST_IP + 1 + i);
+  }
+  WaitForDelivery(nb_pipes);
+
+  // Every pipe receives the packet sent to it.
+  for (uint32_t i = 0; i < nb_pipes; ++i) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(RECV_TIMEOUT_S);
+    uint8_t* buf;
+    uint32_t nb_bytes = 0;
+    while (nb_bytes == 0) {
+      ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+      nb_bytes = pipes[i]->Recv(&buf, ~0);
+    }
+    EXPECT_EQ(nb_bytes, 64u);
+    struct iphdr* l3_hdr = (struct iphdr*)(buf + sizeof(struct ether_header));
+    EXPECT_EQ(ntohl(l3_hdr->daddr), DST_IP + 1 + i);
+    pipes[i]->Clear();
+  }
+}
+
+TEST_F(PipeTest, AllocatePipesFailure) {
+  std::vector<enso::RxPipe*> first = device_->AllocateRxPipes(2);
+  ASSERT_EQ(first.size(), 2u);
+
+  // There are not enough pipes left.
+  EXPECT_TRUE(device_->AllocateRxPipes(enso::kMaxNbFlows).empty());
+  EXPECT_TRUE(device_->AllocateRxTxPipes(enso::kMaxNbFlows).empty());
+
+  // Pipes other than fallback pipes are allocated from the highest free ID
+  // down, so these would get lower IDs if the failed allocations leaked any.
+  std::vector<enso::RxTxPipe*> second = device_->AllocateRxTxPipes(2);
+  ASSERT_EQ(second.size(), 2u);
+  EXPECT_EQ(second[0]->rx_id(), first[1]->id() - 1);
+  EXPECT_EQ(second[1]->rx_id(), first[1]->id() - 2);
+}
+
+TEST_F(PipeTest, SmallArenaPipe) {
+  // Pipes outside of the arena are mirrored, so they take whole huge pages.
+  EXPECT_EQ(device_->AllocateRxPipe(false, enso::kPipeGuardSize), nullptr);
+
+  device_.reset();
+  device_ = enso::Device::Create("", "", 4 * enso::kBufPageSize);
+  ASSERT_NE(device_, nullptr);
+
+  EXPECT_EQ(device_->AllocateRxPipe(false, enso::kPipeGuardSize / 2),
+            nullptr);
+  EXPECT_NE(device_->AllocateRxTxPipe(false, enso::kPipeGuardSize), nullptr);
+
+  rx_pipe_ = device_->AllocateRxPipe(false, enso::kPipeGuardSize);
+  tx_pipe_ = device_->AllocateTxPipe();
+  ASSERT_NE(rx_pipe_, nullptr);
+  ASSERT_NE(tx_pipe_, nullptr);
+  ASSERT_EQ(rx_pipe_->buf_size(), enso::kPipeGuardSize);
+  ASSERT_EQ(rx_pipe_->Bind(DST_PORT, 0, DST_IP, 0, PROTOCOL), 0);
+
+  // Wraps around the buffer several times, with packets that straddle its end.
+  for (uint32_t i = 0; i < 8; ++i) {
+    std::deque<RxPkt> rx_pkts;
+    SendAndRecv({1500, 1500, 1500}, &rx_pkts);
+    rx_pipe_->Clear();
+  }
+}
+
+TEST_F(PipeTest, ReleaseOutOfOrder) {
+  std::deque<RxPkt> rx_pkts;
+  SendAndRecv({64, 128, 64, 256}, &rx_pkts);
+  ASSERT_EQ(rx_pipe_->capacity(), 512);
+
+  // Packets released after the oldest one stay in the pipe.
+  rx_pipe_->Release(rx_pkts[2].addr, rx_pkts[2].nb_bytes);
+  rx_pipe_->Release(rx_pkts[1].addr, rx_pkts[1].nb_bytes);
+  EXPECT_EQ(rx_pipe_->capacity(), 512);
+
+  // Releasing the oldest also frees the ones released after it.
+  rx_pipe_->Release(rx_pkts[0].addr, rx_pkts[0].nb_bytes);
+  EXPECT_EQ(rx_pipe_->capacity(), 256);
+
+  rx_pipe_->Release(rx_pkts[3].addr, rx_pkts[3].nb_bytes);
+  EXPECT_EQ(rx_pipe_->capacity(), 0);
+}
+
+TEST_F(PipeTest, ReleaseThenFree) {
+  std::deque<RxPkt> rx_pkts;
+  SendAndRecv({64, 64, 64, 64}, &rx_pkts);
+
+  rx_pipe_->Release(rx_pkts[1].addr, rx_pkts[1].nb_bytes);
+  rx_pipe_->Release(rx_pkts[3].addr, rx_pkts[3].nb_bytes);
+
+  // Freeing the oldest packet also frees the released one after it.
+  rx_pipe_->Free(64);
+  EXPECT_EQ(rx_pipe_->capacity(), 128);
+
+  // Freeing a released packet does not release it twice.
+  rx_pipe_->Free(128);
+  EXPECT_EQ(rx_pipe_->capacity(), 0);
+}
+
+TEST_F(PipeTest, ReleaseThenClear) {
+  std::deque<RxPkt> rx_pkts;
+  SendAndRecv({64, 64, 64}, &rx_pkts);
+
+  rx_pipe_->Release(rx_pkts[2].addr, rx_pkts[2].nb_bytes);
+  rx_pipe_->Clear();
+  EXPECT_EQ(rx_pipe_->capacity(), 0);
+
+  // Packets received after `Clear()` are not released.
+  rx_pkts.clear();
+  SendAndRecv({64, 64, 64}, &rx_pkts);
+  rx_pipe_->Release(rx_pkts[1].addr, rx_pkts[1].nb_bytes);
+  EXPECT_EQ(rx_pipe_->capacity(), 192);
+}
+
+TEST_F(PipeTest, ReleaseZeroBytes) {
+  std::deque<RxPkt> rx_pkts;
+  SendAndRecv({64, 64, 64}, &rx_pkts);
+
+  rx_pipe_->Release(rx_pkts[0].addr, 0);
+  EXPECT_EQ(rx_pipe_->capacity(), 192);
+
+  rx_pipe_->Release(rx_pkts[1].addr, rx_pkts[1].nb_bytes);
+  rx_pipe_->Free(0);
+  EXPECT_EQ(rx_pipe_->capacity(), 192);
+
+  // The packet released before `Free(0)` is still released.
+  rx_pipe_->Release(rx_pkts[0].addr, rx_pkts[0].nb_bytes);
+  EXPECT_EQ(rx_pipe_->capacity(), 64);
+
+  ASSERT_EQ(rx_pipe_->EnableSpill(1), 0);
+  EXPECT_EQ(rx_pipe_->Spill(rx_pkts[2].addr, 0), nullptr);
+  EXPECT_EQ(rx_pipe_->nb_spilled(), 0);
+  EXPECT_EQ(rx_pipe_->capacity(), 64);
+}
+
+// Interleaves `Release()`, `Free()` and `Clear()` at random, going around the
+// pipe's buffer a few times, and checks that the pipe always owns the bytes
+// from the oldest packet that was not released.
+TEST_F(PipeTest, ReleaseFreeClearInterleaved) {
+  std::mt19937 rng(42);
+  std::deque<RxPkt> rx_pkts;
+  uint64_t nb_received_bytes = 0;
+
+  while (nb_received_bytes < 4 * (uint64_t)rx_pipe_->buf_size()) {
+    std::vector<uint16_t> lens(32);
+    for (uint16_t& len : lens) {
+      len = 64 + rng() % 960;
+    }
+    uint32_t nb_old_pkts = rx_pkts.size();
+    SendAndRecv(lens, &rx_pkts);
+    for (uint32_t i = nb_old_pkts; i < rx_pkts.size(); ++i) {
+      nb_received_bytes += rx_pkts[i].nb_bytes;
+    }
+
+    for (uint32_t i = 0; i < 64 && !rx_pkts.empty(); ++i) {
+      uint32_t op = rng() % 16;
+      if (op == 0) {
+        rx_pipe_->Clear();
+        rx_pkts.clear();
+      } else if (op < 3) {
+        uint32_t nb_pkts = 1 + rng() % rx_pkts.size();
+        uint32_t nb_bytes = 0;
+        for (uint32_t j = 0; j < nb_pkts; ++j) {
+          nb_bytes += rx_pkts.front().nb_bytes;
+          rx_pkts.pop_front();
+        }
+        rx_pipe_->Free(nb_bytes);
+      } else {
+        RxPkt& pkt = rx_pkts[rng() % rx_pkts.size()];
+        if (!pkt.released) {
+          rx_pipe_->Release(pkt.addr, pkt.nb_bytes);
+          pkt.released = true;
+        }
+      }
+      ASSERT_EQ(rx_pipe_->capacity(), OwnedBytes(&rx_pkts));
+    }
+
+    // Keeps enough free space in the pipe for the next packets.
+    if (rx_pipe_->capacity() > rx_pipe_->buf_size() / 4) {
+      rx_pipe_->Clear();
+      rx_pkts.clear();
+    }
+  }
+}
+
+// Bytes received from a pipe in one turn of `Device::NextRxPipeToRecv()`.
+struct RxTurn {
+  enso::RxPipe* pipe;
+  uint32_t nb_bytes;
+
+  bool operator==(const RxTurn& other) const {
+    return pipe == other.pipe && nb_bytes == other.nb_bytes;
+  }
+};
+
+// Receives from the pipes chosen by `device` until none has data pending.
+static std::vector<RxTurn> recv_turns(enso::Device* device) {
+  std::vector<RxTurn> turns;
+  for (enso::RxPipe* pipe = device->NextRxPipeToRecv(); pipe != nullptr;
+       pipe = device->NextRxPipeToRecv()) {
+    uint8_t* buf;
+    uint32_t nb_bytes = pipe->Recv(&buf, ~0);
+    pipe->Clear();
+    turns.push_back({pipe, nb_bytes});
+  }
+  return turns;
+}
+
+TEST_F(PipeTest, RxQuota) {
+  device_->SetRxSchedPolicy(enso::RxSchedPolicy::kStrictPriority);
+
+  enso::RxSchedParams params;
+  params.quota = 200;
+  ASSERT_EQ(rx_pipe_->SetSchedParams(params), 0);
+
+  Send({128, 128, 128, 512, 64}, DST_IP);
+  WaitForDelivery(5);
+
+  // Only whole packets, and at least one even if larger than the quota.
+  ASSERT_EQ(device_->NextRxPipeToRecv(), rx_pipe_);
+  uint8_t* buf;
+  EXPECT_EQ(rx_pipe_->Recv(&buf, ~0), 128);
+  EXPECT_EQ(rx_pipe_->Recv(&buf, ~0), 0);
+  rx_pipe_->Clear();
+
+  std::vector<RxTurn> expected = {
+      {rx_pipe_, 128}, {rx_pipe_, 128}, {rx_pipe_, 512}, {rx_pipe_, 64}};
+  EXPECT_EQ(recv_turns(device_.get()), expected);
+}
+
+TEST_F(PipeTest, RxQuotaLargerThanBatch) {
+  device_->SetRxSchedPolicy(enso::RxSchedPolicy::kStrictPriority);
+
+  enso::RxSchedParams params;
+  params.quota = 1024;
+  ASSERT_EQ(rx_pipe_->SetSchedParams(params), 0);
+
+  Send({128, 128, 256}, DST_IP);
+  WaitForDelivery(3);
+
+  std::vector<RxTurn> expected = {{rx_pipe_, 512}};
+  EXPECT_EQ(recv_turns(device_.get()), expected);
+}
+
+TEST_F(PipeTest, RxStrictPriority) {
+  device_->SetRxSchedPolicy(enso::RxSchedPolicy::kStrictPriority);
+
+  enso::RxSchedParams params;
+  params.priority = 1;
+  enso::RxPipe* high = device_->AllocateRxPipe(
+      false, enso::kDefaultPipeBufSize, params);
+  ASSERT_NE(high, nullptr);
+  ASSERT_EQ(high->Bind(DST_PORT, 0, DST_IP + 1, 0, PROTOCOL), 0);
+
+  // The high priority pipe is chosen first even though it is notified last.
+  Send({64, 64}, DST_IP);
+  WaitForDelivery(2);
+  Send({128}, DST_IP + 1);
+  WaitForDelivery(1);
+
+  std::vector<RxTurn> expected = {{high, 128}, {rx_pipe_, 128}};
+  EXPECT_EQ(recv_turns(device_.get()), expected);
+}
+
+TEST_F(PipeTest, RxWeightedRoundRobin) {
+  device_->SetRxSchedPolicy(enso::RxSchedPolicy::kWeightedRoundRobin);
+
+  // One packet per turn.
+  enso::RxSchedParams params;
+  params.quota = 64;
+  params.weight = 2;
+  ASSERT_EQ(rx_pipe_->SetSchedParams(params), 0);
+
+  params.weight = 1;
+  enso::RxPipe* light = device_->AllocateRxPipe(
+      false, enso::kDefaultPipeBufSize, params);
+  ASSERT_NE(light, nullptr);
+  ASSERT_EQ(light->Bind(DST_PORT, 0, DST_IP + 1, 0, PROTOCOL), 0);
+
+  Send(std::vector<uint16_t>(6, 64), DST_IP);
+  WaitForDelivery(6);
+  Send(std::vector<uint16_t>(4, 64), DST_IP + 1);
+  WaitForDelivery(4);
+
+  // Every round, `rx_pipe_` gets two turns in a row and `light` one.
+  RxTurn heavy_turn = {rx_pipe_, 64};
+  RxTurn light_turn = {light, 64};
+  std::vector<RxTurn> expected = {
+      heavy_turn, heavy_turn, light_turn, heavy_turn, heavy_turn,
+      light_turn, heavy_turn, heavy_turn, light_turn, light_turn};
+  EXPECT_EQ(recv_turns(device_.get()), expected);
+}
+
+TEST_F(PipeTest, RxDeficitRoundRobin) {
+  device_->SetRxSchedPolicy(enso::RxSchedPolicy::kDeficitRoundRobin);
+
+  enso::RxSchedParams params;
+  params.weight = 2;
+  enso::RxPipe* heavy = device_->AllocateRxPipe(
+      false, enso::kDefaultPipeBufSize, params);
+  ASSERT_NE(heavy, nullptr);
+  ASSERT_EQ(heavy->Bind(DST_PORT, 0, DST_IP + 1, 0, PROTOCOL), 0);
+
+  // Packets of half a quantum, so that `rx_pipe_` receives two per round.
+  const uint16_t pkt_len = enso::kRxSchedQuantum / 2;
+  Send(std::vector<uint16_t>(8, pkt_len), DST_IP);
+  WaitForDelivery(8);
+  Send(std::vector<uint16_t>(8, pkt_len), DST_IP + 1);
+  WaitForDelivery(8);
+
+  RxTurn light_turn = {rx_pipe_, enso::kRxSchedQuantum};
+  RxTurn heavy_turn = {heavy, 2 * enso::kRxSchedQuantum};
+  std::vector<RxTurn> expected = {light_turn, heavy_turn, light_turn,
+                                  heavy_turn, light_turn, light_turn};
+  EXPECT_EQ(recv_turns(device_.get()), expected);
+}
+
+TEST_F(PipeTest, RxDeficitRoundRobinLargePackets) {
+  device_->SetRxSchedPolicy(enso::RxSchedPolicy::kDeficitRoundRobin);
+
+  enso::RxPipe* other = device_->AllocateRxPipe();
+  ASSERT_NE(other, nullptr);
+  ASSERT_EQ(other->Bind(DST_PORT, 0, DST_IP + 1, 0, PROTOCOL), 0);
+
+  // A packet larger than the quantum is received whole, and the pipe pays
+  // for it by skipping the next round.
+  const uint16_t large_len = 2 * enso::kRxSchedQuantum + 1024;
+  Send({large_len, 64}, DST_IP);
+  WaitForDelivery(2);
+  Send({1024, 1024, 1024}, DST_IP + 1);
+  WaitForDelivery(3);
+
+  std::vector<RxTurn> expected = {{rx_pipe_, large_len},
+                                  {other, 2048},
+                                  {other, 1024},
+                                  {rx_pipe_, 64}};
+  EXPECT_EQ(recv_turns(device_.get()), expected);
+}
+
+// Sends packets filled with a pattern with `TxPipe::SendBurst()` and checks
+// that they are received unchanged, each starting at a multiple of 64 bytes.
+static void check_send_burst(enso::TxPipe* tx_pipe, enso::RxPipe* rx_pipe,
+                             const std::vector<uint16_t>& lens,
+                             uint32_t seed) {
+  std::vector<std::vector<uint8_t>> pkts;
+  std::vector<const uint8_t*> pkt_addrs;
+  for (uint32_t i = 0; i < lens.size(); ++i) {
+    pkts.emplace_back(lens[i]);
+    uint8_t* pkt = pkts.back().data();
+    write_pkt(pkt, lens[i], DST_IP, i);
+    uint32_t header_len = sizeof(struct ether_header) + sizeof(struct iphdr) +
+                          sizeof(struct udphdr) + sizeof(uint32_t);
+    for (uint32_t j = header_len; j < lens[i]; ++j) {
+      pkt[j] = seed + i + j;
+    }
+    pkt_addrs.push_back(pkt);
+  }
+
+  uint16_t nb_sent = 0;
+  while (nb_sent < lens.size()) {
+    nb_sent += tx_pipe->SendBurst(pkt_addrs.data() + nb_sent,
+                                  lens.data() + nb_sent, lens.size() - nb_sent);
+  }
+
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::seconds(RECV_TIMEOUT_S);
+  uint32_t nb_received = 0;
+  while (nb_received < lens.size()) {
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+
+    uint8_t* buf;
+    uint32_t nb_bytes = rx_pipe->Recv(&buf, ~0);
+    uint32_t offset = 0;
+    while (offset < nb_bytes) {
+      uint16_t len = lens[nb_received];
+      ASSERT_EQ(enso::get_pkt_len(buf + offset), len);
+      ASSERT_EQ(memcmp(buf + offset, pkts[nb_received].data(), len), 0);
+      offset += (len + 63) / 64 * 64;
+      ++nb_received;
+    }
+    ASSERT_EQ(offset, nb_bytes);
+    rx_pipe->Clear();
+  }
+}
+
+TEST_F(PipeTest, SendBurst) {
+  check_send_burst(tx_pipe_, rx_pipe_, {60, 64, 65, 127, 128, 1500, 61, 129},
+                   0);
+}
+
+// Sends enough bursts to go around the TX pipe's buffer twice.
+TEST_F(PipeTest, SendBurstWrapAround) {
+  std::mt19937 rng(5);
+  uint64_t nb_sent_bytes = 0;
+  for (uint32_t seed = 0; nb_sent_bytes < 2 * (uint64_t)tx_pipe_->buf_size();
+       ++seed) {
+    std::vector<uint16_t> lens(1 + rng() % 64);
+    for (uint16_t& len : lens) {
+      len = 60 + rng() % 1455;
+      nb_sent_bytes += (len + 63) / 64 * 64;
+    }
+    check_send_burst(tx_pipe_, rx_pipe_, lens, seed);
+    if (HasFatalFailure()) {
+      return;
+    }
+  }
+}
+
+// A burst that does not fit in the pipe is only partially sent, and only with
+// whole packets.
+TEST_F(PipeTest, SendBurstPartial) {
+  const uint16_t pkt_len = 1500;
+  const uint32_t nb_pkt_bytes = (pkt_len + 63) / 64 * 64;
+  const uint16_t nb_pkts = tx_pipe_->max_capacity() / nb_pkt_bytes + 1;
+
+  // Goes to an address without pipes, the emulator drops the packets.
+  std::vector<uint8_t> pkt(pkt_len);
+  write_pkt(pkt.data(), pkt_len, DST_IP + 1, 0);
+  std::vector<const uint8_t*> pkts(nb_pkts, pkt.data());
+  std::vector<uint16_t> lens(nb_pkts, pkt_len);
+
+  uint16_t nb_sent = tx_pipe_->SendBurst(pkts.data(), lens.data(), nb_pkts);
+  EXPECT_GT(nb_sent, 0);
+  EXPECT_LT(nb_sent, nb_pkts);
+
+  // The rest is sent once the device is done with the first packets.
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::seconds(RECV_TIMEOUT_S);
+  while (nb_sent < nb_pkts) {
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+    nb_sent += tx_pipe_->SendBurst(pkts.data() + nb_sent,
+                                   lens.data() + nb_sent, nb_pkts - nb_sent);
+  }
+}
+
+// Processes completions until `rx_pipe` owns `nb_bytes` bytes.
+static void wait_for_capacity(enso::Device* device, enso::RxPipe* rx_pipe,
+                              uint32_t nb_bytes) {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::seconds(RECV_TIMEOUT_S);
+  while (rx_pipe->capacity() != nb_bytes) {
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+    device->ProcessCompletions();
+  }
+}
+
+// Receives packets on `rx_pipe` until it gets as many as in `pkts` and checks
+// that they are the same, in the same order.
+static void check_recv(enso::RxPipe* rx_pipe,
+                       const std::vector<std::vector<uint8_t>>& pkts) {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::seconds(RECV_TIMEOUT_S);
+  uint32_t nb_received = 0;
+  while (nb_received < pkts.size()) {
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+
+    uint8_t* buf;
+    uint32_t nb_bytes = rx_pipe->Recv(&buf, ~0);
+    uint8_t* end = buf + nb_bytes;
+    for (uint8_t* pkt = buf; pkt < end; pkt = enso::get_next_pkt(pkt)) {
+      ASSERT_LT(nb_received, pkts.size());
+      const std::vector<uint8_t>& expected = pkts[nb_received];
+      ASSERT_EQ(enso::get_pkt_len(pkt), expected.size());
+      ASSERT_EQ(memcmp(pkt, expected.data(), expected.size()), 0);
+      ++nb_received;
+    }
+    rx_pipe->Clear();
+  }
+}
+
+// Bytes sent with `TxPipe::SendFromRxPipe()` stay in the RX pipe until they are
+// transmitted and the completion is processed.
+TEST_F(PipeTest, SendFromRxPipe) {
+  enso::RxPipe* fwd_pipe = device_->AllocateRxPipe();
+  ASSERT_NE(fwd_pipe, nullptr);
+  ASSERT_EQ(fwd_pipe->Bind(DST_PORT, 0, DST_IP + 1, 0, PROTOCOL), 0);
+
+  std::deque<RxPkt> rx_pkts;
+  SendAndRecv({64, 1500, 128, 256}, &rx_pkts);
+  const uint32_t nb_bytes = rx_pipe_->capacity();
+
+  // The device only sees the sends after `FlushTx()`.
+  ASSERT_EQ(device_->EnableTxBatching(~0U, ~0ULL), 0);
+
+  // Forwards all packets but the third one, which is released instead.
+  std::vector<std::vector<uint8_t>> fwd_pkts;
+  for (uint32_t i : {0u, 1u, 3u}) {
+    RxPkt& pkt = rx_pkts[i];
+    set_dst_ip(pkt.addr, DST_IP + 1);
+    fwd_pkts.emplace_back(pkt.addr, pkt.addr + enso::get_pkt_len(pkt.addr));
+    ASSERT_EQ(tx_pipe_->SendFromRxPipe(rx_pipe_, pkt.addr, pkt.nb_bytes), 0);
+  }
+  rx_pipe_->Release(rx_pkts[2].addr, rx_pkts[2].nb_bytes);
+
+  device_->ProcessCompletions();
+  EXPECT_EQ(rx_pipe_->capacity(), nb_bytes);
+
+  // Transmitted, but the completions were not processed yet.
+  device_->FlushTx();
+  check_recv(fwd_pipe, fwd_pkts);
+  EXPECT_EQ(rx_pipe_->capacity(), nb_bytes);
+
+  wait_for_capacity(device_.get(), rx_pipe_, 0);
+}
+
+// Forwards packets that cross the end of the buffer, or that the application
+// reads past its end, in the mirror.
+TEST_F(PipeTest, SendFromRxPipeWrapAround) {
+  enso::RxPipe* fwd_pipe = device_->AllocateRxPipe();
+  ASSERT_NE(fwd_pipe, nullptr);
+  ASSERT_EQ(fwd_pipe->Bind(DST_PORT, 0, DST_IP + 1, 0, PROTOCOL), 0);
+
+  const uint16_t pkt_len = 1500;
+  const uint32_t nb_pkt_bytes = (pkt_len + 63) / 64 * 64;
+
+  // Moves the tail to less than a packet from the end of the buffer.
+  std::deque<RxPkt> rx_pkts;
+  for (uint32_t nb_pkts = rx_pipe_->buf_size() / nb_pkt_bytes; nb_pkts > 0;) {
+    uint32_t nb_batch_pkts = std::min(nb_pkts, 256u);
+    SendAndRecv(std::vector<uint16_t>(nb_batch_pkts, pkt_len), &rx_pkts);
+    rx_pipe_->Clear();
+    rx_pkts.clear();
+    nb_pkts -= nb_batch_pkts;
+  }
+
+  SendAndRecv({pkt_len, pkt_len, pkt_len}, &rx_pkts);
+  uint8_t* end = rx_pipe_->buf() + rx_pipe_->buf_size();
+  ASSERT_LT(rx_pkts[0].addr, end);
+  ASSERT_GT(rx_pkts[0].addr + rx_pkts[0].nb_bytes, end);
+
+  // The payload tells if the device reads the wrong part of the buffer.
+  const uint32_t header_len = sizeof(struct ether_header) +
+                              sizeof(struct iphdr) + sizeof(struct udphdr) +
+                              sizeof(uint32_t);
+  std::vector<std::vector<uint8_t>> fwd_pkts;
+  for (uint32_t i = 0; i < rx_pkts.size(); ++i) {
+    RxPkt& pkt = rx_pkts[i];
+    set_dst_ip(pkt.addr, DST_IP + 1);
+    for (uint32_t j = header_len; j < pkt_len; ++j) {
+      pkt.addr[j] = i + j;
+    }
+    fwd_pkts.emplace_back(pkt.addr, pkt.addr + pkt_len);
+    ASSERT_EQ(tx_pipe_->SendFromRxPipe(rx_pipe_, pkt.addr, pkt.nb_bytes), 0);
+  }
+
+  check_recv(fwd_pipe, fwd_pkts);
+  wait_for_capacity(device_.get(), rx_pipe_, 0);
+}
+
+// Regions that follow each other count as one, so more than
+// `kMaxRxForwardedRegions` packets can wait to be transmitted.
+TEST_F(PipeTest, SendFromRxPipeAdjacent) {
+  std::deque<RxPkt> rx_pkts;
+  SendAndRecv(std::vector<uint16_t>(2 * enso::kMaxRxForwardedRegions, 64),
+              &rx_pkts);
+  const uint32_t nb_bytes = rx_pipe_->capacity();
+
+  ASSERT_EQ(device_->EnableTxBatching(~0U, ~0ULL), 0);
+
+  // Goes to an address without pipes, the emulator drops the packets.
+  for (RxPkt& pkt : rx_pkts) {
+    set_dst_ip(pkt.addr, DST_IP + 1);
+    ASSERT_EQ(tx_pipe_->SendFromRxPipe(rx_pipe_, pkt.addr, pkt.nb_bytes), 0);
+  }
+
+  // Otherwise, sends would have waited for earlier ones to complete.
+  EXPECT_EQ(rx_pipe_->capacity(), nb_bytes);
+
+  device_->FlushTx();
+  wait_for_capacity(device_.get(), rx_pipe_, 0);
+}
+
+// Once `kMaxRxForwardedRegions` separate regions wait to be transmitted, the
+// next send waits for the oldest ones to complete.
+TEST_F(PipeTest, SendFromRxPipeBackPressure) {
+  const uint32_t nb_regions = enso::kMaxRxForwardedRegions + 1;
+
+  std::deque<RxPkt> rx_pkts;
+  SendAndRecv(std::vector<uint16_t>(2 * nb_regions, 64), &rx_pkts);
+  const uint32_t nb_bytes = rx_pipe_->capacity();
+
+  ASSERT_EQ(device_->EnableTxBatching(~0U, ~0ULL), 0);
+
+  // Only forwards every other packet, so that no regions follow each other.
+  // Goes to an address without pipes, the emulator drops the packets.
+  for (uint32_t i = 0; i < rx_pkts.size(); i += 2) {
+    set_dst_ip(rx_pkts[i].addr, DST_IP + 1);
+    rx_pipe_->Release(rx_pkts[i + 1].addr, rx_pkts[i + 1].nb_bytes);
+  }
+
+  for (uint32_t i = 0; i < 2 * (nb_regions - 1); i += 2) {
+    ASSERT_EQ(tx_pipe_->SendFromRxPipe(rx_pipe_, rx_pkts[i].addr,
+                                       rx_pkts[i].nb_bytes),
+              0);
+  }
+  EXPECT_EQ(rx_pipe_->capacity(), nb_bytes);
+
+  RxPkt& last = rx_pkts[2 * (nb_regions - 1)];
+  ASSERT_EQ(tx_pipe_->SendFromRxPipe(rx_pipe_, last.addr, last.nb_bytes), 0);
+  EXPECT_LT(rx_pipe_->capacity(), nb_bytes);
+
+  device_->FlushTx();
+  wait_for_capacity(device_.get(), rx_pipe_, 0);
+}
+
+// Pipes cannot move to another device while they have bytes waiting to be
+// transmitted, since the completions would go to the old device.
+TEST_F(PipeTest, SendFromRxPipeThenMove) {
+  std::unique_ptr<enso::DeviceGroup> group = enso::DeviceGroup::Create(2);
+  ASSERT_NE(group, nullptr);
+  enso::Device* device = group->GetDevice(0);
+
+  enso::RxPipe* rx_pipe = device->AllocateRxPipe();
+  enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+  ASSERT_NE(rx_pipe, nullptr);
+  ASSERT_NE(tx_pipe, nullptr);
+  ASSERT_EQ(rx_pipe->Bind(DST_PORT, 0, DST_IP + 1, 0, PROTOCOL), 0);
+
+  Send({64}, DST_IP + 1);
+  WaitForDelivery(1);
+
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::seconds(RECV_TIMEOUT_S);
+  uint8_t* buf;
+  uint32_t nb_bytes = 0;
+  while (nb_bytes == 0) {
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+    nb_bytes = rx_pipe->Recv(&buf, ~0);
+  }
+  ASSERT_EQ(nb_bytes, 64u);
+
+  ASSERT_EQ(device->EnableTxBatching(~0U, ~0ULL), 0);
+
+  // Goes to an address without pipes, the emulator drops the packet.
+  set_dst_ip(buf, DST_IP + 2);
+  EXPECT_EQ(tx_pipe_->SendFromRxPipe(rx_pipe, buf, nb_bytes), -1);
+  ASSERT_EQ(tx_pipe->SendFromRxPipe(rx_pipe, buf, nb_bytes), 0);
+  EXPECT_EQ(device->MoveRxPipe(rx_pipe, group->GetDevice(1)), -1);
+
+  device->FlushTx();
+  wait_for_capacity(device, rx_pipe, 0);
+  EXPECT_EQ(device->MoveRxPipe(rx_pipe, group->GetDevice(1)), 0);
+}
+
+// Memory in a huge page file with its huge pages mapped in reverse order. The
+// emulator maps the file in order, so the huge pages are contiguous in the
+// application's address space but not in the device's.
+class RegisteredMemoryTest : public PipeTest {
+ protected:
+  static constexpr uint32_t kNbPages = 4;
+  static constexpr uint64_t kMemSize = kNbPages * enso::kBufPageSize;
+
+  void SetUp() override {
+    PipeTest::SetUp();
+    if (HasFatalFailure()) {
+      return;
+    }
+
+    void* file_mem = enso::get_huge_page(path_, kMemSize);
+    ASSERT_NE(file_mem, nullptr);
+    munmap(file_mem, kMemSize);
+
+    // Reserves enough address space to align the memory to a huge page.
+    void* reserved = mmap(nullptr, kMemSize + enso::kBufPageSize, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(reserved, MAP_FAILED);
+    reserved_ = (uint8_t*)reserved;
+    mem_ = (uint8_t*)(((uint64_t)reserved_ + enso::kBufPageSize - 1) &
+                      ~(enso::kBufPageSize - 1));
+
+    int fd = open(path_.c_str(), O_RDWR);
+    ASSERT_NE(fd, -1);
+    for (uint32_t i = 0; i < kNbPages; ++i) {
+      uint8_t* page = mem_ + i * enso::kBufPageSize;
+      off_t offset = (kNbPages - 1 - i) * enso::kBufPageSize;
+      void* addr = mmap(page, enso::kBufPageSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_FIXED | MAP_HUGETLB, fd, offset);
+      if (addr != page) {
+        close(fd);
+        FAIL() << "Could not map huge page " << i;
+      }
+    }
+    close(fd);
+  }
+
+  void TearDown() override {
+    PipeTest::TearDown();
+    if (reserved_ != nullptr) {
+      munmap(reserved_, kMemSize + enso::kBufPageSize);
+    }
+    unlink(path_.c_str());
+  }
+
+  const std::string path_ =
+      std::string(enso::kHugePageDefaultPrefix) + "_pipe_test_registered";
+  uint8_t* reserved_ = nullptr;
+  uint8_t* mem_ = nullptr;
+};
+
+TEST_F(RegisteredMemoryTest, Overlap) {
+  const uint64_t half = kMemSize / 2;
+  const uint64_t page_size = sysconf(_SC_PAGESIZE);
+
+  EXPECT_EQ(device_->RegisterMemory(nullptr, half), -1);
+  EXPECT_EQ(device_->RegisterMemory(mem_, 0), -1);
+
+  ASSERT_EQ(device_->RegisterMemory(mem_ + half, half), 0);
+
+  // Overlaps the start, the end, or all of the registered memory.
+  EXPECT_EQ(device_->RegisterMemory(mem_ + half - 64, 128), -1);
+  EXPECT_EQ(device_->RegisterMemory(mem_ + kMemSize - 64, 64), -1);
+  EXPECT_EQ(device_->RegisterMemory(mem_, kMemSize), -1);
+  EXPECT_EQ(device_->RegisterMemory(mem_ + half, half), -1);
+
+  // Right before the registered memory.
+  ASSERT_EQ(device_->RegisterMemory(mem_ + page_size, half - page_size), 0);
+
+  EXPECT_EQ(device_->RegisterMemory(mem_ + page_size - 64, 128), -1);
+  ASSERT_EQ(device_->RegisterMemory(mem_, page_size - 64), 0);
+
+  // Shares a page with the memory registered above without overlapping it.
+  EXPECT_EQ(device_->RegisterMemory(mem_ + page_size - 32, 16), -1);
+
+  // Only the address given to `RegisterMemory()` can be deregistered.
+  EXPECT_EQ(device_->DeregisterMemory(mem_ + half + 64), -1);
+  EXPECT_EQ(device_->DeregisterMemory(mem_ + half), 0);
+  EXPECT_EQ(device_->DeregisterMemory(mem_ + half), -1);
+
+  // Deregistered memory can be registered again.
+  ASSERT_EQ(device_->RegisterMemory(mem_ + half + 64, 64), 0);
+
+  EXPECT_EQ(device_->DeregisterMemory(mem_), 0);
+  EXPECT_EQ(device_->DeregisterMemory(mem_ + page_size), 0);
+  EXPECT_EQ(device_->DeregisterMemory(mem_ + half + 64), 0);
+}
+
+// Sends packets that cross the boundaries between huge pages, which are not
+// contiguous in the device's address space, and checks that they arrive
+// unchanged.
+TEST_F(RegisteredMemoryTest, SendAcrossPages) {
+  ASSERT_EQ(device_->RegisterMemory(mem_, kMemSize), 0);
+
+  const uint16_t pkt_len = 1500;
+  const uint32_t nb_pkt_bytes = (pkt_len + 63) / 64 * 64;
+  const uint32_t nb_pkts = 4;
+
+  for (uint64_t boundary = enso::kBufPageSize; boundary < kMemSize;
+       boundary += enso::kBufPageSize) {
+    uint8_t* start = mem_ + boundary - 2 * nb_pkt_bytes + 128;
+    for (uint32_t i = 0; i < nb_pkts; ++i) {
+      uint8_t* pkt = start + i * nb_pkt_bytes;
+      write_pkt(pkt, pkt_len, DST_IP, i);
+      for (uint32_t j = 64; j < pkt_len; ++j) {
+        pkt[j] = boundary / enso::kBufPageSize + i + j;
+      }
+    }
+
+    ASSERT_EQ(tx_pipe_->SendRegistered(start, nb_pkts * nb_pkt_bytes), 0);
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(RECV_TIMEOUT_S);
+    uint32_t nb_received_bytes = 0;
+    while (nb_received_bytes < nb_pkts * nb_pkt_bytes) {
+      ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+
+      uint8_t* buf;
+      uint32_t nb_bytes = rx_pipe_->Recv(&buf, ~0);
+      ASSERT_EQ(memcmp(buf, start + nb_received_bytes, nb_bytes), 0);
+      nb_received_bytes += nb_bytes;
+      rx_pipe_->Clear();
+    }
+  }
+
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::seconds(RECV_TIMEOUT_S);
+  while (device_->registered_tx_pending() != 0) {
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+    device_->ProcessCompletions();
+  }
+
+  // Not registered.
+  EXPECT_EQ(tx_pipe_->SendRegistered(rx_pipe_->buf(), nb_pkt_bytes), -1);
+
+  EXPECT_EQ(device_->DeregisterMemory(mem_), 0);
+}
+
+// Manages the emulator's flow table with a `FlowTable` shadow, which must be
+// the only one inserting entries. Starts from an empty table.
+class FlowTableTest : public PipeTest {
+ protected:
+  static constexpr uint32_t kFlowIp = 0x0a000000;  // 10.0.0.0
+
+  void SetUp() override {
+    PipeTest::SetUp();
+    if (HasFatalFailure()) {
+      return;
+    }
+
+    // Also removes the entry for `rx_pipe_`.
+    emulator_->flow_table().Clear();
+
+    flow_table_ = enso::FlowTable::Create(device_.get());
+    ASSERT_NE(flow_table_, nullptr);
+  }
+
+  void TearDown() override {
+    flow_table_.reset();
+    emulator_->flow_table().Clear();
+    PipeTest::TearDown();
+  }
+
+  // Subtable where the emulator placed `flow`, or -1 if it is not installed.
+  static int32_t EmulatorSubtable(const enso::FlowEntry& flow) {
+    enso::FlowTuple tuple = {flow.src_ip, flow.dst_ip, flow.src_port,
+                             flow.dst_port};
+    return emulator_->flow_table().FindSubtable(tuple);
+  }
+
+  // Checks that the shadow has as many entries in every subtable as the
+  // emulator.
+  void CheckOccupancy() {
+    enso::FlowTable::Stats stats = flow_table_->GetStats();
+    uint32_t nb_entries = 0;
+    for (uint32_t i = 0; i < enso::FlowTable::kNbSubtables; ++i) {
+      EXPECT_EQ(stats.subtable_entries[i],
+                emulator_->flow_table().CountEntries(i));
+      nb_entries += stats.subtable_entries[i];
+    }
+    EXPECT_EQ(stats.nb_entries, nb_entries);
+  }
+
+  // Sends a packet to `dst_ip` and checks that `pipe` receives it and
+  // `other_pipe` does not.
+  void ExpectSteered(uint32_t dst_ip, enso::RxPipe* pipe,
+                     enso::RxPipe* other_pipe) {
+    Send({64}, dst_ip);
+    WaitForDelivery(1);
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(RECV_TIMEOUT_S);
+    uint8_t* buf;
+    uint32_t nb_bytes = 0;
+    while (nb_bytes == 0) {
+      ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+      nb_bytes = pipe->Recv(&buf, ~0);
+    }
+    EXPECT_EQ(nb_bytes, 64u);
+    pipe->Clear();
+
+    EXPECT_EQ(other_pipe->Recv(&buf, ~0), 0u);
+  }
+
+  // Sends a packet to `dst_ip` and checks that the emulator drops it, as there
+  // are no fallback pipes.
+  void ExpectDropped(uint32_t dst_ip) {
+    uint64_t target = emulator_->GetStats().rx_no_pipe_drops + 1;
+    Send({64}, dst_ip);
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(RECV_TIMEOUT_S);
+    while (emulator_->GetStats().rx_no_pipe_drops < target) {
+      ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+      device_->ProcessCompletions();
+    }
+  }
+
+  std::unique_ptr<enso::FlowTable> flow_table_;
+};
+
+TEST_F(FlowTableTest, Traffic) {
+  enso::RxPipe* other = device_->AllocateRxPipe();
+  ASSERT_NE(other, nullptr);
+
+  // The emulator only parses the destination of UDP packets.
+  std::vector<enso::FlowEntry> flows;
+  for (uint32_t i = 0; i < 3; ++i) {
+    flows.push_back({DST_PORT, 0, kFlowIp + i, 0, PROTOCOL});
+  }
+
+  ASSERT_EQ(flow_table_->Insert(flows[0], rx_pipe_->id()), 0);
+  ASSERT_NO_FATAL_FAILURE(ExpectSteered(kFlowIp, rx_pipe_, other));
+
+  ASSERT_EQ(flow_table_->Replace(flows[0], other->id()), 0);
+  ASSERT_NO_FATAL_FAILURE(ExpectSteered(kFlowIp, other, rx_pipe_));
+
+  // Inserting an installed flow also moves it.
+  ASSERT_EQ(flow_table_->Insert(flows[0], rx_pipe_->id()), 0);
+  ASSERT_NO_FATAL_FAILURE(ExpectSteered(kFlowIp, rx_pipe_, other));
+
+  for (const enso::FlowEntry& flow : flows) {
+    ASSERT_EQ(flow_table_->Insert(flow, other->id()), 0);
+  }
+  EXPECT_EQ(flow_table_->Migrate(other->id(), rx_pipe_->id()), 3);
+  EXPECT_EQ(flow_table_->Migrate(other->id(), rx_pipe_->id()), 0);
+  for (const enso::FlowEntry& flow : flows) {
+    EXPECT_EQ(flow_table_->Lookup(flow), (int32_t)rx_pipe_->id());
+    ASSERT_NO_FATAL_FAILURE(ExpectSteered(flow.dst_ip, rx_pipe_, other));
+  }
+
+  ASSERT_EQ(flow_table_->Remove(flows[1]), 0);
+  EXPECT_EQ(flow_table_->Lookup(flows[1]), -1);
+  ASSERT_NO_FATAL_FAILURE(ExpectDropped(flows[1].dst_ip));
+  ASSERT_NO_FATAL_FAILURE(ExpectSteered(flows[2].dst_ip, rx_pipe_, other));
+
+  enso::FlowTable::Stats stats = flow_table_->GetStats();
+  EXPECT_EQ(stats.nb_entries, 2u);
+  EXPECT_EQ(stats.nb_inserts, 3u);
+  EXPECT_EQ(stats.nb_updates, 6u);
+  EXPECT_EQ(stats.nb_removals, 1u);
+  CheckOccupancy();
+}
+
+// Removing or moving a flow that is not installed fails without sending
+// anything to the NIC.
+TEST_F(FlowTableTest, MissingFlow) {
+  const enso::FlowEntry flow = {DST_PORT, 0, kFlowIp, 0, PROTOCOL};
+  uint64_t nb_configs = emulator_->GetStats().config_notifications;
+
+  EXPECT_EQ(flow_table_->Remove(flow), -1);
+  EXPECT_EQ(flow_table_->Replace(flow, rx_pipe_->id()), -1);
+  EXPECT_EQ(flow_table_->Lookup(flow), -1);
+
+  ASSERT_EQ(flow_table_->Insert(flow, rx_pipe_->id()), 0);
+  ASSERT_EQ(flow_table_->Remove(flow), 0);
+  uint64_t nb_flow_configs = emulator_->GetStats().config_notifications;
+  EXPECT_EQ(nb_flow_configs, nb_configs + 2);
+
+  EXPECT_EQ(flow_table_->Remove(flow), -1);
+  EXPECT_EQ(emulator_->GetStats().config_notifications, nb_flow_configs);
+
+  enso::FlowTable::Stats stats = flow_table_->GetStats();
+  EXPECT_EQ(stats.nb_entries, 0u);
+  EXPECT_EQ(stats.nb_removals, 1u);
+  EXPECT_EQ(stats.nb_updates, 0u);
+  CheckOccupancy();
+}
+
+// Fills the table with random flows until the hardware would drop some,
+// removes some and fills it again. The shadow must predict the subtable that
+// the emulator picks for every flow, and refuse the flows that it would drop.
+TEST_F(FlowTableTest, Placement) {
+  std::mt19937 rng(11);
+  std::vector<enso::FlowEntry> flows;
+
+  // Does not wait for every entry, the emulator applies them in order.
+  auto fill = [&]() {
+    std::vector<std::pair<enso::FlowEntry, int32_t>> predictions;
+    enso::ConfigTicket ticket = 0;
+    for (uint32_t i = 0; i < enso::FlowTable::kCapacity; ++i) {
+      enso::FlowEntry flow = {(uint16_t)rng(), (uint16_t)rng(), (uint32_t)rng(),
+                              (uint32_t)rng(), PROTOCOL};
+      int32_t subtable = flow_table_->PredictSubtable(flow);
+      int ret = flow_table_->Insert(flow, rx_pipe_->id(), &ticket);
+      ASSERT_EQ(ret, subtable < 0 ? -1 : 0);
+      predictions.push_back({flow, subtable});
+      if (ret == 0) {
+        flows.push_back(flow);
+      }
+    }
+    device_->WaitForConfig(ticket);
+
+    for (const auto& [flow, subtable] : predictions) {
+      ASSERT_EQ(EmulatorSubtable(flow), subtable);
+    }
+  };
+
+  fill();
+  if (HasFatalFailure()) {
+    return;
+  }
+  enso::FlowTable::Stats stats = flow_table_->GetStats();
+  EXPECT_GT(stats.nb_rejected, 0u);
+  EXPECT_GT(stats.subtable_entries[enso::FlowTable::kNbSubtables - 1], 0u);
+  EXPECT_EQ(stats.nb_entries, flows.size());
+  CheckOccupancy();
+
+  // Frees slots in every subtable.
+  std::shuffle(flows.begin(), flows.end(), rng);
+  std::vector<enso::FlowEntry> removed(flows.begin() + flows.size() / 2,
+                                       flows.end());
+  flows.resize(flows.size() / 2);
+  enso::ConfigTicket ticket = 0;
+  for (const enso::FlowEntry& flow : removed) {
+    ASSERT_EQ(flow_table_->Remove(flow, &ticket), 0);
+  }
+  device_->WaitForConfig(ticket);
+  for (const enso::FlowEntry& flow : removed) {
+    ASSERT_EQ(EmulatorSubtable(flow), -1);
+  }
+  CheckOccupancy();
+
+  fill();
+  if (HasFatalFailure()) {
+    return;
+  }
+  EXPECT_EQ(flow_table_->GetStats().nb_entries, flows.size());
+  CheckOccupancy();
+
+  // The shadow refused every entry that the emulator would drop.
+  EXPECT_EQ(emulator_->GetStats().flow_table_evictions, 0u);
+}
+
+// Sends from TX pipes with TX batching enabled, so that adjacent sends may
+// share a descriptor. Sends 64-byte packets to an address without pipes, the
+// emulator drops them.
+class TxCoalesceTest : public PipeTest {
+ protected:
+  static constexpr uint32_t kPktLen = 64;
+
+  void SetUp() override {
+    PipeTest::SetUp();
+    if (HasFatalFailure()) {
+      return;
+    }
+
+    // The device only sees the sends after `FlushTx()`.
+    ASSERT_EQ(device_->EnableTxBatching(~0U, ~0ULL), 0);
+
+    write_pkt(pkt_, kPktLen, DST_IP + 1, 0);
+    nb_tx_notifications_ = emulator_->GetStats().tx_notifications;
+  }
+
+  // Sends `nb_pkts` packets from `tx_pipe`, one `SendAndFree()` each.
+  void SendPkts(enso::TxPipe* tx_pipe, uint32_t nb_pkts) {
+    for (uint32_t i = 0; i < nb_pkts; ++i) {
+      uint8_t* buf = tx_pipe->AllocateBuf(kPktLen);
+      memcpy(buf, pkt_, kPktLen);
+      tx_pipe->SendAndFree(kPktLen);
+    }
+  }
+
+  // Waits until all sends from `tx_pipes` complete and sets
+  // `nb_descriptors` to the number of descriptors that the emulator processed
+  // since the last call.
+  void WaitForCompletions(const std::vector<enso::TxPipe*>& tx_pipes,
+                          uint64_t* nb_descriptors) {
+    device_->FlushTx();
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(RECV_TIMEOUT_S);
+    for (enso::TxPipe* tx_pipe : tx_pipes) {
+      while (tx_pipe->pending_transmission() != 0) {
+        ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+        device_->ProcessCompletions();
+      }
+    }
+
+    uint64_t nb_tx_notifications = emulator_->GetStats().tx_notifications;
+    *nb_descriptors = nb_tx_notifications - nb_tx_notifications_;
+    nb_tx_notifications_ = nb_tx_notifications;
+  }
+
+  uint8_t pkt_[kPktLen];
+  uint64_t nb_tx_notifications_;
+};
+
+TEST_F(TxCoalesceTest, Adjacent) {
+  const uint32_t capacity = tx_pipe_->capacity();
+  uint64_t nb_descriptors;
+  SendPkts(tx_pipe_, 100);
+  EXPECT_EQ(tx_pipe_->capacity(), capacity - 100 * kPktLen);
+
+  // The descriptor completes all sends at once.
+  ASSERT_NO_FATAL_FAILURE(WaitForCompletions({tx_pipe_}, &nb_descriptors));
+  EXPECT_EQ(nb_descriptors, 1u);
+  EXPECT_EQ(tx_pipe_->capacity(), capacity);
+}
+
+TEST_F(TxCoalesceTest, MaxTransferLen) {
+  const uint32_t capacity = tx_pipe_->capacity();
+  uint64_t nb_descriptors;
+  SendPkts(tx_pipe_, enso::kMaxTransferLen / kPktLen + 1);
+  ASSERT_NO_FATAL_FAILURE(WaitForCompletions({tx_pipe_}, &nb_descriptors));
+  EXPECT_EQ(nb_descriptors, 2u);
+  EXPECT_EQ(tx_pipe_->capacity(), capacity);
+}
+
+// The two huge pages of the pipe's buffer are contiguous for the emulator, but
+// a descriptor must not cross from one to the other.
+TEST_F(TxCoalesceTest, PageBoundary) {
+  enso::TxPipe* tx_pipe = device_->AllocateTxPipe(nullptr,
+                                                  2 * enso::kBufPageSize);
+  ASSERT_NE(tx_pipe, nullptr);
+  const uint32_t capacity = tx_pipe->capacity();
+
+  uint64_t nb_descriptors;
+  SendPkts(tx_pipe, enso::kBufPageSize / kPktLen - 2);
+  ASSERT_NO_FATAL_FAILURE(WaitForCompletions({tx_pipe}, &nb_descriptors));
+  EXPECT_EQ(nb_descriptors, enso::kBufPageSize / enso::kMaxTransferLen);
+
+  // Two packets on each side of the boundary.
+  SendPkts(tx_pipe, 4);
+  ASSERT_NO_FATAL_FAILURE(WaitForCompletions({tx_pipe}, &nb_descriptors));
+  EXPECT_EQ(nb_descriptors, 2u);
+  EXPECT_EQ(tx_pipe->capacity(), capacity);
+}
+
+// Sends that are adjacent in memory but come from different pipes must not
+// share a descriptor, as each pipe must get its own completions. The pipes
+// share the same buffer to make their sends adjacent.
+TEST_F(TxCoalesceTest, DifferentPipes) {
+  enso::TxPipe* other = device_->AllocateTxPipe(tx_pipe_->buf());
+  ASSERT_NE(other, nullptr);
+  const uint32_t capacity = tx_pipe_->capacity();
+
+  uint64_t nb_descriptors;
+  SendPkts(other, 1);
+  SendPkts(tx_pipe_, 1);
+  SendPkts(other, 1);  // Follows the last send from `tx_pipe_`.
+  SendPkts(tx_pipe_, 1);
+  ASSERT_NO_FATAL_FAILURE(
+      WaitForCompletions({tx_pipe_, other}, &nb_descriptors));
+  EXPECT_EQ(nb_descriptors, 4u);
+  EXPECT_EQ(tx_pipe_->capacity(), capacity);
+  EXPECT_EQ(other->capacity(), capacity);
+}
+
+// The device may already be reading a descriptor once the doorbell rings.
+TEST_F(TxCoalesceTest, DoorbellRung) {
+  const uint32_t capacity = tx_pipe_->capacity();
+  uint64_t nb_descriptors;
+  SendPkts(tx_pipe_, 2);
+  device_->FlushTx();
+  SendPkts(tx_pipe_, 2);
+  ASSERT_NO_FATAL_FAILURE(WaitForCompletions({tx_pipe_}, &nb_descriptors));
+  EXPECT_EQ(nb_descriptors, 2u);
+
+  // Without TX batching, every send rings the doorbell.
+  device_->DisableTxBatching();
+  SendPkts(tx_pipe_, 4);
+  ASSERT_NO_FATAL_FAILURE(WaitForCompletions({tx_pipe_}, &nb_descriptors));
+  EXPECT_EQ(nb_descriptors, 4u);
+  EXPECT_EQ(tx_pipe_->capacity(), capacity);
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Measures the throughput of QueueProducer/QueueConsumer with bulk
+ * operations.
+ *
+ * One thread pushes and another pops, both using the same batch size. Batch
+ * size 1 uses the regular Push and Pop methods. Reports elements per second
+ * for batch sizes 1, 2, 4, ... up to 64.
+ */
+
+#include <enso/queue.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <thread>
+
+static constexpr uint32_t kMaxBatchSize = 64;
+
+static std::atomic<bool> start_flag;
+
+static void producer(enso::QueueProducer<uint64_t>* queue, uint32_t batch_size,
+                     uint64_t nb_elements) {
+  std::array<uint64_t, kMaxBatchSize> batch;
+
+  while (!start_flag.load(std::memory_order_acquire)) {
+  }
+
+  uint64_t next = 0;
+  while (next < nb_elements) {
+    if (batch_size == 1) {
+      if (queue->Push(next) == 0) {
+        ++next;
+      }
+      continue;
+    }
+
+    uint32_t nb_to_push = std::min((uint64_t)batch_size, nb_elements - next);
+    for (uint32_t i = 0; i < nb_to_push; ++i) {
+      batch[i] = next + i;
+    }
+
+    uint32_t nb_pushed = 0;
+    while (nb_pushed < nb_to_push) {
+      nb_pushed += queue->PushBulk(batch.data() + nb_pushed,
+                                   nb_to_push - nb_pushed);
+    }
+    next += nb_to_push;
+  }
+}
+
+// Returns the number of elements received out of order.
+static uint64_t consumer(enso::QueueConsumer<uint64_t>* queue,
+                         uint32_t batch_size, uint64_t nb_elements) {
+  std::array<uint64_t, kMaxBatchSize> batch;
+  uint64_t nb_errors = 0;
+
+  while (!start_flag.load(std::memory_order_acquire)) {
+  }
+
+  uint64_t next = 0;
+  while (next < nb_elements) {
+    if (batch_size == 1) {
+      std::optional<uint64_t> data = queue->Pop();
+      if (data) {
+        nb_errors += *data != next;
+        ++next;
+      }
+      continue;
+    }
+
+    uint32_t nb_popped = queue->PopBulk(batch.data(), batch_size);
+    for (uint32_t i = 0; i < nb_popped; ++i) {
+      nb_errors += batch[i] != next;
+      ++next;
+    }
+  }
+
+  return nb_errors;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc > 2) {
+    std::cerr << "Usage: " << argv[0] << " [NB_ELEMENTS]" << std::endl
+              << std::endl;
+    std::cerr << "NB_ELEMENTS: Elements sent per batch size (default: "
+                 "10000000)."
+              << std::endl;
+    return 1;
+  }
+
+  uint64_t nb_elements = argc == 2 ? atoll(argv[1]) : 10000000;
+
+  for (uint32_t batch_size = 1; batch_size <= kMaxBatchSize; batch_size *= 2) {
+    auto queue_producer = enso::QueueProducer<uint64_t>::Create("queue_bench");
+    auto queue_consumer = enso::QueueConsumer<uint64_t>::Create("queue_bench");
+    if (queue_producer == nullptr || queue_consumer == nullptr) {
+      std::cerr << "Could not create queue" << std::endl;
+      return 2;
+    }
+
+    start_flag = false;
+
+    uint64_t nb_errors = 0;
+    std::thread producer_thread(producer, queue_producer.get(), batch_size,
+                                nb_elements);
+    std::thread consumer_thread([&] {
+      nb_errors = consumer(queue_consumer.get(), batch_size, nb_elements);
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    start_flag.store(true, std::memory_order_release);
+
+    producer_thread.join();
+    consumer_thread.join();
+
+    auto end = std::chrono::steady_clock::now();
+    double elapsed_s = std::chrono::duration<double>(end - start).count();
+
+    std::cout << "batch size: " << batch_size << "  "
+              << nb_elements / elapsed_s / 1e6 << " M elements/s" << std::endl;
+
+    if (nb_errors) {
+      std::cerr << nb_errors << " elements out of order" << std::endl;
+      return 3;
+    }
+  }
+
+  return 0;
+}
@@ -36,7 +36,12 @@
 #include <gtest/gtest.h>
 
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <optional>
+#include <thread>
+#include <vector>
 
 TEST(TestQueue, CreateProducer) {
   auto q = enso::QueueProducer<int>::Create("CreateProducer");
@@ -144,6 +149,99 @@ TEST(TestQueue, Front) {
   EXPECT_EQ(q_cons->Front(), nullptr);
 }
 
+TEST(TestQueue, PushPopBulk) {
+  auto q_prod = enso::QueueProducer<int>::Create("PushPopBulk");
+  EXPECT_NE(q_prod, nullptr);
+
+  auto q_cons = enso::QueueConsumer<int>::Create("PushPopBulk");
+  EXPECT_NE(q_cons, nullptr);
+
+  std::array<int, 64> data;
+  for (uint32_t i = 0; i < data.size(); ++i) {
+    data[i] = i;
+  }
+
+  EXPECT_EQ(q_prod->PushBulk(data.data(), data.size()), data.size());
+  EXPECT_EQ(q_prod->Push(64), 0);
+
+  std::array<int, 64> popped;
+  EXPECT_EQ(q_cons->PopBulk(popped.data(), 10), 10);
+  for (uint32_t i = 0; i < 10; ++i) {
+    EXPECT_EQ(popped[i], (int)i);
+  }
+
+  EXPECT_EQ(q_cons->Pop().value_or(-1), 10);
+
+  EXPECT_EQ(q_cons->PopBulk(popped.data(), popped.size()), 54);
+  for (uint32_t i = 0; i < 54; ++i) {
+    EXPECT_EQ(popped[i], (int)i + 11);
+  }
+
+  EXPECT_EQ(q_cons->PopBulk(popped.data(), popped.size()), 0);
+  EXPECT_EQ(q_cons->Pop().value_or(-1), -1);
+}
+
+TEST(TestQueue, FrontBulk) {
+  auto q_prod = enso::QueueProducer<int>::Create("FrontBulk");
+  EXPECT_NE(q_prod, nullptr);
+
+  auto q_cons = enso::QueueConsumer<int>::Create("FrontBulk");
+  EXPECT_NE(q_cons, nullptr);
+
+  std::array<int*, 4> front;
+  EXPECT_EQ(q_cons->FrontBulk(front.data(), front.size()), 0);
+
+  std::array<int, 3> data = {42, 43, 44};
+  EXPECT_EQ(q_prod->PushBulk(data.data(), data.size()), data.size());
+
+  EXPECT_EQ(q_cons->FrontBulk(front.data(), front.size()), 3);
+  EXPECT_EQ(*front[0], 42);
+  EXPECT_EQ(*front[1], 43);
+  EXPECT_EQ(*front[2], 44);
+
+  EXPECT_EQ(q_cons->Pop().value_or(-1), 42);
+  EXPECT_EQ(q_cons->FrontBulk(front.data(), 1), 1);
+  EXPECT_EQ(*front[0], 43);
+}
+
+TEST(TestQueue, BulkWrapAround) {
+  auto q_prod =
+      enso::QueueProducer<int>::Create("BulkWrapAround", enso::kBufPageSize);
+  EXPECT_NE(q_prod, nullptr);
+
+  auto q_cons = enso::QueueConsumer<int>::Create("BulkWrapAround");
+  EXPECT_NE(q_cons, nullptr);
+
+  uint32_t capacity = q_prod->capacity();
+  std::vector<int> data(capacity + 1);
+  for (uint32_t i = 0; i < data.size(); ++i) {
+    data[i] = i;
+  }
+
+  EXPECT_EQ(q_prod->PushBulk(data.data(), data.size()), capacity);
+  EXPECT_EQ(q_prod->Push(-1), -1);
+
+  // Popped elements are only released in batches.
+  std::vector<int> popped(capacity + 1);
+  uint32_t nb_popped = enso::QueueConsumer<int>::kReleaseBatchSize - 1;
+  EXPECT_EQ(q_cons->PopBulk(popped.data(), nb_popped), nb_popped);
+  EXPECT_EQ(q_prod->PushBulk(data.data(), 1), 0);
+
+  EXPECT_EQ(q_cons->Pop().value_or(-1), (int)nb_popped);
+  ++nb_popped;
+  EXPECT_EQ(q_prod->PushBulk(data.data(), data.size()), nb_popped);
+
+  // Elements that were popped but not released must not be popped again.
+  EXPECT_EQ(q_cons->PopBulk(popped.data(), popped.size()), capacity);
+  for (uint32_t i = 0; i < capacity; ++i) {
+    EXPECT_EQ(popped[i], (int)((i + nb_popped) % capacity));
+  }
+
+  // Queue found empty, so all elements are released.
+  EXPECT_EQ(q_cons->Pop().value_or(-1), -1);
+  EXPECT_EQ(q_prod->PushBulk(data.data(), capacity), capacity);
+}
+
 // TEST(TestQueue, TestWrapAround) {
 //   using elem_t = std::array<int32_t, 2 * enso::kCacheLineSize / 4>;
 //   auto q_prod =
@@ -194,4 +292,139 @@ TEST(TestQueue, JoinExisting) {
   EXPECT_EQ(q_cons2, nullptr);
 }
 
+TEST(TestQueue, Wait) {
+  auto q_prod = enso::QueueProducer<int>::Create("Wait");
+  EXPECT_NE(q_prod, nullptr);
+
+  auto q_cons = enso::QueueConsumer<int>::Create("Wait");
+  EXPECT_NE(q_cons, nullptr);
+
+  // Times out while the queue is empty, both spinning and sleeping.
+  EXPECT_EQ(q_cons->Wait(1000, 1000), -1);
+  EXPECT_EQ(q_cons->Wait(0, 1000), -1);
+
+  EXPECT_EQ(q_prod->Push(42), 0);
+  EXPECT_EQ(q_cons->Wait(0, 1000), 0);
+  EXPECT_EQ(q_cons->Pop().value_or(-1), 42);
+
+  // Wakes up once a producer pushes while sleeping.
+  std::thread producer([&q_prod]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(q_prod->Push(43), 0);
+  });
+  EXPECT_EQ(q_cons->Wait(0, 1000000), 0);
+  producer.join();
+  EXPECT_EQ(q_cons->Pop().value_or(-1), 43);
+}
+
+TEST(TestQueue, IsStale) {
+  auto q_prod = enso::QueueProducer<int>::Create("IsStale");
+  EXPECT_NE(q_prod, nullptr);
+
+  auto q_cons = enso::QueueConsumer<int>::Create("IsStale");
+  EXPECT_NE(q_cons, nullptr);
+  EXPECT_FALSE(q_cons->IsStale());
+
+  // The producer created the queue, so it removes it when destroyed.
+  q_prod.reset();
+  EXPECT_TRUE(q_cons->IsStale());
+
+  // A new queue with the same name does not make the old one valid again.
+  q_prod = enso::QueueProducer<int>::Create("IsStale");
+  EXPECT_NE(q_prod, nullptr);
+  EXPECT_TRUE(q_cons->IsStale());
+  EXPECT_FALSE(q_prod->IsStale());
+}
+
+TEST(TestQueueMpmc, PushPop) {
+  auto q1 = enso::QueueMpmc<int>::Create("MpmcPushPop");
+  EXPECT_NE(q1, nullptr);
+
+  auto q2 = enso::QueueMpmc<int>::Create("MpmcPushPop");
+  EXPECT_NE(q2, nullptr);
+
+  EXPECT_EQ(q1->Push(42), 0);
+  EXPECT_EQ(q2->Push(43), 0);
+
+  EXPECT_EQ(q2->Pop().value_or(-1), 42);
+  EXPECT_EQ(q1->Pop().value_or(-1), 43);
+  EXPECT_EQ(q1->Pop().value_or(-1), -1);
+  EXPECT_EQ(q2->Pop().value_or(-1), -1);
+}
+
+TEST(TestQueueMpmc, QueueFull) {
+  auto q = enso::QueueMpmc<int>::Create("MpmcQueueFull");
+  EXPECT_NE(q, nullptr);
+
+  uint32_t capacity = q->capacity();
+  EXPECT_LT(capacity, enso::kBufPageSize / enso::kCacheLineSize);
+
+  for (uint32_t i = 0; i < capacity; ++i) {
+    EXPECT_EQ(q->Push(i), 0);
+  }
+  EXPECT_EQ(q->Push(42), -1);
+
+  // Wrap around.
+  for (uint32_t i = 0; i < capacity; ++i) {
+    EXPECT_EQ(q->Pop().value_or(-1), (int)i);
+    EXPECT_EQ(q->Push(capacity + i), 0);
+  }
+  EXPECT_EQ(q->Pop().value_or(-1), (int)capacity);
+}
+
+TEST(TestQueueMpmc, JoinExisting) {
+  auto q = enso::QueueMpmc<int>::Create("MpmcJoinExisting", 0, false);
+  EXPECT_NE(q, nullptr);
+
+  EXPECT_EQ(q->Push(42), 0);
+
+  auto q2 = enso::QueueMpmc<int>::Create("MpmcJoinExisting", 0, true);
+  EXPECT_NE(q2, nullptr);
+  EXPECT_EQ(q2->Pop().value_or(-1), 42);
+
+  auto q3 = enso::QueueMpmc<int>::Create("MpmcJoinExisting", 0, false);
+  EXPECT_EQ(q3, nullptr);
+}
+
+TEST(TestQueueMpmc, MultipleThreads) {
+  constexpr uint32_t kNbThreads = 4;
+  constexpr uint64_t kNbElementsPerThread = 100000;
+
+  auto q = enso::QueueMpmc<uint64_t>::Create("MpmcMultipleThreads");
+  EXPECT_NE(q, nullptr);
+
+  std::atomic<uint64_t> sum = 0;
+  std::atomic<uint64_t> nb_popped = 0;
+  std::vector<std::thread> threads;
+
+  for (uint32_t i = 0; i < kNbThreads; ++i) {
+    threads.emplace_back([&] {
+      auto producer = enso::QueueMpmc<uint64_t>::Create("MpmcMultipleThreads");
+      for (uint64_t j = 1; j <= kNbElementsPerThread; ++j) {
+        while (producer->Push(j) != 0) {
+        }
+      }
+    });
+    threads.emplace_back([&] {
+      auto consumer = enso::QueueMpmc<uint64_t>::Create("MpmcMultipleThreads");
+      while (nb_popped.load() < kNbThreads * kNbElementsPerThread) {
+        std::optional<uint64_t> data = consumer->Pop();
+        if (data) {
+          sum += data.value();
+          ++nb_popped;
+        }
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(nb_popped.load(), kNbThreads * kNbElementsPerThread);
+  EXPECT_EQ(sum.load(), kNbThreads * kNbElementsPerThread *
+                            (kNbElementsPerThread + 1) / 2);
+  EXPECT_EQ(q->Pop().value_or(0), 0);
+}
+
 #endif  // __AVX512F__